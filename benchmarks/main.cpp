@@ -0,0 +1,511 @@
+/*
+* main.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description: Repeatable stress scenes that report Zenith's performance as JSON.
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#include <zenith/zenith.h>
+#include <zenith/window.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+
+using namespace zen;
+
+namespace {
+    struct Settings {
+        uint32_t repetitions = 5;
+        uint32_t warmupFrames = 10;
+        uint32_t frames = 120;
+        uint32_t draws = 10000;
+        uint32_t uniformBlocks = 1024;
+        uint32_t uniformSize = 256;
+        uint32_t textures = 16;
+        uint32_t textureSize = 1024;
+        uint32_t shaders = 8;
+        std::string filter; // Only scenarios whose name contains it run
+        std::string output; // Standard output when empty
+    };
+
+    struct Result {
+        std::string name;
+        std::string unit;
+        bool higherIsBetter = false;
+        std::vector<double> samples = {};
+    };
+
+    struct DrawConstants {
+        glm::vec2 offset;
+    };
+
+    // Every variant is a different module, so neither the shader nor the pipeline cache knows it
+    std::string makeVertexSource(uint32_t variant) {
+        return R"(
+#version 450
+layout(location = 0) in vec3 inPosition;
+
+layout(push_constant) uniform Draw {
+    vec2 offset;
+} draw;
+
+const float variant = )" + std::to_string(variant) + R"(.0;
+
+void main() {
+    gl_Position = vec4(inPosition.xy * 0.02 + draw.offset, inPosition.z + variant * 1e-9, 1.0);
+}
+)";
+    }
+
+    constexpr const char* fragmentSource = R"(
+#version 450
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = vec4(1.0, 0.5, 0.25, 1.0);
+}
+)";
+
+    double percentile(std::vector<double> samples, double fraction) {
+        if (samples.empty()) {
+            return 0.0;
+        }
+        std::sort(samples.begin(), samples.end());
+        const auto index = static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1) + 0.5);
+        return samples[std::min(index, samples.size() - 1)];
+    }
+
+    std::string escapeJson(const std::string& value) {
+        std::string escaped;
+        for (const char c : value) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    constexpr VkExtent2D benchExtent = {1280, 720};
+
+    // A device and what the scenes draw with. Headless ones render into a target, so the numbers
+    // don't depend on a compositor, only acquire and present go through a window.
+    struct Context {
+        std::unique_ptr<Device> device;
+        std::unique_ptr<RenderTarget> target;
+        std::unique_ptr<Presentable> presentable;
+        RenderPass renderPass;
+        InputDescriptor inputDescriptor;
+        Buffer vertexBuffer;
+        glfw::Window* window = nullptr;
+
+        explicit Context(const Instance& instance) {
+            // Nothing may be cached from an earlier run, or cold numbers would depend on who ran before
+            device = std::make_unique<Device>(instance);
+            device->pipelineCachePath = "";
+            device->shaderCacheDirectory = "";
+            device->init();
+
+            inputDescriptor.addItem(InputDescriptorItem<glm::vec3>(0, InputFormat::Vector3));
+            device->useInputDescriptor(inputDescriptor);
+
+            std::vector<glm::vec3> vertices = {{-1.0f, -1.0f, 0.0f}, {1.0f, -1.0f, 0.0f}, {0.0f, 1.0f, 0.0f}};
+            vertexBuffer = device->makeBuffer(vertices);
+            device->flushUploads().wait();
+        }
+
+        ~Context() {
+            device->waitIdle();
+        }
+    };
+
+    class Bench {
+    public:
+        explicit Bench(const Settings& settings) : settings(settings), instance(Instance::makeHeadless()) {
+            headless = std::make_unique<Context>(instance);
+            headless->target = std::make_unique<RenderTarget>(*headless->device, benchExtent);
+            headless->renderPass = headless->target->getRenderPass();
+        }
+
+        ~Bench() {
+            // The instance is ours, it goes once the device made from it is gone
+            headless.reset();
+            instance.destroy();
+        }
+
+        void run(const std::string& name, const std::function<void()>& scenario) const {
+            if (settings.filter.empty() || name.find(settings.filter) != std::string::npos) {
+                std::cerr << "Zenith benchmark: " << name << std::endl;
+                scenario();
+            }
+        }
+
+        void shaderCompile() {
+            // A compiler of our own, so the device's cache stays out of it
+            ShaderCompiler compiler("");
+            Result cold{"shader_compile_cold", "ms per shader", false, {}};
+            Result warm{"shader_compile_warm", "ms per shader", false, {}};
+            for (uint32_t repetition = 0; repetition < settings.repetitions; repetition++) {
+                std::vector<ShaderSource> sources;
+                for (uint32_t i = 0; i < settings.shaders; i++) {
+                    sources.push_back({makeVertexSource(nextVariant++), ShaderType::Vertex, {}});
+                }
+
+                double start = Profiler::now();
+                (void)compiler.compileBatch(sources);
+                cold.samples.push_back((Profiler::now() - start) / settings.shaders);
+
+                start = Profiler::now();
+                (void)compiler.compileBatch(sources);
+                warm.samples.push_back((Profiler::now() - start) / settings.shaders);
+            }
+            results.push_back(std::move(cold));
+            results.push_back(std::move(warm));
+        }
+
+        void pipelineCreation() {
+            Result coldResult{"pipeline_create_cold", "ms", false, {}};
+            Result warmResult{"pipeline_create_warm", "ms", false, {}};
+            for (uint32_t repetition = 0; repetition < settings.repetitions; repetition++) {
+                const uint32_t variant = nextVariant++;
+
+                // The driver has never seen the first one, the second hits the device's pipeline cache
+                double elapsed = 0.0;
+                RenderPipeline first = buildPipeline(*headless, variant, &elapsed);
+                coldResult.samples.push_back(elapsed);
+                RenderPipeline second = buildPipeline(*headless, variant, &elapsed);
+                warmResult.samples.push_back(elapsed);
+
+                destroyPipeline(*headless, first);
+                destroyPipeline(*headless, second);
+            }
+            results.push_back(std::move(coldResult));
+            results.push_back(std::move(warmResult));
+        }
+
+        void drawCalls() {
+            RenderPipeline pipeline = buildPipeline(*headless, 0);
+
+            Result record{"draw_calls_record", "ms per frame", false, {}};
+            const uint64_t firstSerial = renderFrames(*headless, pipeline, [&](CommandBuffer& commandBuffer,
+                                                                               bool measured) {
+                const double start = Profiler::now();
+                for (uint32_t i = 0; i < settings.draws; i++) {
+                    // A grid over the whole screen, the same for every run
+                    const float x = static_cast<float>(i % 100) / 50.0f - 0.99f;
+                    const float y = static_cast<float>(i / 100 % 100) / 50.0f - 0.99f;
+                    commandBuffer.pushConstants(pipeline, DrawConstants{{x, y}});
+                    commandBuffer.draw(3, false);
+                }
+                if (measured) {
+                    record.samples.push_back(Profiler::now() - start);
+                }
+            });
+            results.push_back(std::move(record));
+            results.push_back(collectGpu(*headless, "draw_calls_gpu", firstSerial));
+            destroyPipeline(*headless, pipeline);
+        }
+
+        void uniformUpdates() {
+            Device& device = *headless->device;
+            RenderPipeline pipeline = buildPipeline(*headless, 0);
+
+            std::vector<UniformBlock> blocks;
+            for (uint32_t i = 0; i < settings.uniformBlocks; i++) {
+                blocks.push_back(device.makeUniformBlock(settings.uniformSize));
+            }
+            std::vector<uint8_t> data(settings.uniformSize, 0x5a);
+
+            Result throughput{"uniform_update_throughput", "MB/s", true, {}};
+            (void)renderFrames(*headless, pipeline, [&](CommandBuffer&, bool measured) {
+                // Resolving is what a bind does, it writes the block into the frame's arena slice
+                const double start = Profiler::now();
+                for (auto& block : blocks) {
+                    data[0]++;
+                    block.uploadData(data.data());
+                    (void)block.resolveOffset();
+                }
+                const double elapsed = Profiler::now() - start;
+                if (measured && elapsed > 0.0) {
+                    const double megabytes = static_cast<double>(blocks.size() * data.size()) / (1024.0 * 1024.0);
+                    throughput.samples.push_back(megabytes / (elapsed / 1000.0));
+                }
+            });
+            results.push_back(std::move(throughput));
+
+            device.waitIdle();
+            for (auto& block : blocks) {
+                block.destroy(device);
+            }
+            destroyPipeline(*headless, pipeline);
+        }
+
+        void textureUpload() {
+            Device& device = *headless->device;
+            const VkDeviceSize size = static_cast<VkDeviceSize>(settings.textureSize) * settings.textureSize * 4;
+            const std::shared_ptr<void> pixels(new uint8_t[size], std::default_delete<uint8_t[]>());
+            std::fill_n(static_cast<uint8_t*>(pixels.get()), size, static_cast<uint8_t>(0x80));
+
+            // Mip generation runs in the same batch, so it is part of the number
+            Result throughput{"texture_upload_throughput", "MB/s", true, {}};
+            for (uint32_t repetition = 0; repetition < settings.repetitions; repetition++) {
+                std::vector<Texture> textures(settings.textures);
+                const double start = Profiler::now();
+                for (auto& texture : textures) {
+                    texture = device.createTexture(settings.textureSize, settings.textureSize, 4, pixels);
+                    texture.activateTexture(device);
+                }
+                device.flushUploads().wait();
+                const double elapsed = Profiler::now() - start;
+
+                const double megabytes = static_cast<double>(size * textures.size()) / (1024.0 * 1024.0);
+                throughput.samples.push_back(megabytes / (elapsed / 1000.0));
+                for (auto& texture : textures) {
+                    texture.destroy(device);
+                }
+            }
+            results.push_back(std::move(throughput));
+        }
+
+        // The only scene that needs a window, it gets a device of its own
+        void acquirePresent() {
+            glfw::WindowConfiguration config;
+            config.name = "Zenith Benchmark";
+            config.width = static_cast<int>(benchExtent.width);
+            config.height = static_cast<int>(benchExtent.height);
+            config.resizable = false;
+            config.visible = false;
+            glfw::Window window(config);
+            window.init();
+
+            Context context(window.acquireInstance());
+            context.window = &window;
+
+            // We don't want vertical blank in the numbers, Immediate falls back when it's missing
+            PresentConfiguration configuration;
+            configuration.mode = PresentMode::Immediate;
+            context.presentable = std::make_unique<Presentable>(*context.device, context.device->instance,
+                                                                configuration);
+
+            std::vector<RenderAttachment> attachments;
+            RenderAttachment colorAttachment;
+            colorAttachment.layout = AttachmentLayout::ColorAttachment;
+            colorAttachment.format = context.device->makeColorFormat();
+            colorAttachment.attachmentIndex = 0;
+            attachments.emplace_back(colorAttachment);
+            context.renderPass = context.device->makeRenderPass(attachments, *context.presentable);
+
+            RenderPipeline pipeline = buildPipeline(context, 0);
+            const uint64_t firstSerial = renderFrames(context, pipeline, [](CommandBuffer&, bool) {
+            });
+            Result acquire{"acquire_latency", "ms", false, {}};
+            Result present{"present_latency", "ms", false, {}};
+            Result frame{"frame_time", "ms", false, {}};
+            for (const auto& profile : context.device->getProfiler().getHistory()) {
+                if (profile.serial >= firstSerial && profile.serial < firstSerial + settings.frames) {
+                    acquire.samples.push_back(profile.getCpuTime("Acquire"));
+                    present.samples.push_back(profile.getCpuTime("Present"));
+                    frame.samples.push_back(profile.getCpuTime("Record") + profile.getCpuTime("Submit") +
+                        profile.getCpuTime("Present") + profile.getCpuTime("Wait for frame"));
+                }
+            }
+            results.push_back(std::move(acquire));
+            results.push_back(std::move(present));
+            results.push_back(std::move(frame));
+            destroyPipeline(context, pipeline);
+        }
+
+        [[nodiscard]] std::string makeJson() const {
+            std::ostringstream json;
+            json.precision(6);
+            const VkPhysicalDeviceProperties& properties = headless->device->physicalDeviceProperties;
+            json << "{\n";
+            json << "  \"device\": \"" << escapeJson(properties.deviceName) << "\",\n";
+            json << "  \"vendorID\": " << properties.vendorID << ",\n";
+            json << "  \"driverVersion\": " << properties.driverVersion << ",\n";
+            json << "  \"settings\": {\"repetitions\": " << settings.repetitions << ", \"frames\": "
+                << settings.frames << ", \"draws\": " << settings.draws << ", \"uniformBlocks\": "
+                << settings.uniformBlocks << ", \"textures\": " << settings.textures << ", \"textureSize\": "
+                << settings.textureSize << "},\n";
+            json << "  \"results\": [";
+            for (size_t i = 0; i < results.size(); i++) {
+                const Result& result = results[i];
+                const double mean = result.samples.empty()
+                                        ? 0.0
+                                        : std::accumulate(result.samples.begin(), result.samples.end(), 0.0) /
+                                        static_cast<double>(result.samples.size());
+                json << (i == 0 ? "\n" : ",\n");
+                json << "    {\"name\": \"" << result.name << "\", \"unit\": \"" << result.unit
+                    << "\", \"higherIsBetter\": " << (result.higherIsBetter ? "true" : "false")
+                    << ", \"samples\": " << result.samples.size()
+                    << ", \"median\": " << percentile(result.samples, 0.5)
+                    << ", \"mean\": " << mean
+                    << ", \"min\": " << percentile(result.samples, 0.0)
+                    << ", \"p95\": " << percentile(result.samples, 0.95)
+                    << ", \"max\": " << percentile(result.samples, 1.0) << "}";
+            }
+            json << "\n  ]\n}\n";
+            return json.str();
+        }
+
+    private:
+        const Settings& settings;
+        Instance instance;
+        std::unique_ptr<Context> headless;
+        uint32_t nextVariant = 1;
+        std::vector<Result> results = {};
+
+        // Only makePipeline is timed. The modules are gone once it returns, nothing reads them after.
+        [[nodiscard]] static RenderPipeline buildPipeline(Context& context, uint32_t variant,
+                                                          double* elapsed = nullptr) {
+            Device& device = *context.device;
+            ShaderModule vertexShader = device.makeShader(makeVertexSource(variant), ShaderType::Vertex);
+            ShaderModule fragmentShader = device.makeShader(fragmentSource, ShaderType::Fragment);
+            vertexShader.compile("main");
+            fragmentShader.compile("main");
+
+            RenderPipeline pipeline = device.makeRenderPipeline();
+            pipeline.inputDescriptor = context.inputDescriptor;
+            pipeline.renderPass = context.renderPass;
+            pipeline.shaderProgram = ShaderProgram(vertexShader, fragmentShader);
+            pipeline.addPushConstant<DrawConstants>();
+
+            const double start = Profiler::now();
+            pipeline.makePipeline();
+            if (elapsed != nullptr) {
+                *elapsed = Profiler::now() - start;
+            }
+
+            vkDestroyShaderModule(device.logicalDevice, vertexShader.shaderModule, nullptr);
+            vkDestroyShaderModule(device.logicalDevice, fragmentShader.shaderModule, nullptr);
+            return pipeline;
+        }
+
+        static void destroyPipeline(Context& context, RenderPipeline& pipeline) {
+            context.device->waitIdle();
+            pipeline.destroy();
+        }
+
+        // Renders warmup frames, the measured frames, then enough to get the last results back.
+        // Returns the serial of the first measured frame.
+        uint64_t renderFrames(Context& context, const RenderPipeline& pipeline,
+                              const std::function<void(CommandBuffer&, bool measured)>& record) const {
+            Device& device = *context.device;
+            Profiler& profiler = device.getProfiler();
+            profiler.enabled = true;
+            profiler.historySize = settings.frames + device.framesInFlight;
+
+            uint64_t firstSerial = 0;
+            const uint32_t total = settings.warmupFrames + settings.frames + device.framesInFlight;
+            for (uint32_t frame = 0; frame < total; frame++) {
+                const bool measured = frame >= settings.warmupFrames &&
+                    frame < settings.warmupFrames + settings.frames;
+                auto commandBuffer = context.presentable
+                                         ? device.requestCommandBuffer(pipeline, *context.presentable)
+                                         : device.requestCommandBuffer(pipeline, *context.target);
+                if (frame == settings.warmupFrames) {
+                    firstSerial = device.getFrameSerial();
+                }
+                commandBuffer->begin();
+                commandBuffer->beginRendering();
+                commandBuffer->bindVertexBuffer(context.vertexBuffer);
+                record(*commandBuffer, measured);
+                commandBuffer->endRendering();
+                commandBuffer->end();
+                commandBuffer->submit();
+                if (context.presentable) {
+                    commandBuffer->present();
+                    context.window->allEvents();
+                }
+            }
+            profiler.enabled = false;
+            return firstSerial;
+        }
+
+        [[nodiscard]] Result collectGpu(const Context& context, const std::string& name, uint64_t firstSerial) const {
+            Result result{name, "ms per frame", false, {}};
+            for (const auto& profile : context.device->getProfiler().getHistory()) {
+                if (profile.serial >= firstSerial && profile.serial < firstSerial + settings.frames &&
+                    !profile.gpuScopes.empty()) {
+                    result.samples.push_back(profile.getGpuTime());
+                }
+            }
+            return result;
+        }
+    };
+
+    bool parseArguments(int argc, char** argv, Settings& settings) {
+        for (int i = 1; i < argc; i++) {
+            const std::string argument = argv[i];
+            if (argument == "--help") {
+                return false;
+            }
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << argument << std::endl;
+                return false;
+            }
+            const std::string value = argv[++i];
+            if (argument == "--output") {
+                settings.output = value;
+            }
+            else if (argument == "--filter") {
+                settings.filter = value;
+            }
+            else if (argument == "--repetitions") {
+                settings.repetitions = static_cast<uint32_t>(std::stoul(value));
+            }
+            else if (argument == "--frames") {
+                settings.frames = static_cast<uint32_t>(std::stoul(value));
+            }
+            else if (argument == "--draws") {
+                settings.draws = static_cast<uint32_t>(std::stoul(value));
+            }
+            else if (argument == "--textures") {
+                settings.textures = static_cast<uint32_t>(std::stoul(value));
+            }
+            else {
+                std::cerr << "Unknown argument " << argument << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    Settings settings;
+    if (!parseArguments(argc, argv, settings)) {
+        std::cerr << "Usage: ZenithBench [--output results.json] [--filter name] [--repetitions n] "
+            "[--frames n] [--draws n] [--textures n]" << std::endl;
+        return 1;
+    }
+
+    std::string json;
+    {
+        Bench bench(settings);
+        bench.run("shader_compile", [&] { bench.shaderCompile(); });
+        bench.run("pipeline_create", [&] { bench.pipelineCreation(); });
+        bench.run("draw_calls", [&] { bench.drawCalls(); });
+        bench.run("uniform_update", [&] { bench.uniformUpdates(); });
+        bench.run("texture_upload", [&] { bench.textureUpload(); });
+        bench.run("acquire_present", [&] { bench.acquirePresent(); });
+        json = bench.makeJson();
+    }
+
+    if (settings.output.empty()) {
+        std::cout << json;
+        return 0;
+    }
+    std::ofstream file(settings.output, std::ios::trunc);
+    if (!file || !(file << json)) {
+        std::cerr << "Could not write " << settings.output << std::endl;
+        return 1;
+    }
+    return 0;
+}
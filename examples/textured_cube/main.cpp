@@ -31,16 +31,19 @@ layout(location = 2) in vec2 inTexCoord;
 layout(set = 0, binding = 0) uniform Uniforms {
     bool enabled;
     float time;
-    mat4 modelMatrix;
     mat4 viewMatrix;
     mat4 projectionMatrix;
 } ubo;
 
+layout(push_constant) uniform Object {
+    mat4 modelMatrix;
+} object;
+
 layout(location = 0) out vec4 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
 void main() {
-    gl_Position = ubo.projectionMatrix * ubo.viewMatrix * ubo.modelMatrix * vec4(inPosition, 1.0);
+    gl_Position = ubo.projectionMatrix * ubo.viewMatrix * object.modelMatrix * vec4(inPosition, 1.0);
     if (ubo.enabled) {
         fragColor = inColor * sin(ubo.time);
     } else {
@@ -67,7 +70,6 @@ void main() {
 struct alignas(16) Uniforms {
     float time;
     bool enabled;
-    glm::mat4 modelMatrix;
     glm::mat4 viewMatrix;
     glm::mat4 projectionMatrix;
 };
@@ -107,7 +109,14 @@ int main() {
     colorAttachment.attachmentIndex = 0;
     attachments.emplace_back(colorAttachment);
 
-    auto renderPass = device->makeRenderPass(attachments, presentable);
+    // The cube's faces overlap, so it needs a depth buffer to draw them in any order
+    RenderAttachment depthAttachment;
+    depthAttachment.layout = AttachmentLayout::DepthAttachment;
+    depthAttachment.format = device->makeDepthFormat();
+    depthAttachment.attachmentIndex = 1;
+    attachments.emplace_back(depthAttachment);
+
+    auto renderPass = device->makeRenderPass(attachments, presentable, VK_SAMPLE_COUNT_4_BIT);
 
     ShaderModule vertexShader = device->makeShader(vertexShaderSource, ShaderType::Vertex);
     ShaderModule fragmentShader = device->makeShader(fragmentShaderSource, ShaderType::Fragment);
@@ -141,6 +150,7 @@ int main() {
 
     device->activateTexture(texture);
     pipeline.attachTexture(texture);
+    pipeline.addPushConstant<glm::mat4>();
 
     pipeline.makePipeline();
 
@@ -180,7 +190,7 @@ int main() {
         4, 5, 1, 1, 0, 4,
     };
 
-    Buffer indexBuffer = device->makeBuffer(indices);
+    Buffer indexBuffer = device->makeBuffer(indices, BufferUsage::Index);
 
     auto model = Model();
 
@@ -200,7 +210,6 @@ int main() {
 
     while (!window.shouldClose()) {
         uniforms.time = glfwGetTime();
-        uniforms.modelMatrix = model.makeMatrix();
         uniformBlock.uploadData(&uniforms);
         auto commandBuffer = device->requestCommandBuffer(pipeline, presentable);
         commandBuffer->begin();
@@ -211,6 +220,7 @@ int main() {
         commandBuffer->bindIndexBuffer(indexBuffer, IndexType::UInt32);
 
         commandBuffer->bindTexture(pipeline);
+        commandBuffer->pushConstants(pipeline, model.makeMatrix());
 
         commandBuffer->draw(static_cast<int>(indices.size()), true);
 
@@ -93,6 +93,9 @@ void main() {
 
     pipeline.makePipeline();
 
+    // The frame loop only passes the handle around, the registry holds the pipeline itself
+    const PipelineHandle pipelineHandle = device->getResources().pipelines.add(std::move(pipeline));
+
     std::vector<Vertex> vertices(3);
     vertices[0] = {glm::vec3(-0.5f, -0.5f, 0.0f), glm::vec4(1.0f, 0.0f, 0.0f, 1.0f)};
     vertices[1] = {glm::vec3(0.5f, -0.5f, 0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 1.0f)};
@@ -101,7 +104,7 @@ void main() {
     Buffer vertexBuffer = device->makeBuffer(vertices);
 
     while (!window.shouldClose()) {
-        auto commandBuffer = device->requestCommandBuffer(pipeline, presentable);
+        auto commandBuffer = device->requestCommandBuffer(pipelineHandle, presentable);
         commandBuffer->begin();
         commandBuffer->beginRendering();
 
@@ -0,0 +1,439 @@
+/*
+* streaming.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_EXT_TEXTURE
+#ifdef ZENITH_VULKAN
+
+#include <zenith/streaming.h>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+using namespace zen;
+using namespace zen::texture;
+
+namespace {
+    // Share of the driver's budget after which the streamer starts giving memory back
+    constexpr float deviceBudgetThreshold = 0.9f;
+}
+
+TextureStreamer::TextureStreamer(Device& device, VkDeviceSize budget, uint32_t threadCount)
+    : device(device), budget(budget) {
+    // Textures that aren't resident yet sample a flat grey instead of garbage
+    const std::shared_ptr<void> pixels(new uint8_t[4]{128, 128, 128, 255}, std::default_delete<uint8_t[]>());
+    placeholder = device.createTexture(1, 1, 4, pixels);
+    placeholder.activateTexture(device);
+    if (device.supportsDescriptorIndexing) {
+        placeholderSlot = device.getBindlessTable().add(placeholder);
+    }
+
+    if (threadCount == 0) {
+        threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    }
+    workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++) {
+        workers.emplace_back([this] { work(); });
+    }
+
+    // Only device local heaps hold our textures, the rest isn't ours to fix
+    device.getAllocator().setBudgetCallback([this](const MemoryBudgetWarning& warning) {
+        const VkMemoryHeap& heap = this->device.physicalDeviceMemoryProperties.memoryHeaps[warning.heapIndex];
+        if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0) {
+            return;
+        }
+        const auto limit = static_cast<VkDeviceSize>(deviceBudgetThreshold * static_cast<double>(warning.budget));
+        std::lock_guard lock(mutex);
+        evictBytes(warning.usage > limit ? warning.usage - limit : 0);
+        this->budget = std::min(this->budget, residentBytes);
+    }, deviceBudgetThreshold);
+}
+
+TextureStreamer::~TextureStreamer() {
+    device.getAllocator().setBudgetCallback(nullptr);
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // We can't tell which frames still sample our textures, so we let all of them finish
+    device.waitIdle();
+    std::lock_guard lock(mutex);
+    for (auto& [handle, entry] : entries) {
+        if (entry.slot != UINT32_MAX) {
+            device.getBindlessTable().remove(entry.slot);
+        }
+        entry.texture.destroy(device);
+    }
+    entries.clear();
+    collectRetired(true);
+
+    if (placeholderSlot != UINT32_MAX) {
+        device.getBindlessTable().remove(placeholderSlot);
+    }
+    placeholder.destroy(device);
+}
+
+StreamHandle TextureStreamer::request(const std::string& path, float priority) {
+    StreamHandle handle;
+    {
+        std::lock_guard lock(mutex);
+        handle = nextHandle++;
+        Entry& entry = entries[handle];
+        entry.path = path;
+        entry.priority = priority;
+    }
+    workAvailable.notify_one();
+    return handle;
+}
+
+void TextureStreamer::setPriority(StreamHandle handle, float priority) {
+    std::lock_guard lock(mutex);
+    auto it = entries.find(handle);
+    if (it == entries.end()) {
+        throw std::runtime_error("Unknown texture stream handle " + std::to_string(handle));
+    }
+    it->second.priority = priority; // Workers and update read it when they pick what to do next
+}
+
+void TextureStreamer::release(StreamHandle handle) {
+    std::lock_guard lock(mutex);
+    auto it = entries.find(handle);
+    if (it == entries.end()) {
+        return;
+    }
+    Entry& entry = it->second;
+    if (entry.residency == Residency::Loading && !entry.decoded) {
+        entry.released = true; // The worker decoding it drops it when it's done
+        return;
+    }
+    if (entry.residency == Residency::Resident || entry.residency == Residency::Uploading) {
+        retire(entry);
+    }
+    entries.erase(it);
+}
+
+void TextureStreamer::update() {
+    // What gets uploaded this update, the decoded pixels move out so the upload can run unlocked
+    struct Staged {
+        StreamHandle handle = 0;
+        std::string path;
+        TextureData data = {};
+        VkDeviceSize estimate = 0;
+        Texture texture = {};
+        bool failed = false;
+    };
+    std::vector<Staged> staging;
+
+    {
+        std::lock_guard lock(mutex);
+        collectRetired(false);
+
+        const bool bindless = device.supportsDescriptorIndexing;
+        std::vector<std::pair<StreamHandle, Entry*>> ready;
+        for (auto& [handle, entry] : entries) {
+            if (entry.residency == Residency::Uploading && entry.upload.isValid() && entry.upload.isComplete()) {
+                // Only now can frames sample it, the slot swap makes shaders pick it up
+                entry.residency = Residency::Resident;
+                entry.upload = {};
+                if (bindless) {
+                    entry.slot = device.getBindlessTable().add(entry.texture);
+                }
+            }
+            else if (entry.residency == Residency::Loading && entry.decoded) {
+                ready.emplace_back(handle, &entry);
+            }
+        }
+
+        // The most important textures get the budget and this update's upload bytes first
+        std::sort(ready.begin(), ready.end(), [](const auto& a, const auto& b) {
+            return a.second->priority > b.second->priority;
+        });
+
+        VkDeviceSize staged = 0;
+        for (auto& [handle, entry] : ready) {
+            if (staged >= uploadBytesPerUpdate) {
+                break; // The rest stays decoded until the next update
+            }
+            if (makeRoom(entry->bytes, entry->priority)) {
+                // The estimate holds the room until the image exists and we know what it takes
+                staged += entry->data.size;
+                residentBytes += entry->bytes;
+                entry->residency = Residency::Uploading;
+                staging.push_back({
+                    .handle = handle,
+                    .path = entry->path,
+                    .data = std::move(entry->data),
+                    .estimate = entry->bytes
+                });
+            }
+            else {
+                // Everything resident matters more, we decode it again once there is room
+                entry->residency = Residency::Evicted;
+            }
+            entry->data = {};
+            entry->decoded = false;
+        }
+    }
+
+    // Creating the images and staging their pixels may block, so other threads keep the lock meanwhile
+    UploadHandle upload = {};
+    if (!staging.empty()) {
+        for (Staged& item : staging) {
+            try {
+                item.texture = device.createTexture(std::move(item.data));
+                item.texture.activateTexture(device);
+            }
+            catch (const std::exception& error) {
+                std::cerr << "Zenith: could not upload " << item.path << ": " << error.what() << std::endl;
+                item.failed = true;
+            }
+            item.data = {};
+        }
+        // One submit for everything staged this update, failed textures included since whatever
+        // got recorded for them must run before they are destroyed
+        upload = device.flushUploads();
+    }
+
+    std::lock_guard lock(mutex);
+    for (Staged& item : staging) {
+        auto it = entries.find(item.handle);
+        // Released or evicted while we uploaded, which already gave its bytes back
+        if (it == entries.end() || it->second.residency != Residency::Uploading) {
+            retired.push_back({device.getFrameSerial(), upload, std::move(item.texture)});
+            continue;
+        }
+        Entry& entry = it->second;
+        residentBytes -= item.estimate;
+        if (item.failed) {
+            entry.residency = Residency::Failed;
+            retired.push_back({device.getFrameSerial(), upload, std::move(item.texture)});
+            continue;
+        }
+        entry.texture = std::move(item.texture);
+        entry.bytes = entry.texture.imageAllocation.size;
+        entry.upload = upload;
+        residentBytes += entry.bytes;
+    }
+
+    // Evicted textures come back, most important first, as long as the free budget holds them
+    std::vector<Entry*> evicted;
+    for (auto& [handle, entry] : entries) {
+        if (entry.residency == Residency::Evicted) {
+            evicted.push_back(&entry);
+        }
+    }
+    std::sort(evicted.begin(), evicted.end(), [](const Entry* a, const Entry* b) {
+        return a->priority > b->priority;
+    });
+    VkDeviceSize room = budget > residentBytes ? budget - residentBytes : 0;
+    bool requeued = false;
+    for (Entry* entry : evicted) {
+        if (entry->bytes > room) {
+            break;
+        }
+        room -= entry->bytes;
+        entry->residency = Residency::Queued;
+        requeued = true;
+    }
+    if (requeued) {
+        workAvailable.notify_all();
+    }
+}
+
+const Texture& TextureStreamer::get(StreamHandle handle) const {
+    std::lock_guard lock(mutex);
+    const Entry& entry = find(handle);
+    return entry.residency == Residency::Resident ? entry.texture : placeholder;
+}
+
+uint32_t TextureStreamer::getBindlessSlot(StreamHandle handle) const {
+    if (placeholderSlot == UINT32_MAX) {
+        throw std::runtime_error("Bindless slots need descriptor indexing, which the device doesn't support");
+    }
+    std::lock_guard lock(mutex);
+    const Entry& entry = find(handle);
+    return entry.residency == Residency::Resident ? entry.slot : placeholderSlot;
+}
+
+Residency TextureStreamer::getResidency(StreamHandle handle) const {
+    std::lock_guard lock(mutex);
+    return find(handle).residency;
+}
+
+VkDeviceSize TextureStreamer::getResidentBytes() const {
+    std::lock_guard lock(mutex);
+    return residentBytes;
+}
+
+void TextureStreamer::setBudget(VkDeviceSize budget) {
+    std::lock_guard lock(mutex);
+    this->budget = budget;
+    // A smaller budget evicts right away, from the least important texture up
+    makeRoom(0, std::numeric_limits<float>::infinity());
+}
+
+const TextureStreamer::Entry& TextureStreamer::find(StreamHandle handle) const {
+    auto it = entries.find(handle);
+    if (it == entries.end()) {
+        throw std::runtime_error("Unknown texture stream handle " + std::to_string(handle));
+    }
+    return it->second;
+}
+
+bool TextureStreamer::makeRoom(VkDeviceSize bytes, float priority) {
+    if (residentBytes + bytes <= budget) {
+        return true;
+    }
+
+    std::vector<Entry*> candidates;
+    VkDeviceSize reclaimable = 0;
+    for (auto& [handle, entry] : entries) {
+        const bool onDevice = entry.residency == Residency::Resident || entry.residency == Residency::Uploading;
+        if (onDevice && entry.priority < priority) {
+            candidates.push_back(&entry);
+            reclaimable += entry.bytes;
+        }
+    }
+    // We only evict when it actually makes the texture fit, otherwise nobody gains anything
+    if (residentBytes - reclaimable + bytes > budget && bytes > 0) {
+        return false;
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Entry* a, const Entry* b) {
+        return a->priority < b->priority;
+    });
+    for (Entry* entry : candidates) {
+        if (residentBytes + bytes <= budget) {
+            break;
+        }
+        evict(*entry);
+    }
+    return residentBytes + bytes <= budget;
+}
+
+void TextureStreamer::evict(Entry& entry) {
+    retire(entry);
+    entry.residency = Residency::Evicted;
+}
+
+void TextureStreamer::evictBytes(VkDeviceSize bytes) {
+    std::vector<Entry*> candidates;
+    for (auto& [handle, entry] : entries) {
+        if (entry.residency == Residency::Resident || entry.residency == Residency::Uploading) {
+            candidates.push_back(&entry);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Entry* a, const Entry* b) {
+        return a->priority < b->priority;
+    });
+    VkDeviceSize freed = 0;
+    for (Entry* entry : candidates) {
+        if (freed >= bytes) {
+            break;
+        }
+        freed += entry->bytes;
+        evict(*entry);
+    }
+}
+
+void TextureStreamer::retire(Entry& entry) {
+    if (entry.slot != UINT32_MAX) {
+        device.getBindlessTable().remove(entry.slot);
+        entry.slot = UINT32_MAX;
+    }
+    if (entry.residency == Residency::Resident || entry.residency == Residency::Uploading) {
+        residentBytes -= entry.bytes;
+    }
+    retired.push_back({device.getFrameSerial(), entry.upload, std::move(entry.texture)});
+    entry.texture = {};
+    entry.upload = {};
+}
+
+void TextureStreamer::collectRetired(bool force) {
+    // Frames recorded before the texture was retired may still sample it
+    const uint64_t serial = device.getFrameSerial();
+    while (!retired.empty()) {
+        Retired& next = retired.front();
+        if (!force) {
+            const bool framesDone = next.serial + device.framesInFlight <= serial;
+            if (!framesDone || (next.upload.isValid() && !next.upload.isComplete())) {
+                break;
+            }
+        }
+        else if (next.upload.isValid()) {
+            next.upload.wait();
+        }
+        next.texture.destroy(device);
+        retired.pop_front();
+    }
+}
+
+void TextureStreamer::work() {
+    while (true) {
+        StreamHandle handle = 0;
+        std::string path;
+        {
+            std::unique_lock lock(mutex);
+            Entry* next = nullptr;
+            workAvailable.wait(lock, [&] {
+                // We always decode the most important queued texture first
+                next = nullptr;
+                for (auto& [candidate, entry] : entries) {
+                    if (entry.residency == Residency::Queued && (!next || entry.priority > next->priority)) {
+                        next = &entry;
+                        handle = candidate;
+                    }
+                }
+                return stopping || next != nullptr;
+            });
+            if (stopping) {
+                return;
+            }
+            next->residency = Residency::Loading;
+            path = next->path;
+        }
+
+        TextureData data;
+        bool loaded = true;
+        try {
+            data.load(path);
+        }
+        catch (const std::exception& error) {
+            std::cerr << "Zenith: could not stream " << path << ": " << error.what() << std::endl;
+            loaded = false;
+        }
+
+        std::lock_guard lock(mutex);
+        auto it = entries.find(handle);
+        if (it == entries.end()) {
+            continue;
+        }
+        Entry& entry = it->second;
+        if (entry.released) {
+            entries.erase(it);
+            continue;
+        }
+        if (!loaded) {
+            entry.residency = Residency::Failed;
+            continue;
+        }
+        // Generated mips add a third on top of the base level
+        const bool generatesMips = data.levelOffsets.size() <= 1 && std::max(data.width, data.height) > 1;
+        entry.bytes = generatesMips ? data.size + data.size / 3 : data.size;
+        entry.data = std::move(data);
+        entry.decoded = true;
+    }
+}
+
+#endif
+#endif
@@ -12,24 +12,254 @@
 
 #include <zenith/texture.h>
 #define STB_IMAGE_IMPLEMENTATION
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <stb/stb_image.h>
 
 using namespace zen;
 
+namespace {
+    // Containers are little endian, and so is every platform we run on
+    template <typename T>
+    T read(const std::vector<uint8_t>& file, size_t offset) {
+        T value{};
+        std::memcpy(&value, file.data() + offset, sizeof(T));
+        return value;
+    }
+
+    constexpr uint32_t makeFourCC(char a, char b, char c, char d) {
+        return static_cast<uint32_t>(a) | static_cast<uint32_t>(b) << 8 | static_cast<uint32_t>(c) << 16 |
+            static_cast<uint32_t>(d) << 24;
+    }
+
+    // Bytes per 4x4 block for the block compressed formats, zero for everything else
+    uint32_t getBlockSize(VkFormat format) {
+        switch (format) {
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+        case VK_FORMAT_BC4_SNORM_BLOCK:
+            return 8;
+        case VK_FORMAT_BC2_UNORM_BLOCK:
+        case VK_FORMAT_BC2_SRGB_BLOCK:
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC5_SNORM_BLOCK:
+        case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+        case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            return 16;
+        default:
+            return 0;
+        }
+    }
+
+    VkFormat fromDXGIFormat(uint32_t format) {
+        switch (format) {
+        case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+        case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+        case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+        case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+        case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+        case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+        case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+        case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+        case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+        case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+        case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+        case 87: return VK_FORMAT_B8G8R8A8_UNORM;
+        case 91: return VK_FORMAT_B8G8R8A8_SRGB;
+        case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+        case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+        case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+        case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+        default: return VK_FORMAT_UNDEFINED;
+        }
+    }
+
+    constexpr uint8_t ktx2Identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+}
+
 void zen::texture::TextureData::load(const std::string& path) {
-    int width, height, channels;
-    stbi_uc* imageData = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
-    this->width = static_cast<uint32_t>(width);
-    this->height = static_cast<uint32_t>(height);
-    size = width * height * 4;
-    if (!imageData) {
-        throw std::runtime_error("Failed to load texture image: " + path);
-    }
-    data = std::shared_ptr<void>(imageData, [](void* ptr)
+    std::ifstream stream(path, std::ios::binary | std::ios::ate);
+    if (!stream) {
+        throw std::runtime_error("Failed to open texture image: " + path);
+    }
+    const std::streamsize length = stream.tellg();
+    stream.seekg(0, std::ios::beg);
+    std::vector<uint8_t> file(static_cast<size_t>(std::max<std::streamsize>(length, 0)));
+    if (!stream.read(reinterpret_cast<char*>(file.data()), length)) {
+        throw std::runtime_error("Failed to read texture image: " + path);
+    }
+
+    // We go by the contents, not the extension
+    format = VK_FORMAT_R8G8B8A8_SRGB;
+    levelOffsets.clear();
+    if (file.size() >= sizeof(ktx2Identifier) && std::memcmp(file.data(), ktx2Identifier, sizeof(ktx2Identifier)) == 0) {
+        loadKTX2(file, path);
+    }
+    else if (file.size() >= 4 && read<uint32_t>(file, 0) == makeFourCC('D', 'D', 'S', ' ')) {
+        loadDDS(file, path);
+    }
+    else {
+        int width, height, channels;
+        stbi_uc* imageData = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &width, &height,
+                                                   &channels, STBI_rgb_alpha);
+        if (!imageData) {
+            throw std::runtime_error("Failed to load texture image: " + path);
+        }
+        this->width = static_cast<uint32_t>(width);
+        this->height = static_cast<uint32_t>(height);
+        size = width * height * 4;
+        data = std::shared_ptr<void>(imageData, [](void* ptr)
+        {
+            stbi_image_free(ptr);
+        });
+    }
+}
+
+void zen::texture::TextureData::loadKTX2(const std::vector<uint8_t>& file, const std::string& path) {
+    constexpr size_t levelIndexOffset = 80;
+    if (file.size() < levelIndexOffset) {
+        throw std::runtime_error("Truncated KTX2 header in " + path);
+    }
+
+    format = static_cast<VkFormat>(read<uint32_t>(file, 12));
+    width = read<uint32_t>(file, 20);
+    height = read<uint32_t>(file, 24);
+    const uint32_t depth = read<uint32_t>(file, 28);
+    const uint32_t layerCount = read<uint32_t>(file, 32);
+    const uint32_t faceCount = read<uint32_t>(file, 36);
+    const uint32_t levelCount = std::max(read<uint32_t>(file, 40), 1u);
+    const uint32_t supercompression = read<uint32_t>(file, 44);
+
+    // Basis and zstd payloads would need a transcoder first
+    if (format == VK_FORMAT_UNDEFINED || supercompression != 0) {
+        throw std::runtime_error("Supercompressed KTX2 files are not supported: " + path);
+    }
+    if (depth > 1 || layerCount > 1 || faceCount != 1) {
+        throw std::runtime_error("Only single 2D KTX2 textures are supported: " + path);
+    }
+    if (file.size() < levelIndexOffset + levelCount * 24) {
+        throw std::runtime_error("Truncated KTX2 level index in " + path);
+    }
+
+    std::vector<std::pair<size_t, size_t>> levels;
+    for (uint32_t level = 0; level < levelCount; level++) {
+        const size_t entry = levelIndexOffset + level * 24;
+        levels.emplace_back(read<uint64_t>(file, entry), read<uint64_t>(file, entry + 8));
+    }
+    pack(file, levels, path);
+}
+
+void zen::texture::TextureData::loadDDS(const std::vector<uint8_t>& file, const std::string& path) {
+    constexpr size_t headerOffset = 4;
+    constexpr size_t headerSize = 124;
+    if (file.size() < headerOffset + headerSize) {
+        throw std::runtime_error("Truncated DDS header in " + path);
+    }
+
+    height = read<uint32_t>(file, headerOffset + 8);
+    width = read<uint32_t>(file, headerOffset + 12);
+    const uint32_t flags = read<uint32_t>(file, headerOffset + 4);
+    const uint32_t levelCount = flags & 0x20000 ? std::max(read<uint32_t>(file, headerOffset + 24), 1u) : 1u;
+    const uint32_t pixelFlags = read<uint32_t>(file, headerOffset + 76);
+    const uint32_t fourCC = read<uint32_t>(file, headerOffset + 80);
+    const uint32_t caps2 = read<uint32_t>(file, headerOffset + 108);
+    if (caps2 & (0x200 | 0x200000)) {
+        throw std::runtime_error("Cube maps and volume DDS files are not supported: " + path);
+    }
+
+    size_t dataOffset = headerOffset + headerSize;
+    format = VK_FORMAT_UNDEFINED;
+    if (pixelFlags & 0x4) {
+        switch (fourCC) {
+        case makeFourCC('D', 'X', 'T', '1'):
+            format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+            break;
+        case makeFourCC('D', 'X', 'T', '3'):
+            format = VK_FORMAT_BC2_UNORM_BLOCK;
+            break;
+        case makeFourCC('D', 'X', 'T', '5'):
+            format = VK_FORMAT_BC3_UNORM_BLOCK;
+            break;
+        case makeFourCC('A', 'T', 'I', '1'):
+        case makeFourCC('B', 'C', '4', 'U'):
+            format = VK_FORMAT_BC4_UNORM_BLOCK;
+            break;
+        case makeFourCC('A', 'T', 'I', '2'):
+        case makeFourCC('B', 'C', '5', 'U'):
+            format = VK_FORMAT_BC5_UNORM_BLOCK;
+            break;
+        case makeFourCC('D', 'X', '1', '0'):
+            if (file.size() < dataOffset + 20) {
+                throw std::runtime_error("Truncated DDS DX10 header in " + path);
+            }
+            if (read<uint32_t>(file, dataOffset + 4) != 3 || read<uint32_t>(file, dataOffset + 12) > 1) {
+                throw std::runtime_error("Only single 2D DDS textures are supported: " + path);
+            }
+            format = fromDXGIFormat(read<uint32_t>(file, dataOffset));
+            dataOffset += 20;
+            break;
+        default:
+            break;
+        }
+    }
+    else if ((pixelFlags & 0x40) && read<uint32_t>(file, headerOffset + 84) == 32) {
+        // Plain 32 bit texels, the red mask tells the channel order
+        const uint32_t redMask = read<uint32_t>(file, headerOffset + 88);
+        format = redMask == 0x000000FF ? VK_FORMAT_R8G8B8A8_UNORM
+                                       : redMask == 0x00FF0000 ? VK_FORMAT_B8G8R8A8_UNORM
+                                                               : VK_FORMAT_UNDEFINED;
+    }
+    if (format == VK_FORMAT_UNDEFINED) {
+        throw std::runtime_error("Unsupported DDS pixel format in " + path);
+    }
+
+    // Levels follow each other without padding, largest first
+    const uint32_t blockSize = getBlockSize(format);
+    std::vector<std::pair<size_t, size_t>> levels;
+    size_t offset = dataOffset;
+    for (uint32_t level = 0; level < levelCount; level++) {
+        const size_t levelWidth = std::max<size_t>(width >> level, 1);
+        const size_t levelHeight = std::max<size_t>(height >> level, 1);
+        const size_t levelSize = blockSize != 0
+                                     ? ((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * blockSize
+                                     : levelWidth * levelHeight * 4;
+        levels.emplace_back(offset, levelSize);
+        offset += levelSize;
+    }
+    pack(file, levels, path);
+}
+
+void zen::texture::TextureData::pack(const std::vector<uint8_t>& file,
+                                     const std::vector<std::pair<size_t, size_t>>& levels, const std::string& path) {
+    // Copies need offsets aligned to the texel block, 16 bytes covers every format we load
+    size_t packedSize = 0;
+    levelOffsets.clear();
+    for (const auto& [offset, length] : levels) {
+        if (offset > file.size() || length > file.size() - offset) {
+            throw std::runtime_error("Mip level out of the file's bounds in " + path);
+        }
+        packedSize = (packedSize + 15) & ~static_cast<size_t>(15);
+        levelOffsets.push_back(packedSize);
+        packedSize += length;
+    }
+
+    auto* packed = new uint8_t[packedSize];
+    for (size_t level = 0; level < levels.size(); level++) {
+        std::memcpy(packed + levelOffsets[level], file.data() + levels[level].first, levels[level].second);
+    }
+    data = std::shared_ptr<void>(packed, [](void* ptr)
     {
-        stbi_image_free(ptr);
+        delete[] static_cast<uint8_t*>(ptr);
     });
+    size = packedSize;
 }
 
 
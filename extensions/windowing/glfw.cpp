@@ -48,6 +48,7 @@ void VkInitializer::initialize() {
 
     // We set other window hints based on the configuration
     glfwWindowHint(GLFW_RESIZABLE, config.resizable ? GLFW_TRUE : GLFW_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, config.visible ? GLFW_TRUE : GLFW_FALSE);
 
     int monitorCount = 0;
     GLFWmonitor** monitors = glfwGetMonitors(&monitorCount);
@@ -180,6 +181,13 @@ void VkInitializer::initializeVulkan() {
         }
     }
 
+#ifndef __APPLE__
+    // Memory budgets are read through properties2, which a 1.0 instance only has as an extension
+    if (zen::CoreVulkanExtension{VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME}.exists()) {
+        enabledExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+#endif
+
     if (config.enableDebugMessenger) {
         // If the debug messenger is enabled, we add the debug utils extension
         if (!zen::CoreVulkanExtension{"VK_EXT_debug_utils"}.exists()) {
@@ -0,0 +1,125 @@
+/*
+* streaming.h
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description: Asynchronous texture streaming with residency priorities
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifndef ZENITH_STREAMING_H
+#define ZENITH_STREAMING_H
+
+#ifdef ZENITH_EXT_TEXTURE
+
+#include <zenith/zenith.h>
+#include <zenith/texture.h>
+
+#ifdef ZENITH_VULKAN
+
+namespace zen::texture {
+    enum class Residency {
+        Queued, // Waiting for a worker to decode it
+        Loading, // Being decoded, or decoded and waiting for room in the budget
+        Uploading, // Copied into the staging ring, the upload batch hasn't finished yet
+        Resident,
+        Evicted, // Dropped to stay within the budget, comes back once there is room again
+        Failed, // The file couldn't be decoded, the placeholder is used for good
+    };
+
+    using StreamHandle = uint32_t;
+
+    // Decodes textures on worker threads and uploads them through the device's staging ring,
+    // so loading never stalls the thread that records frames. Until a texture is resident the
+    // streamer hands out a small placeholder. Resident textures are kept within a VRAM budget,
+    // the lowest priorities are evicted first when a more important one needs the room. The
+    // streamer also takes the allocator's budget callback: when device local memory runs short
+    // it evicts the difference and lowers its budget to what is left, setBudget raises it again.
+    class TextureStreamer {
+    public:
+        // Zero threads picks one per core, leaving one for the render thread
+        TextureStreamer(Device& device, VkDeviceSize budget, uint32_t threadCount = 0);
+
+        TextureStreamer(const TextureStreamer&) = delete;
+        TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+        ~TextureStreamer();
+
+        // Caps the bytes staged per update, so a burst of finished decodes doesn't stall one frame
+        VkDeviceSize uploadBytesPerUpdate = 16ull * 1024 * 1024;
+
+        // Higher priorities are decoded first and evicted last
+        [[nodiscard]] StreamHandle request(const std::string& path, float priority = 0.0f);
+        void setPriority(StreamHandle handle, float priority);
+        void release(StreamHandle handle);
+
+        // Called once per frame on the render thread, uploads decoded textures and evicts
+        void update();
+
+        // The placeholder until the texture is resident. Render thread only.
+        [[nodiscard]] const Texture& get(StreamHandle handle) const;
+        // Requires Device::supportsDescriptorIndexing, the slot changes once the texture is resident
+        [[nodiscard]] uint32_t getBindlessSlot(StreamHandle handle) const;
+        [[nodiscard]] Residency getResidency(StreamHandle handle) const;
+
+        [[nodiscard]] VkDeviceSize getResidentBytes() const;
+
+        [[nodiscard]] VkDeviceSize getBudget() const {
+            return budget;
+        }
+
+        void setBudget(VkDeviceSize budget);
+
+    private:
+        struct Entry {
+            std::string path;
+            float priority = 0.0f;
+            Residency residency = Residency::Queued;
+            bool decoded = false;
+            bool released = false; // Released while a worker was decoding it
+            TextureData data = {};
+            Texture texture = {};
+            VkDeviceSize bytes = 0; // Estimated until the image exists, then what it really takes
+            UploadHandle upload = {};
+            uint32_t slot = UINT32_MAX;
+        };
+
+        // Destroyed once no frame can sample it and its upload has finished
+        struct Retired {
+            uint64_t serial = 0;
+            UploadHandle upload = {};
+            Texture texture = {};
+        };
+
+        Device& device;
+        VkDeviceSize budget = 0;
+        VkDeviceSize residentBytes = 0;
+
+        Texture placeholder = {};
+        uint32_t placeholderSlot = UINT32_MAX;
+
+        std::unordered_map<StreamHandle, Entry> entries = {};
+        StreamHandle nextHandle = 1;
+        std::deque<Retired> retired = {};
+        mutable std::mutex mutex;
+
+        std::vector<std::thread> workers = {};
+        std::condition_variable workAvailable;
+        bool stopping = false;
+
+        [[nodiscard]] const Entry& find(StreamHandle handle) const;
+        [[nodiscard]] bool makeRoom(VkDeviceSize bytes, float priority);
+        void evict(Entry& entry);
+        void evictBytes(VkDeviceSize bytes);
+        void retire(Entry& entry);
+        void collectRetired(bool force);
+
+        void work();
+    };
+}
+
+#endif
+
+#endif
+
+#endif //ZENITH_STREAMING_H
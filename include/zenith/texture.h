@@ -22,8 +22,19 @@ namespace zen::texture {
         VkDeviceSize size = 0;
         std::shared_ptr<void> data;
         size_t width, height;
+        VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+        // Where each mip level starts in data, level 0 first. Empty when the file has a single level.
+        std::vector<VkDeviceSize> levelOffsets = {};
 
+        // KTX2 and DDS files are uploaded as they are, with their own format and mips. Anything
+        // else goes through stb and is expanded to RGBA8, the texture then generates its mips.
         void load(const std::string& path);
+
+    private:
+        void loadKTX2(const std::vector<uint8_t>& file, const std::string& path);
+        void loadDDS(const std::vector<uint8_t>& file, const std::string& path);
+        void pack(const std::vector<uint8_t>& file, const std::vector<std::pair<size_t, size_t>>& levels,
+                  const std::string& path);
     };
 }
 
@@ -36,6 +36,7 @@ namespace zen::glfw {
         int height;
         std::string engineName = "Zenith";
         bool resizable = true;
+        bool visible = true; // Hidden windows still get a surface, e.g. for benchmarks
         bool fullscreen = false;
         int monitorIndex = 0;
         const int vulkanVersion = VK_API_VERSION_1_0;
@@ -104,11 +105,27 @@ namespace zen::glfw {
             return vulkan.shouldClose();
         }
 
+        // The size the surface should have now, for Presentable::recreate after a resize
+        [[nodiscard]] inline VkExtent2D getFramebufferExtent() const {
+            int width = 0;
+            int height = 0;
+            glfwGetFramebufferSize(*vulkan.window, &width, &height);
+            return {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+        }
+
         [[nodiscard]] inline Instance acquireInstance() const {
-            return {
-                vulkan.instance, vulkan.surface,
-                {static_cast<uint32_t>(vulkan.config.width), static_cast<uint32_t>(vulkan.config.height)}
+            const VkExtent2D extent = {
+                static_cast<uint32_t>(vulkan.config.width), static_cast<uint32_t>(vulkan.config.height)
+            };
+            Instance instance(vulkan.instance, vulkan.surface, extent);
+            // The GLFW window outlives the instance, this wrapper may not
+            instance.queryExtent = [window = *vulkan.window]() {
+                int width = 0;
+                int height = 0;
+                glfwGetFramebufferSize(window, &width, &height);
+                return VkExtent2D{static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
             };
+            return instance;
         }
 
 #endif
@@ -10,10 +10,27 @@
 #ifndef ZENITH_ZENITH_VULKAN_H
 #define ZENITH_ZENITH_VULKAN_H
 
+#include <array>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 #include <functional>
+#include <map>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 
 #ifdef ZENITH_EXT_TEXTURE
 #include <zenith/texture.h>
@@ -33,10 +50,29 @@ namespace zen {
         VkInstance instance;
         VkSurfaceKHR surface;
         VkExtent2D extent = {0, 0};
+        // The window's framebuffer size right now. Surfaces that leave the extent to the swapchain
+        // report none, so recreating after a resize asks the window instead.
+        std::function<VkExtent2D()> queryExtent = nullptr;
 
         Instance(VkInstance instance, VkSurfaceKHR surface, VkExtent2D extent) : instance(instance), surface(surface),
             extent(extent) {
         };
+
+        // No surface, so devices made from it only render into RenderTargets
+        explicit Instance(VkInstance instance, VkExtent2D extent = {0, 0}) : instance(instance),
+            surface(VK_NULL_HANDLE), extent(extent) {
+        };
+
+        // Creates a Vulkan instance without any window system extensions, e.g. for render farm nodes
+        // and CI machines without a display. The caller destroys it once every device made from it is gone.
+        static Instance makeHeadless(uint32_t vulkanVersion = VK_API_VERSION_1_0, bool enableValidationLayers = false);
+
+        // Only for instances from makeHeadless, windows destroy their own
+        void destroy() const;
+
+        [[nodiscard]] bool isHeadless() const {
+            return surface == VK_NULL_HANDLE;
+        }
     };
 
     class CoreValidationLayer {
@@ -65,6 +101,8 @@ namespace zen {
 
     class Device;
 
+    class UniformArena;
+
     using DeviceSelector = std::function<float(const Device&)>;
 
     class DevicePicker {
@@ -84,6 +122,14 @@ namespace zen {
         Present,
     };
 
+    // The job a queue is picked for. Compute and transfer fall back to the graphics
+    // family when the hardware has no dedicated one.
+    enum class QueueRole {
+        Graphics,
+        Compute,
+        Transfer,
+    };
+
     class CoreQueue {
     public:
         VkQueue queue = VK_NULL_HANDLE;
@@ -95,6 +141,8 @@ namespace zen {
 
     struct Format;
 
+    struct Image;
+
     class RenderPass;
 
     class RenderAttachment;
@@ -106,22 +154,602 @@ namespace zen {
     class InputDescriptor;
 
     class RenderPipeline;
+    class RenderGraph;
+    class RenderTarget;
+    class ReadbackPool;
+    class PipelineStateCache;
+    class ComputePipeline;
+    class ShaderModule;
+    class ShaderCompiler;
+    struct ShaderSource;
+    class DescriptorLayoutCache;
+    class DescriptorAllocator;
+    class ResourceSet;
+    class BindlessTable;
+
+    enum class PresentMode {
+        Fifo, // Waits for vertical blank, the only mode every surface supports and the most power friendly
+        FifoRelaxed, // Like Fifo, but a late frame tears instead of waiting for the next blank
+        Mailbox, // Never blocks, newer frames replace queued ones. Frames nobody sees still cost power.
+        Immediate, // Presents right away and may tear, lowest latency
+    };
+
+    struct PresentConfiguration {
+        // Unsupported modes fall back towards Fifo: Immediate to Mailbox, Mailbox and FifoRelaxed to Fifo
+        PresentMode mode = PresentMode::Mailbox;
+        uint32_t minImageCount = 0; // Zero takes one more than the surface minimum, clamped to the surface limits
+
+        // With VK_KHR_present_wait, present blocks the CPU until no more than maxQueuedPresents are
+        // waiting to be displayed. Ignored on devices without support.
+        bool paceFrames = false;
+        uint32_t maxQueuedPresents = 1;
+        uint64_t presentWaitTimeout = 100'000'000; // Nanoseconds, so an occluded window can't hang us
+    };
+
+    enum class AllocationStrategy {
+        General, // Buddy sub-allocation inside large blocks, for long-lived resources
+        Linear, // Per-frame ring, reclaimed when the frame slot that made it comes back around
+    };
+
+    enum class ResourceKind {
+        Buffer,
+        Image,
+    };
+
+    // What an allocation is for, so statistics and leak reports can tell where the memory went
+    enum class MemoryCategory : uint32_t {
+        Buffer,
+        Texture,
+        Attachment, // Depth, multisample and render target images, transient graph memory
+        Staging, // Uploads and readbacks
+        Uniform,
+        Other,
+    };
+
+    inline constexpr uint32_t memoryCategoryCount = static_cast<uint32_t>(MemoryCategory::Other) + 1;
+
+    [[nodiscard]] const char* getMemoryCategoryName(MemoryCategory category);
+
+    struct Allocation {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        void* mapped = nullptr; // Already offset, only set for host visible memory
+        uint32_t memoryType = 0;
+        AllocationStrategy strategy = AllocationStrategy::General;
+        ResourceKind kind = ResourceKind::Buffer;
+        MemoryCategory category = MemoryCategory::Other;
+        bool dedicated = false;
+
+        [[nodiscard]] bool isValid() const {
+            return memory != VK_NULL_HANDLE;
+        }
+    };
+
+    // What a framebuffer holds besides the image it renders into. Both images are transient, they
+    // only live within the render pass, so tilers can keep them on chip and never back them with memory.
+    struct FramebufferAttachments {
+        VkFormat depthFormat = VK_FORMAT_UNDEFINED; // Undefined renders without a depth buffer
+        // Above one, the pass renders into a multisample image and resolves it into the output image
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+
+        [[nodiscard]] bool hasDepth() const {
+            return depthFormat != VK_FORMAT_UNDEFINED;
+        }
+    };
+
+    // A depth or multisample image that is only ever used as an attachment, in lazily allocated
+    // memory when the device has it
+    struct AttachmentImage {
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        Allocation allocation = {};
+
+        void create(Device& device, VkExtent2D extent, VkFormat format, VkSampleCountFlagBits samples);
+        void destroy(Device& device);
+    };
+
+    struct MemoryUsage {
+        VkDeviceSize bytes = 0;
+        uint32_t allocations = 0;
+    };
+
+    struct MemoryHeapStatistics {
+        VkDeviceSize size = 0;
+        VkMemoryHeapFlags flags = 0;
+        VkDeviceSize reservedBytes = 0; // Device memory the allocator holds in the heap, free block space included
+        MemoryUsage used = {}; // What live resources take of it
+        // From VK_EXT_memory_budget when the device has it, the usage then counts the whole process.
+        // Without it the budget is the plain heap size and the usage is our own reservation.
+        VkDeviceSize budget = 0;
+        VkDeviceSize usage = 0;
+    };
+
+    struct MemoryStatistics {
+        std::vector<MemoryHeapStatistics> heaps = {};
+        std::array<MemoryUsage, memoryCategoryCount> categories = {}; // Indexed by MemoryCategory
+        uint32_t deviceMemoryCount = 0;
+        bool hasBudget = false; // Whether the budgets came from the driver
+
+        [[nodiscard]] const MemoryUsage& getCategory(MemoryCategory category) const {
+            return categories[static_cast<uint32_t>(category)];
+        }
+    };
+
+    struct MemoryBudgetWarning {
+        uint32_t heapIndex = 0;
+        VkDeviceSize usage = 0;
+        VkDeviceSize budget = 0;
+    };
+
+    using MemoryBudgetCallback = std::function<void(const MemoryBudgetWarning&)>;
+
+    // Sub-allocates device memory so that resources don't each pay a vkAllocateMemory call
+    // and we stay far away from maxMemoryAllocationCount. Host visible blocks are mapped once
+    // and stay mapped for their whole lifetime.
+    class MemoryAllocator {
+    public:
+        VkDeviceSize blockSize = 64ull * 1024 * 1024; // Must be a power of two
+        VkDeviceSize linearBlockSize = 16ull * 1024 * 1024;
+
+        explicit MemoryAllocator(const Device& device) : device(device) {
+        }
+
+        MemoryAllocator(const MemoryAllocator&) = delete;
+        MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+        ~MemoryAllocator();
+
+        [[nodiscard]] Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+                                          ResourceKind kind,
+                                          AllocationStrategy strategy = AllocationStrategy::General,
+                                          MemoryCategory category = MemoryCategory::Other);
+
+        [[nodiscard]] Allocation allocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties,
+                                                   AllocationStrategy strategy = AllocationStrategy::General,
+                                                   MemoryCategory category = MemoryCategory::Buffer);
+
+        [[nodiscard]] Allocation allocateForImage(VkImage image, VkMemoryPropertyFlags properties,
+                                                  MemoryCategory category = MemoryCategory::Texture);
+
+        void free(Allocation& allocation);
+
+        // Called once the fence of the frame slot has been waited, recycles its linear memory
+        void beginFrame(uint32_t frameIndex, uint32_t frameCount);
+
+        // Recycles every linear allocation, only valid when the device is idle
+        void resetLinear();
+
+        void destroy();
+
+        [[nodiscard]] uint32_t getDeviceMemoryCount() const {
+            return deviceMemoryCount;
+        }
+
+        // Linear allocations are transient, they only show up in the reserved bytes of their heap
+        [[nodiscard]] MemoryStatistics getStatistics() const;
+
+        // Called from beginFrame for every heap whose usage is above the threshold of its budget,
+        // once per frame for as long as it stays there, so streaming can evict before the driver
+        // starts paging. The callback may free memory.
+        void setBudgetCallback(MemoryBudgetCallback callback, float threshold = 0.9f);
+
+        // Live allocations by category, empty when everything was freed. destroy prints it.
+        [[nodiscard]] std::string getLeakReport() const;
+
+        // For device memory allocated outside the allocator, e.g. imported host pages, so it still
+        // shows up in the statistics and the leak report. Called once with live set, once without.
+        void trackExternal(VkDeviceSize size, uint32_t memoryType, MemoryCategory category, bool live);
+
+    private:
+        struct MemoryBlock {
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            VkDeviceSize size = 0;
+            uint32_t memoryType = 0;
+            void* mapped = nullptr;
+            std::vector<std::set<VkDeviceSize>> freeLists = {}; // Free offsets, indexed by order
+            std::unordered_map<VkDeviceSize, uint32_t> allocatedOrders = {};
+        };
+
+        struct LinearRing {
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            VkDeviceSize size = 0;
+            void* mapped = nullptr;
+            // Head and tail are ever-growing byte counters, the physical offset is counter % size
+            VkDeviceSize head = 0;
+            VkDeviceSize tail = 0;
+            std::vector<VkDeviceSize> frameStarts = {};
+        };
+
+        const Device& device;
+        mutable std::mutex mutex;
+        std::unordered_map<uint32_t, std::vector<std::unique_ptr<MemoryBlock>>> pools = {};
+        std::unordered_map<uint32_t, LinearRing> rings = {};
+        // The frame slot linear allocations belong to, as of the last beginFrame
+        uint32_t linearFrameIndex = 0;
+        uint32_t linearFrameCount = 0;
+        uint32_t deviceMemoryCount = 0;
+        std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> reservedBytes = {};
+        std::array<MemoryUsage, VK_MAX_MEMORY_HEAPS> heapUsage = {};
+        std::array<MemoryUsage, memoryCategoryCount> categoryUsage = {};
+        MemoryBudgetCallback budgetCallback = nullptr;
+        float budgetThreshold = 0.9f;
+
+        VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped);
+        void freeDeviceMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType);
+        void track(const Allocation& allocation, bool live);
+        [[nodiscard]] uint32_t getHeapIndex(uint32_t memoryType) const;
+
+        [[nodiscard]] uint32_t getBlockOrder() const;
+        MemoryBlock& createBlock(uint32_t poolKey, uint32_t memoryType);
+        bool allocateFromBlock(MemoryBlock& block, uint32_t order, VkDeviceSize& offset) const;
+        void freeFromBlock(MemoryBlock& block, VkDeviceSize offset) const;
+
+        Allocation allocateLinear(const VkMemoryRequirements& requirements, uint32_t memoryType, ResourceKind kind);
+        void recycleLinear(uint32_t frameIndex, uint32_t frameCount);
+    };
+
+    struct StagingRegion {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;
+    };
+
+    // Persistently mapped upload buffer used as a ring. Regions handed out since the last
+    // retire() are recycled once the fence passed to it is signaled.
+    class StagingRing {
+    public:
+        explicit StagingRing(Device& device, VkDeviceSize capacity = 32ull * 1024 * 1024);
+
+        StagingRing(const StagingRing&) = delete;
+        StagingRing& operator=(const StagingRing&) = delete;
+
+        ~StagingRing();
+
+        [[nodiscard]] StagingRegion allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+        // Passing VK_NULL_HANDLE means the work has already completed
+        void retire(VkFence fence);
+        void reclaim();
+
+        [[nodiscard]] VkDeviceSize getCapacity() const {
+            return capacity;
+        }
+
+    private:
+        Device& device;
+        VkDeviceSize capacity = 0;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        Allocation allocation = {};
+        // Ever-growing byte counters, the physical offset is counter % capacity
+        VkDeviceSize head = 0;
+        VkDeviceSize tail = 0;
+        std::deque<std::pair<VkDeviceSize, VkFence>> inFlight = {};
+        std::mutex mutex;
+
+        void reclaimLocked(bool wait);
+    };
+
+    class UploadBatcher;
+    class Buffer;
+
+    // Refers to one batch of uploads. Cheap to copy, and safe to keep after the batch's
+    // command buffer and fence have been recycled.
+    class UploadHandle {
+    public:
+        UploadHandle() = default;
+
+        [[nodiscard]] bool isComplete() const;
+        void wait() const;
+
+        [[nodiscard]] bool isValid() const {
+            return batcher != nullptr;
+        }
+
+        [[nodiscard]] uint64_t getSerial() const {
+            return serial;
+        }
+
+    private:
+        friend class UploadBatcher;
+
+        UploadHandle(UploadBatcher* batcher, uint64_t serial) : batcher(batcher), serial(serial) {
+        }
+
+        UploadBatcher* batcher = nullptr;
+        uint64_t serial = 0;
+    };
+
+    // Records copies and layout transitions into one command buffer per batch and submits
+    // them together with a fence, so loading many resources costs a single submit and never
+    // drains the queue. Frames flush pending uploads before they are submitted.
+    class UploadBatcher {
+    public:
+        explicit UploadBatcher(Device& device);
+
+        UploadBatcher(const UploadBatcher&) = delete;
+        UploadBatcher& operator=(const UploadBatcher&) = delete;
+
+        ~UploadBatcher();
+
+        // The transfer lane runs on the dedicated transfer queue when there is one and hands the
+        // buffer over to the graphics family afterwards. It is meant for contents no frame has read
+        // yet; updates to buffers that are already in use go through the graphics lane.
+        void uploadBuffer(const Buffer& buffer, const void* data, VkDeviceSize size, VkDeviceSize offset = 0,
+                          QueueRole lane = QueueRole::Transfer);
+
+        // Records arbitrary work into the current batch on the given lane
+        void record(const std::function<void(VkCommandBuffer)>& recorder, QueueRole lane = QueueRole::Transfer);
+
+        // Copies the data into the staging ring and records the work that reads it into the same
+        // batch. Returns false without doing anything when the data is larger than a batch may stage.
+        bool stage(const void* data, VkDeviceSize size,
+                   const std::function<void(VkCommandBuffer, const StagingRegion&)>& recorder,
+                   QueueRole lane = QueueRole::Transfer);
+
+        // Makes transfer lane writes visible to graphics work, transferring queue family
+        // ownership when the lanes run on different families
+        void releaseToGraphics(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkAccessFlags access,
+                               VkPipelineStageFlags stages);
+        void releaseToGraphics(VkImage image, const VkImageSubresourceRange& range, VkImageLayout oldLayout,
+                               VkImageLayout newLayout, VkAccessFlags access, VkPipelineStageFlags stages);
+
+        // Runs once the batch currently being recorded has finished on the GPU
+        void releaseOnCompletion(std::function<void()> release);
+
+        [[nodiscard]] bool usesDedicatedTransfer() const {
+            return transferFamily != graphicsFamily;
+        }
+
+        [[nodiscard]] bool hasPendingWork();
+
+        UploadHandle flush();
+
+        [[nodiscard]] bool isComplete(uint64_t serial);
+        void wait(uint64_t serial);
+
+        // Recycles every batch the GPU has finished
+        void collect();
+
+    private:
+        struct Batch {
+            VkCommandBuffer transferCommands = VK_NULL_HANDLE;
+            VkCommandBuffer graphicsCommands = VK_NULL_HANDLE;
+            bool transferRecording = false;
+            bool graphicsRecording = false;
+            VkSemaphore transferFinished = VK_NULL_HANDLE;
+            VkFence fence = VK_NULL_HANDLE;
+            uint64_t serial = 0;
+            std::vector<std::function<void()>> releases = {};
+        };
+
+        Device& device;
+        uint32_t graphicsFamily = 0;
+        uint32_t transferFamily = 0;
+        VkCommandPool graphicsPool = VK_NULL_HANDLE;
+        VkCommandPool transferPool = VK_NULL_HANDLE;
+        std::optional<Batch> recording = std::nullopt;
+        std::deque<Batch> submitted = {};
+        std::vector<Batch> freeBatches = {};
+        VkDeviceSize stagedBytes = 0;
+        uint64_t nextSerial = 1;
+        uint64_t completedSerial = 0;
+        std::mutex mutex;
+
+        Batch& beginLocked();
+        VkCommandBuffer laneLocked(QueueRole lane);
+        void releaseBufferLocked(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkAccessFlags access,
+                                 VkPipelineStageFlags stages, QueueRole lane);
+        uint64_t flushLocked();
+        void collectLocked();
+    };
+
+    // A point on one queue's timeline semaphore. The job is complete once the counter reaches the
+    // value, so handles are cheap to copy and never go stale.
+    struct GpuJob {
+        QueueRole queue = QueueRole::Graphics;
+        uint64_t value = 0; // Every timeline starts at zero, so the default job is always complete
+
+        [[nodiscard]] bool isValid() const {
+            return value != 0;
+        }
+    };
+
+    // One submission to a queue. The command buffers stay the caller's and must live until the job
+    // is complete.
+    struct GpuJobDescription {
+        QueueRole queue = QueueRole::Graphics;
+        std::vector<VkCommandBuffer> commandBuffers = {};
+
+        // Jobs on any queue that must finish before the waiting stages of this one start
+        std::vector<GpuJob> dependencies = {};
+        VkPipelineStageFlags waitStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+        // Binary semaphores, e.g. for swapchain images, waited on and signaled alongside the timeline
+        std::vector<VkSemaphore> waitSemaphores = {};
+        std::vector<VkPipelineStageFlags> waitSemaphoreStages = {};
+        std::vector<VkSemaphore> signalSemaphores = {};
+    };
+
+    class JobScheduler;
+
+    // What co_await on JobScheduler::completion suspends on, the coroutine resumes in poll
+    struct GpuJobAwaiter {
+        JobScheduler& scheduler;
+        GpuJob job;
+
+        [[nodiscard]] bool await_ready() const;
+        void await_suspend(std::coroutine_handle<> handle) const;
+
+        void await_resume() const {
+        }
+    };
+
+    // Submits work to the graphics, compute and transfer queues, each tracked by one timeline
+    // semaphore. Jobs are queued until flush, which hands every queue its jobs in a single
+    // vkQueueSubmit. Dependencies may cross queues, but resources shared between queue families
+    // still need ownership transfers like UploadBatcher::releaseToGraphics does.
+    class JobScheduler {
+    public:
+        explicit JobScheduler(Device& device);
+
+        JobScheduler(const JobScheduler&) = delete;
+        JobScheduler& operator=(const JobScheduler&) = delete;
+
+        // Queued jobs still run and the callbacks waiting on them too, coroutines included, until nothing
+        // is left. We wait for every queue before destroying the semaphores.
+        ~JobScheduler();
+
+        // Queues the job for the next flush. Later jobs may depend on the handle right away.
+        GpuJob submit(const GpuJobDescription& job);
+
+        // Records into a command buffer the scheduler owns and recycles once the job is complete.
+        // The recorder may submit jobs but must not record another one on the same queue.
+        // The command buffer is recycled right away when the recorder throws.
+        GpuJob record(QueueRole queue, const std::function<void(VkCommandBuffer)>& recorder,
+                      const std::vector<GpuJob>& dependencies = {},
+                      VkPipelineStageFlags waitStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+        // Queues the job behind everything queued so far and flushes, the fence is signaled with it
+        GpuJob submitNow(const GpuJobDescription& job, VkFence fence);
+
+        // Safe from any thread, the submits hold Device::getSubmitMutex like every other submitter
+        void flush();
+
+        [[nodiscard]] bool isComplete(GpuJob job) const;
+
+        // Flushes when the job is still queued. Returns false when the timeout, in nanoseconds, ran out.
+        bool wait(GpuJob job, uint64_t timeout = UINT64_MAX);
+        bool waitAll(const std::vector<GpuJob>& jobs, uint64_t timeout = UINT64_MAX);
+
+        // Runs on the thread calling poll once the job is complete
+        void onCompletion(GpuJob job, std::function<void()> callback);
+
+        [[nodiscard]] GpuJobAwaiter completion(GpuJob job) {
+            return {*this, job};
+        }
+
+        // Runs the callbacks of completed jobs and recycles their command buffers. The device polls
+        // whenever it hands out a frame.
+        void poll();
+
+    private:
+        struct QueuedJob {
+            GpuJobDescription description;
+            uint64_t value = 0;
+        };
+
+        struct Timeline {
+            VkQueue queue = VK_NULL_HANDLE;
+            VkSemaphore semaphore = VK_NULL_HANDLE;
+            VkCommandPool pool = VK_NULL_HANDLE;
+            uint64_t nextValue = 1;
+            uint64_t submittedValue = 0;
+            std::vector<QueuedJob> queued = {};
+            std::deque<std::pair<uint64_t, VkCommandBuffer>> recorded = {};
+            std::vector<VkCommandBuffer> freeCommandBuffers = {};
+            std::mutex recording; // The command pool, held for as long as a recorder runs
+        };
+
+        struct Callback {
+            GpuJob job;
+            std::function<void()> callback;
+        };
+
+        Device& device;
+        std::array<Timeline, 3> timelines = {};
+        std::vector<Callback> callbacks = {};
+        mutable std::mutex mutex;
+
+        [[nodiscard]] Timeline& getTimeline(QueueRole queue);
+        [[nodiscard]] const Timeline& getTimeline(QueueRole queue) const;
+        [[nodiscard]] uint64_t getCompletedValue(const Timeline& timeline) const;
+
+        GpuJob queueLocked(const GpuJobDescription& job);
+        void flushLocked(VkFence fence, QueueRole fenceQueue);
+    };
+
+    // A VkPipelineCache shared by every pipeline the device creates. It is loaded from disk when
+    // the file was written by the same driver and device, and saved back when the device goes away.
+    class PipelineCache {
+    public:
+        // An empty path keeps the cache in memory only
+        PipelineCache(Device& device, std::string path);
+
+        PipelineCache(const PipelineCache&) = delete;
+        PipelineCache& operator=(const PipelineCache&) = delete;
+
+        ~PipelineCache();
+
+        // Writes the cache atomically, returns false if it could not be written
+        bool save() const;
+
+        [[nodiscard]] VkPipelineCache getCache() const {
+            return cache;
+        }
+
+        // Whether the initial data came from disk
+        [[nodiscard]] bool wasLoaded() const {
+            return loaded;
+        }
+
+    private:
+        Device& device;
+        std::string path;
+        VkPipelineCache cache = VK_NULL_HANDLE;
+        bool loaded = false;
+
+        [[nodiscard]] bool isCompatible(const std::vector<uint8_t>& data) const;
+    };
+
+    enum class BufferUsage : uint32_t {
+        Vertex = 1 << 0,
+        Index = 1 << 1,
+        Storage = 1 << 2,
+        Indirect = 1 << 3,
+        Uniform = 1 << 4,
+        TransferSource = 1 << 5,
+    };
+
+    inline BufferUsage operator|(BufferUsage a, BufferUsage b) {
+        return static_cast<BufferUsage>(static_cast<uint32_t>(a) | static_cast<uint32_t>(b));
+    }
+
+    inline bool hasUsage(BufferUsage usage, BufferUsage flag) {
+        return (static_cast<uint32_t>(usage) & static_cast<uint32_t>(flag)) != 0;
+    }
+
+    VkBufferUsageFlags toVulkanBufferUsage(BufferUsage usage);
+
+    // Where the GPU will read the usage from once a transfer has written it
+    void getBufferAccess(BufferUsage usage, VkAccessFlags& access, VkPipelineStageFlags& stages);
+
+    // Who accesses an image while it sits in the given layout
+    void getImageAccess(VkImageLayout layout, VkAccessFlags& access, VkPipelineStageFlags& stages);
+
+    enum class BufferResidency {
+        DeviceLocal, // Uploaded through the staging ring, fastest for the GPU to read
+        HostVisible, // Written directly by the CPU, meant for data that changes every frame
+    };
 
     class Buffer {
     public:
         VkBuffer buffer = VK_NULL_HANDLE;
         VkDeviceMemory memory = VK_NULL_HANDLE;
+        Allocation allocation = {};
+        BufferUsage usage = BufferUsage::Vertex;
+        BufferResidency residency = BufferResidency::DeviceLocal;
+        VkDeviceSize size = 0;
 
         template <typename T>
         void uploadData(const std::vector<T>& data, Device& device) {
-            pushData(
-                std::vector<uint8_t>(reinterpret_cast<const uint8_t*>(data.data()),
-                                     reinterpret_cast<const uint8_t*>(data.data() + data.size())),
-                sizeof(T) * data.size(),
-                device
-            );
+            uploadData(data.data(), sizeof(T) * data.size(), device);
         }
 
+        // Copies straight from the caller's memory into mapped or staging memory
+        void uploadData(const void* data, VkDeviceSize size, Device& device);
+
         void destroy(const Device& device);
 
         [[nodiscard]] bool isValid() const {
@@ -129,7 +757,9 @@ namespace zen {
         }
 
     private:
-        void pushData(const std::vector<uint8_t>& data, int size, Device& device);
+        friend class AssetPackage;
+
+        void create(VkDeviceSize size, Device& device);
     };
 
     enum class IndexType {
@@ -142,27 +772,319 @@ namespace zen {
 
     VkIndexType getIndexType(IndexType type);
 
+    // Pipelines keep viewport and scissor dynamic, so every render pass sets them for its extent
+    void setViewport(VkCommandBuffer commandBuffer, VkExtent2D extent);
+
+    // A named span of time, in milliseconds since the program started
+    struct ProfileScope {
+        std::string name;
+        double start = 0.0;
+        double duration = 0.0;
+        uint32_t depth = 0; // How many scopes of the same thread enclose it
+        uint32_t thread = 0; // Order in which threads first recorded a scope
+    };
+
+    struct PipelineStatistics {
+        uint64_t inputAssemblyVertices = 0;
+        uint64_t inputAssemblyPrimitives = 0;
+        uint64_t vertexShaderInvocations = 0;
+        uint64_t clippingPrimitives = 0;
+        uint64_t fragmentShaderInvocations = 0;
+        uint64_t computeShaderInvocations = 0;
+    };
+
+    // Everything measured for one frame. GPU scopes come from timestamps and are placed on the CPU
+    // timeline by the frame's submit, so they are only as accurate as that anchor.
+    struct FrameProfile {
+        uint64_t serial = 0; // Device::getFrameSerial of the frame
+        std::vector<ProfileScope> cpuScopes = {};
+        std::vector<ProfileScope> gpuScopes = {};
+        std::optional<PipelineStatistics> statistics = std::nullopt;
+        uint32_t droppedScopes = 0; // GPU scopes beyond the profiler's limit
+
+        // Sums every scope with that name, zero when there is none
+        [[nodiscard]] double getCpuTime(const std::string& name) const;
+        [[nodiscard]] double getGpuTime(const std::string& name = "Frame") const;
+    };
+
+    // Times frames on both sides. Command buffers time acquire, record, submit and present and
+    // wrap their GPU work in a "Frame" timestamp scope, callers add their own scopes inside.
+    // Results are read back when the frame slot is reused, after its fence was already waited
+    // on, so reading them never stalls.
+    class Profiler {
+    public:
+        explicit Profiler(Device& device, uint32_t maxGpuScopes = 256);
+
+        Profiler(const Profiler&) = delete;
+        Profiler& operator=(const Profiler&) = delete;
+
+        ~Profiler();
+
+        // Checked when a frame begins, so toggling it takes effect on the next frame
+        std::atomic<bool> enabled = false;
+        // Needs the pipelineStatisticsQuery feature, and inheritedQueries since the query stays active
+        // while secondaries execute, ignored without them
+        bool collectStatistics = false;
+        // How many resolved frames are kept around
+        size_t historySize = 240;
+
+        [[nodiscard]] static double now();
+
+        // Scopes nest per thread and must be closed on the thread that opened them
+        void beginCpuScope(const std::string& name);
+        void endCpuScope();
+        // For spans the caller measured itself, e.g. a wait that started before the frame did
+        void addCpuScope(const std::string& name, double start, double end, uint32_t depth = 0);
+
+        // Device and CommandBuffer drive these, the frame's command buffer must be recording
+        void beginFrame(uint32_t frameIndex, uint32_t frameCount, uint64_t serial);
+        void beginCommands(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+        void endCommands(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+        void markSubmit(uint32_t frameIndex);
+        // What secondaries executed in the frame have to declare in their inheritance info
+        [[nodiscard]] VkQueryPipelineStatisticFlags getInheritedStatistics(uint32_t frameIndex) const;
+        void beginGpuScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, const std::string& name);
+        void endGpuScope(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+        [[nodiscard]] bool supportsGpuTiming() const {
+            return timestampMask != 0;
+        }
+
+        // The newest frame whose results are in, framesInFlight behind the one being recorded
+        [[nodiscard]] std::optional<FrameProfile> getLatest() const;
+        [[nodiscard]] std::vector<FrameProfile> getHistory() const;
+
+        // Human readable breakdown of the latest frame
+        [[nodiscard]] std::string makeReport() const;
+
+        // Writes the history in the Trace Event format, chrome://tracing and Perfetto open it
+        bool exportChromeTrace(const std::string& path) const;
+
+    private:
+        struct GpuRecord {
+            std::string name;
+            uint32_t depth = 0;
+            bool closed = false;
+        };
+
+        struct Slot {
+            bool active = false;
+            bool recorded = false; // Queries were reset and written, results will come
+            bool statistics = false;
+            uint64_t serial = 0;
+            double submitTime = 0.0;
+            uint32_t droppedScopes = 0;
+            std::vector<GpuRecord> records = {};
+            std::vector<uint32_t> openRecords = {}; // UINT32_MAX for scopes that were dropped
+            std::vector<ProfileScope> cpuScopes = {};
+        };
+
+        Device& device;
+        uint32_t maxGpuScopes = 0;
+        double timestampPeriod = 0.0; // Nanoseconds per tick
+        uint64_t timestampMask = 0; // Zero when the graphics queue can't write timestamps
+        VkQueryPool timestampPool = VK_NULL_HANDLE;
+        VkQueryPool statisticsPool = VK_NULL_HANDLE;
+
+        std::vector<Slot> slots = {};
+        uint32_t currentSlot = 0;
+        std::unordered_map<std::thread::id, uint32_t> threads = {};
+        std::deque<FrameProfile> history = {};
+        mutable std::mutex mutex;
+
+        void createPools(uint32_t frameCount);
+        void resolve(Slot& slot, uint32_t frameIndex);
+        void beginGpuScopeLocked(VkCommandBuffer commandBuffer, uint32_t frameIndex, const std::string& name);
+        void endGpuScopeLocked(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+    };
+
+    // Times the enclosing block on the calling thread
+    class CpuScope {
+    public:
+        CpuScope(Profiler& profiler, const std::string& name) : profiler(profiler) {
+            profiler.beginCpuScope(name);
+        }
+
+        CpuScope(const CpuScope&) = delete;
+        CpuScope& operator=(const CpuScope&) = delete;
+
+        ~CpuScope() {
+            profiler.endCpuScope();
+        }
+
+    private:
+        Profiler& profiler;
+    };
+
+    class CommandBuffer;
+
+    // One slot of the frames-in-flight ring. The fence is signaled when the GPU finishes the
+    // work submitted from this slot, so the CPU only waits when it wraps back around to it.
+    struct FrameContext {
+        uint32_t index = 0;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence inFlightFence = VK_NULL_HANDLE;
+        std::shared_ptr<CommandBuffer> recorder = nullptr;
+        uint64_t serial = 0; // Device::getFrameSerial when the slot was last handed out
+    };
+
+    // How the render pass gets its commands. A pass begun for secondaries only accepts
+    // executeSecondaries until endRendering.
+    enum class RenderingContents {
+        Inline,
+        Secondary,
+    };
+
+    class UniformBlock;
+
+    // A generational reference into a ResourceRegistry. It is eight bytes and passed by value, and
+    // the generation catches handles to a removed resource before they reach whatever reused its slot.
+    template <typename T>
+    struct Handle {
+        uint32_t index = UINT32_MAX;
+        uint32_t generation = 0;
+
+        [[nodiscard]] bool isValid() const {
+            return index != UINT32_MAX;
+        }
+
+        bool operator==(const Handle&) const = default;
+    };
+
+    using BufferHandle = Handle<Buffer>;
+    using TextureHandle = Handle<Texture>;
+    using UniformBlockHandle = Handle<UniformBlock>;
+    using PipelineHandle = Handle<RenderPipeline>;
+
+    // A slice of a frame recorded by a worker thread. It belongs to the calling thread's pool for
+    // the frame slot and is recycled once that slot comes around again, so it is never freed.
+    class SecondaryCommandBuffer {
+    public:
+        void bindPipeline(const RenderPipeline& pipeline) const;
+        void bindResourceSet(const RenderPipeline& pipeline, uint32_t set, const ResourceSet& resourceSet) const;
+        void bindBindlessTextures(const RenderPipeline& pipeline, uint32_t set) const;
+
+        // Writes per-draw data straight into the command buffer, no buffer update or set bind needed
+        template <typename T>
+        void pushConstants(const RenderPipeline& pipeline, const T& data, uint32_t offset = 0) const {
+            static_assert(std::is_trivially_copyable_v<T>, "Push constants are copied byte for byte");
+            pushConstants(pipeline, &data, static_cast<uint32_t>(sizeof(T)), offset);
+        }
+
+        void pushConstants(const RenderPipeline& pipeline, const void* data, uint32_t size, uint32_t offset) const;
+        void bindVertexBuffer(const Buffer& buffer, uint32_t binding = 0, VkDeviceSize offset = 0) const;
+        void bindIndexBuffer(const Buffer& buffer, IndexType type) const;
+        void draw(int vertexCount, bool indexed) const;
+        void drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex = 0,
+                           uint32_t firstInstance = 0) const;
+        void drawIndexed(uint32_t indexCount, uint32_t instanceCount = 1, uint32_t firstIndex = 0,
+                         int32_t vertexOffset = 0, uint32_t firstInstance = 0) const;
+
+        // Must be called by the recording thread before the primary executes it
+        void end() const;
+
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+
+    private:
+        friend class CommandBuffer;
+
+        explicit SecondaryCommandBuffer(VkCommandBuffer commandBuffer) : commandBuffer(commandBuffer) {
+        }
+    };
+
     class CommandBuffer {
     public:
-        CommandBuffer(const RenderPipeline& pipeline, VkCommandPool commandPool,
-                      VkCommandBuffer commandBuffer, Device& device, Presentable& presentable
+        // Exactly one of presentable and target is set, a target never touches a swapchain
+        CommandBuffer(const RenderPipeline& pipeline, const FrameContext& frame, VkCommandPool commandPool,
+                      Device& device, Presentable* presentable, RenderTarget* target
         );
 
-        void begin() const;
+        void usePipeline(const RenderPipeline& pipeline);
+        void useFrame(const FrameContext& frame);
+        void useOutput(Presentable* presentable, RenderTarget* target);
+
+        void begin();
         void end();
 
-        void beginRendering();
+        void beginRendering(RenderingContents contents = RenderingContents::Inline);
         void endRendering() const;
 
+        // Safe to call from any thread between beginRendering and endRendering. Every thread
+        // records into its own pool, so workers never contend with each other.
+        [[nodiscard]] SecondaryCommandBuffer beginSecondary() const;
+
+        // Needs a pass begun with RenderingContents::Secondary, the buffers run in the given order
+        void executeSecondaries(const std::vector<SecondaryCommandBuffer>& secondaries) const;
+
+        // Acquires the swapchain image and records the whole graph in place of beginRendering and
+        // endRendering. The graph is compiled again when the presentable was recreated since.
+        // Without a presentable nothing is acquired, so the graph must not import a backbuffer.
+        void executeGraph(RenderGraph& graph);
+
+        // Only for command buffers requested with a presentable
         void present() const;
-        void submit() const;
 
-        void bindVertexBuffer(const Buffer& buffer) const;
+        // Returns the point on the graphics timeline the frame signals, so jobs on other queues can
+        // depend on it. Without timeline semaphores the job is invalid.
+        GpuJob submit() const;
+
+        // The frame's submit waits for the job before the given stages run. Cleared by begin, needs
+        // Device::supportsTimelineSemaphore.
+        void waitFor(GpuJob job, VkPipelineStageFlags stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+        // GPU scopes measured with timestamps, they nest and show up in Device::getProfiler
+        void beginScope(const std::string& name) const;
+        void endScope() const;
+
+        void bindVertexBuffer(const Buffer& buffer, uint32_t binding = 0, VkDeviceSize offset = 0) const;
         void bindIndexBuffer(const Buffer& buffer, IndexType type) const;
+        // Looked up in Device::getResources when recorded
+        void bindVertexBuffer(BufferHandle buffer, uint32_t binding = 0, VkDeviceSize offset = 0) const;
+        void bindIndexBuffer(BufferHandle buffer, IndexType type) const;
         void bindUniforms(const RenderPipeline& pipeline);
+
+        // Binds a set declared with RenderPipeline::useResourceSet, e.g. to swap materials between draws
+        void bindResourceSet(const RenderPipeline& pipeline, uint32_t set, const ResourceSet& resourceSet);
+        void bindBindlessTextures(const RenderPipeline& pipeline, uint32_t set);
+
+        // Writes per-draw data straight into the command buffer, no buffer update or set bind needed
+        template <typename T>
+        void pushConstants(const RenderPipeline& pipeline, const T& data, uint32_t offset = 0) const {
+            static_assert(std::is_trivially_copyable_v<T>, "Push constants are copied byte for byte");
+            pushConstants(pipeline, &data, static_cast<uint32_t>(sizeof(T)), offset);
+        }
+
+        void pushConstants(const RenderPipeline& pipeline, const void* data, uint32_t size, uint32_t offset) const;
         void activateTexture(Texture& texture, Device& device);
         void bindTexture(RenderPipeline& pipeline);
         void draw(int vertexCount, bool indexed) const;
+        void drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex = 0,
+                           uint32_t firstInstance = 0) const;
+        void drawIndexed(uint32_t indexCount, uint32_t instanceCount = 1, uint32_t firstIndex = 0,
+                         int32_t vertexOffset = 0, uint32_t firstInstance = 0) const;
+
+        // The buffer holds tightly packed VkDrawIndirectCommand or VkDrawIndexedIndirectCommand
+        // records. More than one draw needs the multiDrawIndirect feature.
+        void drawIndirect(const Buffer& buffer, uint32_t drawCount, bool indexed, VkDeviceSize offset = 0) const;
+
+        // Same, but the GPU decides how many draws run by writing a uint32_t into the count buffer.
+        // Needs Device::supportsDrawIndirectCount.
+        void drawIndirectCount(const Buffer& buffer, const Buffer& countBuffer, uint32_t maxDrawCount, bool indexed,
+                               VkDeviceSize offset = 0, VkDeviceSize countOffset = 0) const;
+
+        // Compute work must be recorded outside of beginRendering/endRendering
+        void dispatch(const ComputePipeline& pipeline, uint32_t groupsX, uint32_t groupsY = 1,
+                      uint32_t groupsZ = 1) const;
+        void dispatchIndirect(const ComputePipeline& pipeline, const Buffer& buffer, VkDeviceSize offset = 0) const;
+
+        // Makes what one kind of access wrote visible to the next, e.g. Storage to Vertex when a
+        // compute pass produced the vertices a draw reads
+        void bufferBarrier(const Buffer& buffer, BufferUsage from, BufferUsage to) const;
+        void imageBarrier(const Image& image, VkImageLayout oldLayout, VkImageLayout newLayout) const;
+
+        [[nodiscard]] uint32_t getFrameIndex() const {
+            return frameIndex;
+        }
 
         bool inUse;
 
@@ -171,21 +1093,34 @@ namespace zen {
     private:
         [[maybe_unused]] VkCommandPool commandPool = VK_NULL_HANDLE;
         VkRenderPass renderPass = VK_NULL_HANDLE;
+        VkFramebuffer framebuffer = VK_NULL_HANDLE;
         VkPipeline pipeline = VK_NULL_HANDLE;
         VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
         VkSemaphore renderFinishedSemaphore = VK_NULL_HANDLE;
-        Presentable& presentable;
+        VkFence inFlightFence = VK_NULL_HANDLE;
+        uint32_t frameIndex = 0;
+        uint64_t frameSerial = 0;
+        Presentable* presentable = nullptr;
+        RenderTarget* target = nullptr;
         int imageIndex = 0;
         Device& device;
-        bool resourcesBound = false;
+        // What set 0 holds right now, so binding the same pipeline's set again can be skipped
+        VkDescriptorSet boundSet = VK_NULL_HANDLE;
+        VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+        std::vector<uint32_t> boundOffsets = {};
+        std::vector<GpuJob> dependencies = {};
+        VkPipelineStageFlags dependencyStages = 0;
+
+        [[nodiscard]] VkExtent2D getExtent() const;
+        void acquireImage();
+        void bindDescriptorSet(const RenderPipeline& pipeline);
+        void bindComputePipeline(const ComputePipeline& pipeline) const;
     };
 
     struct Framebuffer {
         VkFramebuffer framebuffer = VK_NULL_HANDLE;
     };
 
-    class UniformBlock;
-
     class SimpleCommandBuffer {
     public:
         void start() const;
@@ -199,6 +1134,96 @@ namespace zen {
         Device& device;
     };
 
+    // Owns resources moved into it and hands out handles to them. Slots sit in one vector and are
+    // reused through a free list, so lookups are an index and a generation compare. References from
+    // get are only valid until the next add. The registry owns the objects, not their Vulkan handles:
+    // remove gives the resource back for the caller to destroy once no frame in flight uses it.
+    template <typename T>
+    class ResourceRegistry {
+    public:
+        ResourceRegistry() = default;
+
+        ResourceRegistry(const ResourceRegistry&) = delete;
+        ResourceRegistry& operator=(const ResourceRegistry&) = delete;
+        ResourceRegistry(ResourceRegistry&&) noexcept = default;
+        ResourceRegistry& operator=(ResourceRegistry&&) noexcept = default;
+
+        [[nodiscard]] Handle<T> add(T&& resource) {
+            uint32_t index;
+            if (!freeSlots.empty()) {
+                index = freeSlots.back();
+                freeSlots.pop_back();
+            }
+            else {
+                index = static_cast<uint32_t>(slots.size());
+                slots.emplace_back();
+            }
+            slots[index].resource.emplace(std::move(resource));
+            count++;
+            return {index, slots[index].generation};
+        }
+
+        [[nodiscard]] T& get(Handle<T> handle) {
+            return *find(handle);
+        }
+
+        [[nodiscard]] const T& get(Handle<T> handle) const {
+            return *find(handle);
+        }
+
+        [[nodiscard]] bool contains(Handle<T> handle) const {
+            return handle.index < slots.size() && slots[handle.index].generation == handle.generation &&
+                slots[handle.index].resource.has_value();
+        }
+
+        // Every handle to the slot goes stale, the slot itself is reused by a later add
+        [[nodiscard]] T remove(Handle<T> handle) {
+            T* resource = find(handle);
+            T removed = std::move(*resource);
+            Slot& slot = slots[handle.index];
+            slot.resource.reset();
+            slot.generation++;
+            freeSlots.push_back(handle.index);
+            count--;
+            return removed;
+        }
+
+        [[nodiscard]] size_t size() const {
+            return count;
+        }
+
+    private:
+        struct Slot {
+            std::optional<T> resource = std::nullopt;
+            uint32_t generation = 0;
+        };
+
+        std::vector<Slot> slots = {};
+        std::vector<uint32_t> freeSlots = {};
+        size_t count = 0;
+
+        [[nodiscard]] T* find(Handle<T> handle) {
+            return const_cast<T*>(std::as_const(*this).find(handle));
+        }
+
+        [[nodiscard]] const T* find(Handle<T> handle) const {
+            if (!contains(handle)) {
+                throw std::runtime_error("Stale or invalid resource handle " + std::to_string(handle.index) +
+                    " (generation " + std::to_string(handle.generation) + ")");
+            }
+            return &*slots[handle.index].resource;
+        }
+    };
+
+    struct ResourceRegistries;
+
+    // Block compression families, desktop GPUs have BC while mobile ones have ASTC or ETC2
+    enum class TextureCompression {
+        None,
+        BC,
+        ASTC,
+        ETC2,
+    };
 
     class Device {
     public:
@@ -210,6 +1235,11 @@ namespace zen {
             : picker(std::move(picker)), instance(instance) {
         }
 
+        Device(const Device&) = delete;
+        Device& operator=(const Device&) = delete;
+
+        ~Device();
+
         [[nodiscard]] bool supportsExtensions(const std::vector<std::string>& requiredExtensions = {}) const;
 
         [[nodiscard]] bool supportsSwapchain() const;
@@ -218,6 +1248,33 @@ namespace zen {
 
         [[nodiscard]] bool supportsRaytracing() const;
 
+        // Set by init when VK_KHR_draw_indirect_count is available and enabled
+        bool supportsDrawIndirectCount = false;
+        PFN_vkCmdDrawIndirectCountKHR cmdDrawIndirectCount = nullptr;
+        PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
+        // Set by init when VK_EXT_descriptor_indexing has everything the bindless table needs
+        bool supportsDescriptorIndexing = false;
+
+        // Set by init when VK_KHR_present_id and VK_KHR_present_wait can pace presentation
+        bool supportsPresentWait = false;
+        PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+
+        // Set by init when VK_EXT_memory_budget reports what the heaps allow this process. Reading it
+        // takes properties2, core in 1.1 and VK_KHR_get_physical_device_properties2 before that.
+        bool supportsMemoryBudget = false;
+        PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+
+        // Set by init when VK_EXT_external_memory_host lets host memory back buffers directly
+        bool supportsHostMemoryImport = false;
+        VkDeviceSize minImportedHostPointerAlignment = 0;
+        PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerProperties = nullptr;
+
+        // Set by init when VK_KHR_timeline_semaphore backs the job scheduler
+        bool supportsTimelineSemaphore = false;
+        PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue = nullptr;
+        PFN_vkWaitSemaphoresKHR waitForSemaphores = nullptr;
+
         void init();
 
         VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
@@ -227,6 +1284,7 @@ namespace zen {
 
         VkDevice logicalDevice = VK_NULL_HANDLE;
         std::vector<CoreQueue> queues;
+        std::unordered_map<QueueRole, uint32_t> queueRoles = {};
 
         std::vector<const char*> extensions = {
             VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -234,24 +1292,59 @@ namespace zen {
 
         std::vector<CoreQueue> getQueueFromCapability(DeviceCapabilities capability);
 
-        [[nodiscard]] Presentable makePresentable() const;
+        [[nodiscard]] Presentable makePresentable(const PresentConfiguration& configuration = {});
 
         [[nodiscard]] Format makeDepthFormat() const;
 
         [[nodiscard]] Format makeColorFormat() const;
 
-        [[nodiscard]] RenderPass makeRenderPass(std::vector<RenderAttachment>&, Presentable&);
+        // The highest sample count both color and depth framebuffer attachments support
+        [[nodiscard]] VkSampleCountFlagBits getMaxSampleCount() const;
+
+        // A second attachment with AttachmentLayout::DepthAttachment gets a depth buffer, more than one
+        // sample renders into multisample images that resolve into the swapchain
+        [[nodiscard]] RenderPass makeRenderPass(std::vector<RenderAttachment>&, Presentable&,
+                                                VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT);
 
         [[nodiscard]] ShaderModule makeShader(const std::string& source, ShaderType type) const;
 
         [[nodiscard]] ShaderModule makeShader(const std::vector<uint32_t>& code, ShaderType type) const;
 
+        // Compiles every source concurrently, the modules come back in the same order
+        [[nodiscard]] std::vector<ShaderModule> makeShaders(const std::vector<ShaderSource>& sources) const;
+
+        // Where compiled SPIR-V is kept between runs. Must be set before init, empty disables it.
+        std::string shaderCacheDirectory = "zenith_shaders";
+
+        [[nodiscard]] ShaderCompiler& getShaderCompiler() const;
+
         [[nodiscard]] RenderPipeline makeRenderPipeline() const;
 
+        [[nodiscard]] ResourceSet makeResourceSet() const;
+
+        [[nodiscard]] DescriptorLayoutCache& getDescriptorLayoutCache() const;
+
+        // For sets that live as long as their owner, e.g. materials
+        [[nodiscard]] DescriptorAllocator& getDescriptorAllocator() const;
+
+        // For sets that only live while the frame slot is recorded, reset once its fence is waited on
+        [[nodiscard]] DescriptorAllocator& getFrameDescriptorAllocator(uint32_t frameIndex) const;
+
+        // Slots in the bindless texture table. Must be set before init, which lowers it to what the
+        // device's update after bind limits allow, so afterwards it is the table's real capacity.
+        uint32_t bindlessTextureCapacity = 16384;
+
+        [[nodiscard]] BindlessTable& getBindlessTable() const;
+
+        [[nodiscard]] ComputePipeline makeComputePipeline() const;
+
         [[nodiscard]] UniformBlock makeUniformBlock(size_t size);
 
         [[nodiscard]] Texture createTexture(size_t width, size_t height, size_t channels,
                                             std::shared_ptr<void> data);
+
+        // Which pre-compressed assets to ship to this device, checked in the order BC, ASTC, ETC2
+        [[nodiscard]] TextureCompression getTextureCompression() const;
 #ifdef ZENITH_EXT_TEXTURE
 #ifdef ZENITH_VULKAN
         [[nodiscard]] Texture createTexture(zen::texture::TextureData data);
@@ -260,42 +1353,195 @@ namespace zen {
 
         void useInputDescriptor(InputDescriptor& inputDescriptor) const;
 
+        // Number of frames the CPU may record ahead of the GPU. Must be set before the first
+        // call to requestCommandBuffer.
+        uint32_t framesInFlight = 2;
+
+        [[nodiscard]] std::shared_ptr<CommandBuffer> requestCommandBuffer(
+            const RenderPipeline& pipeline, Presentable& presentable);
+
+        // Renders into the target instead of a swapchain image, works on headless instances too
         [[nodiscard]] std::shared_ptr<CommandBuffer> requestCommandBuffer(
-            RenderPipeline pipeline, Presentable& presentable);
+            const RenderPipeline& pipeline, RenderTarget& target);
+
+        // Looks the pipeline up in getResources, so a frame only passes the handle around
+        [[nodiscard]] std::shared_ptr<CommandBuffer> requestCommandBuffer(PipelineHandle pipeline,
+                                                                          Presentable& presentable);
+        [[nodiscard]] std::shared_ptr<CommandBuffer> requestCommandBuffer(PipelineHandle pipeline,
+                                                                          RenderTarget& target);
+
+        [[nodiscard]] uint32_t getCurrentFrame() const {
+            return currentFrame;
+        }
+
+        // Increases every time a frame slot is handed out
+        [[nodiscard]] uint64_t getFrameSerial() const {
+            return frameSerial;
+        }
+
+        // Size of each frame's region of the uniform arena. Must be set before creating uniform blocks.
+        VkDeviceSize uniformArenaFrameSize = 4ull * 1024 * 1024;
+
+        [[nodiscard]] UniformArena& getUniformArena();
+
+        // Destroys the buffer once no frame that was recording when it was retired can still read it
+        void retireBuffer(VkBuffer buffer, const Allocation& allocation);
+
+        // Where the pipeline cache persists between runs. Must be set before init, empty disables it.
+        std::string pipelineCachePath = "zenith_pipelines.cache";
+
+        [[nodiscard]] VkPipelineCache getPipelineCache() const;
+
+        // Graphics pipelines built from descriptions, shared by every RenderPipeline variant
+        [[nodiscard]] PipelineStateCache& getPipelineStateCache() const;
+
+        bool savePipelineCache() const;
+
+        void waitIdle() const;
 
         [[nodiscard]] std::shared_ptr<SimpleCommandBuffer> requestSimpleCommandBuffer();
 
         void freeCommandBuffer(CommandBuffer& commandBuffer);
         void freeCommandBuffer(SimpleCommandBuffer& commandBuffer);
 
+        // Hands out a secondary command buffer from the calling thread's pool for the frame slot.
+        // The pool is reset the first time the thread asks for a newer frame serial.
+        [[nodiscard]] VkCommandBuffer acquireSecondaryCommandBuffer(uint32_t frameIndex, uint64_t frameSerial);
+
         void activateTexture(Texture& texture);
 
         template <typename T>
-        Buffer makeBuffer(std::vector<T>& data) {
+        Buffer makeBuffer(std::vector<T>& data, BufferUsage usage = BufferUsage::Vertex,
+                          BufferResidency residency = BufferResidency::DeviceLocal) {
             Buffer buffer;
+            buffer.usage = usage;
+            buffer.residency = residency;
             buffer.uploadData(data, *this);
             return buffer;
         }
 
+        // Copies the data into a device local buffer through the staging ring. The copy is batched
+        // and only submitted by flushUploads or the next frame's submit.
+        void uploadBuffer(const Buffer& buffer, const void* data, VkDeviceSize size, VkDeviceSize offset = 0,
+                          QueueRole lane = QueueRole::Transfer);
+
+        UploadHandle flushUploads();
+
+        [[nodiscard]] StagingRing& getStagingRing() const;
+
+        [[nodiscard]] UploadBatcher& getUploadBatcher() const;
+
+        // Cross-queue submissions, needs supportsTimelineSemaphore
+        [[nodiscard]] JobScheduler& getJobScheduler() const;
+
+        [[nodiscard]] Profiler& getProfiler() const;
+
+        [[nodiscard]] ReadbackPool& getReadbackPool() const;
+
+        // Buffers, textures, uniform blocks and pipelines the render loop refers to by handle
+        [[nodiscard]] ResourceRegistries& getResources() const;
+
         [[nodiscard]] CoreQueue getGraphicsQueue() const;
         [[nodiscard]] CoreQueue getPresentQueue() const;
 
+        [[nodiscard]] CoreQueue getQueue(QueueRole role) const;
+
+        // Submitting and presenting need the queue externally synchronized, so everything that calls
+        // vkQueueSubmit or vkQueuePresentKHR holds the queue's mutex while it does
+        [[nodiscard]] std::mutex& getSubmitMutex(VkQueue queue) const;
+
+        // Whether the role runs on a family of its own rather than sharing the graphics family
+        [[nodiscard]] bool hasDedicatedQueue(QueueRole role) const;
+
         [[nodiscard]] uint32_t vkFindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
 
+        [[nodiscard]] MemoryAllocator& getAllocator() const;
+
+        // Per heap and per category counters of the device allocator, with the driver's budgets
+        [[nodiscard]] MemoryStatistics getMemoryStatistics() const;
+
         Instance instance;
 
         std::vector<Framebuffer> framebuffers = {};
 
+        // One framebuffer per swapchain image for the render pass, replacing the previous ones. The depth
+        // and multisample images are the device's, all the framebuffers share them.
+        void makeFramebuffers(VkRenderPass renderPass, const Presentable& presentable,
+                              const FramebufferAttachments& attachments);
+
+        // Same attachments as last time, for when the presentable was recreated
+        void makeFramebuffers(VkRenderPass renderPass, const Presentable& presentable);
+
+        [[nodiscard]] VkRenderPass getFramebufferRenderPass() const {
+            return framebufferRenderPass;
+        }
+
     private:
+        VkRenderPass framebufferRenderPass = VK_NULL_HANDLE;
+        FramebufferAttachments framebufferAttachments = {};
+        AttachmentImage depthImage = {};
+        AttachmentImage multisampleImage = {};
+
+        void destroyFramebuffers();
         void findQueueFamilies();
 
         void initializeLogicalDevice();
 
         void makeCommandPool();
 
+        void makeFrames();
+
+        [[nodiscard]] std::shared_ptr<CommandBuffer> requestCommandBuffer(const RenderPipeline& pipeline,
+                                                                          Presentable* presentable,
+                                                                          RenderTarget* target);
+
         std::optional<VkCommandPool> commandPool = std::nullopt;
+        std::mutex commandPoolMutex; // Guards creating the shared pool and allocating from it
+
+        // One pool per thread and frame slot, only the owning thread ever touches it
+        struct ThreadCommandPool {
+            VkCommandPool pool = VK_NULL_HANDLE;
+            uint64_t serial = 0;
+            std::vector<VkCommandBuffer> buffers = {};
+            size_t used = 0;
+        };
+
+        std::unordered_map<std::thread::id, std::vector<ThreadCommandPool>> threadPools = {};
+        std::mutex threadPoolMutex;
 
-        std::vector<std::shared_ptr<CommandBuffer>> commandBuffers;
+        std::vector<FrameContext> frames;
+        uint32_t currentFrame = 0;
+        std::atomic<uint64_t> frameSerial = 0; // Read by worker threads resolving uniforms
+
+        struct RetiredBuffer {
+            uint64_t serial = 0; // Device::getFrameSerial when it was retired
+            VkBuffer buffer = VK_NULL_HANDLE;
+            Allocation allocation = {};
+        };
+
+        std::deque<RetiredBuffer> retiredBuffers = {};
+        std::mutex retiredBuffersMutex;
+
+        void collectRetiredBuffers(bool force);
+
+        std::unique_ptr<MemoryAllocator> allocator = nullptr;
+        std::unique_ptr<StagingRing> stagingRing = nullptr;
+        std::unique_ptr<UniformArena> uniformArena = nullptr;
+        std::unique_ptr<UploadBatcher> uploadBatcher = nullptr;
+        std::unique_ptr<JobScheduler> jobScheduler = nullptr;
+        std::unique_ptr<PipelineCache> pipelineCache = nullptr;
+        std::unique_ptr<PipelineStateCache> pipelineStateCache = nullptr;
+        std::unique_ptr<ShaderCompiler> shaderCompiler = nullptr;
+        std::unique_ptr<DescriptorLayoutCache> descriptorLayoutCache = nullptr;
+        std::unique_ptr<DescriptorAllocator> descriptorAllocator = nullptr;
+        std::vector<std::unique_ptr<DescriptorAllocator>> frameDescriptorAllocators = {};
+        std::unique_ptr<BindlessTable> bindlessTable = nullptr;
+        std::unique_ptr<Profiler> profiler = nullptr;
+        std::unique_ptr<ReadbackPool> readbackPool = nullptr;
+        std::unique_ptr<ResourceRegistries> resources = nullptr;
+
+        // Filled when the queues are retrieved and never changed after, so lookups need no lock
+        std::unordered_map<VkQueue, std::unique_ptr<std::mutex>> submitMutexes = {};
     };
 
     struct Image {
@@ -303,26 +1549,77 @@ namespace zen {
         VkImageView view = VK_NULL_HANDLE;
     };
 
+    // Owns the semaphores used to acquire and present swapchain images. Acquire semaphores are
+    // keyed per frame slot (we don't know the image index before acquiring) and render finished
+    // semaphores per swapchain image, since the presentation engine holds them until the image
+    // comes back. Command buffers borrow from here instead of creating their own.
+    class SynchronizationPool {
+    public:
+        void create(VkDevice device, uint32_t frameCount, uint32_t imageCount);
+        void destroy(VkDevice device);
+
+        [[nodiscard]] VkSemaphore getImageAvailableSemaphore(uint32_t frameIndex) const;
+        [[nodiscard]] VkSemaphore getRenderFinishedSemaphore(uint32_t imageIndex) const;
+
+        // Waits for the frame that last rendered to this image and records the new owner
+        void claimImage(VkDevice device, uint32_t imageIndex, VkFence frameFence);
+
+        [[nodiscard]] bool isValid() const {
+            return !imageAvailableSemaphores.empty() && !renderFinishedSemaphores.empty();
+        }
+
+    private:
+        std::vector<VkSemaphore> imageAvailableSemaphores = {};
+        std::vector<VkSemaphore> renderFinishedSemaphores = {};
+        std::vector<VkFence> imagesInFlight = {};
+    };
+
     class Presentable {
     public:
         VkSwapchainKHR swapchain = VK_NULL_HANDLE;
         std::vector<Image> images = {};
         VkFormat format = VK_FORMAT_UNDEFINED;
         VkExtent2D extent = {0, 0};
+        VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR; // What the surface actually got
+        SynchronizationPool synchronization = {};
 
-        Presentable(Device device, Instance instance);
+        Presentable(Device& device, Instance instance, PresentConfiguration configuration = {});
 
         ~Presentable();
 
+        // Rebuilds the swapchain, its views and the device framebuffers for the new surface size,
+        // pipelines stay as they are. Command buffers call it when acquire or present report the
+        // swapchain out of date, windows whose surface follows the window size pass the new size.
+        // Without one, Instance::queryExtent is asked for it so the swapchain never keeps a stale size.
+        // Returns false while the surface has no area, e.g. when the window is minimized.
+        bool recreate(VkExtent2D windowExtent = {0, 0});
+
+        // Goes up on every recreate, so whatever was built against the old images can tell
+        [[nodiscard]] uint64_t getGeneration() const {
+            return generation;
+        }
+
+        [[nodiscard]] const PresentConfiguration& getConfiguration() const {
+            return configuration;
+        }
+
+        // Queues the image for presentation once the semaphore signals, then paces the CPU if asked to
+        VkResult present(VkQueue queue, VkSemaphore waitSemaphore, uint32_t imageIndex);
+
     private:
-        Device device;
+        Device& device;
         Instance instance;
+        PresentConfiguration configuration;
+        uint64_t generation = 0;
+        uint64_t presentId = 0; // Ids restart with every swapchain
 
-        void create();
+        void create(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
+        void destroyViews();
 
         static VkSurfaceFormatKHR chooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 
-        static VkPresentModeKHR choosePresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
+        static VkPresentModeKHR choosePresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes,
+                                                  PresentMode requested);
 
         static VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, VkExtent2D windowExtent);
     };
@@ -332,12 +1629,24 @@ namespace zen {
 
         [[nodiscard]] bool isSupportedColorAttachment(const Device& device) const;
         [[nodiscard]] bool isSupportedDepthAttachment(const Device& device) const;
+        [[nodiscard]] bool isSupportedTexture(const Device& device) const;
+        // Mips can only be generated on the GPU when the format can be blitted with linear filtering
+        [[nodiscard]] bool isSupportedMipmapBlit(const Device& device) const;
+
+        // Only the 32-bit float formats and the 8 and 16-bit normalized ones are guaranteed, check
+        // the packed 10-bit ones before using them
+        [[nodiscard]] bool isSupportedVertexBuffer(const Device& device) const;
+
+        // Bytes of one tightly packed level, zero for formats whose layout we don't know. Block
+        // compressed levels round up to whole blocks.
+        [[nodiscard]] VkDeviceSize getLevelSize(uint32_t width, uint32_t height) const;
     };
 
     enum class Operation {
         Store,
         Clear,
         DontCare,
+        Load, // Keeps what an earlier pass left in the attachment
     };
 
     VkAttachmentStoreOp toVulkanStoreOp(Operation operation);
@@ -359,24 +1668,391 @@ namespace zen {
         AttachmentLayout layout = AttachmentLayout::ColorAttachment;
         int attachmentIndex = -1;
 
-        void makeRenderAttachment();
-    };
+        void makeRenderAttachment();
+    };
+
+    // The first attachment is the color output. A second one with AttachmentLayout::DepthAttachment
+    // adds a depth buffer, whoever makes the framebuffers owns its image.
+    class RenderPass {
+    public:
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        std::vector<RenderAttachment> attachments = {};
+
+        // Set before create, which lowers it to what the device supports. Pipelines made for the
+        // pass rasterize with the same count.
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+
+        void addAttachment(const RenderAttachment& attachment) {
+            attachments.push_back(attachment);
+        }
+
+        void create(Device& device, const Presentable& presentable);
+
+        // Only builds the pass, the color output ends up in the given layout
+        void createPass(const Device& device, VkImageLayout outputLayout);
+
+        [[nodiscard]] FramebufferAttachments getFramebufferAttachments() const;
+    };
+
+    // A color image rendered without a swapchain, e.g. for thumbnails or batch jobs on machines
+    // without a display. Every pass leaves it in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ready to be
+    // read back or blitted. Pipelines that draw into it are made with getRenderPass.
+    class RenderTarget {
+    public:
+        RenderTarget(Device& device, VkExtent2D extent, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM,
+                     const FramebufferAttachments& attachments = {});
+
+        RenderTarget(const RenderTarget&) = delete;
+        RenderTarget& operator=(const RenderTarget&) = delete;
+
+        ~RenderTarget();
+
+        VkClearColorValue clearColor = {{0.0f, 0.0f, 0.0f, 1.0f}};
+
+        // The pass stays owned by the target
+        [[nodiscard]] const RenderPass& getRenderPass() const {
+            return pass;
+        }
+
+        [[nodiscard]] VkFramebuffer getFramebuffer() const {
+            return framebuffer;
+        }
+
+        [[nodiscard]] const Image& getImage() const {
+            return image;
+        }
+
+        [[nodiscard]] VkExtent2D getExtent() const {
+            return extent;
+        }
+
+        [[nodiscard]] VkFormat getFormat() const {
+            return format;
+        }
+
+    private:
+        Device& device;
+        VkExtent2D extent = {0, 0};
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        Image image = {};
+        Allocation allocation = {};
+        AttachmentImage depthImage = {};
+        AttachmentImage multisampleImage = {};
+        RenderPass pass = {};
+        VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    };
+
+    // Pixels copied from a RenderTarget into host memory. The copy runs on the GPU after whatever
+    // was submitted before it, so the CPU only blocks once it needs the data. Dropping the last
+    // reference hands the buffer back to the pool, which must happen before the device goes away.
+    class Readback {
+    public:
+        Readback(const Readback&) = delete;
+        Readback& operator=(const Readback&) = delete;
+
+        ~Readback();
+
+        [[nodiscard]] bool isReady() const;
+        void wait() const;
+
+        // Waits for the copy, rows are tightly packed in the target's format
+        [[nodiscard]] const void* getData() const;
+
+        [[nodiscard]] VkDeviceSize getSize() const {
+            return size;
+        }
+
+        [[nodiscard]] VkExtent2D getExtent() const {
+            return extent;
+        }
+
+        [[nodiscard]] VkFormat getFormat() const {
+            return format;
+        }
+
+    private:
+        friend class ReadbackPool;
+
+        Readback(ReadbackPool& pool, size_t slot, VkDeviceSize size, VkExtent2D extent, VkFormat format);
+
+        ReadbackPool& pool;
+        size_t slot = 0;
+        VkDeviceSize size = 0;
+        VkExtent2D extent = {0, 0};
+        VkFormat format = VK_FORMAT_UNDEFINED;
+    };
+
+    // Host visible buffers, command buffers and fences reused across readbacks, so reading every
+    // frame back doesn't allocate. A slot is only handed out again once its Readback is gone.
+    class ReadbackPool {
+    public:
+        explicit ReadbackPool(Device& device);
+
+        ReadbackPool(const ReadbackPool&) = delete;
+        ReadbackPool& operator=(const ReadbackPool&) = delete;
+
+        ~ReadbackPool();
+
+        // Submits a copy of what the target holds once earlier submissions finish, so the frame
+        // that renders it must be submitted first. Submits to the graphics queue, render thread only.
+        [[nodiscard]] std::shared_ptr<Readback> read(const RenderTarget& target);
+
+    private:
+        friend class Readback;
+
+        struct Slot {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            Allocation allocation = {};
+            VkDeviceSize capacity = 0;
+            VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+            VkFence fence = VK_NULL_HANDLE;
+            bool busy = false;
+        };
+
+        Device& device;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        std::deque<Slot> slots = {}; // Readbacks keep indices, a deque never moves what it holds
+        mutable std::mutex mutex;
+
+        [[nodiscard]] size_t acquire(VkDeviceSize size);
+        void release(size_t slot);
+        [[nodiscard]] const Slot& getSlot(size_t slot) const;
+    };
+
+    // Indices into a RenderGraph, only meaningful for the graph that returned them
+    using GraphResource = uint32_t;
+    using GraphPass = uint32_t;
+
+    struct GraphAttachmentInfo {
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent2D extent = {0, 0}; // Zero follows the backbuffer, or the instance when there is none
+        bool depth = false;
+    };
+
+    // What a pass sees while it records
+    struct GraphContext {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkRenderPass renderPass = VK_NULL_HANDLE; // Null for passes without attachments
+        uint32_t subpass = 0;
+        VkExtent2D extent = {0, 0};
+    };
+
+    class RenderGraph;
+
+    // Handed to a pass' setup function to declare everything the pass touches. The graph derives
+    // barriers, layouts, load and store operations and lifetimes from these declarations alone.
+    class GraphPassBuilder {
+    public:
+        void writeColor(GraphResource resource, Operation load = Operation::Clear,
+                        VkClearColorValue clear = {{0.0f, 0.0f, 0.0f, 1.0f}});
+        void writeDepth(GraphResource resource, Operation load = Operation::Clear, float clearDepth = 1.0f);
+
+        // Sampled by this pass' shaders, so the writer can never share a render pass with it
+        void readTexture(GraphResource resource);
+
+        // Only read at the pixel being shaded, which lets the graph merge this pass into a subpass
+        // of the writer and keep the data on chip on tile based GPUs
+        void readAttachment(GraphResource resource);
+
+        void readBuffer(GraphResource resource, BufferUsage usage);
+        void writeBuffer(GraphResource resource, BufferUsage usage);
+
+        // Keeps the pass even when nothing reads what it writes
+        void keep();
+
+    private:
+        friend class RenderGraph;
+
+        GraphPassBuilder(RenderGraph& graph, GraphPass pass) : graph(graph), pass(pass) {
+        }
+
+        RenderGraph& graph;
+        GraphPass pass;
+    };
+
+    // Declares a frame as a list of passes and turns it into render passes, subpasses and
+    // barriers. Passes run in the order they were added, compile culls the ones nobody reads
+    // from, merges neighbours into subpasses and places transient attachments whose lifetimes
+    // don't overlap in the same memory.
+    class RenderGraph {
+    public:
+        explicit RenderGraph(Device& device) : device(device) {
+        }
+
+        RenderGraph(const RenderGraph&) = delete;
+        RenderGraph& operator=(const RenderGraph&) = delete;
+
+        ~RenderGraph();
+
+        [[nodiscard]] GraphResource createAttachment(const std::string& name, const GraphAttachmentInfo& info);
+
+        // The swapchain image of the frame, it is left in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+        [[nodiscard]] GraphResource importBackbuffer(Presentable& presentable);
+
+        // The image is expected in the given layout and is put back into it at the end of the graph
+        [[nodiscard]] GraphResource importImage(const std::string& name, const Image& image,
+                                                const GraphAttachmentInfo& info, VkImageLayout layout);
+
+        [[nodiscard]] GraphResource importBuffer(const std::string& name, const Buffer& buffer);
+
+        GraphPass addPass(const std::string& name, const std::function<void(GraphPassBuilder&)>& setup,
+                          std::function<void(GraphContext&)> execute);
+
+        // Must run again after adding passes or recreating the presentable
+        void compile();
+
+        // Records every pass that survived compile, the image index picks the backbuffer
+        void execute(VkCommandBuffer commandBuffer, uint32_t imageIndex) const;
+
+        // For pipelines drawn from the pass, together with getSubpass and getColorAttachmentCount
+        [[nodiscard]] RenderPass getRenderPass(GraphPass pass) const;
+        [[nodiscard]] uint32_t getSubpass(GraphPass pass) const;
+        [[nodiscard]] uint32_t getColorAttachmentCount(GraphPass pass) const;
+
+        [[nodiscard]] bool isCulled(GraphPass pass) const;
+
+        // True when the imported presentable was recreated after the last compile
+        [[nodiscard]] bool isOutdated() const {
+            return presentable != nullptr && presentable->getGeneration() != compiledGeneration;
+        }
+
+        // Transient attachments only exist after compile
+        [[nodiscard]] Image getImage(GraphResource resource) const;
+
+        // Bytes of device memory backing transient attachments, with and without aliasing
+        [[nodiscard]] VkDeviceSize getTransientMemorySize() const {
+            return transientMemorySize;
+        }
+
+        [[nodiscard]] VkDeviceSize getUnaliasedMemorySize() const {
+            return unaliasedMemorySize;
+        }
+
+        // Neighbouring passes that only read each other's attachments per pixel become subpasses
+        bool mergeSubpasses = true;
+
+        void destroy();
+
+    private:
+        friend class GraphPassBuilder;
+
+        enum class Access {
+            ColorWrite,
+            DepthWrite,
+            Sampled,
+            InputAttachment,
+            BufferRead,
+            BufferWrite,
+        };
+
+        enum class ResourceType {
+            Transient,
+            Backbuffer,
+            ImportedImage,
+            ImportedBuffer,
+        };
+
+        struct ResourceUse {
+            GraphResource resource = 0;
+            Access access = Access::Sampled;
+            BufferUsage usage = BufferUsage::Vertex;
+            Operation load = Operation::Load;
+            VkClearValue clear = {};
+        };
+
+        struct PassNode {
+            std::string name;
+            std::vector<ResourceUse> uses = {};
+            std::function<void(GraphContext&)> execute;
+            bool keep = false;
+            bool culled = false;
+            uint32_t group = 0;
+            uint32_t subpass = 0;
+        };
+
+        struct ResourceNode {
+            std::string name;
+            ResourceType type = ResourceType::Transient;
+            GraphAttachmentInfo info = {};
+            Image image = {};
+            VkImageLayout importedLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkBuffer buffer = VK_NULL_HANDLE;
+
+            // Filled by compile
+            VkImageUsageFlags imageUsage = 0;
+            uint32_t firstGroup = UINT32_MAX;
+            uint32_t lastGroup = 0;
+        };
 
-    class RenderPass {
-    public:
-        VkRenderPass renderPass = VK_NULL_HANDLE;
-        std::vector<RenderAttachment> attachments = {};
+        struct ImageTransition {
+            GraphResource resource = 0;
+            VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkImageLayout newLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkAccessFlags srcAccess = 0;
+            VkAccessFlags dstAccess = 0;
+        };
 
-        void addAttachment(const RenderAttachment& attachment) {
-            attachments.push_back(attachment);
-        }
+        struct BufferTransition {
+            GraphResource resource = 0;
+            VkAccessFlags srcAccess = 0;
+            VkAccessFlags dstAccess = 0;
+        };
 
-        void create(Device& device, const Presentable& presentable);
+        struct Barrier {
+            VkPipelineStageFlags srcStages = 0;
+            VkPipelineStageFlags dstStages = 0;
+            std::vector<ImageTransition> images = {};
+            std::vector<BufferTransition> buffers = {};
+
+            [[nodiscard]] bool isEmpty() const {
+                return images.empty() && buffers.empty();
+            }
+        };
+
+        // One vkCmdBeginRenderPass, or a single pass recorded outside of any render pass
+        struct PassGroup {
+            std::vector<GraphPass> passes = {};
+            std::vector<GraphResource> attachments = {};
+            std::vector<VkClearValue> clearValues = {};
+            VkRenderPass renderPass = VK_NULL_HANDLE;
+            std::vector<VkFramebuffer> framebuffers = {}; // One per swapchain image when it draws to the backbuffer
+            VkExtent2D extent = {0, 0};
+            Barrier barrier = {};
+        };
+
+        Device& device;
+        Presentable* presentable = nullptr;
+        uint64_t compiledGeneration = 0;
+        std::vector<ResourceNode> resources = {};
+        std::vector<PassNode> passes = {};
+
+        // Compiled state
+        std::vector<PassGroup> groups = {};
+        Barrier finalBarrier = {};
+        std::vector<Allocation> transientMemory = {};
+        VkDeviceSize transientMemorySize = 0;
+        VkDeviceSize unaliasedMemorySize = 0;
+
+        static bool isWrite(Access access);
+        static bool isAttachment(Access access);
+        static VkImageLayout getLayout(Access access, bool depth);
+        static void getAccess(const ResourceUse& use, VkAccessFlags& access, VkPipelineStageFlags& stages);
+
+        [[nodiscard]] VkExtent2D resolveExtent(const ResourceNode& resource) const;
+        [[nodiscard]] bool canMerge(const PassGroup& group, const PassNode& pass) const;
+        void cullPasses();
+        void buildGroups();
+        void createTransientImages();
+        void buildRenderPass(PassGroup& group);
+        void buildBarriers();
+        void recordBarrier(VkCommandBuffer commandBuffer, const Barrier& barrier, uint32_t imageIndex) const;
+        [[nodiscard]] VkImage resolveImage(GraphResource resource, uint32_t imageIndex) const;
     };
 
     enum class ShaderType {
         Vertex,
         Fragment,
+        Compute,
     };
 
     EShLanguage toGlslShaderType(ShaderType type);
@@ -432,6 +2108,7 @@ namespace zen {
     public:
         VkShaderModule shaderModule = VK_NULL_HANDLE;
         ShaderType type = ShaderType::Vertex;
+        uint64_t codeHash = 0; // Of the SPIR-V, pipelines are cached by it since handles get reused
         std::string entryPoint;
         ShaderSpecializationInformation specializationInfo;
         VkPipelineShaderStageCreateInfo shaderStageInfo = {};
@@ -442,6 +2119,54 @@ namespace zen {
         void compile(std::string entryPoint, ShaderSpecializationInformation info = {});
     };
 
+    // Everything that decides what SPIR-V comes out of a compile
+    struct ShaderSource {
+        std::string source;
+        ShaderType type = ShaderType::Vertex;
+        std::vector<std::pair<std::string, std::string>> defines = {};
+    };
+
+    // Turns GLSL into SPIR-V. glslang is initialized once per process, batches compile on a
+    // thread pool, and results are cached in memory and on disk under a hash of everything in
+    // ShaderSource plus the target environment, so unchanged shaders never reach glslang.
+    class ShaderCompiler {
+    public:
+        // An empty directory keeps the cache in memory only, zero threads picks one per core
+        explicit ShaderCompiler(std::string cacheDirectory = "", uint32_t threadCount = 0);
+
+        ShaderCompiler(const ShaderCompiler&) = delete;
+        ShaderCompiler& operator=(const ShaderCompiler&) = delete;
+
+        ~ShaderCompiler();
+
+        [[nodiscard]] std::vector<uint32_t> compile(const ShaderSource& source);
+
+        [[nodiscard]] std::future<std::vector<uint32_t>> compileAsync(ShaderSource source);
+
+        [[nodiscard]] std::vector<std::vector<uint32_t>> compileBatch(const std::vector<ShaderSource>& sources);
+
+        [[nodiscard]] static uint64_t hash(const ShaderSource& source);
+
+    private:
+        std::string cacheDirectory;
+
+        std::vector<std::thread> workers = {};
+        std::deque<std::function<void()>> jobs = {};
+        std::mutex jobMutex;
+        std::condition_variable jobAvailable;
+        bool stopping = false;
+
+        std::unordered_map<uint64_t, std::vector<uint32_t>> compiled = {};
+        std::mutex cacheMutex;
+
+        [[nodiscard]] std::optional<std::vector<uint32_t>> findCached(uint64_t key);
+        void storeCached(uint64_t key, const std::vector<uint32_t>& spirv);
+
+        [[nodiscard]] static std::vector<uint32_t> compileGlsl(const ShaderSource& source);
+
+        void work();
+    };
+
     class ShaderProgram {
     public:
         std::vector<std::reference_wrapper<ShaderModule>> shaderModules = {};
@@ -468,25 +2193,53 @@ namespace zen {
         Int,
         Uint,
         Bool,
-        Mat3,
-        Mat4,
+        Mat3, // Spans three locations, one per column, e.g. for per-instance transforms
+        Mat4, // Spans four locations
+        Half2, // 16-bit floats, read as vec2 in the shader. Enough for texture coordinates.
+        Half4,
+        Byte4Norm, // Signed, read as vec4 in [-1, 1], e.g. tangents
+        UByte4Norm, // Unsigned, read as vec4 in [0, 1], e.g. vertex colors
+        Short2Norm,
+        Short4Norm,
+        UShort2Norm,
+        UShort4Norm,
+        Packed1010102Norm, // A2B10G10R10, signed. Normals and tangents with their sign in four bytes.
+        UPacked1010102Norm,
     };
 
     VkFormat toVulkanFormat(InputFormat format);
 
+    // Bytes one attribute of the format takes in a vertex
+    [[nodiscard]] size_t getInputFormatSize(InputFormat format);
+
+    // Number of consecutive locations the format takes, only matrices take more than one
+    [[nodiscard]] uint32_t getInputFormatLocations(InputFormat format);
+
+    // Rounds to the nearest 16-bit float, values beyond its range become infinity
+    [[nodiscard]] uint16_t toHalf(float value);
+
+    // How often a vertex binding advances, once per vertex or once per instance
+    enum class InputRate {
+        Vertex,
+        Instance,
+    };
+
     struct InputDescriptorItemInterface {
         virtual ~InputDescriptorItemInterface() = default;
         [[nodiscard]] virtual int getLocation() const = 0;
         [[nodiscard]] virtual InputFormat getFormat() const = 0;
         [[nodiscard]] virtual size_t getSize() const = 0;
+        [[nodiscard]] virtual uint32_t getBinding() const = 0;
     };
 
     template <typename T>
     struct InputDescriptorItem final : public InputDescriptorItemInterface {
         int location = 0;
         InputFormat format = InputFormat::Vector3;
+        uint32_t binding = 0;
 
-        InputDescriptorItem(const int location, const InputFormat format) : location(location), format(format) {
+        InputDescriptorItem(const int location, const InputFormat format, const uint32_t binding = 0)
+            : location(location), format(format), binding(binding) {
         }
 
         InputDescriptorItem() = default;
@@ -494,13 +2247,33 @@ namespace zen {
         [[nodiscard]] int getLocation() const override { return location; }
         [[nodiscard]] InputFormat getFormat() const override { return format; }
         [[nodiscard]] size_t getSize() const override { return sizeof(T); }
+        [[nodiscard]] uint32_t getBinding() const override { return binding; }
+    };
+
+    // An attribute whose size comes from its format, for packed data that has no C++ type
+    struct PackedInputDescriptorItem final : public InputDescriptorItemInterface {
+        int location = 0;
+        InputFormat format = InputFormat::Half4;
+        uint32_t binding = 0;
+
+        PackedInputDescriptorItem(const int location, const InputFormat format, const uint32_t binding = 0)
+            : location(location), format(format), binding(binding) {
+        }
+
+        PackedInputDescriptorItem() = default;
+
+        [[nodiscard]] int getLocation() const override { return location; }
+        [[nodiscard]] InputFormat getFormat() const override { return format; }
+        [[nodiscard]] size_t getSize() const override { return getInputFormatSize(format); }
+        [[nodiscard]] uint32_t getBinding() const override { return binding; }
     };
 
 
     class InputDescriptor {
     public:
         std::vector<VkVertexInputAttributeDescription> attributes;
-        VkVertexInputBindingDescription binding = {};
+        VkVertexInputBindingDescription binding = {}; // The first binding, kept for single buffer layouts
+        std::vector<VkVertexInputBindingDescription> bindings;
         std::vector<std::shared_ptr<InputDescriptorItemInterface>> items;
 
         InputDescriptor() = default;
@@ -512,6 +2285,15 @@ namespace zen {
             items.push_back(std::make_shared<InputDescriptorItem<T>>(item));
         }
 
+        inline void addItem(const PackedInputDescriptorItem& item) {
+            items.push_back(std::make_shared<PackedInputDescriptorItem>(item));
+        }
+
+        // Bindings advance per vertex unless told otherwise
+        inline void setInputRate(uint32_t bindingIndex, InputRate rate) {
+            rates[bindingIndex] = rate;
+        }
+
         [[nodiscard]] inline size_t getSize() const {
             size_t size = 0;
             for (const auto& item : items) {
@@ -519,10 +2301,277 @@ namespace zen {
             }
             return size;
         }
+
+    private:
+        std::unordered_map<uint32_t, InputRate> rates = {};
+    };
+
+    // The format an attribute is repacked into, attributes without one are copied as they are
+    struct VertexCompression {
+        int location = 0;
+        InputFormat format = InputFormat::Half4;
     };
 
+    struct CompressedVertices {
+        std::vector<uint8_t> data = {};
+        InputDescriptor descriptor = {}; // The source layout with the compressed binding's items swapped
+        uint32_t stride = 0;
+    };
+
+    // Repacks an interleaved binding of float attributes into smaller formats, e.g. positions to
+    // Half4, normals to Packed1010102Norm and texture coordinates to Half2, which usually halves
+    // the buffer. Missing components are filled like the pipeline would, with zero and w as one.
+    [[nodiscard]] CompressedVertices compressVertices(const void* vertices, size_t vertexCount,
+                                                      const InputDescriptor& layout,
+                                                      const std::vector<VertexCompression>& compressions,
+                                                      uint32_t binding = 0);
+
     class UniformBlock;
 
+    // Hands out descriptor set layouts deduplicated by their bindings. Sets that declare the same
+    // resources end up with the very same layout, which keeps them interchangeable in pipelines.
+    class DescriptorLayoutCache {
+    public:
+        explicit DescriptorLayoutCache(const Device& device) : device(device) {
+        }
+
+        DescriptorLayoutCache(const DescriptorLayoutCache&) = delete;
+        DescriptorLayoutCache& operator=(const DescriptorLayoutCache&) = delete;
+
+        ~DescriptorLayoutCache();
+
+        [[nodiscard]] VkDescriptorSetLayout getLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+        [[nodiscard]] size_t getLayoutCount();
+
+    private:
+        const Device& device;
+        std::mutex mutex;
+        std::map<std::vector<uint32_t>, VkDescriptorSetLayout> layouts = {}; // Keyed by the flattened bindings
+    };
+
+    // Allocates descriptor sets from a list of pools and opens a new, larger pool whenever the
+    // current one runs out. Sets are never freed one by one, resetPools recycles all of them.
+    class DescriptorAllocator {
+    public:
+        // Freeable pools let single sets go back with free, for sets that live longer than a frame
+        explicit DescriptorAllocator(const Device& device, bool freeable = false)
+            : device(device), freeable(freeable) {
+        }
+
+        DescriptorAllocator(const DescriptorAllocator&) = delete;
+        DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+
+        ~DescriptorAllocator();
+
+        // Sets the first pool holds, every new pool doubles it up to maxSetsPerPool
+        uint32_t setsPerPool = 64;
+        uint32_t maxSetsPerPool = 4096;
+
+        [[nodiscard]] VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+        // Only for freeable allocators, the GPU must be done with the set. Pools that end up empty
+        // are reset and handed out again.
+        void free(VkDescriptorSet set);
+
+        // Every set handed out so far becomes invalid, only call it once the GPU is done with them
+        void resetPools();
+
+        [[nodiscard]] size_t getPoolCount();
+
+    private:
+        const Device& device;
+        bool freeable = false;
+        std::mutex mutex;
+        VkDescriptorPool currentPool = VK_NULL_HANDLE;
+        std::vector<VkDescriptorPool> usedPools = {};
+        std::vector<VkDescriptorPool> freePools = {};
+        uint32_t nextPoolSize = 0;
+        // Only tracked when freeable
+        std::unordered_map<VkDescriptorSet, VkDescriptorPool> owners = {};
+        std::unordered_map<VkDescriptorPool, uint32_t> liveSets = {};
+
+        VkDescriptorPool grabPool();
+    };
+
+    // Resources bound together as one descriptor set: per frame, per material or per draw.
+    // Bindings are numbered in groups, uniform blocks first, then textures, storage buffers and
+    // storage images, each group in the order it was attached. Sets with the same resource kinds
+    // share a layout, so a pipeline made against one of them can bind any other at draw time.
+    class ResourceSet {
+    public:
+        explicit ResourceSet(const Device& device,
+                             VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+            : device(device), stages(stages) {
+        }
+
+        void attachUniformBlock(const UniformBlock& uniformBlock);
+        void attachTexture(const Texture& texture);
+        void attachStorageBuffer(const Buffer& buffer);
+        // The image must be in VK_IMAGE_LAYOUT_GENERAL when the set is used
+        void attachStorageImage(const Image& image);
+
+        // Same, for resources registered in Device::getResources
+        void attachUniformBlock(UniformBlockHandle uniformBlock);
+        void attachTexture(TextureHandle texture);
+        void attachStorageBuffer(BufferHandle buffer);
+
+        // Swaps an attached texture for another one, the layout stays the same
+        void setTexture(uint32_t index, const Texture& texture);
+        void setTexture(uint32_t index, TextureHandle texture);
+
+        // Allocates and writes a set that lives until release or the device goes. A built set is immutable.
+        void build();
+
+        // Gives the set made by build back to the device, once no frame in flight uses it. The set
+        // can be changed and built again afterwards.
+        void release();
+
+        // Writes a fresh set that is only valid while the given frame slot is recorded, for
+        // resources that change from frame to frame or draw to draw
+        void buildForFrame(uint32_t frameIndex);
+
+        [[nodiscard]] VkDescriptorSetLayout getLayout();
+
+        [[nodiscard]] bool isEmpty() const;
+
+        // Dynamic offsets of every attached uniform block, in binding order
+        void resolveUniformOffsets(std::vector<uint32_t>& offsets) const;
+
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    private:
+        const Device& device;
+        VkShaderStageFlags stages;
+        // Blocks share their data between copies, textures only need what is written to the set
+        std::vector<UniformBlock> uniformBlocks;
+        std::vector<VkDescriptorImageInfo> textures;
+        std::vector<VkDescriptorBufferInfo> storageBuffers;
+        std::vector<VkDescriptorImageInfo> storageImages;
+        VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+        bool built = false;
+
+        void checkMutable() const;
+        void write(VkDescriptorSet set) const;
+    };
+
+    // One large, partially bound sampler2D[] at binding 0 of its own set. Textures get a slot
+    // when added and keep it until removed, shaders index the table with that slot through push
+    // constants or per-instance data, so draws with different textures no longer need own binds.
+    // Only exists when Device::supportsDescriptorIndexing is set.
+    class BindlessTable {
+    public:
+        BindlessTable(const Device& device, uint32_t capacity);
+
+        BindlessTable(const BindlessTable&) = delete;
+        BindlessTable& operator=(const BindlessTable&) = delete;
+
+        ~BindlessTable();
+
+        // Writes the texture into a free slot and returns the index shaders use for it
+        [[nodiscard]] uint32_t add(const Texture& texture);
+
+        // Points a slot at another texture. The slot must not be sampled by a frame in flight,
+        // streaming in a new version is safer through add and remove.
+        void update(uint32_t slot, const Texture& texture);
+
+        // The slot is only handed out again once every frame that could still sample it is done
+        void remove(uint32_t slot);
+
+        [[nodiscard]] VkDescriptorSetLayout getLayout() const {
+            return layout;
+        }
+
+        [[nodiscard]] VkDescriptorSet getSet() const {
+            return set;
+        }
+
+        [[nodiscard]] uint32_t getCapacity() const {
+            return capacity;
+        }
+
+    private:
+        const Device& device;
+        uint32_t capacity = 0;
+        VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        VkDescriptorSet set = VK_NULL_HANDLE;
+
+        std::mutex mutex;
+        uint32_t nextSlot = 0;
+        std::vector<uint32_t> freeSlots = {};
+        std::deque<std::pair<uint64_t, uint32_t>> retiredSlots = {}; // Frame serial of the removal, slot
+
+        void write(uint32_t slot, const Texture& texture);
+    };
+
+    enum class BlendMode {
+        Opaque, // No blending, the fragment replaces what is there
+        Alpha, // Straight alpha: src * a + dst * (1 - a)
+        Premultiplied, // The color already carries its alpha: src + dst * (1 - a)
+        Additive, // src * a + dst, e.g. for particles and light accumulation
+    };
+
+    // The fixed function state of a graphics pipeline. The defaults are what every pipeline used
+    // to be hardcoded to.
+    struct PipelineState {
+        VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        bool primitiveRestart = false;
+
+        VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL; // Anything but fill needs fillModeNonSolid
+        VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+        VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        float lineWidth = 1.0f; // Anything but one needs wideLines
+        bool depthBias = false; // E.g. for shadow maps, to keep surfaces from shadowing themselves
+        float depthBiasConstant = 0.0f;
+        float depthBiasSlope = 0.0f;
+
+        bool depthTest = true;
+        bool depthWrite = true;
+        VkCompareOp depthCompare = VK_COMPARE_OP_LESS;
+
+        BlendMode blend = BlendMode::Opaque;
+        VkColorComponentFlags colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+            VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        bool alphaToCoverage = false; // Only does anything with a multisampled render pass
+
+        bool operator==(const PipelineState&) const = default;
+    };
+
+    struct PipelineShaderStage {
+        VkShaderStageFlagBits stage = VK_SHADER_STAGE_VERTEX_BIT;
+        VkShaderModule module = VK_NULL_HANDLE;
+        uint64_t codeHash = 0; // Identifies the module in the cache, zero falls back to the handle
+        std::string entryPoint = "main";
+        std::vector<VkSpecializationMapEntry> specializationEntries = {};
+        std::vector<uint8_t> specializationData = {};
+    };
+
+    // Everything a graphics pipeline is built from. It owns copies of whatever the create info
+    // points at, so it can be built on another thread after the RenderPipeline it came from is gone.
+    // The shader modules and handles it names must outlive the build. Descriptions are compared by
+    // the hashes standing in for the handles, so a pipeline stays cached after its render pass or
+    // modules are destroyed and is never confused with one made from a reused handle value.
+    struct PipelineDescription {
+        PipelineState state = {};
+        std::vector<PipelineShaderStage> stages = {};
+        std::vector<VkVertexInputBindingDescription> bindings = {};
+        std::vector<VkVertexInputAttributeDescription> attributes = {};
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+        uint32_t colorAttachmentCount = 1;
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        uint32_t subpass = 0;
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+
+        // What makes passes and layouts compatible, zero falls back to comparing the handles
+        uint64_t renderPassHash = 0;
+        uint64_t layoutHash = 0;
+
+        [[nodiscard]] uint64_t hash() const;
+
+        bool operator==(const PipelineDescription& other) const;
+    };
+
     class RenderPipeline {
     public:
         VkPipeline pipeline = VK_NULL_HANDLE;
@@ -530,30 +2579,212 @@ namespace zen {
         VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
         InputDescriptor inputDescriptor = {};
         RenderPass renderPass = RenderPass();
+        uint32_t subpass = 0;
+        uint32_t colorAttachmentCount = 1; // One blend state is made for each
+        PipelineState state = {}; // What makePipeline builds with
         const Device& device;
 
-        explicit RenderPipeline(const Device& device) : device(device) {
+        explicit RenderPipeline(const Device& device) : device(device), resources(device) {
         }
 
         void makePipeline();
+
+        // Resources attached here form set 0, which is built once by makePipeline
         void attachUniformBlock(UniformBlock& uniformBlock);
         void attachTexture(Texture& texture);
+        void attachUniformBlock(UniformBlockHandle uniformBlock);
+        void attachTexture(TextureHandle texture);
+
+        // Declares that the given set index takes sets shaped like this one, which are then bound
+        // with CommandBuffer::bindResourceSet. Must be called before makePipeline.
+        void useResourceSet(uint32_t set, ResourceSet& resourceSet);
+
+        // Declares the device's bindless texture table at the given set index
+        void useBindlessTextures(uint32_t set);
+
+        // Declares a push constant range big enough for T and returns its offset, which is what
+        // CommandBuffer::pushConstants takes. Ranges are packed in declaration order and must be
+        // declared before makePipeline.
+        template <typename T>
+        uint32_t addPushConstant(VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT) {
+            static_assert(std::is_trivially_copyable_v<T>, "Push constants are copied byte for byte");
+            return addPushConstantRange(static_cast<uint32_t>(sizeof(T)), stages);
+        }
+
+        uint32_t addPushConstantRange(uint32_t size, VkShaderStageFlags stages);
+
+        // Stages every range overlapping an update must be pushed with, the API requires them all
+        [[nodiscard]] VkShaderStageFlags getPushConstantStages(uint32_t offset, uint32_t size) const;
+
+        // Dynamic offsets of every attached uniform block, in binding order
+        void resolveUniformOffsets(std::vector<uint32_t>& offsets) const;
+
+        // The same shaders, layout and resources with other fixed function state, e.g. a blended or
+        // double sided permutation of a material. Variants come from Device::getPipelineStateCache,
+        // which owns them, so each combination is only built once. Needs makePipeline first.
+        [[nodiscard]] RenderPipeline makeVariant(const PipelineState& variantState) const;
+
+        // Never blocks: queues the variant on the cache's workers and returns nothing until it is
+        // built, so the frame can draw with another pipeline meanwhile instead of hitching
+        [[nodiscard]] std::optional<RenderPipeline> requestVariant(const PipelineState& variantState) const;
+
+        [[nodiscard]] PipelineDescription describe(const PipelineState& variantState) const;
+
+        // Destroys what makePipeline made and gives the set back, once no frame in flight uses them.
+        // Variants only share these, the cache owns their pipelines, so only call it on the original.
+        void destroy();
+
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    private:
+        ResourceSet resources;
+        std::map<uint32_t, VkDescriptorSetLayout> setLayouts = {};
+        std::vector<VkPushConstantRange> pushConstantRanges = {};
+    };
+
+    // Graphics pipelines keyed by a hash of their description, so each combination of shaders and
+    // state is built once per run, and once ever with the device's VkPipelineCache behind it. Builds
+    // can be queued ahead of use on worker threads, e.g. every material permutation while a level
+    // loads, so new permutations don't stall the frame that first draws them.
+    class PipelineStateCache {
+    public:
+        // Zero threads picks one per core, leaving one for the render thread
+        explicit PipelineStateCache(Device& device, uint32_t threadCount = 0);
+
+        PipelineStateCache(const PipelineStateCache&) = delete;
+        PipelineStateCache& operator=(const PipelineStateCache&) = delete;
+
+        // Queued builds that haven't started are dropped, every pipeline is destroyed
+        ~PipelineStateCache();
+
+        // Blocks until the pipeline is built. A queued build runs on the calling thread right away
+        // and one already running is waited for, nothing is ever built twice.
+        [[nodiscard]] VkPipeline get(const PipelineDescription& description);
+
+        // Returns VK_NULL_HANDLE and queues the build unless the pipeline is ready
+        [[nodiscard]] VkPipeline request(const PipelineDescription& description);
+
+        void prewarm(const std::vector<PipelineDescription>& descriptions);
+
+        // Blocks until nothing is queued or building
+        void wait();
+
+        // Forgets the builds that failed, so the next get or request tries them again, e.g. once the
+        // pipeline cache or a driver issue is sorted
+        void clearFailed();
+
+        [[nodiscard]] size_t getPipelineCount() const;
+
+        // Builds without caching, the caller owns the pipeline
+        [[nodiscard]] static VkPipeline build(const Device& device, const PipelineDescription& description);
+
+    private:
+        enum class BuildState {
+            Queued,
+            Building,
+            Ready,
+            Failed,
+        };
+
+        struct Entry {
+            PipelineDescription description;
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            BuildState state = BuildState::Queued;
+            std::string error;
+        };
+
+        Device& device;
+        // Descriptions whose hashes collide share a bucket. Shared, because get still reads its
+        // entry after the lock was released for the wait and clearFailed may have dropped it.
+        std::unordered_map<uint64_t, std::vector<std::shared_ptr<Entry>>> entries = {};
+        std::deque<Entry*> queue = {};
+        size_t pipelineCount = 0;
+        mutable std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::condition_variable buildFinished;
+        std::vector<std::thread> workers = {};
+        bool stopping = false;
+
+        // Finds or adds the entry, queuing new ones when asked to. Call with the lock held.
+        std::shared_ptr<Entry> findLocked(const PipelineDescription& description, bool enqueue);
+        void buildEntry(Entry& entry, std::unique_lock<std::mutex>& lock);
+        void work();
+    };
 
+    // A single compute shader with its resources. Bindings are numbered in groups like in
+    // RenderPipeline: uniform blocks first, then storage buffers, then storage images, each
+    // group in the order it was attached.
+    class ComputePipeline {
+    public:
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
         VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        const Device& device;
+
+        explicit ComputePipeline(const Device& device) : device(device),
+                                                         resources(device, VK_SHADER_STAGE_COMPUTE_BIT) {
+        }
+
+        void attachShader(ShaderModule& shader);
+        void attachUniformBlock(UniformBlock& uniformBlock);
+        void attachStorageBuffer(const Buffer& buffer);
+        // The image must be in VK_IMAGE_LAYOUT_GENERAL when the pipeline is dispatched
+        void attachStorageImage(const Image& image);
+
+        void makePipeline();
+        void destroy();
+
+        void resolveUniformOffsets(std::vector<uint32_t>& offsets) const;
 
     private:
-        std::vector<std::shared_ptr<UniformBlock>> uniformBlocks;
-        std::vector<std::shared_ptr<Texture>> textures;
-        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
-        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        std::optional<std::reference_wrapper<ShaderModule>> shader = std::nullopt;
+        ResourceSet resources;
+    };
+
+    struct UniformSlice {
+        uint32_t offset = 0; // Dynamic offset into the arena buffer
+        void* mapped = nullptr;
+    };
 
-        void recalculateDescriptors();
+    // A persistently mapped uniform buffer split in one region per frame in flight. Slices are
+    // handed out linearly and the region is recycled once its frame slot's fence is waited on,
+    // so writing a slice never races with the GPU reading an older one.
+    class UniformArena {
+    public:
+        UniformArena(Device& device, uint32_t frameCount, VkDeviceSize frameCapacity);
+
+        UniformArena(const UniformArena&) = delete;
+        UniformArena& operator=(const UniformArena&) = delete;
+
+        ~UniformArena();
+
+        void beginFrame(uint32_t frameIndex);
+
+        [[nodiscard]] UniformSlice allocate(VkDeviceSize size);
+
+        [[nodiscard]] VkBuffer getBuffer() const {
+            return buffer;
+        }
+
+        [[nodiscard]] uint32_t getFrameCount() const {
+            return frameCount;
+        }
+
+    private:
+        Device& device;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        Allocation allocation = {};
+        uint32_t frameCount = 0;
+        VkDeviceSize frameCapacity = 0;
+        VkDeviceSize alignment = 1;
+        uint32_t currentFrame = 0;
+        VkDeviceSize frameHead = 0;
+        std::mutex mutex;
     };
 
     class UniformBlock {
     public:
         VkBuffer buffer = VK_NULL_HANDLE;
-        VkDeviceMemory memory = VK_NULL_HANDLE;
         VkDescriptorBufferInfo descriptorBufferInfo = {};
 
         explicit UniformBlock(Device& device) : device(device) {
@@ -563,9 +2794,23 @@ namespace zen {
         void destroy(const Device& device);
         void uploadData(void* data) const;
 
+        // Writes the latest data into the current frame's slice if needed and returns its offset
+        [[nodiscard]] uint32_t resolveOffset() const;
+
     private:
+        // Shared between copies, so the pipeline sees what the owner uploads
+        struct State {
+            std::vector<uint8_t> data = {};
+            uint64_t version = 0;
+            uint64_t sliceVersion = UINT64_MAX;
+            uint64_t sliceFrame = UINT64_MAX;
+            uint32_t offset = 0;
+            std::mutex mutex; // Secondaries may resolve the same block from several threads
+        };
+
         size_t size = 0;
         Device& device;
+        std::shared_ptr<State> state = nullptr;
     };
 
     enum class TextureFilter {
@@ -587,6 +2832,7 @@ namespace zen {
         TextureWrap wrapS = TextureWrap::Repeat;
         TextureWrap wrapT = TextureWrap::Repeat;
         TextureWrap wrapR = TextureWrap::Repeat;
+        float maxLod = VK_LOD_CLAMP_NONE; // Every mip level the texture has
 
         void createSampler(const Device& device);
     };
@@ -600,25 +2846,161 @@ namespace zen {
         std::shared_ptr<void> imageData = nullptr;
         VkDeviceMemory imageMemory = VK_NULL_HANDLE;
         VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+        Allocation imageAllocation = {};
+        Allocation stagingAllocation = {};
         VkDeviceSize imageSize = 0;
         Image image = {};
         TextureSampler sampler = {};
+        VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+        uint32_t mipLevels = 1;
 
+        // Level offsets point at precomputed mips inside the data, block compressed formats need
+        // them. Without them the full chain is blitted on the GPU when the format allows it.
         void load(std::shared_ptr<void> imageData, VkDeviceSize imageSize, Device& device, uint32_t width,
-                  uint32_t height);
+                  uint32_t height, VkFormat format = VK_FORMAT_R8G8B8A8_SRGB,
+                  const std::vector<VkDeviceSize>& levelOffsets = {}, bool generateMips = true);
 
         void activateTexture(Device& device);
         void createSampler(Device& device);
         void createDescriptorSet(Device& device, VkDescriptorSetLayout layout, VkDescriptorPool descriptorPool);
 
+        // Nothing may still sample the texture
+        void destroy(const Device& device);
+
         uint32_t width = 0;
         uint32_t height = 0;
 
     private:
+        std::vector<VkDeviceSize> levelOffsets = {};
+        bool generatesMipmaps = false;
+
         void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
                          VkImageUsageFlags usage, VkMemoryPropertyFlags properties, Device& device);
         void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
-                                   std::shared_ptr<SimpleCommandBuffer> commandBuffer) const;
+                                   VkCommandBuffer commandBuffer) const;
+        void generateMipmaps(VkCommandBuffer commandBuffer) const;
+    };
+
+    inline constexpr uint32_t packageVersion = 1;
+    inline constexpr VkDeviceSize packageAlignment = 4096; // The page size, and what host imports usually need
+    inline constexpr uint32_t packageMaxLevels = 16;
+
+    enum class PackageBlobType : uint32_t {
+        Raw,
+        Vertices,
+        Indices,
+        Texture,
+    };
+
+    // Packages are little endian: the header, the table of contents, the names without terminators
+    // and then the blobs, each starting on packageAlignment and padded up to it
+    struct PackageHeader {
+        char magic[4] = {'Z', 'P', 'A', 'K'};
+        uint32_t version = packageVersion;
+        uint32_t entryCount = 0;
+        uint32_t nameBytes = 0;
+    };
+
+    struct PackageEntry {
+        uint64_t offset = 0; // From the start of the file
+        uint64_t size = 0;
+        uint32_t nameOffset = 0; // Into the names
+        uint32_t nameLength = 0;
+        PackageBlobType type = PackageBlobType::Raw;
+        uint32_t stride = 0; // Bytes per vertex or per index
+        uint32_t width = 0;
+        uint32_t height = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        uint32_t levelCount = 0; // Baked mips, zero lets Texture::load generate them
+        uint64_t levelOffsets[packageMaxLevels] = {};
+    };
+
+    static_assert(sizeof(PackageHeader) == 16 && sizeof(PackageEntry) == 176, "Packages are read straight from disk");
+
+    // Bakes decoded and already converted data into a package, offline or on first run
+    class PackageWriter {
+    public:
+        void addBlob(const std::string& name, const void* data, size_t size,
+                     PackageBlobType type = PackageBlobType::Raw, uint32_t stride = 0);
+
+        template <typename T>
+        void addVertices(const std::string& name, const std::vector<T>& vertices) {
+            addBlob(name, vertices.data(), sizeof(T) * vertices.size(), PackageBlobType::Vertices, sizeof(T));
+        }
+
+        template <typename T>
+        void addIndices(const std::string& name, const std::vector<T>& indices) {
+            static_assert(std::is_same_v<T, uint16_t> || std::is_same_v<T, uint32_t>, "Indices are 16 or 32 bit");
+            addBlob(name, indices.data(), sizeof(T) * indices.size(), PackageBlobType::Indices, sizeof(T));
+        }
+
+        // Level offsets point into the data like for Texture::load
+        void addTexture(const std::string& name, const void* pixels, size_t size, uint32_t width, uint32_t height,
+                        VkFormat format, const std::vector<VkDeviceSize>& levelOffsets = {});
+
+        void write(const std::string& path) const;
+
+    private:
+        struct Blob {
+            PackageEntry entry;
+            std::string name;
+            std::vector<uint8_t> data;
+        };
+
+        std::vector<Blob> blobs = {};
+    };
+
+    // A package mapped read-only into memory. Nothing is read or decoded up front, the pages of a
+    // blob are only faulted in when it is loaded, so cold loads are bound by the disk, not the CPU.
+    class AssetPackage {
+    public:
+        // Maps the file and checks the table of contents against its size
+        explicit AssetPackage(const std::string& path);
+
+        AssetPackage(const AssetPackage&) = delete;
+        AssetPackage& operator=(const AssetPackage&) = delete;
+        AssetPackage(AssetPackage&&) noexcept = default;
+        AssetPackage& operator=(AssetPackage&&) noexcept = default;
+
+        [[nodiscard]] const PackageEntry* find(std::string_view name) const;
+        [[nodiscard]] const PackageEntry& get(std::string_view name) const;
+
+        [[nodiscard]] std::string_view getName(const PackageEntry& entry) const;
+
+        // Points into the mapping, valid for as long as the package lives
+        [[nodiscard]] const void* getData(const PackageEntry& entry) const;
+
+        [[nodiscard]] size_t getEntryCount() const {
+            return index.size();
+        }
+
+        // A device local buffer. With VK_EXT_external_memory_host the mapped pages are imported and
+        // copied by the GPU, otherwise they are copied once into the staging ring. Either way the
+        // copy joins the current upload batch.
+        [[nodiscard]] Buffer loadBuffer(Device& device, std::string_view name, BufferUsage usage) const;
+
+        // The texture keeps the file mapped until activateTexture has staged its pixels
+        [[nodiscard]] Texture loadTexture(Device& device, std::string_view name, bool generateMips = true) const;
+
+    private:
+        struct MappedFile;
+
+        std::shared_ptr<MappedFile> file = nullptr;
+        const PackageEntry* entries = nullptr;
+        const char* names = nullptr;
+        std::unordered_map<std::string_view, uint32_t> index = {};
+
+        bool importBuffer(Device& device, const Buffer& target, const PackageEntry& entry) const;
+    };
+
+    // The registries aren't synchronized, they belong to the thread that records frames. Worker
+    // threads, like the texture streamer's or the pipeline builds', are handed the resources
+    // themselves and never resolve handles.
+    struct ResourceRegistries {
+        ResourceRegistry<Buffer> buffers = {};
+        ResourceRegistry<Texture> textures = {};
+        ResourceRegistry<UniformBlock> uniformBlocks = {};
+        ResourceRegistry<RenderPipeline> pipelines = {};
     };
 };
 
@@ -10,106 +10,237 @@
 #ifdef ZENITH_VULKAN
 
 #include <zenith/zenith_vulkan.h>
+#include <algorithm>
+#include <cstring>
 
 using namespace zen;
 
-void Buffer::pushData(const std::vector<uint8_t>& data, int size, Device& device) {
-    if (buffer == VK_NULL_HANDLE || memory == VK_NULL_HANDLE) {
-        VkBufferCreateInfo bufferInfo = {};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = size;
-        bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        VkResult result = vkCreateBuffer(device.logicalDevice, &bufferInfo, nullptr, &buffer);
-        if (result != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create buffer. Error: " + zen::getVulkanErrorString(result));
-        }
+VkBufferUsageFlags zen::toVulkanBufferUsage(BufferUsage usage) {
+    VkBufferUsageFlags flags = 0;
+    if (hasUsage(usage, BufferUsage::Vertex)) {
+        flags |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::Index)) {
+        flags |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::Storage)) {
+        flags |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::Indirect)) {
+        flags |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::Uniform)) {
+        flags |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::TransferSource)) {
+        flags |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    }
+    return flags;
+}
 
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device.logicalDevice, buffer, &memRequirements);
-        VkMemoryAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = device.vkFindMemoryType(memRequirements.memoryTypeBits,
-                                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+void zen::getBufferAccess(BufferUsage usage, VkAccessFlags& access, VkPipelineStageFlags& stages) {
+    access = 0;
+    stages = 0;
+    if (hasUsage(usage, BufferUsage::Vertex)) {
+        access |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::Index)) {
+        access |= VK_ACCESS_INDEX_READ_BIT;
+        stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::Storage)) {
+        access |= VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::Indirect)) {
+        access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::Uniform)) {
+        access |= VK_ACCESS_UNIFORM_READ_BIT;
+        stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    }
+    if (hasUsage(usage, BufferUsage::TransferSource)) {
+        access |= VK_ACCESS_TRANSFER_READ_BIT;
+        stages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    if (stages == 0) {
+        // We don't know who reads it, so we make it visible to everyone
+        access = VK_ACCESS_MEMORY_READ_BIT;
+        stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+}
 
-        vkAllocateMemory(device.logicalDevice, &allocInfo, nullptr, &memory);
+void Buffer::create(VkDeviceSize size, Device& device) {
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = toVulkanBufferUsage(usage) | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkResult result = vkCreateBuffer(device.logicalDevice, &bufferInfo, nullptr, &buffer);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create buffer. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    if (residency == BufferResidency::HostVisible) {
+        properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    }
 
-        vkBindBufferMemory(device.logicalDevice, buffer, memory, 0);
+    allocation = device.getAllocator().allocateForBuffer(buffer, properties);
+    memory = allocation.memory;
+    this->size = size;
+}
+
+void Buffer::uploadData(const void* data, VkDeviceSize size, Device& device) {
+    // Fresh buffers are filled by the transfer queue, buffers that frames already read are
+    // updated in order on the graphics queue
+    QueueRole lane = QueueRole::Graphics;
+    if (buffer == VK_NULL_HANDLE || memory == VK_NULL_HANDLE || size > this->size) {
+        if (buffer != VK_NULL_HANDLE) {
+            // The old buffer may still be read by a frame in flight, it goes once those are done
+            device.retireBuffer(buffer, allocation);
+            buffer = VK_NULL_HANDLE;
+        }
+        create(size, device);
+        lane = QueueRole::Transfer;
     }
 
-    void* mappedData;
-    vkMapMemory(device.logicalDevice, memory, 0, size, 0, &mappedData);
-    std::memcpy(mappedData, data.data(), size);
-    vkUnmapMemory(device.logicalDevice, memory);
+    if (allocation.mapped != nullptr && lane == QueueRole::Transfer) {
+        // Nothing reads a fresh buffer yet, so mapped memory (host visible, or device local on
+        // unified architectures) is written directly. Once frames may read it, overwriting it in
+        // place would race them, so the copy below orders it after them on the graphics queue.
+        std::memcpy(allocation.mapped, data, size);
+    }
+    else {
+        device.uploadBuffer(*this, data, size, 0, lane);
+    }
 }
 
 
 void Buffer::destroy(const Device& device) {
-    vkDestroyBuffer(device.logicalDevice, buffer, nullptr);
+    if (buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device.logicalDevice, buffer, nullptr);
+    }
+    device.getAllocator().free(allocation);
+
+    buffer = VK_NULL_HANDLE;
+    memory = VK_NULL_HANDLE;
+    size = 0;
 }
 
-void UniformBlock::create(const Device& device, size_t size) {
-    this->size = size;
-    this->device = device;
+UniformArena::UniformArena(Device& device, uint32_t frameCount, VkDeviceSize frameCapacity) : device(device),
+    frameCount(frameCount) {
+    if (frameCount == 0) {
+        throw std::runtime_error("The uniform arena needs at least one frame region");
+    }
+
+    // Every region must start on a valid dynamic offset
+    alignment = std::max<VkDeviceSize>(device.physicalDeviceProperties.limits.minUniformBufferOffsetAlignment, 1);
+    this->frameCapacity = (frameCapacity + alignment - 1) / alignment * alignment;
 
-    // We first create the buffer
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.size = this->frameCapacity * frameCount;
+    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
     VkResult result = vkCreateBuffer(device.logicalDevice, &bufferInfo, nullptr, &buffer);
     if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create uniform buffer. Error: " + zen::getVulkanErrorString(result));
+        throw std::runtime_error("Failed to create uniform arena. Error: " + zen::getVulkanErrorString(result));
     }
 
-    // We allocate the memory for the buffer
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(device.logicalDevice, buffer, &memRequirements);
+    allocation = device.getAllocator().allocateForBuffer(buffer,
+                                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                         AllocationStrategy::General, MemoryCategory::Uniform);
+}
+
+UniformArena::~UniformArena() {
+    if (buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device.logicalDevice, buffer, nullptr);
+    }
+    device.getAllocator().free(allocation);
+}
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device.vkFindMemoryType(memRequirements.memoryTypeBits,
-                                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+void UniformArena::beginFrame(uint32_t frameIndex) {
+    std::lock_guard lock(mutex);
+    currentFrame = frameIndex % frameCount;
+    frameHead = 0;
+}
 
-    result = vkAllocateMemory(device.logicalDevice, &allocInfo, nullptr, &memory);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error(
-            "Failed to allocate uniform buffer memory. Error: " + zen::getVulkanErrorString(result));
+UniformSlice UniformArena::allocate(VkDeviceSize size) {
+    std::lock_guard lock(mutex);
+
+    const VkDeviceSize offset = (frameHead + alignment - 1) / alignment * alignment;
+    if (offset + size > frameCapacity) {
+        throw std::runtime_error("Uniform arena region is full, consider raising Device::uniformArenaFrameSize");
+    }
+    frameHead = offset + size;
+
+    const VkDeviceSize absolute = currentFrame * frameCapacity + offset;
+
+    UniformSlice slice;
+    slice.offset = static_cast<uint32_t>(absolute);
+    slice.mapped = static_cast<uint8_t*>(allocation.mapped) + absolute;
+    return slice;
+}
+
+void UniformBlock::create(const Device& device, size_t size) {
+    if (size > device.physicalDeviceProperties.limits.maxUniformBufferRange) {
+        throw std::runtime_error("Uniform block of " + std::to_string(size) +
+            " bytes exceeds the device's maxUniformBufferRange");
     }
 
-    vkBindBufferMemory(device.logicalDevice, buffer, memory, 0);
+    this->size = size;
+    state = std::make_shared<State>();
+    state->data.resize(size);
+
+    // Uniform blocks don't own memory, they live in slices of the device's uniform arena
+    buffer = this->device.getUniformArena().getBuffer();
 
-    // We fill the descriptor information
+    // We fill the descriptor information, the offset is supplied dynamically when binding
     descriptorBufferInfo.buffer = buffer;
     descriptorBufferInfo.offset = 0;
     descriptorBufferInfo.range = size;
 }
 
 void UniformBlock::uploadData(void* data) const {
-    void* mappedData;
-    vkMapMemory(device.logicalDevice, memory, 0, size, 0, &mappedData);
-    std::memcpy(mappedData, data, size);
-    vkUnmapMemory(device.logicalDevice, memory);
+    if (!state) {
+        throw std::runtime_error("Uniform block must be created before uploading data");
+    }
+    // We only keep a CPU copy here, it is written into the arena when the block is bound
+    std::lock_guard lock(state->mutex);
+    std::memcpy(state->data.data(), data, size);
+    state->version++;
 }
 
-void UniformBlock::destroy(const Device& device) {
-    if (buffer != VK_NULL_HANDLE) {
-        vkDestroyBuffer(device.logicalDevice, buffer, nullptr);
+uint32_t UniformBlock::resolveOffset() const {
+    if (!state) {
+        throw std::runtime_error("Uniform block must be created before binding it");
     }
 
-    if (memory != VK_NULL_HANDLE) {
-        vkFreeMemory(device.logicalDevice, memory, nullptr);
+    // A slice is only valid for the frame that wrote it, so each frame gets a fresh one
+    const uint64_t frame = device.getFrameSerial();
+    std::lock_guard lock(state->mutex);
+    if (state->sliceFrame != frame || state->sliceVersion != state->version) {
+        UniformSlice slice = device.getUniformArena().allocate(size);
+        std::memcpy(slice.mapped, state->data.data(), size);
+        state->offset = slice.offset;
+        state->sliceFrame = frame;
+        state->sliceVersion = state->version;
     }
+    return state->offset;
+}
 
+void UniformBlock::destroy(const Device& device) {
+    (void)device; // The arena owns the memory
     buffer = VK_NULL_HANDLE;
-    memory = VK_NULL_HANDLE;
     descriptorBufferInfo = {};
+    state = nullptr;
 }
 
 
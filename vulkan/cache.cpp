@@ -0,0 +1,129 @@
+/*
+* cache.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace zen;
+
+PipelineCache::PipelineCache(Device& device, std::string path) : device(device), path(std::move(path)) {
+    std::vector<uint8_t> data;
+    if (!this->path.empty()) {
+        std::ifstream file(this->path, std::ios::binary | std::ios::ate);
+        if (file) {
+            const std::streamsize size = file.tellg();
+            file.seekg(0, std::ios::beg);
+            data.resize(static_cast<size_t>(std::max<std::streamsize>(size, 0)));
+            if (!file.read(reinterpret_cast<char*>(data.data()), size)) {
+                data.clear();
+            }
+        }
+    }
+
+    // Drivers are not required to survive data from another driver, so we never hand it over blindly
+    if (!data.empty() && !isCompatible(data)) {
+        data.clear();
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    VkResult result = vkCreatePipelineCache(device.logicalDevice, &cacheInfo, nullptr, &cache);
+    if (result != VK_SUCCESS && !data.empty()) {
+        // The header matched but the driver still refused it, we start over
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = nullptr;
+        result = vkCreatePipelineCache(device.logicalDevice, &cacheInfo, nullptr, &cache);
+        data.clear();
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline cache. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    loaded = !data.empty();
+}
+
+PipelineCache::~PipelineCache() {
+    if (cache == VK_NULL_HANDLE) {
+        return;
+    }
+    if (!save()) {
+        std::cerr << "Zenith: could not write the pipeline cache to " << path << std::endl;
+    }
+    vkDestroyPipelineCache(device.logicalDevice, cache, nullptr);
+}
+
+bool PipelineCache::isCompatible(const std::vector<uint8_t>& data) const {
+    // Every cache starts with the header version one layout
+    struct Header {
+        uint32_t length;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint8_t uuid[VK_UUID_SIZE];
+    };
+
+    if (data.size() < sizeof(Header)) {
+        return false;
+    }
+
+    Header header{};
+    std::memcpy(&header, data.data(), sizeof(Header));
+
+    const VkPhysicalDeviceProperties& properties = device.physicalDeviceProperties;
+    return header.length >= sizeof(Header) &&
+        header.version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header.vendorID == properties.vendorID &&
+        header.deviceID == properties.deviceID &&
+        std::memcmp(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+bool PipelineCache::save() const {
+    if (path.empty() || cache == VK_NULL_HANDLE) {
+        return true; // Nothing to persist
+    }
+
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device.logicalDevice, cache, &size, nullptr) != VK_SUCCESS || size == 0) {
+        return false;
+    }
+
+    std::vector<uint8_t> data(size);
+    if (vkGetPipelineCacheData(device.logicalDevice, cache, &size, data.data()) != VK_SUCCESS) {
+        return false;
+    }
+
+    // We write next to the target and rename, so a crash never leaves a truncated cache behind
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file || !file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(size))) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+#endif
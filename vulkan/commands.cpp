@@ -14,117 +14,403 @@
 
 using namespace zen;
 
-void CommandBuffer::begin() const {
+void CommandBuffer::begin() {
+    Profiler& profiler = device.getProfiler();
+    profiler.beginCpuScope("Record"); // Closed by end, acquire shows up nested in it
+
     vkResetCommandBuffer(commandBuffer, 0);
+    dependencies.clear();
+    dependencyStages = 0;
 
     // We first check if the command buffer is valid
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
     vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    profiler.beginCommands(commandBuffer, frameIndex);
 }
 
 void CommandBuffer::end() {
+    Profiler& profiler = device.getProfiler();
+    profiler.endCommands(commandBuffer, frameIndex);
     vkEndCommandBuffer(commandBuffer);
+    profiler.endCpuScope();
     inUse = false;
-    resourcesBound = false;
+    framebuffer = VK_NULL_HANDLE;
+    boundSet = VK_NULL_HANDLE;
+    boundLayout = VK_NULL_HANDLE;
+    boundOffsets.clear();
 }
 
-CommandBuffer::CommandBuffer(const RenderPipeline& pipeline, VkCommandPool commandPool, VkCommandBuffer commandBuffer,
-                             Device& device, Presentable& presentable) : presentable(presentable), device(device) {
+CommandBuffer::CommandBuffer(const RenderPipeline& pipeline, const FrameContext& frame, VkCommandPool commandPool,
+                             Device& device, Presentable* presentable, RenderTarget* target) :
+    presentable(presentable), target(target), device(device) {
     this->commandPool = commandPool;
-    this->commandBuffer = commandBuffer;
+    this->commandBuffer = frame.commandBuffer;
     this->inUse = true;
     this->pipeline = pipeline.pipeline;
     this->renderPass = pipeline.renderPass.renderPass;
 
-    VkSemaphoreCreateInfo semaphoreInfo = {};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    vkCreateSemaphore(device.logicalDevice, &semaphoreInfo, nullptr, &imageAvailableSemaphore);
-    vkCreateSemaphore(device.logicalDevice, &semaphoreInfo, nullptr, &renderFinishedSemaphore);
+    // The fence belongs to the frame slot and the semaphores to the presentable, we only borrow them
+    this->inFlightFence = frame.inFlightFence;
+    this->frameIndex = frame.index;
+    this->frameSerial = frame.serial;
+}
+
+void CommandBuffer::usePipeline(const RenderPipeline& pipeline) {
+    this->pipeline = pipeline.pipeline;
+    this->renderPass = pipeline.renderPass.renderPass;
+}
+
+void CommandBuffer::useFrame(const FrameContext& frame) {
+    // Workers read the serial to pick their pool, so it is copied here rather than read from the device
+    this->frameSerial = frame.serial;
+}
+
+void CommandBuffer::useOutput(Presentable* presentable, RenderTarget* target) {
+    // The recorder of a frame slot is reused, the next request may draw somewhere else
+    this->presentable = presentable;
+    this->target = target;
 }
 
-void CommandBuffer::beginRendering() {
+VkExtent2D CommandBuffer::getExtent() const {
+    return target != nullptr ? target->getExtent() : presentable->extent;
+}
+
+void CommandBuffer::acquireImage() {
+    if (presentable == nullptr) {
+        throw std::runtime_error("Only command buffers requested for a presentable can acquire swapchain images");
+    }
+    if (!presentable->synchronization.isValid()) {
+        throw std::runtime_error("The presentable has no synchronization objects to borrow");
+    }
+
+    CpuScope scope(device.getProfiler(), "Acquire");
+    imageAvailableSemaphore = presentable->synchronization.getImageAvailableSemaphore(frameIndex);
+
     uint32_t imageIndexLocal = 0;
-    vkAcquireNextImageKHR(device.logicalDevice, presentable.swapchain, UINT64_MAX,
-                          imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndexLocal);
+    VkResult result = vkAcquireNextImageKHR(device.logicalDevice, presentable->swapchain, UINT64_MAX,
+                                            imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndexLocal);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        // The surface changed under us, a failed acquire leaves the semaphore unsignaled so we can retry
+        if (!presentable->recreate()) {
+            throw std::runtime_error("The swapchain can't be recreated while the surface has no area");
+        }
+        imageAvailableSemaphore = presentable->synchronization.getImageAvailableSemaphore(frameIndex);
+        result = vkAcquireNextImageKHR(device.logicalDevice, presentable->swapchain, UINT64_MAX,
+                                       imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndexLocal);
+    }
+    // A suboptimal swapchain still presents, present recreates it afterwards
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+        throw std::runtime_error("Failed to acquire swapchain image. Error: " + zen::getVulkanErrorString(result));
+    }
     imageIndex = static_cast<int>(imageIndexLocal);
 
+    // The image may still be in use by an older frame slot if images are acquired out of order
+    presentable->synchronization.claimImage(device.logicalDevice, imageIndexLocal, inFlightFence);
+    renderFinishedSemaphore = presentable->synchronization.getRenderFinishedSemaphore(imageIndexLocal);
+}
+
+void CommandBuffer::executeGraph(RenderGraph& graph) {
+    // The graph brings its own render passes, we only acquire the image it draws into
+    if (presentable != nullptr) {
+        acquireImage();
+    }
+    else {
+        imageIndex = 0; // Headless graphs only draw into their own attachments
+    }
+    if (graph.isOutdated()) {
+        // Older frames may still use the graph's framebuffers
+        device.waitIdle();
+        graph.compile();
+    }
+    graph.execute(commandBuffer, static_cast<uint32_t>(imageIndex));
+}
+
+void CommandBuffer::beginRendering(RenderingContents contents) {
+    // Indexed like RenderPass::createPass orders the attachments: color, depth, resolve. Values for
+    // attachments the pass doesn't have are ignored.
+    VkClearValue clearValues[3] = {};
+    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    if (target != nullptr) {
+        // Offscreen targets have a single framebuffer and nothing to wait for
+        framebuffer = target->getFramebuffer();
+        clearValues[0].color = target->clearColor;
+    }
+    else {
+        acquireImage();
+        framebuffer = device.framebuffers[imageIndex].framebuffer;
+    }
+
     VkRenderPassBeginInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderPass;
-    renderPassInfo.framebuffer = device.framebuffers[imageIndex].framebuffer;
+    renderPassInfo.framebuffer = framebuffer;
     renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = device.instance.extent;
+    renderPassInfo.renderArea.extent = getExtent();
 
-    VkClearValue clearColor = {};
-    clearColor.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    renderPassInfo.clearValueCount = 3;
+    renderPassInfo.pClearValues = clearValues;
 
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+    if (contents == RenderingContents::Secondary) {
+        // The secondaries bind their own pipelines, the primary may only execute them
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        return;
+    }
 
     vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    zen::setViewport(commandBuffer, getExtent());
 }
 
 void CommandBuffer::endRendering() const {
     vkCmdEndRenderPass(commandBuffer);
 }
 
+SecondaryCommandBuffer CommandBuffer::beginSecondary() const {
+    if (framebuffer == VK_NULL_HANDLE) {
+        throw std::runtime_error("Secondary command buffers can only be recorded after beginRendering");
+    }
+
+    VkCommandBuffer secondary = device.acquireSecondaryCommandBuffer(frameIndex, frameSerial);
+
+    // We inherit the pass so the driver can validate and optimize against the real framebuffer
+    VkCommandBufferInheritanceInfo inheritanceInfo = {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = framebuffer;
+    // The profiler's statistics query is active while this executes
+    inheritanceInfo.pipelineStatistics = device.getProfiler().getInheritedStatistics(frameIndex);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    VkResult result = vkBeginCommandBuffer(secondary, &beginInfo);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin secondary command buffer. Error: " +
+            zen::getVulkanErrorString(result));
+    }
+
+    // Dynamic state is not inherited from the primary
+    zen::setViewport(secondary, getExtent());
+    return SecondaryCommandBuffer(secondary);
+}
+
+void CommandBuffer::executeSecondaries(const std::vector<SecondaryCommandBuffer>& secondaries) const {
+    if (secondaries.empty()) {
+        return;
+    }
+
+    std::vector<VkCommandBuffer> buffers;
+    buffers.reserve(secondaries.size());
+    for (const auto& secondary : secondaries) {
+        buffers.push_back(secondary.commandBuffer);
+    }
+    vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(buffers.size()), buffers.data());
+}
+
+void SecondaryCommandBuffer::bindPipeline(const RenderPipeline& pipeline) const {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
+
+    if (pipeline.descriptorSet == VK_NULL_HANDLE) {
+        return; // Nothing is attached to the pipeline
+    }
+
+    // Nothing is inherited between command buffers, so every secondary binds its own set
+    std::vector<uint32_t> offsets;
+    pipeline.resolveUniformOffsets(offsets);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipelineLayout, 0, 1,
+                            &pipeline.descriptorSet, static_cast<uint32_t>(offsets.size()), offsets.data());
+}
+
+void SecondaryCommandBuffer::bindResourceSet(const RenderPipeline& pipeline, uint32_t set,
+                                             const ResourceSet& resourceSet) const {
+    if (resourceSet.descriptorSet == VK_NULL_HANDLE) {
+        throw std::runtime_error("The resource set must be built before binding it");
+    }
+
+    std::vector<uint32_t> offsets;
+    resourceSet.resolveUniformOffsets(offsets);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipelineLayout, set, 1,
+                            &resourceSet.descriptorSet, static_cast<uint32_t>(offsets.size()), offsets.data());
+}
+
+void SecondaryCommandBuffer::bindBindlessTextures(const RenderPipeline& pipeline, uint32_t set) const {
+    const VkDescriptorSet table = pipeline.device.getBindlessTable().getSet();
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipelineLayout, set, 1,
+                            &table, 0, nullptr);
+}
+
+void SecondaryCommandBuffer::pushConstants(const RenderPipeline& pipeline, const void* data, uint32_t size,
+                                           uint32_t offset) const {
+    vkCmdPushConstants(commandBuffer, pipeline.pipelineLayout, pipeline.getPushConstantStages(offset, size), offset,
+                       size, data);
+}
+
+void SecondaryCommandBuffer::bindVertexBuffer(const Buffer& buffer, uint32_t binding, VkDeviceSize offset) const {
+    VkBuffer buffers[] = {buffer.buffer};
+    VkDeviceSize offsets[] = {offset};
+    vkCmdBindVertexBuffers(commandBuffer, binding, 1, buffers, offsets);
+}
+
+void SecondaryCommandBuffer::bindIndexBuffer(const Buffer& buffer, IndexType type) const {
+    vkCmdBindIndexBuffer(commandBuffer, buffer.buffer, 0, getIndexType(type));
+}
+
+void SecondaryCommandBuffer::draw(const int vertexCount, const bool indexed) const {
+    if (indexed) {
+        vkCmdDrawIndexed(commandBuffer, vertexCount, 1, 0, 0, 0);
+    }
+    else {
+        vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
+    }
+}
+
+void SecondaryCommandBuffer::drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex,
+                                           uint32_t firstInstance) const {
+    vkCmdDraw(commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+}
+
+void SecondaryCommandBuffer::drawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex,
+                                         int32_t vertexOffset, uint32_t firstInstance) const {
+    vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+}
+
+void SecondaryCommandBuffer::end() const {
+    VkResult result = vkEndCommandBuffer(commandBuffer);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to end secondary command buffer. Error: " +
+            zen::getVulkanErrorString(result));
+    }
+}
+
 void CommandBuffer::present() const {
-    VkPresentInfoKHR presentInfo = {};
-    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presentInfo.waitSemaphoreCount = 1;
-    VkSemaphore waitSemaphores[] = {renderFinishedSemaphore};
-    presentInfo.pWaitSemaphores = waitSemaphores;
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = &presentable.swapchain;
-    auto imageIndexLocal = static_cast<uint32_t>(imageIndex);
-    presentInfo.pImageIndices = &imageIndexLocal;
-    presentInfo.pResults = nullptr;
+    // Blocks when the presentation engine is behind or frame pacing waits for an earlier present
+    if (presentable == nullptr) {
+        throw std::runtime_error("Command buffers rendering into a target have nothing to present");
+    }
 
+    CpuScope scope(device.getProfiler(), "Present");
     VkQueue queue = device.getPresentQueue().queue;
 
-    vkQueuePresentKHR(queue, &presentInfo);
+    const VkResult result = presentable->present(queue, renderFinishedSemaphore, static_cast<uint32_t>(imageIndex));
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        // We rebuild right away so the next acquire already gets images of the right size
+        (void)presentable->recreate();
+    }
+    else if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to present swapchain image. Error: " + zen::getVulkanErrorString(result));
+    }
 }
 
-void CommandBuffer::submit() const {
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-    submitInfo.waitSemaphoreCount = 1;
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.pWaitDstStageMask = waitStages;
+GpuJob CommandBuffer::submit() const {
+    Profiler& profiler = device.getProfiler();
+    CpuScope scope(profiler, "Submit");
 
-    assert(imageAvailableSemaphore != VK_NULL_HANDLE);
-    assert(renderFinishedSemaphore != VK_NULL_HANDLE);
+    // Pending uploads go first, their barriers then cover everything this frame reads
+    UploadBatcher& uploads = device.getUploadBatcher();
+    if (uploads.hasPendingWork()) {
+        (void)uploads.flush();
+    }
 
-    assert(presentable.swapchain != VK_NULL_HANDLE);
     assert(commandBuffer != VK_NULL_HANDLE);
     assert(device.logicalDevice != VK_NULL_HANDLE);
+    assert(inFlightFence != VK_NULL_HANDLE);
+
+    GpuJobDescription job;
+    job.queue = QueueRole::Graphics;
+    job.commandBuffers = {commandBuffer};
+    job.dependencies = dependencies;
+    job.waitStages = dependencyStages;
+    // Offscreen targets neither wait for an image nor hand one to the presentation engine
+    if (presentable != nullptr) {
+        assert(imageAvailableSemaphore != VK_NULL_HANDLE);
+        assert(renderFinishedSemaphore != VK_NULL_HANDLE);
+        assert(presentable->swapchain != VK_NULL_HANDLE);
+
+        job.waitSemaphores = {imageAvailableSemaphore};
+        job.waitSemaphoreStages = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+        job.signalSemaphores = {renderFinishedSemaphore};
+    }
 
-    VkSemaphore waitSemaphores[] = {imageAvailableSemaphore};
-    VkSemaphore signalSemaphores[] = {renderFinishedSemaphore};
+    // The fence is only reset once we are sure we are going to submit, otherwise the next
+    // wait on this frame slot would never return
+    vkResetFences(device.logicalDevice, 1, &inFlightFence);
+    profiler.markSubmit(frameIndex);
 
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalSemaphores;
+    // Through the scheduler the frame lands on the graphics timeline, behind the jobs queued before it
+    if (device.supportsTimelineSemaphore) {
+        return device.getJobScheduler().submitNow(job, inFlightFence);
+    }
 
-    submitInfo.pWaitSemaphores = waitSemaphores;
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(job.waitSemaphores.size());
+    submitInfo.pWaitSemaphores = job.waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = job.waitSemaphoreStages.data();
+    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(job.signalSemaphores.size());
+    submitInfo.pSignalSemaphores = job.signalSemaphores.data();
 
     VkQueue graphicsQueue = device.getGraphicsQueue().queue;
     assert(graphicsQueue != VK_NULL_HANDLE);
+    std::lock_guard submitLock(device.getSubmitMutex(graphicsQueue));
+    VkResult result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit command buffer. Error: " + zen::getVulkanErrorString(result));
+    }
+    return {};
+}
 
-    vkQueueSubmit(graphicsQueue, 1,
-                  &submitInfo, VK_NULL_HANDLE
-    );
+void CommandBuffer::waitFor(GpuJob job, VkPipelineStageFlags stages) {
+    if (!device.supportsTimelineSemaphore) {
+        throw std::runtime_error("Waiting for jobs needs a device with VK_KHR_timeline_semaphore");
+    }
+    if (job.isValid()) {
+        dependencies.push_back(job);
+        dependencyStages |= stages;
+    }
 }
 
-void CommandBuffer::bindVertexBuffer(const Buffer& buffer) const {
+void CommandBuffer::beginScope(const std::string& name) const {
+    device.getProfiler().beginGpuScope(commandBuffer, frameIndex, name);
+}
+
+void CommandBuffer::endScope() const {
+    device.getProfiler().endGpuScope(commandBuffer, frameIndex);
+}
+
+void CommandBuffer::bindVertexBuffer(const Buffer& buffer, uint32_t binding, VkDeviceSize offset) const {
     VkBuffer buffers[] = {buffer.buffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+    VkDeviceSize offsets[] = {offset};
+    vkCmdBindVertexBuffers(commandBuffer, binding, 1, buffers, offsets);
+}
+
+void CommandBuffer::bindVertexBuffer(BufferHandle buffer, uint32_t binding, VkDeviceSize offset) const {
+    bindVertexBuffer(device.getResources().buffers.get(buffer), binding, offset);
+}
+
+void zen::setViewport(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = static_cast<float>(extent.height); // Start from bottom
+    viewport.width = static_cast<float>(extent.width);
+    viewport.height = -static_cast<float>(extent.height); // Negative height flips Y
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = extent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 }
 
 VkIndexType zen::getIndexType(IndexType type) {
@@ -145,11 +431,26 @@ void CommandBuffer::bindIndexBuffer(const Buffer& buffer, IndexType type) const
     vkCmdBindIndexBuffer(commandBuffer, buffer.buffer, 0, getIndexType(type));
 }
 
-void CommandBuffer::bindUniforms(const RenderPipeline& pipeline) {
-    if (resourcesBound) {
+void CommandBuffer::bindIndexBuffer(BufferHandle buffer, IndexType type) const {
+    bindIndexBuffer(device.getResources().buffers.get(buffer), type);
+}
+
+void CommandBuffer::bindDescriptorSet(const RenderPipeline& pipeline) {
+    if (pipeline.descriptorSet == VK_NULL_HANDLE) {
+        return; // Nothing is attached to the pipeline
+    }
+
+    // Uniform blocks that changed since the last bind get a fresh slice of the arena
+    std::vector<uint32_t> offsets;
+    pipeline.resolveUniformOffsets(offsets);
+    // Other pipelines share this command buffer, so the same offsets alone don't mean the same set
+    if (boundSet == pipeline.descriptorSet && boundLayout == pipeline.pipelineLayout && offsets == boundOffsets) {
         return;
     }
-    resourcesBound = true;
+    boundSet = pipeline.descriptorSet;
+    boundLayout = pipeline.pipelineLayout;
+    boundOffsets = std::move(offsets);
+
     vkCmdBindDescriptorSets(
         commandBuffer,
         VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -157,24 +458,47 @@ void CommandBuffer::bindUniforms(const RenderPipeline& pipeline) {
         0, // First set
         1, // Descriptor set count
         &pipeline.descriptorSet, // The descriptor set created earlier
-        0, nullptr // Dynamic offsets, if any (not needed for static uniforms)
+        static_cast<uint32_t>(boundOffsets.size()), boundOffsets.data() // One offset per uniform block
     );
 }
 
-void CommandBuffer::bindTexture(RenderPipeline& pipeline) {
-    if (resourcesBound) {
-        return;
+void CommandBuffer::bindUniforms(const RenderPipeline& pipeline) {
+    bindDescriptorSet(pipeline);
+}
+
+void CommandBuffer::bindResourceSet(const RenderPipeline& pipeline, uint32_t set, const ResourceSet& resourceSet) {
+    if (resourceSet.descriptorSet == VK_NULL_HANDLE) {
+        throw std::runtime_error("The resource set must be built before binding it");
     }
-    resourcesBound = true;
-    vkCmdBindDescriptorSets(
-        commandBuffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        pipeline.pipelineLayout, // Must match the one used in pipeline creation
-        0, // First set
-        1, // Descriptor set count
-        &pipeline.descriptorSet, // The descriptor set created earlier
-        0, nullptr // Dynamic offsets, if any (not needed for static textures)
-    );
+    if (set == 0) {
+        boundSet = VK_NULL_HANDLE; // The pipeline's own set was replaced
+    }
+
+    // Other sets stay bound, their layouts are compatible up to this index
+    std::vector<uint32_t> offsets;
+    resourceSet.resolveUniformOffsets(offsets);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipelineLayout, set, 1,
+                            &resourceSet.descriptorSet, static_cast<uint32_t>(offsets.size()), offsets.data());
+}
+
+void CommandBuffer::bindBindlessTextures(const RenderPipeline& pipeline, uint32_t set) {
+    // Binding the table once covers every draw, whatever textures they index
+    if (set == 0) {
+        boundSet = VK_NULL_HANDLE;
+    }
+    const VkDescriptorSet table = pipeline.device.getBindlessTable().getSet();
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipelineLayout, set, 1,
+                            &table, 0, nullptr);
+}
+
+void CommandBuffer::pushConstants(const RenderPipeline& pipeline, const void* data, uint32_t size,
+                                  uint32_t offset) const {
+    vkCmdPushConstants(commandBuffer, pipeline.pipelineLayout, pipeline.getPushConstantStages(offset, size), offset,
+                       size, data);
+}
+
+void CommandBuffer::bindTexture(RenderPipeline& pipeline) {
+    bindDescriptorSet(pipeline);
 }
 
 void CommandBuffer::activateTexture(Texture& texture, Device& device) {
@@ -191,6 +515,133 @@ void CommandBuffer::draw(const int vertexCount, const bool indexed) const {
     }
 }
 
+void CommandBuffer::bindComputePipeline(const ComputePipeline& pipeline) const {
+    if (pipeline.pipeline == VK_NULL_HANDLE) {
+        throw std::runtime_error("The compute pipeline must be made before dispatching it");
+    }
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+
+    if (pipeline.descriptorSet == VK_NULL_HANDLE) {
+        return; // Nothing is attached to the pipeline
+    }
+
+    // The compute bind point has its own state, so this never disturbs the graphics bindings
+    std::vector<uint32_t> offsets;
+    pipeline.resolveUniformOffsets(offsets);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipelineLayout, 0, 1,
+                            &pipeline.descriptorSet, static_cast<uint32_t>(offsets.size()), offsets.data());
+}
+
+void CommandBuffer::dispatch(const ComputePipeline& pipeline, uint32_t groupsX, uint32_t groupsY,
+                             uint32_t groupsZ) const {
+    bindComputePipeline(pipeline);
+    vkCmdDispatch(commandBuffer, groupsX, groupsY, groupsZ);
+}
+
+void CommandBuffer::dispatchIndirect(const ComputePipeline& pipeline, const Buffer& buffer,
+                                     VkDeviceSize offset) const {
+    if (!hasUsage(buffer.usage, BufferUsage::Indirect)) {
+        throw std::runtime_error("Indirect dispatches need a buffer created with BufferUsage::Indirect");
+    }
+    bindComputePipeline(pipeline);
+    vkCmdDispatchIndirect(commandBuffer, buffer.buffer, offset);
+}
+
+void CommandBuffer::bufferBarrier(const Buffer& buffer, BufferUsage from, BufferUsage to) const {
+    VkAccessFlags sourceAccess;
+    VkPipelineStageFlags sourceStages;
+    zen::getBufferAccess(from, sourceAccess, sourceStages);
+
+    VkAccessFlags destinationAccess;
+    VkPipelineStageFlags destinationStages;
+    zen::getBufferAccess(to, destinationAccess, destinationStages);
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = sourceAccess;
+    barrier.dstAccessMask = destinationAccess;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer.buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(commandBuffer, sourceStages, destinationStages, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void CommandBuffer::imageBarrier(const Image& image, VkImageLayout oldLayout, VkImageLayout newLayout) const {
+    VkAccessFlags sourceAccess;
+    VkPipelineStageFlags sourceStages;
+    zen::getImageAccess(oldLayout, sourceAccess, sourceStages);
+
+    VkAccessFlags destinationAccess;
+    VkPipelineStageFlags destinationStages;
+    zen::getImageAccess(newLayout, destinationAccess, destinationStages);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcAccessMask = sourceAccess;
+    barrier.dstAccessMask = destinationAccess;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+    vkCmdPipelineBarrier(commandBuffer, sourceStages, destinationStages, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void CommandBuffer::drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex,
+                                  uint32_t firstInstance) const {
+    vkCmdDraw(commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+}
+
+void CommandBuffer::drawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex,
+                                int32_t vertexOffset, uint32_t firstInstance) const {
+    vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+}
+
+void CommandBuffer::drawIndirect(const Buffer& buffer, uint32_t drawCount, bool indexed, VkDeviceSize offset) const {
+    if (!hasUsage(buffer.usage, BufferUsage::Indirect)) {
+        throw std::runtime_error("Indirect draws need a buffer created with BufferUsage::Indirect");
+    }
+    if (drawCount > 1 && !device.physicalDeviceFeatures.multiDrawIndirect) {
+        throw std::runtime_error("The device doesn't support more than one draw per indirect call");
+    }
+
+    if (indexed) {
+        vkCmdDrawIndexedIndirect(commandBuffer, buffer.buffer, offset, drawCount,
+                                 sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else {
+        vkCmdDrawIndirect(commandBuffer, buffer.buffer, offset, drawCount, sizeof(VkDrawIndirectCommand));
+    }
+}
+
+void CommandBuffer::drawIndirectCount(const Buffer& buffer, const Buffer& countBuffer, uint32_t maxDrawCount,
+                                      bool indexed, VkDeviceSize offset, VkDeviceSize countOffset) const {
+    if (!device.supportsDrawIndirectCount) {
+        throw std::runtime_error("The device doesn't support VK_KHR_draw_indirect_count");
+    }
+    if (!hasUsage(buffer.usage, BufferUsage::Indirect) || !hasUsage(countBuffer.usage, BufferUsage::Indirect)) {
+        throw std::runtime_error("Indirect draws need buffers created with BufferUsage::Indirect");
+    }
+
+    if (indexed) {
+        device.cmdDrawIndexedIndirectCount(commandBuffer, buffer.buffer, offset, countBuffer.buffer, countOffset,
+                                           maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else {
+        device.cmdDrawIndirectCount(commandBuffer, buffer.buffer, offset, countBuffer.buffer, countOffset,
+                                    maxDrawCount, sizeof(VkDrawIndirectCommand));
+    }
+}
+
 void SimpleCommandBuffer::start() const {
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -207,11 +658,29 @@ void SimpleCommandBuffer::endCommitAndDelete() {
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
+    // We only wait for this submission instead of draining the whole queue
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence = VK_NULL_HANDLE;
+    VkResult result = vkCreateFence(device.logicalDevice, &fenceInfo, nullptr, &fence);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create submission fence. Error: " + zen::getVulkanErrorString(result));
+    }
+
     VkQueue graphicsQueue = device.getGraphicsQueue().queue;
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphicsQueue);
+    {
+        std::lock_guard submitLock(device.getSubmitMutex(graphicsQueue));
+        result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence);
+    }
+    if (result == VK_SUCCESS) {
+        vkWaitForFences(device.logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+    vkDestroyFence(device.logicalDevice, fence, nullptr);
 
     device.freeCommandBuffer(*this);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit command buffer. Error: " + zen::getVulkanErrorString(result));
+    }
 }
 
 
@@ -0,0 +1,378 @@
+/*
+* compiler.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/SPIRV/GlslangToSpv.h>
+#include <glslang/Include/ResourceLimits.h>
+#include <zenith/zenith_vulkan.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+using namespace zen;
+
+namespace {
+    // Bumped whenever the way we drive glslang changes, so stale cache entries stop matching
+    constexpr const char* compilerRevision = "zenith-glslang-1";
+    constexpr const char* targetEnvironment = "vulkan1.2/spirv1.5/glsl450";
+
+    // glslang keeps process wide state, it is set up once and torn down at exit
+    struct GlslangProcess {
+        GlslangProcess() {
+            glslang::InitializeProcess();
+        }
+
+        ~GlslangProcess() {
+            glslang::FinalizeProcess();
+        }
+    };
+
+    void ensureGlslang() {
+        static GlslangProcess process;
+    }
+
+    TBuiltInResource makeResources() {
+        TBuiltInResource resources = {};
+        resources.maxLights = 32;
+        resources.maxClipPlanes = 6;
+        resources.maxTextureUnits = 32;
+        resources.maxTextureCoords = 32;
+        resources.maxVertexAttribs = 64;
+        resources.maxVertexUniformComponents = 4096;
+        resources.maxVaryingFloats = 64;
+        resources.maxVertexTextureImageUnits = 32;
+        resources.maxCombinedTextureImageUnits = 80;
+        resources.maxTextureImageUnits = 32;
+        resources.maxFragmentUniformComponents = 4096;
+        resources.maxDrawBuffers = 32;
+        resources.maxVertexUniformVectors = 128;
+        resources.maxVaryingVectors = 8;
+        resources.maxFragmentUniformVectors = 16;
+        resources.maxVertexOutputVectors = 16;
+        resources.maxFragmentInputVectors = 15;
+        resources.minProgramTexelOffset = -8;
+        resources.maxProgramTexelOffset = 7;
+        resources.maxClipDistances = 8;
+        resources.maxComputeWorkGroupCountX = 65535;
+        resources.maxComputeWorkGroupCountY = 65535;
+        resources.maxComputeWorkGroupCountZ = 65535;
+        resources.maxComputeWorkGroupSizeX = 1024;
+        resources.maxComputeWorkGroupSizeY = 1024;
+        resources.maxComputeWorkGroupSizeZ = 64;
+        resources.maxComputeUniformComponents = 1024;
+        resources.maxComputeTextureImageUnits = 16;
+        resources.maxComputeImageUniforms = 8;
+        resources.maxComputeAtomicCounters = 8;
+        resources.maxComputeAtomicCounterBuffers = 1;
+        resources.maxVaryingComponents = 60;
+        resources.maxVertexOutputComponents = 64;
+        resources.maxGeometryInputComponents = 64;
+        resources.maxGeometryOutputComponents = 128;
+        resources.maxFragmentInputComponents = 128;
+        resources.maxImageUnits = 8;
+        resources.maxCombinedImageUnitsAndFragmentOutputs = 8;
+        resources.maxCombinedShaderOutputResources = 8;
+        resources.maxImageSamples = 0;
+        resources.maxVertexImageUniforms = 0;
+        resources.maxTessControlImageUniforms = 0;
+        resources.maxTessEvaluationImageUniforms = 0;
+        resources.maxGeometryImageUniforms = 0;
+        resources.maxFragmentImageUniforms = 8;
+        resources.maxCombinedImageUniforms = 8;
+        resources.maxGeometryTextureImageUnits = 16;
+        resources.maxGeometryOutputVertices = 256;
+        resources.maxGeometryTotalOutputComponents = 1024;
+        resources.maxGeometryUniformComponents = 1024;
+        resources.maxGeometryVaryingComponents = 64;
+        resources.maxTessControlInputComponents = 128;
+        resources.maxTessControlOutputComponents = 128;
+        resources.maxTessControlTextureImageUnits = 16;
+        resources.maxTessControlUniformComponents = 1024;
+        resources.maxTessControlTotalOutputComponents = 4096;
+        resources.maxTessEvaluationInputComponents = 128;
+        resources.maxTessEvaluationOutputComponents = 128;
+        resources.maxTessEvaluationTextureImageUnits = 16;
+        resources.maxTessEvaluationUniformComponents = 1024;
+        resources.maxTessPatchComponents = 120;
+        resources.maxPatchVertices = 32;
+        resources.maxTessGenLevel = 64;
+        resources.maxViewports = 16;
+        resources.maxVertexAtomicCounters = 0;
+        resources.maxTessControlAtomicCounters = 0;
+        resources.maxTessEvaluationAtomicCounters = 0;
+        resources.maxGeometryAtomicCounters = 0;
+        resources.maxFragmentAtomicCounters = 8;
+        resources.maxCombinedAtomicCounters = 8;
+        resources.maxAtomicCounterBindings = 1;
+        resources.maxVertexAtomicCounterBuffers = 0;
+        resources.maxTessControlAtomicCounterBuffers = 0;
+        resources.maxTessEvaluationAtomicCounterBuffers = 0;
+        resources.maxGeometryAtomicCounterBuffers = 0;
+        resources.maxFragmentAtomicCounterBuffers = 1;
+        resources.maxCombinedAtomicCounterBuffers = 1;
+        resources.maxAtomicCounterBufferSize = 16384;
+        resources.maxTransformFeedbackBuffers = 4;
+        resources.maxTransformFeedbackInterleavedComponents = 64;
+        resources.maxCullDistances = 8;
+        resources.maxCombinedClipAndCullDistances = 8;
+        resources.maxSamples = 4;
+        resources.limits.nonInductiveForLoops = true;
+        resources.limits.whileLoops = true;
+        resources.limits.doWhileLoops = true;
+        resources.limits.generalUniformIndexing = true;
+        resources.limits.generalAttributeMatrixVectorIndexing = true;
+        resources.limits.generalVaryingIndexing = true;
+        resources.limits.generalSamplerIndexing = true;
+        resources.limits.generalVariableIndexing = true;
+        resources.limits.generalConstantMatrixVectorIndexing = true;
+
+        return resources;
+    }
+
+    const TBuiltInResource& getResources() {
+        static const TBuiltInResource resources = makeResources();
+        return resources;
+    }
+
+    void hashBytes(uint64_t& hash, const void* data, size_t size) {
+        // FNV-1a, stable across platforms and runs
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    void hashString(uint64_t& hash, const std::string& value) {
+        const uint64_t length = value.size();
+        hashBytes(hash, &length, sizeof(length)); // The length keeps "ab"+"c" apart from "a"+"bc"
+        hashBytes(hash, value.data(), value.size());
+    }
+}
+
+ShaderCompiler::ShaderCompiler(std::string cacheDirectory, uint32_t threadCount)
+    : cacheDirectory(std::move(cacheDirectory)) {
+    ensureGlslang();
+
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++) {
+        workers.emplace_back([this] { work(); });
+    }
+}
+
+ShaderCompiler::~ShaderCompiler() {
+    {
+        std::lock_guard lock(jobMutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ShaderCompiler::work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock lock(jobMutex);
+            jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) {
+                return; // Only stop once everything queued has run
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+uint64_t ShaderCompiler::hash(const ShaderSource& source) {
+    uint64_t hash = 14695981039346656037ull;
+    hashString(hash, compilerRevision);
+    hashString(hash, targetEnvironment);
+
+    const auto type = static_cast<uint32_t>(source.type);
+    hashBytes(hash, &type, sizeof(type));
+    hashString(hash, source.source);
+
+    const uint64_t defineCount = source.defines.size();
+    hashBytes(hash, &defineCount, sizeof(defineCount));
+    for (const auto& [name, value] : source.defines) {
+        hashString(hash, name);
+        hashString(hash, value);
+    }
+    return hash;
+}
+
+std::optional<std::vector<uint32_t>> ShaderCompiler::findCached(uint64_t key) {
+    {
+        std::lock_guard lock(cacheMutex);
+        if (auto entry = compiled.find(key); entry != compiled.end()) {
+            return entry->second;
+        }
+    }
+
+    if (cacheDirectory.empty()) {
+        return std::nullopt;
+    }
+
+    std::ostringstream name;
+    name << std::hex << key << ".spv";
+    std::ifstream file(std::filesystem::path(cacheDirectory) / name.str(), std::ios::binary | std::ios::ate);
+    if (!file) {
+        return std::nullopt;
+    }
+
+    const std::streamsize size = file.tellg();
+    if (size <= 0 || size % static_cast<std::streamsize>(sizeof(uint32_t)) != 0) {
+        return std::nullopt;
+    }
+    std::vector<uint32_t> spirv(static_cast<size_t>(size) / sizeof(uint32_t));
+    file.seekg(0, std::ios::beg);
+    if (!file.read(reinterpret_cast<char*>(spirv.data()), size)) {
+        return std::nullopt;
+    }
+
+    // A truncated or foreign file doesn't start with the SPIR-V magic number
+    constexpr uint32_t spirvMagic = 0x07230203;
+    if (spirv.front() != spirvMagic) {
+        return std::nullopt;
+    }
+
+    std::lock_guard lock(cacheMutex);
+    compiled[key] = spirv;
+    return spirv;
+}
+
+void ShaderCompiler::storeCached(uint64_t key, const std::vector<uint32_t>& spirv) {
+    {
+        std::lock_guard lock(cacheMutex);
+        compiled[key] = spirv;
+    }
+
+    if (cacheDirectory.empty()) {
+        return;
+    }
+
+    // The cache only saves time, so failing to write it is never an error
+    std::error_code error;
+    const std::filesystem::path directory(cacheDirectory);
+    std::filesystem::create_directories(directory, error);
+
+    std::ostringstream name;
+    name << std::hex << key << ".spv";
+    const std::filesystem::path target = directory / name.str();
+
+    // Several threads may finish the same shader, each writes its own file before renaming
+    std::ostringstream temporaryName;
+    temporaryName << name.str() << "." << std::this_thread::get_id() << ".tmp";
+    const std::filesystem::path temporary = directory / temporaryName.str();
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file || !file.write(reinterpret_cast<const char*>(spirv.data()),
+                                 static_cast<std::streamsize>(spirv.size() * sizeof(uint32_t)))) {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, target, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+    }
+}
+
+std::vector<uint32_t> ShaderCompiler::compile(const ShaderSource& source) {
+    const uint64_t key = hash(source);
+    if (auto cached = findCached(key)) {
+        return std::move(*cached);
+    }
+
+    std::vector<uint32_t> spirv = compileGlsl(source);
+    storeCached(key, spirv);
+    return spirv;
+}
+
+std::future<std::vector<uint32_t>> ShaderCompiler::compileAsync(ShaderSource source) {
+    auto task = std::make_shared<std::packaged_task<std::vector<uint32_t>()>>(
+        [this, source = std::move(source)] { return compile(source); });
+    std::future<std::vector<uint32_t>> result = task->get_future();
+    {
+        std::lock_guard lock(jobMutex);
+        jobs.emplace_back([task] { (*task)(); });
+    }
+    jobAvailable.notify_one();
+    return result;
+}
+
+std::vector<std::vector<uint32_t>> ShaderCompiler::compileBatch(const std::vector<ShaderSource>& sources) {
+    std::vector<std::future<std::vector<uint32_t>>> pending;
+    pending.reserve(sources.size());
+    for (const auto& source : sources) {
+        pending.push_back(compileAsync(source));
+    }
+
+    // get rethrows the first compile error of the batch
+    std::vector<std::vector<uint32_t>> results;
+    results.reserve(sources.size());
+    for (auto& future : pending) {
+        results.push_back(future.get());
+    }
+    return results;
+}
+
+std::vector<uint32_t> ShaderCompiler::compileGlsl(const ShaderSource& source) {
+    const EShLanguage stage = toGlslShaderType(source.type);
+
+    const char* shaderStrings[1];
+    shaderStrings[0] = source.source.c_str();
+
+    glslang::TShader shader(stage);
+    shader.setStrings(shaderStrings, 1);
+
+    std::string preamble;
+    for (const auto& [name, value] : source.defines) {
+        preamble += "#define " + name + " " + value + "\n";
+    }
+    if (!preamble.empty()) {
+        shader.setPreamble(preamble.c_str());
+    }
+
+    shader.setEnvInput(glslang::EShSourceGlsl, stage, glslang::EShClientVulkan, 450);
+    shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_2);
+    shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_5);
+
+    auto messages = static_cast<EShMessages>(EShMsgSpvRules | EShMsgVulkanRules);
+
+    if (!shader.parse(&getResources(), 450, false, messages)) {
+        std::string errorMessage = std::string(shader.getInfoLog()) + "\n" + shader.getInfoDebugLog();
+        throw std::runtime_error("Failed to parse shader: " + errorMessage);
+    }
+
+    glslang::TProgram program;
+    program.addShader(&shader);
+
+    if (!program.link(messages)) {
+        std::string errorMessage = std::string(program.getInfoLog()) + "\n" + program.getInfoDebugLog();
+        throw std::runtime_error("Failed to link shader program: " + errorMessage);
+    }
+
+    std::vector<uint32_t> spirv;
+    glslang::GlslangToSpv(*program.getIntermediate(stage), spirv);
+    return spirv;
+}
+
+#endif
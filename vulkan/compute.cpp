@@ -0,0 +1,128 @@
+/*
+* compute.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <stdexcept>
+
+using namespace zen;
+
+void ComputePipeline::attachShader(ShaderModule& shader) {
+    if (shader.type != ShaderType::Compute) {
+        throw std::runtime_error("Compute pipelines only accept compute shaders");
+    }
+    if (shader.shaderStageInfo.module == VK_NULL_HANDLE) {
+        throw std::runtime_error("The compute shader must be compiled before attaching it");
+    }
+    this->shader = std::ref(shader);
+}
+
+void ComputePipeline::attachUniformBlock(UniformBlock& uniformBlock) {
+    resources.attachUniformBlock(uniformBlock);
+}
+
+void ComputePipeline::attachStorageBuffer(const Buffer& buffer) {
+    resources.attachStorageBuffer(buffer);
+}
+
+void ComputePipeline::attachStorageImage(const Image& image) {
+    resources.attachStorageImage(image);
+}
+
+void ComputePipeline::makePipeline() {
+    if (!shader.has_value()) {
+        throw std::runtime_error("A compute shader must be attached before making the pipeline");
+    }
+    if (descriptorSet == VK_NULL_HANDLE) {
+        resources.build(); // Without resources there is no set, but the layout still gets an empty one
+        descriptorSet = resources.descriptorSet;
+    }
+    VkDescriptorSetLayout descriptorSetLayout = resources.getLayout();
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pPushConstantRanges = nullptr;
+
+    VkResult result = vkCreatePipelineLayout(device.logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute pipeline layout. Error: " +
+            zen::getVulkanErrorString(result));
+    }
+
+    VkComputePipelineCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    info.stage = shader->get().shaderStageInfo;
+    info.layout = pipelineLayout;
+
+    result = vkCreateComputePipelines(device.logicalDevice, device.getPipelineCache(), 1, &info, nullptr,
+                                      &pipeline);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute pipeline. Error: " + zen::getVulkanErrorString(result));
+    }
+}
+
+void ComputePipeline::resolveUniformOffsets(std::vector<uint32_t>& offsets) const {
+    resources.resolveUniformOffsets(offsets);
+}
+
+void ComputePipeline::destroy() {
+    if (pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device.logicalDevice, pipeline, nullptr);
+        pipeline = VK_NULL_HANDLE;
+    }
+    if (pipelineLayout != VK_NULL_HANDLE) {
+        vkDestroyPipelineLayout(device.logicalDevice, pipelineLayout, nullptr);
+        pipelineLayout = VK_NULL_HANDLE;
+    }
+    // The layout stays with the device's cache, only the set goes back
+    resources.release();
+    descriptorSet = VK_NULL_HANDLE;
+}
+
+void zen::getImageAccess(VkImageLayout layout, VkAccessFlags& access, VkPipelineStageFlags& stages) {
+    switch (layout) {
+    case VK_IMAGE_LAYOUT_UNDEFINED:
+        access = 0;
+        stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_GENERAL:
+        // Storage images are read and written by compute shaders
+        access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+        access = VK_ACCESS_SHADER_READ_BIT;
+        stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+        access = VK_ACCESS_TRANSFER_WRITE_BIT;
+        stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+        access = VK_ACCESS_TRANSFER_READ_BIT;
+        stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+        access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        break;
+    default:
+        // We don't know who uses it, so we make it visible to everyone
+        access = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        break;
+    }
+}
+
+#endif
@@ -0,0 +1,531 @@
+/*
+* descriptors.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace zen;
+
+DescriptorLayoutCache::~DescriptorLayoutCache() {
+    for (auto& [key, layout] : layouts) {
+        vkDestroyDescriptorSetLayout(device.logicalDevice, layout, nullptr);
+    }
+    layouts.clear();
+}
+
+VkDescriptorSetLayout DescriptorLayoutCache::getLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+    // Immutable samplers would make the handles part of the signature, we don't hand them out
+    for (const auto& binding : bindings) {
+        if (binding.pImmutableSamplers != nullptr) {
+            throw std::runtime_error("Cached descriptor layouts don't support immutable samplers");
+        }
+    }
+
+    // The binding order doesn't change the layout, so the key doesn't depend on it either
+    std::vector<VkDescriptorSetLayoutBinding> sorted = bindings;
+    std::ranges::sort(sorted, [](const auto& a, const auto& b) { return a.binding < b.binding; });
+
+    std::vector<uint32_t> key;
+    key.reserve(sorted.size() * 4);
+    for (const auto& binding : sorted) {
+        key.push_back(binding.binding);
+        key.push_back(static_cast<uint32_t>(binding.descriptorType));
+        key.push_back(binding.descriptorCount);
+        key.push_back(binding.stageFlags);
+    }
+
+    std::lock_guard lock(mutex);
+    if (auto it = layouts.find(key); it != layouts.end()) {
+        return it->second;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(sorted.size());
+    layoutInfo.pBindings = sorted.data();
+
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    VkResult result = vkCreateDescriptorSetLayout(device.logicalDevice, &layoutInfo, nullptr, &layout);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout. Error: " + zen::getVulkanErrorString(result));
+    }
+    layouts.emplace(std::move(key), layout);
+    return layout;
+}
+
+size_t DescriptorLayoutCache::getLayoutCount() {
+    std::lock_guard lock(mutex);
+    return layouts.size();
+}
+
+DescriptorAllocator::~DescriptorAllocator() {
+    // Destroying the pools frees every set allocated from them
+    if (currentPool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(device.logicalDevice, currentPool, nullptr);
+    }
+    for (VkDescriptorPool pool : usedPools) {
+        vkDestroyDescriptorPool(device.logicalDevice, pool, nullptr);
+    }
+    for (VkDescriptorPool pool : freePools) {
+        vkDestroyDescriptorPool(device.logicalDevice, pool, nullptr);
+    }
+}
+
+VkDescriptorPool DescriptorAllocator::grabPool() {
+    if (!freePools.empty()) {
+        VkDescriptorPool pool = freePools.back();
+        freePools.pop_back();
+        return pool;
+    }
+
+    if (nextPoolSize == 0) {
+        nextPoolSize = std::max(setsPerPool, 1u);
+    }
+    const uint32_t maxSets = nextPoolSize;
+    nextPoolSize = std::min(nextPoolSize * 2, std::max(maxSetsPerPool, setsPerPool));
+
+    // Rough shares of what a set usually holds, per set in the pool
+    const std::vector<std::pair<VkDescriptorType, float>> ratios = {
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2.0f},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f},
+    };
+
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for (const auto& [type, ratio] : ratios) {
+        poolSizes.push_back({
+            .type = type,
+            .descriptorCount = static_cast<uint32_t>(ratio * static_cast<float>(maxSets))
+        });
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = freeable ? VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT : 0;
+    poolInfo.maxSets = maxSets;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    VkResult result = vkCreateDescriptorPool(device.logicalDevice, &poolInfo, nullptr, &pool);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor pool. Error: " + zen::getVulkanErrorString(result));
+    }
+    return pool;
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+    std::lock_guard lock(mutex);
+    if (currentPool == VK_NULL_HANDLE) {
+        currentPool = grabPool();
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = currentPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    VkResult result = vkAllocateDescriptorSets(device.logicalDevice, &allocInfo, &set);
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+        // The pool is full, we retire it until the next reset and try once more with a fresh one
+        usedPools.push_back(currentPool);
+        currentPool = grabPool();
+        allocInfo.descriptorPool = currentPool;
+        result = vkAllocateDescriptorSets(device.logicalDevice, &allocInfo, &set);
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate descriptor set. Error: " + zen::getVulkanErrorString(result));
+    }
+    if (freeable) {
+        owners[set] = currentPool;
+        liveSets[currentPool]++;
+    }
+    return set;
+}
+
+void DescriptorAllocator::free(VkDescriptorSet set) {
+    std::lock_guard lock(mutex);
+    const auto owner = owners.find(set);
+    if (owner == owners.end()) {
+        throw std::runtime_error("The descriptor set was not allocated from this allocator or was already freed");
+    }
+    const VkDescriptorPool pool = owner->second;
+    owners.erase(owner);
+    vkFreeDescriptorSets(device.logicalDevice, pool, 1, &set);
+
+    // A retired pool is never allocated from again, so once it is empty we recycle it whole
+    if (--liveSets[pool] == 0 && pool != currentPool) {
+        liveSets.erase(pool);
+        std::erase(usedPools, pool);
+        vkResetDescriptorPool(device.logicalDevice, pool, 0);
+        freePools.push_back(pool);
+    }
+}
+
+void DescriptorAllocator::resetPools() {
+    std::lock_guard lock(mutex);
+    if (currentPool != VK_NULL_HANDLE) {
+        usedPools.push_back(currentPool);
+        currentPool = VK_NULL_HANDLE;
+    }
+    for (VkDescriptorPool pool : usedPools) {
+        vkResetDescriptorPool(device.logicalDevice, pool, 0);
+        freePools.push_back(pool);
+    }
+    usedPools.clear();
+    owners.clear();
+    liveSets.clear();
+}
+
+size_t DescriptorAllocator::getPoolCount() {
+    std::lock_guard lock(mutex);
+    return usedPools.size() + freePools.size() + (currentPool != VK_NULL_HANDLE ? 1 : 0);
+}
+
+void ResourceSet::checkMutable() const {
+    if (built) {
+        throw std::runtime_error("A built resource set is immutable, use buildForFrame for changing resources");
+    }
+}
+
+void ResourceSet::attachUniformBlock(const UniformBlock& uniformBlock) {
+    checkMutable();
+    uniformBlocks.push_back(uniformBlock);
+    layout = VK_NULL_HANDLE;
+}
+
+void ResourceSet::attachTexture(const Texture& texture) {
+    checkMutable();
+    textures.push_back(texture.imageDescriptorInfo);
+    layout = VK_NULL_HANDLE;
+}
+
+void ResourceSet::attachStorageBuffer(const Buffer& buffer) {
+    checkMutable();
+    if (!hasUsage(buffer.usage, BufferUsage::Storage)) {
+        throw std::runtime_error("Storage buffer bindings need a buffer created with BufferUsage::Storage");
+    }
+    storageBuffers.push_back({
+        .buffer = buffer.buffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE
+    });
+    layout = VK_NULL_HANDLE;
+}
+
+void ResourceSet::attachStorageImage(const Image& image) {
+    checkMutable();
+    storageImages.push_back({
+        .sampler = VK_NULL_HANDLE,
+        .imageView = image.view,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL
+    });
+    layout = VK_NULL_HANDLE;
+}
+
+void ResourceSet::attachUniformBlock(UniformBlockHandle uniformBlock) {
+    attachUniformBlock(device.getResources().uniformBlocks.get(uniformBlock));
+}
+
+void ResourceSet::attachTexture(TextureHandle texture) {
+    attachTexture(device.getResources().textures.get(texture));
+}
+
+void ResourceSet::attachStorageBuffer(BufferHandle buffer) {
+    attachStorageBuffer(device.getResources().buffers.get(buffer));
+}
+
+void ResourceSet::setTexture(uint32_t index, const Texture& texture) {
+    checkMutable();
+    if (index >= textures.size()) {
+        throw std::runtime_error("Texture " + std::to_string(index) + " was never attached to the resource set");
+    }
+    textures[index] = texture.imageDescriptorInfo;
+}
+
+void ResourceSet::setTexture(uint32_t index, TextureHandle texture) {
+    setTexture(index, device.getResources().textures.get(texture));
+}
+
+bool ResourceSet::isEmpty() const {
+    return uniformBlocks.empty() && textures.empty() && storageBuffers.empty() && storageImages.empty();
+}
+
+VkDescriptorSetLayout ResourceSet::getLayout() {
+    if (layout != VK_NULL_HANDLE) {
+        return layout;
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    uint32_t binding = 0;
+    const auto addBindings = [&](size_t count, VkDescriptorType type)
+    {
+        for (size_t i = 0; i < count; i++) {
+            bindings.push_back({
+                .binding = binding++,
+                .descriptorType = type,
+                .descriptorCount = 1,
+                .stageFlags = stages,
+                .pImmutableSamplers = nullptr
+            });
+        }
+    };
+    addBindings(uniformBlocks.size(), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC); // Offsets come from the arena
+    addBindings(textures.size(), VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    addBindings(storageBuffers.size(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    addBindings(storageImages.size(), VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+
+    layout = device.getDescriptorLayoutCache().getLayout(bindings);
+    return layout;
+}
+
+void ResourceSet::write(VkDescriptorSet set) const {
+    std::vector<VkWriteDescriptorSet> descriptorWrites;
+    uint32_t binding = 0;
+
+    for (const auto& block : uniformBlocks) {
+        descriptorWrites.push_back({
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = binding++,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .pBufferInfo = &block.descriptorBufferInfo
+        });
+    }
+    for (const auto& texture : textures) {
+        // Ensure texture has valid descriptor info
+        if (texture.imageView == VK_NULL_HANDLE || texture.sampler == VK_NULL_HANDLE) {
+            throw std::runtime_error("Texture descriptor info not properly initialized");
+        }
+        descriptorWrites.push_back({
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = binding++,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &texture
+        });
+    }
+    for (const auto& buffer : storageBuffers) {
+        descriptorWrites.push_back({
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = binding++,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer
+        });
+    }
+    for (const auto& image : storageImages) {
+        descriptorWrites.push_back({
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = binding++,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .pImageInfo = &image
+        });
+    }
+
+    vkUpdateDescriptorSets(device.logicalDevice, static_cast<uint32_t>(descriptorWrites.size()),
+                           descriptorWrites.data(), 0, nullptr);
+}
+
+void ResourceSet::build() {
+    checkMutable();
+    if (isEmpty()) {
+        return; // Nothing to bind, pipelines fall back to an empty layout
+    }
+    descriptorSet = device.getDescriptorAllocator().allocate(getLayout());
+    write(descriptorSet);
+    built = true;
+}
+
+void ResourceSet::release() {
+    if (!built) {
+        return; // Sets from buildForFrame go back with their frame
+    }
+    device.getDescriptorAllocator().free(descriptorSet);
+    descriptorSet = VK_NULL_HANDLE;
+    built = false;
+}
+
+void ResourceSet::buildForFrame(uint32_t frameIndex) {
+    if (isEmpty()) {
+        return;
+    }
+    // The previous set may still be read by a frame in flight, so we always write a new one
+    descriptorSet = device.getFrameDescriptorAllocator(frameIndex).allocate(getLayout());
+    write(descriptorSet);
+}
+
+void ResourceSet::resolveUniformOffsets(std::vector<uint32_t>& offsets) const {
+    offsets.clear();
+    offsets.reserve(uniformBlocks.size());
+    for (const auto& block : uniformBlocks) {
+        offsets.push_back(block.resolveOffset());
+    }
+}
+
+BindlessTable::BindlessTable(const Device& device, uint32_t capacity) : device(device) {
+    if (!device.supportsDescriptorIndexing) {
+        throw std::runtime_error("Bindless textures need VK_EXT_descriptor_indexing");
+    }
+
+    // The table has to fit the update after bind limits, not the regular ones. Combined image samplers
+    // count as both a sampled image and a sampler, in the set and per stage.
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties{};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &indexingProperties;
+    vkGetPhysicalDeviceProperties2(device.physicalDevice, &properties);
+    this->capacity = std::min({capacity, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+                               indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                               indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+                               indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers});
+    if (this->capacity == 0) {
+        throw std::runtime_error("The bindless texture table needs at least one slot");
+    }
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = this->capacity;
+    binding.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Empty slots are never read, and slots not used by pending work may be written any time
+    const VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo{};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    flagsInfo.bindingCount = 1;
+    flagsInfo.pBindingFlags = &bindingFlags;
+
+    // The flags are not part of the cache key, so this layout is not shared through the layout cache
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &flagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    VkResult result = vkCreateDescriptorSetLayout(device.logicalDevice, &layoutInfo, nullptr, &layout);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create bindless descriptor set layout. Error: " +
+            zen::getVulkanErrorString(result));
+    }
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = this->capacity;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+
+    result = vkCreateDescriptorPool(device.logicalDevice, &poolInfo, nullptr, &pool);
+    if (result != VK_SUCCESS) {
+        vkDestroyDescriptorSetLayout(device.logicalDevice, layout, nullptr);
+        throw std::runtime_error("Failed to create bindless descriptor pool. Error: " +
+            zen::getVulkanErrorString(result));
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    result = vkAllocateDescriptorSets(device.logicalDevice, &allocInfo, &set);
+    if (result != VK_SUCCESS) {
+        vkDestroyDescriptorPool(device.logicalDevice, pool, nullptr);
+        vkDestroyDescriptorSetLayout(device.logicalDevice, layout, nullptr);
+        throw std::runtime_error("Failed to allocate bindless descriptor set. Error: " +
+            zen::getVulkanErrorString(result));
+    }
+}
+
+BindlessTable::~BindlessTable() {
+    // The set goes away with its pool
+    vkDestroyDescriptorPool(device.logicalDevice, pool, nullptr);
+    vkDestroyDescriptorSetLayout(device.logicalDevice, layout, nullptr);
+}
+
+uint32_t BindlessTable::add(const Texture& texture) {
+    std::lock_guard lock(mutex);
+
+    // Removed slots come back once the last frame that could sample them has retired
+    const uint64_t serial = device.getFrameSerial();
+    while (!retiredSlots.empty() && retiredSlots.front().first + device.framesInFlight <= serial) {
+        freeSlots.push_back(retiredSlots.front().second);
+        retiredSlots.pop_front();
+    }
+
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    } else if (nextSlot < capacity) {
+        slot = nextSlot++;
+    } else {
+        throw std::runtime_error("The bindless texture table is full (" + std::to_string(capacity) + " slots)");
+    }
+
+    write(slot, texture);
+    return slot;
+}
+
+void BindlessTable::update(uint32_t slot, const Texture& texture) {
+    std::lock_guard lock(mutex);
+    if (slot >= nextSlot) {
+        throw std::runtime_error("Bindless slot " + std::to_string(slot) + " was never added");
+    }
+    write(slot, texture);
+}
+
+void BindlessTable::remove(uint32_t slot) {
+    std::lock_guard lock(mutex);
+    if (slot >= nextSlot) {
+        throw std::runtime_error("Bindless slot " + std::to_string(slot) + " was never added");
+    }
+    // The descriptor stays as it is, a partially bound table only cares about what shaders index
+    retiredSlots.emplace_back(device.getFrameSerial(), slot);
+}
+
+void BindlessTable::write(uint32_t slot, const Texture& texture) {
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = set;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = slot;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.pImageInfo = &texture.imageDescriptorInfo;
+
+    vkUpdateDescriptorSets(device.logicalDevice, 1, &descriptorWrite, 0, nullptr);
+}
+
+#endif
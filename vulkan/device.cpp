@@ -17,6 +17,7 @@
 #include <vector>
 #include <iostream>
 #include <optional>
+#include <algorithm>
 
 using namespace zen;
 
@@ -28,7 +29,8 @@ DevicePicker DevicePicker::makeDefaultPicker() {
             return 0.0f;
         }
 
-        if (!device.supportsSwapchain()) {
+        // Headless devices never present, so they don't need a swapchain
+        if (!device.instance.isHeadless() && !device.supportsSwapchain()) {
             return 0.0f;
         }
 
@@ -68,12 +70,73 @@ DevicePicker DevicePicker::makeDefaultPicker() {
 
 std::unique_ptr<Device> Device::makeDefaultDevice(Instance instance) {
     // We create a default device with the default picker
-    auto device = std::make_unique<Device>(Device(instance, DevicePicker::makeDefaultPicker()));
+    auto device = std::make_unique<Device>(instance, DevicePicker::makeDefaultPicker());
     device->init();
     return device;
 }
 
+Device::~Device() {
+    if (logicalDevice == VK_NULL_HANDLE) {
+        return; // Temporary devices used for picking never create a logical device
+    }
+
+    // First, its callbacks and coroutines still run and may use anything else the device owns
+    jobScheduler.reset();
+
+    // Nothing may still be executing when we destroy the synchronization objects
+    vkDeviceWaitIdle(logicalDevice);
+
+    for (auto& frame : frames) {
+        if (frame.inFlightFence != VK_NULL_HANDLE) {
+            vkDestroyFence(logicalDevice, frame.inFlightFence, nullptr);
+        }
+    }
+    frames.clear();
+
+    if (commandPool.has_value()) {
+        vkDestroyCommandPool(logicalDevice, commandPool.value(), nullptr);
+        commandPool = std::nullopt;
+    }
+
+    // Destroying a pool frees the secondaries allocated from it
+    for (auto& [thread, pools] : threadPools) {
+        for (auto& pool : pools) {
+            vkDestroyCommandPool(logicalDevice, pool.pool, nullptr);
+        }
+    }
+    threadPools.clear();
+
+    readbackPool.reset(); // Its command pool and buffers go before the allocator
+    collectRetiredBuffers(true);
+    resources.reset(); // Plain objects, their Vulkan handles were the caller's to destroy
+    destroyFramebuffers();
+
+    // Sets and layouts go before the device, nothing executes anymore
+    bindlessTable.reset();
+    profiler.reset();
+    frameDescriptorAllocators.clear();
+    descriptorAllocator.reset();
+    descriptorLayoutCache.reset();
+
+    pipelineStateCache.reset(); // Joins its workers before the VkPipelineCache they compile into goes
+    pipelineCache.reset(); // Saves what this run compiled
+    uploadBatcher.reset(); // Waits for the pending uploads and releases their staging memory
+    uniformArena.reset();
+    stagingRing.reset();
+    allocator.reset();
+
+    vkDestroyDevice(logicalDevice, nullptr);
+    logicalDevice = VK_NULL_HANDLE;
+}
+
 void Device::init() {
+    if (instance.isHeadless()) {
+        // Without a surface there is nothing to present to
+        std::erase_if(extensions, [](const char* extension) {
+            return std::string(extension) == VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+        });
+    }
+
     // First, we need to enumerate the physical devices available
     uint32_t deviceCount = 0;
     vkEnumeratePhysicalDevices(instance.instance, &deviceCount, nullptr);
@@ -93,6 +156,7 @@ void Device::init() {
         vkGetPhysicalDeviceFeatures(device, &features);
 
         Device tempDevice{instance};
+        tempDevice.extensions = extensions; // The picker checks the extensions we are going to enable
         tempDevice.physicalDevice = device;
         tempDevice.physicalDeviceProperties = properties;
         tempDevice.physicalDeviceFeatures = features;
@@ -112,12 +176,33 @@ void Device::init() {
     // Once initialized the physical device, we can retrieve its properties and features
     vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
     vkGetPhysicalDeviceFeatures(physicalDevice, &physicalDeviceFeatures);
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &physicalDeviceMemoryProperties);
 
     // We need to find the queue families that support graphics, compute, and transfer operations
     findQueueFamilies();
 
     // We initialize the logical device with the queue families we found
     initializeLogicalDevice();
+
+    // Every resource allocates its memory through the device allocator
+    allocator = std::make_unique<MemoryAllocator>(*this);
+    stagingRing = std::make_unique<StagingRing>(*this);
+    uploadBatcher = std::make_unique<UploadBatcher>(*this);
+    if (supportsTimelineSemaphore) {
+        jobScheduler = std::make_unique<JobScheduler>(*this);
+    }
+    pipelineCache = std::make_unique<PipelineCache>(*this, pipelineCachePath);
+    pipelineStateCache = std::make_unique<PipelineStateCache>(*this);
+    shaderCompiler = std::make_unique<ShaderCompiler>(shaderCacheDirectory);
+    descriptorLayoutCache = std::make_unique<DescriptorLayoutCache>(*this);
+    descriptorAllocator = std::make_unique<DescriptorAllocator>(*this, true); // Pipelines give their sets back
+    if (supportsDescriptorIndexing) {
+        bindlessTable = std::make_unique<BindlessTable>(*this, bindlessTextureCapacity);
+        bindlessTextureCapacity = bindlessTable->getCapacity();
+    }
+    profiler = std::make_unique<Profiler>(*this);
+    readbackPool = std::make_unique<ReadbackPool>(*this);
+    resources = std::make_unique<ResourceRegistries>();
 }
 
 void Device::findQueueFamilies() {
@@ -143,8 +228,11 @@ void Device::findQueueFamilies() {
             queue.capabilities.push_back(DeviceCapabilities::Transfer);
         }
 
+        // Headless instances have no surface to ask about, their families never present
         VkBool32 present = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, instance.surface, &present);
+        if (!instance.isHeadless()) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, instance.surface, &present);
+        }
         if (present) {
             queue.capabilities.push_back(DeviceCapabilities::Present);
         }
@@ -164,13 +252,49 @@ void Device::findQueueFamilies() {
         throw std::runtime_error("No graphics queue found for the physical device");
     }
 
-    if (std::none_of(queues.begin(), queues.end(), [](const CoreQueue& q)
+    if (!instance.isHeadless() && std::none_of(queues.begin(), queues.end(), [](const CoreQueue& q)
     {
         return std::find(q.capabilities.begin(), q.capabilities.end(), DeviceCapabilities::Present) !=
             q.capabilities.end();
     })) {
         throw std::runtime_error("No present queue found for the physical device");
     }
+
+    const auto supports = [](const CoreQueue& queue, DeviceCapabilities capability) {
+        return std::find(queue.capabilities.begin(), queue.capabilities.end(), capability) !=
+            queue.capabilities.end();
+    };
+    const auto findFamily = [&](const std::function<bool(const CoreQueue&)>& predicate) -> std::optional<uint32_t> {
+        for (const auto& queue : queues) {
+            if (predicate(queue)) {
+                return queue.familyIndex;
+            }
+        }
+        return std::nullopt;
+    };
+
+    const uint32_t graphicsFamily = *findFamily([&](const CoreQueue& q) {
+        return supports(q, DeviceCapabilities::Graphics);
+    });
+
+    // We prefer families without graphics for compute, so async work doesn't queue behind frames
+    const uint32_t computeFamily = findFamily([&](const CoreQueue& q) {
+        return supports(q, DeviceCapabilities::Compute) && !supports(q, DeviceCapabilities::Graphics);
+    }).value_or(graphicsFamily);
+
+    // And for transfers we look for the copy engines first, the families that can only transfer
+    const uint32_t transferFamily = findFamily([&](const CoreQueue& q) {
+        return supports(q, DeviceCapabilities::Transfer) && !supports(q, DeviceCapabilities::Graphics) &&
+            !supports(q, DeviceCapabilities::Compute);
+    }).value_or(findFamily([&](const CoreQueue& q) {
+        return supports(q, DeviceCapabilities::Transfer) && !supports(q, DeviceCapabilities::Graphics);
+    }).value_or(graphicsFamily));
+
+    queueRoles = {
+        {QueueRole::Graphics, graphicsFamily},
+        {QueueRole::Compute, computeFamily},
+        {QueueRole::Transfer, transferFamily},
+    };
 }
 
 void Device::initializeLogicalDevice() {
@@ -199,9 +323,135 @@ void Device::initializeLogicalDevice() {
     }
 
     physicalDeviceFeatures.samplerAnisotropy = VK_TRUE; // Enable anisotropic filtering
+    // Every supported feature stays on, the profiler relies on inheritedQueries for secondaries
+
+    // Optional extensions are only enabled when the device has them
+    const auto enableExtension = [&](const char* name) {
+        if (std::none_of(extensions.begin(), extensions.end(), [&](const char* extension) {
+            return std::string(extension) == name;
+        })) {
+            extensions.push_back(name);
+        }
+    };
+
+    supportsDrawIndirectCount = supportsExtensions({VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME});
+    if (supportsDrawIndirectCount) {
+        enableExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+
+    // Budgets are only queried, the extension has no features to turn on. Instances are made for
+    // 1.0, where properties2 is only there when the instance enabled its KHR extension.
+    getMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+        vkGetInstanceProcAddr(instance.instance, "vkGetPhysicalDeviceMemoryProperties2KHR"));
+    supportsMemoryBudget = getMemoryProperties2 != nullptr &&
+        supportsExtensions({VK_EXT_MEMORY_BUDGET_EXTENSION_NAME});
+    if (supportsMemoryBudget) {
+        enableExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+
+    // Mapped asset packages can then back transfer sources without a staging copy
+    supportsHostMemoryImport = supportsExtensions({VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
+                                                   VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME});
+    if (supportsHostMemoryImport) {
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties{};
+        hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &hostProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+        minImportedHostPointerAlignment = hostProperties.minImportedHostPointerAlignment;
+
+        enableExtension(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+        enableExtension(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    }
+
+    // One counter per queue lets jobs depend on work from any other queue
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    supportsTimelineSemaphore = supportsExtensions({VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME});
+    if (supportsTimelineSemaphore) {
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &timelineFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+        supportsTimelineSemaphore = timelineFeatures.timelineSemaphore;
+    }
+    if (supportsTimelineSemaphore) {
+        timelineFeatures = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR, nullptr, VK_TRUE};
+        enableExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    }
+
+    // The bindless table needs a partially bound, update after bind array indexed with non uniform values
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    supportsDescriptorIndexing = supportsExtensions({VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+                                                     VK_KHR_MAINTENANCE3_EXTENSION_NAME});
+    if (supportsDescriptorIndexing) {
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT available{};
+        available.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &available;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+        supportsDescriptorIndexing = available.shaderSampledImageArrayNonUniformIndexing &&
+            available.descriptorBindingPartiallyBound && available.descriptorBindingSampledImageUpdateAfterBind &&
+            available.descriptorBindingUpdateUnusedWhilePending && available.runtimeDescriptorArray;
+    }
+    if (supportsDescriptorIndexing) {
+        // We only turn on what we use, the rest of the features stay off
+        indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+        enableExtension(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        enableExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    }
+
+    // Present ids let us wait for a given present to reach the screen, which paces the CPU
+    VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+    presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+    presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    supportsPresentWait = !instance.isHeadless() &&
+        supportsExtensions({VK_KHR_PRESENT_ID_EXTENSION_NAME, VK_KHR_PRESENT_WAIT_EXTENSION_NAME});
+    if (supportsPresentWait) {
+        presentIdFeatures.pNext = &presentWaitFeatures;
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &presentIdFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+        supportsPresentWait = presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+        presentIdFeatures.pNext = nullptr;
+    }
+    if (supportsPresentWait) {
+        presentIdFeatures = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR, nullptr, VK_TRUE};
+        presentWaitFeatures = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR, nullptr, VK_TRUE};
+        enableExtension(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+        enableExtension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    }
+
+    // Every enabled feature struct goes into the create info's chain
+    void* featureChain = nullptr;
+    if (supportsDescriptorIndexing) {
+        indexingFeatures.pNext = featureChain;
+        featureChain = &indexingFeatures;
+    }
+    if (supportsTimelineSemaphore) {
+        timelineFeatures.pNext = featureChain;
+        featureChain = &timelineFeatures;
+    }
+    if (supportsPresentWait) {
+        presentWaitFeatures.pNext = featureChain;
+        presentIdFeatures.pNext = &presentWaitFeatures;
+        featureChain = &presentIdFeatures;
+    }
 
     VkDeviceCreateInfo deviceCreateInfo{};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.pNext = featureChain;
     deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
     deviceCreateInfo.pEnabledFeatures = &physicalDeviceFeatures; // We set the physical device features
@@ -213,6 +463,34 @@ void Device::initializeLogicalDevice() {
         throw std::runtime_error("Failed to create logical device. Error: " + zen::getVulkanErrorString(result));
     }
 
+    if (supportsDrawIndirectCount) {
+        cmdDrawIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndirectCountKHR>(
+            vkGetDeviceProcAddr(logicalDevice, "vkCmdDrawIndirectCountKHR"));
+        cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+            vkGetDeviceProcAddr(logicalDevice, "vkCmdDrawIndexedIndirectCountKHR"));
+        supportsDrawIndirectCount = cmdDrawIndirectCount != nullptr && cmdDrawIndexedIndirectCount != nullptr;
+    }
+
+    if (supportsPresentWait) {
+        waitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR>(
+            vkGetDeviceProcAddr(logicalDevice, "vkWaitForPresentKHR"));
+        supportsPresentWait = waitForPresent != nullptr;
+    }
+
+    if (supportsHostMemoryImport) {
+        getMemoryHostPointerProperties = reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+            vkGetDeviceProcAddr(logicalDevice, "vkGetMemoryHostPointerPropertiesEXT"));
+        supportsHostMemoryImport = getMemoryHostPointerProperties != nullptr;
+    }
+
+    if (supportsTimelineSemaphore) {
+        getSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(
+            vkGetDeviceProcAddr(logicalDevice, "vkGetSemaphoreCounterValueKHR"));
+        waitForSemaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(
+            vkGetDeviceProcAddr(logicalDevice, "vkWaitSemaphoresKHR"));
+        supportsTimelineSemaphore = getSemaphoreCounterValue != nullptr && waitForSemaphores != nullptr;
+    }
+
     for (auto& queue : queues) {
         if (queue.capabilities.empty()) {
             continue; // Skip queues without capabilities
@@ -221,6 +499,7 @@ void Device::initializeLogicalDevice() {
         VkQueue vkQueue;
         vkGetDeviceQueue(logicalDevice, queue.familyIndex, 0, &vkQueue); // We get the first queue of the family
         queue.queue = vkQueue; // Set the Vulkan queue handle
+        submitMutexes.try_emplace(vkQueue, std::make_unique<std::mutex>());
     }
 }
 
@@ -317,9 +596,154 @@ bool Device::supportsRaytracing() const {
     return rayTracingFeatures.rayTracingPipeline;
 }
 
-Presentable Device::makePresentable() const {
+Presentable Device::makePresentable(const PresentConfiguration& configuration) {
     // We create a presentable object that can be used to present images to the swapchain
-    return {*this, instance};
+    return {*this, instance, configuration};
+}
+
+void Device::makeFramebuffers(VkRenderPass renderPass, const Presentable& presentable) {
+    makeFramebuffers(renderPass, presentable, framebufferAttachments);
+}
+
+void Device::makeFramebuffers(VkRenderPass renderPass, const Presentable& presentable,
+                              const FramebufferAttachments& attachments) {
+    destroyFramebuffers();
+    framebufferRenderPass = renderPass;
+    framebufferAttachments = attachments;
+
+    // Only one frame renders at a time, so every swapchain image shares the same depth and samples
+    const bool multisampled = attachments.samples != VK_SAMPLE_COUNT_1_BIT;
+    if (multisampled) {
+        multisampleImage.create(*this, presentable.extent, presentable.format, attachments.samples);
+    }
+    if (attachments.hasDepth()) {
+        depthImage.create(*this, presentable.extent, attachments.depthFormat, attachments.samples);
+    }
+
+    framebuffers.resize(presentable.images.size());
+    for (size_t i = 0; i < presentable.images.size(); i++) {
+        // Same order as RenderPass::createPass: color, depth, then the resolve target
+        std::vector<VkImageView> attachmentViews;
+        attachmentViews.push_back(multisampled ? multisampleImage.view : presentable.images[i].view);
+        if (attachments.hasDepth()) {
+            attachmentViews.push_back(depthImage.view);
+        }
+        if (multisampled) {
+            attachmentViews.push_back(presentable.images[i].view);
+        }
+
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = renderPass;
+        framebufferInfo.attachmentCount = static_cast<uint32_t>(attachmentViews.size());
+        framebufferInfo.pAttachments = attachmentViews.data();
+        framebufferInfo.width = presentable.extent.width;
+        framebufferInfo.height = presentable.extent.height;
+        framebufferInfo.layers = 1;
+
+        VkResult result = vkCreateFramebuffer(logicalDevice, &framebufferInfo, nullptr, &framebuffers[i].framebuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create framebuffer. Error: " + zen::getVulkanErrorString(result));
+        }
+    }
+}
+
+void Device::destroyFramebuffers() {
+    for (auto& framebuffer : framebuffers) {
+        if (framebuffer.framebuffer != VK_NULL_HANDLE) {
+            vkDestroyFramebuffer(logicalDevice, framebuffer.framebuffer, nullptr);
+        }
+    }
+    framebuffers.clear();
+
+    // They are sized for the swapchain, so they go with its framebuffers
+    depthImage.destroy(*this);
+    multisampleImage.destroy(*this);
+}
+
+void AttachmentImage::create(Device& device, VkExtent2D extent, VkFormat format, VkSampleCountFlagBits samples) {
+    const bool depth = format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT ||
+        format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT ||
+        format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_X8_D24_UNORM_PACK32;
+    const bool stencil = format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT ||
+        format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {extent.width, extent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT |
+        (depth ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = samples;
+
+    VkResult result = vkCreateImage(device.logicalDevice, &imageInfo, nullptr, &image);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create attachment image. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    // Tilers expose lazily allocated memory, which is only committed if the attachment ever leaves the chip
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device.logicalDevice, image, &requirements);
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    const VkMemoryPropertyFlags lazy = properties | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    for (uint32_t i = 0; i < device.physicalDeviceMemoryProperties.memoryTypeCount; i++) {
+        const VkMemoryPropertyFlags flags = device.physicalDeviceMemoryProperties.memoryTypes[i].propertyFlags;
+        if ((requirements.memoryTypeBits & (1u << i)) && (flags & lazy) == lazy) {
+            properties = lazy;
+            break;
+        }
+    }
+    allocation = device.getAllocator().allocateForImage(image, properties, MemoryCategory::Attachment);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = depth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+    if (stencil) {
+        viewInfo.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    result = vkCreateImageView(device.logicalDevice, &viewInfo, nullptr, &view);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create attachment view. Error: " + zen::getVulkanErrorString(result));
+    }
+}
+
+void AttachmentImage::destroy(Device& device) {
+    if (view != VK_NULL_HANDLE) {
+        vkDestroyImageView(device.logicalDevice, view, nullptr);
+        view = VK_NULL_HANDLE;
+    }
+    if (image != VK_NULL_HANDLE) {
+        vkDestroyImage(device.logicalDevice, image, nullptr);
+        image = VK_NULL_HANDLE;
+    }
+    if (allocation.isValid()) {
+        device.getAllocator().free(allocation);
+        allocation = {};
+    }
+}
+
+VkSampleCountFlagBits Device::getMaxSampleCount() const {
+    const VkSampleCountFlags counts = physicalDeviceProperties.limits.framebufferColorSampleCounts &
+        physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+    for (const VkSampleCountFlagBits samples : {VK_SAMPLE_COUNT_64_BIT, VK_SAMPLE_COUNT_32_BIT, VK_SAMPLE_COUNT_16_BIT,
+                                                VK_SAMPLE_COUNT_8_BIT, VK_SAMPLE_COUNT_4_BIT, VK_SAMPLE_COUNT_2_BIT}) {
+        if (counts & samples) {
+            return samples;
+        }
+    }
+    return VK_SAMPLE_COUNT_1_BIT;
 }
 
 Format Device::makeDepthFormat() const {
@@ -342,9 +766,11 @@ Format Device::makeColorFormat() const {
     return colorFormat;
 }
 
-RenderPass Device::makeRenderPass(std::vector<RenderAttachment>& attachments, Presentable& presentable) {
+RenderPass Device::makeRenderPass(std::vector<RenderAttachment>& attachments, Presentable& presentable,
+                                  VkSampleCountFlagBits samples) {
     RenderPass renderPass{};
     renderPass.attachments = std::move(attachments);
+    renderPass.samples = samples;
     renderPass.create(*this, presentable); // We create the render pass with the current device
     return renderPass;
 }
@@ -359,6 +785,24 @@ ShaderModule Device::makeShader(const std::vector<uint32_t>& code, ShaderType ty
     return ShaderModule::loadFromCompiled(code, *this, type);
 }
 
+std::vector<ShaderModule> Device::makeShaders(const std::vector<ShaderSource>& sources) const {
+    std::vector<std::vector<uint32_t>> code = getShaderCompiler().compileBatch(sources);
+
+    std::vector<ShaderModule> modules;
+    modules.reserve(sources.size());
+    for (size_t i = 0; i < sources.size(); i++) {
+        modules.push_back(ShaderModule::loadFromCompiled(code[i], *this, sources[i].type));
+    }
+    return modules;
+}
+
+ShaderCompiler& Device::getShaderCompiler() const {
+    if (!shaderCompiler) {
+        throw std::runtime_error("The device must be initialized before compiling shaders");
+    }
+    return *shaderCompiler;
+}
+
 void Device::useInputDescriptor(InputDescriptor& inputDescriptor) const {
     inputDescriptor.buildInputLayout();
 }
@@ -367,6 +811,78 @@ RenderPipeline Device::makeRenderPipeline() const {
     return RenderPipeline(*this); // We create a render pipeline with the current device
 }
 
+ResourceSet Device::makeResourceSet() const {
+    return ResourceSet(*this);
+}
+
+DescriptorLayoutCache& Device::getDescriptorLayoutCache() const {
+    if (!descriptorLayoutCache) {
+        throw std::runtime_error("The device must be initialized before creating descriptor layouts");
+    }
+    return *descriptorLayoutCache;
+}
+
+DescriptorAllocator& Device::getDescriptorAllocator() const {
+    if (!descriptorAllocator) {
+        throw std::runtime_error("The device must be initialized before allocating descriptor sets");
+    }
+    return *descriptorAllocator;
+}
+
+BindlessTable& Device::getBindlessTable() const {
+    if (!bindlessTable) {
+        throw std::runtime_error("The bindless texture table needs an initialized device with descriptor indexing");
+    }
+    return *bindlessTable;
+}
+
+Profiler& Device::getProfiler() const {
+    if (!profiler) {
+        throw std::runtime_error("The device must be initialized before profiling");
+    }
+    return *profiler;
+}
+
+ResourceRegistries& Device::getResources() const {
+    if (!resources) {
+        throw std::runtime_error("The device must be initialized before registering resources");
+    }
+    return *resources;
+}
+
+ReadbackPool& Device::getReadbackPool() const {
+    if (!readbackPool) {
+        throw std::runtime_error("The device must be initialized before reading images back");
+    }
+    return *readbackPool;
+}
+
+DescriptorAllocator& Device::getFrameDescriptorAllocator(uint32_t frameIndex) const {
+    if (frameIndex >= frameDescriptorAllocators.size()) {
+        throw std::runtime_error("Frame descriptor sets need a frame slot handed out by requestCommandBuffer");
+    }
+    return *frameDescriptorAllocators[frameIndex];
+}
+
+VkPipelineCache Device::getPipelineCache() const {
+    return pipelineCache ? pipelineCache->getCache() : VK_NULL_HANDLE;
+}
+
+PipelineStateCache& Device::getPipelineStateCache() const {
+    if (!pipelineStateCache) {
+        throw std::runtime_error("The device must be initialized before building pipeline variants");
+    }
+    return *pipelineStateCache;
+}
+
+bool Device::savePipelineCache() const {
+    return pipelineCache && pipelineCache->save();
+}
+
+ComputePipeline Device::makeComputePipeline() const {
+    return ComputePipeline(*this);
+}
+
 void Device::makeCommandPool() {
     // If we don't have a command pool or command buffer, we create them
     VkCommandPoolCreateInfo poolInfo{};
@@ -384,42 +900,158 @@ void Device::makeCommandPool() {
     this->commandPool = commandPool;
 }
 
-std::shared_ptr<CommandBuffer> Device::requestCommandBuffer(RenderPipeline pipeline, Presentable& presentable) {
-    if (!commandPool.has_value()) {
-        makeCommandPool();
+void Device::makeFrames() {
+    if (framesInFlight == 0) {
+        throw std::runtime_error("Device::framesInFlight must be at least 1");
     }
-
-    for (const auto& cmdBuffer : commandBuffers) {
-        if (!cmdBuffer->inUse) {
-            return cmdBuffer;
-        }
+    if (uniformArena && uniformArena->getFrameCount() != framesInFlight) {
+        throw std::runtime_error("Device::framesInFlight was changed after uniform blocks were created");
     }
 
-    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    // We allocate every command buffer of the ring at once
+    std::vector<VkCommandBuffer> buffers(framesInFlight);
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.commandPool = commandPool.value();
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; // We create a primary command buffer
-    allocInfo.commandBufferCount = 1; // We allocate one command buffer
-    VkResult result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer);
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; // We create primary command buffers
+    allocInfo.commandBufferCount = framesInFlight;
+    VkResult result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, buffers.data());
     if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate command buffer. Error: " + zen::getVulkanErrorString(result));
+        throw std::runtime_error("Failed to allocate command buffers. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    // Fences start signaled so that the first wait on every slot returns immediately
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    frames.resize(framesInFlight);
+    frameDescriptorAllocators.resize(framesInFlight);
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        frameDescriptorAllocators[i] = std::make_unique<DescriptorAllocator>(*this);
+
+        FrameContext& frame = frames[i];
+        frame.index = i;
+        frame.commandBuffer = buffers[i];
+
+        result = vkCreateFence(logicalDevice, &fenceInfo, nullptr, &frame.inFlightFence);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create fence. Error: " + zen::getVulkanErrorString(result));
+        }
+    }
+}
+
+std::shared_ptr<CommandBuffer> Device::requestCommandBuffer(const RenderPipeline& pipeline,
+                                                            Presentable& presentable) {
+    return requestCommandBuffer(pipeline, &presentable, nullptr);
+}
+
+std::shared_ptr<CommandBuffer> Device::requestCommandBuffer(const RenderPipeline& pipeline, RenderTarget& target) {
+    return requestCommandBuffer(pipeline, nullptr, &target);
+}
+
+std::shared_ptr<CommandBuffer> Device::requestCommandBuffer(PipelineHandle pipeline, Presentable& presentable) {
+    return requestCommandBuffer(getResources().pipelines.get(pipeline), &presentable, nullptr);
+}
+
+std::shared_ptr<CommandBuffer> Device::requestCommandBuffer(PipelineHandle pipeline, RenderTarget& target) {
+    return requestCommandBuffer(getResources().pipelines.get(pipeline), nullptr, &target);
+}
+
+std::shared_ptr<CommandBuffer> Device::requestCommandBuffer(const RenderPipeline& pipeline, Presentable* presentable,
+                                                            RenderTarget* target) {
+    {
+        std::lock_guard lock(commandPoolMutex);
+        if (!commandPool.has_value()) {
+            makeCommandPool();
+        }
+
+        if (frames.empty()) {
+            makeFrames();
+        }
+    }
+
+    FrameContext& frame = frames[currentFrame];
+
+    // We only block here when the CPU has wrapped around onto a slot the GPU is still executing
+    const double waitStart = Profiler::now();
+    VkResult result = vkWaitForFences(logicalDevice, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to wait for frame fence. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    // The GPU is done with this slot, so is its transient memory
+    allocator->beginFrame(frame.index, framesInFlight);
+    getUniformArena().beginFrame(frame.index);
+    frameDescriptorAllocators[frame.index]->resetPools();
+    frame.serial = ++frameSerial;
+    collectRetiredBuffers(false);
+
+    // The slot's previous results are final now, the wait counts towards the new frame
+    profiler->beginFrame(frame.index, framesInFlight, frame.serial);
+    profiler->addCpuScope("Wait for frame", waitStart, Profiler::now());
+    if (jobScheduler) {
+        jobScheduler->poll();
+    }
+
+    if (!frame.recorder) {
+        frame.recorder = std::make_shared<CommandBuffer>(pipeline, frame, commandPool.value(), *this, presentable,
+                                                         target);
+    }
+    else {
+        frame.recorder->usePipeline(pipeline);
+        frame.recorder->useFrame(frame);
+        frame.recorder->useOutput(presentable, target);
+    }
+    frame.recorder->inUse = true;
+
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    return frame.recorder;
+}
+
+void Device::waitIdle() const {
+    if (uploadBatcher) {
+        // Recorded uploads may reference resources the caller is about to destroy
+        uploadBatcher->flush().wait();
+    }
+    if (jobScheduler) {
+        jobScheduler->flush(); // Queued jobs would otherwise only be submitted after the wait
+    }
+    if (logicalDevice != VK_NULL_HANDLE) {
+        vkDeviceWaitIdle(logicalDevice);
     }
-    CommandBuffer buffer = {pipeline, commandPool.value(), commandBuffer, *this, presentable};
-    buffer.inUse = true;
-    commandBuffers.push_back(std::make_shared<CommandBuffer>(buffer));
-    return commandBuffers.back();
 }
 
 CoreQueue Device::getGraphicsQueue() const {
-    // We return the first queue that supports graphics operations
+    return getQueue(QueueRole::Graphics);
+}
+
+CoreQueue Device::getQueue(QueueRole role) const {
+    const auto family = queueRoles.find(role);
+    if (family == queueRoles.end()) {
+        throw std::runtime_error("Queue roles are only known once the device is initialized");
+    }
     for (const auto& queue : queues) {
-        if (std::ranges::find(queue.capabilities, DeviceCapabilities::Graphics) !=
-            queue.capabilities.end()) {
+        if (queue.familyIndex == family->second) {
             return queue;
         }
     }
-    throw std::runtime_error("No graphics queue found for the device");
+    throw std::runtime_error("No queue found for the requested role");
+}
+
+std::mutex& Device::getSubmitMutex(VkQueue queue) const {
+    const auto it = submitMutexes.find(queue);
+    if (it == submitMutexes.end()) {
+        throw std::runtime_error("The queue does not belong to this device");
+    }
+    return *it->second;
+}
+
+bool Device::hasDedicatedQueue(QueueRole role) const {
+    if (role == QueueRole::Graphics) {
+        return true;
+    }
+    return getQueue(role).familyIndex != getQueue(QueueRole::Graphics).familyIndex;
 }
 
 CoreQueue Device::getPresentQueue() const {
@@ -434,8 +1066,7 @@ CoreQueue Device::getPresentQueue() const {
 }
 
 uint32_t Device::vkFindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    const VkPhysicalDeviceMemoryProperties& memProperties = physicalDeviceMemoryProperties;
 
     for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
         if ((typeFilter & (1 << i)) &&
@@ -447,6 +1078,54 @@ uint32_t Device::vkFindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags pro
     throw std::runtime_error("Failed to find suitable memory type.");
 }
 
+StagingRing& Device::getStagingRing() const {
+    if (!stagingRing) {
+        throw std::runtime_error("The device must be initialized before uploading data");
+    }
+    return *stagingRing;
+}
+
+void Device::uploadBuffer(const Buffer& buffer, const void* data, VkDeviceSize size, VkDeviceSize offset,
+                          QueueRole lane) {
+    getUploadBatcher().uploadBuffer(buffer, data, size, offset, lane);
+}
+
+UploadHandle Device::flushUploads() {
+    return getUploadBatcher().flush();
+}
+
+UploadBatcher& Device::getUploadBatcher() const {
+    if (!uploadBatcher) {
+        throw std::runtime_error("The device must be initialized before uploading data");
+    }
+    return *uploadBatcher;
+}
+
+JobScheduler& Device::getJobScheduler() const {
+    if (!jobScheduler) {
+        throw std::runtime_error("The job scheduler needs an initialized device with VK_KHR_timeline_semaphore");
+    }
+    return *jobScheduler;
+}
+
+UniformArena& Device::getUniformArena() {
+    if (!uniformArena) {
+        uniformArena = std::make_unique<UniformArena>(*this, framesInFlight, uniformArenaFrameSize);
+    }
+    return *uniformArena;
+}
+
+MemoryAllocator& Device::getAllocator() const {
+    if (!allocator) {
+        throw std::runtime_error("The device must be initialized before allocating memory");
+    }
+    return *allocator;
+}
+
+MemoryStatistics Device::getMemoryStatistics() const {
+    return getAllocator().getStatistics();
+}
+
 UniformBlock Device::makeUniformBlock(size_t size) {
     UniformBlock block(*this);
     block.create(*this, size);
@@ -459,13 +1138,27 @@ Texture Device::createTexture(size_t width, size_t height, size_t channels, std:
     return texture;
 }
 
+TextureCompression Device::getTextureCompression() const {
+    // Every feature the device has is enabled, so supported means usable
+    if (physicalDeviceFeatures.textureCompressionBC) {
+        return TextureCompression::BC;
+    }
+    if (physicalDeviceFeatures.textureCompressionASTC_LDR) {
+        return TextureCompression::ASTC;
+    }
+    if (physicalDeviceFeatures.textureCompressionETC2) {
+        return TextureCompression::ETC2;
+    }
+    return TextureCompression::None;
+}
+
 #ifdef ZENITH_EXT_TEXTURE
 
 #include <zenith/texture.h>
 
 Texture Device::createTexture(zen::texture::TextureData data) {
     Texture texture;
-    texture.load(std::move(data.data), data.size, *this, data.width, data.height);
+    texture.load(std::move(data.data), data.size, *this, data.width, data.height, data.format, data.levelOffsets);
     return texture;
 }
 
@@ -475,6 +1168,8 @@ std::shared_ptr<SimpleCommandBuffer> Device::requestSimpleCommandBuffer() {
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+    std::lock_guard lock(commandPoolMutex);
     if (commandPool == std::nullopt) {
         makeCommandPool();
     }
@@ -488,13 +1183,87 @@ std::shared_ptr<SimpleCommandBuffer> Device::requestSimpleCommandBuffer() {
 }
 
 void Device::freeCommandBuffer(CommandBuffer& commandBuffer) {
+    std::lock_guard lock(commandPoolMutex);
     vkFreeCommandBuffers(logicalDevice, commandPool.value(), 1, &commandBuffer.commandBuffer);
 }
 
 void Device::freeCommandBuffer(SimpleCommandBuffer& commandBuffer) {
+    std::lock_guard lock(commandPoolMutex);
     vkFreeCommandBuffers(logicalDevice, commandPool.value(), 1, &commandBuffer.commandBuffer);
 }
 
+void Device::retireBuffer(VkBuffer buffer, const Allocation& allocation) {
+    std::lock_guard lock(retiredBuffersMutex);
+    retiredBuffers.push_back({frameSerial.load(), buffer, allocation});
+}
+
+void Device::collectRetiredBuffers(bool force) {
+    std::lock_guard lock(retiredBuffersMutex);
+
+    // Same rule as the bindless table: once the frame slot was waited on past it, nothing reads it
+    const uint64_t serial = frameSerial.load();
+    while (!retiredBuffers.empty() && (force || retiredBuffers.front().serial + framesInFlight <= serial)) {
+        RetiredBuffer& retired = retiredBuffers.front();
+        vkDestroyBuffer(logicalDevice, retired.buffer, nullptr);
+        allocator->free(retired.allocation);
+        retiredBuffers.pop_front();
+    }
+}
+
+VkCommandBuffer Device::acquireSecondaryCommandBuffer(uint32_t frameIndex, uint64_t frameSerial) {
+    if (frameIndex >= framesInFlight) {
+        throw std::runtime_error("Secondary command buffer requested for an unknown frame slot");
+    }
+
+    std::vector<ThreadCommandPool>* pools = nullptr;
+    {
+        // We only lock to find the thread's pools, map nodes stay put when other threads insert
+        std::lock_guard lock(threadPoolMutex);
+        pools = &threadPools[std::this_thread::get_id()];
+        if (pools->empty()) {
+            pools->resize(framesInFlight);
+        }
+    }
+
+    ThreadCommandPool& slot = (*pools)[frameIndex];
+    if (slot.pool == VK_NULL_HANDLE) {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = getGraphicsQueue().familyIndex;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // Reset as a whole every frame
+
+        VkResult result = vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &slot.pool);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create thread command pool. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+        slot.serial = frameSerial;
+    }
+    else if (slot.serial != frameSerial) {
+        // The frame fence was waited on before this serial was handed out, so the GPU is done with it
+        vkResetCommandPool(logicalDevice, slot.pool, 0);
+        slot.serial = frameSerial;
+        slot.used = 0;
+    }
+
+    if (slot.used == slot.buffers.size()) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = slot.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer buffer = VK_NULL_HANDLE;
+        VkResult result = vkAllocateCommandBuffers(logicalDevice, &allocInfo, &buffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate secondary command buffer. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+        slot.buffers.push_back(buffer);
+    }
+    return slot.buffers[slot.used++];
+}
+
 void Device::activateTexture(Texture& texture) {
     texture.activateTexture(*this);
 }
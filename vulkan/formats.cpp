@@ -28,6 +28,111 @@ bool Format::isSupportedDepthAttachment(const zen::Device& device) const {
     return (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) != 0;
 }
 
+bool Format::isSupportedTexture(const zen::Device& device) const {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(device.physicalDevice, format, &props);
+
+    return (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+}
+
+bool Format::isSupportedMipmapBlit(const zen::Device& device) const {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(device.physicalDevice, format, &props);
+
+    constexpr VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (props.optimalTilingFeatures & required) == required;
+}
+
+bool Format::isSupportedVertexBuffer(const zen::Device& device) const {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(device.physicalDevice, format, &props);
+
+    return (props.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) != 0;
+}
+
+VkDeviceSize Format::getLevelSize(uint32_t width, uint32_t height) const {
+    // Bytes per block and the block's extent, uncompressed formats have one texel per block
+    VkDeviceSize blockBytes = 0;
+    uint32_t blockWidth = 1;
+    uint32_t blockHeight = 1;
+    switch (format) {
+    case VK_FORMAT_R8_UNORM:
+    case VK_FORMAT_R8_SRGB:
+        blockBytes = 1;
+        break;
+    case VK_FORMAT_R8G8_UNORM:
+    case VK_FORMAT_R8G8_SRGB:
+    case VK_FORMAT_R16_SFLOAT:
+    case VK_FORMAT_R16_UNORM:
+        blockBytes = 2;
+        break;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+    case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+    case VK_FORMAT_R16G16_SFLOAT:
+    case VK_FORMAT_R32_SFLOAT:
+        blockBytes = 4;
+        break;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R32G32_SFLOAT:
+        blockBytes = 8;
+        break;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        blockBytes = 16;
+        break;
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+        blockBytes = 8;
+        blockWidth = blockHeight = 4;
+        break;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+    case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+        blockBytes = 16;
+        blockWidth = blockHeight = 4;
+        break;
+    case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+        blockBytes = 16;
+        blockWidth = blockHeight = 6;
+        break;
+    case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+        blockBytes = 16;
+        blockWidth = blockHeight = 8;
+        break;
+    default:
+        return 0;
+    }
+
+    const VkDeviceSize blocksX = (uint64_t{width} + blockWidth - 1) / blockWidth;
+    const VkDeviceSize blocksY = (uint64_t{height} + blockHeight - 1) / blockHeight;
+    return blocksX * blocksY * blockBytes;
+}
+
 VkFormat zen::toVulkanFormat(InputFormat format) {
     switch (format) {
     case InputFormat::Vector3:
@@ -47,13 +152,78 @@ VkFormat zen::toVulkanFormat(InputFormat format) {
     case InputFormat::Bool:
         return VK_FORMAT_R8_UINT; // No direct boolean format, using unsigned byte
     case InputFormat::Mat3:
-        return VK_FORMAT_R32G32B32_SFLOAT; // No direct mat3 format, using vec3
+        return VK_FORMAT_R32G32B32_SFLOAT; // The format of each column, matrices take one location per column
     case InputFormat::Mat4:
-        return VK_FORMAT_R32G32B32A32_SFLOAT; // No direct mat4 format, using vec4
+        return VK_FORMAT_R32G32B32A32_SFLOAT;
+    case InputFormat::Half2:
+        return VK_FORMAT_R16G16_SFLOAT;
+    case InputFormat::Half4:
+        return VK_FORMAT_R16G16B16A16_SFLOAT;
+    case InputFormat::Byte4Norm:
+        return VK_FORMAT_R8G8B8A8_SNORM;
+    case InputFormat::UByte4Norm:
+        return VK_FORMAT_R8G8B8A8_UNORM;
+    case InputFormat::Short2Norm:
+        return VK_FORMAT_R16G16_SNORM;
+    case InputFormat::Short4Norm:
+        return VK_FORMAT_R16G16B16A16_SNORM;
+    case InputFormat::UShort2Norm:
+        return VK_FORMAT_R16G16_UNORM;
+    case InputFormat::UShort4Norm:
+        return VK_FORMAT_R16G16B16A16_UNORM;
+    case InputFormat::Packed1010102Norm:
+        return VK_FORMAT_A2B10G10R10_SNORM_PACK32;
+    case InputFormat::UPacked1010102Norm:
+        return VK_FORMAT_A2B10G10R10_UNORM_PACK32;
     default:
         throw std::runtime_error("Unsupported input format");
     }
 }
 
+size_t zen::getInputFormatSize(InputFormat format) {
+    switch (format) {
+    case InputFormat::Bool:
+        return 1;
+    case InputFormat::Float:
+    case InputFormat::Int:
+    case InputFormat::Uint:
+    case InputFormat::Half2:
+    case InputFormat::Byte4Norm:
+    case InputFormat::UByte4Norm:
+    case InputFormat::Short2Norm:
+    case InputFormat::UShort2Norm:
+    case InputFormat::Packed1010102Norm:
+    case InputFormat::UPacked1010102Norm:
+        return 4;
+    case InputFormat::Vector2:
+    case InputFormat::Half4:
+    case InputFormat::Short4Norm:
+    case InputFormat::UShort4Norm:
+        return 8;
+    case InputFormat::Vector3:
+        return 12;
+    case InputFormat::Vector4:
+    case InputFormat::Color:
+        return 16;
+    case InputFormat::Mat3:
+        return 36;
+    case InputFormat::Mat4:
+        return 64;
+    default:
+        throw std::runtime_error("Unsupported input format");
+    }
+}
+
+uint32_t zen::getInputFormatLocations(InputFormat format) {
+    switch (format) {
+    case InputFormat::Mat3:
+        return 3;
+    case InputFormat::Mat4:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
 
 #endif
@@ -0,0 +1,1014 @@
+/*
+* graph.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace zen;
+
+namespace {
+    constexpr VkAccessFlags writeAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+        VK_ACCESS_MEMORY_WRITE_BIT;
+
+    // Anything that may have touched a transient image before, in this frame through an aliased
+    // resource or in the previous frame that still runs on the same queue
+    constexpr VkPipelineStageFlags transientStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    bool hasStencil(VkFormat format) {
+        return format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT ||
+            format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_S8_UINT;
+    }
+
+    VkImageAspectFlags getAspect(const GraphAttachmentInfo& info) {
+        if (!info.depth) {
+            return VK_IMAGE_ASPECT_COLOR_BIT;
+        }
+        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+        if (hasStencil(info.format)) {
+            aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+        }
+        return aspect;
+    }
+}
+
+void GraphPassBuilder::writeColor(GraphResource resource, Operation load, VkClearColorValue clear) {
+    RenderGraph::ResourceUse use;
+    use.resource = resource;
+    use.access = RenderGraph::Access::ColorWrite;
+    use.load = load;
+    use.clear.color = clear;
+    graph.passes[pass].uses.push_back(use);
+}
+
+void GraphPassBuilder::writeDepth(GraphResource resource, Operation load, float clearDepth) {
+    RenderGraph::ResourceUse use;
+    use.resource = resource;
+    use.access = RenderGraph::Access::DepthWrite;
+    use.load = load;
+    use.clear.depthStencil = {clearDepth, 0};
+    graph.passes[pass].uses.push_back(use);
+}
+
+void GraphPassBuilder::readTexture(GraphResource resource) {
+    RenderGraph::ResourceUse use;
+    use.resource = resource;
+    use.access = RenderGraph::Access::Sampled;
+    graph.passes[pass].uses.push_back(use);
+}
+
+void GraphPassBuilder::readAttachment(GraphResource resource) {
+    RenderGraph::ResourceUse use;
+    use.resource = resource;
+    use.access = RenderGraph::Access::InputAttachment;
+    graph.passes[pass].uses.push_back(use);
+}
+
+void GraphPassBuilder::readBuffer(GraphResource resource, BufferUsage usage) {
+    RenderGraph::ResourceUse use;
+    use.resource = resource;
+    use.access = RenderGraph::Access::BufferRead;
+    use.usage = usage;
+    graph.passes[pass].uses.push_back(use);
+}
+
+void GraphPassBuilder::writeBuffer(GraphResource resource, BufferUsage usage) {
+    RenderGraph::ResourceUse use;
+    use.resource = resource;
+    use.access = RenderGraph::Access::BufferWrite;
+    use.usage = usage;
+    graph.passes[pass].uses.push_back(use);
+}
+
+void GraphPassBuilder::keep() {
+    graph.passes[pass].keep = true;
+}
+
+RenderGraph::~RenderGraph() {
+    destroy();
+}
+
+GraphResource RenderGraph::createAttachment(const std::string& name, const GraphAttachmentInfo& info) {
+    if (info.format == VK_FORMAT_UNDEFINED) {
+        throw std::runtime_error("Graph attachment '" + name + "' needs a format");
+    }
+    ResourceNode resource;
+    resource.name = name;
+    resource.type = ResourceType::Transient;
+    resource.info = info;
+    resources.push_back(resource);
+    return static_cast<GraphResource>(resources.size() - 1);
+}
+
+GraphResource RenderGraph::importBackbuffer(Presentable& presentable) {
+    for (size_t i = 0; i < resources.size(); i++) {
+        if (resources[i].type == ResourceType::Backbuffer) {
+            return static_cast<GraphResource>(i);
+        }
+    }
+    this->presentable = &presentable;
+
+    // The extent stays zero so that it follows the presentable when it is recreated
+    ResourceNode resource;
+    resource.name = "backbuffer";
+    resource.type = ResourceType::Backbuffer;
+    resource.info.format = presentable.format;
+    resources.push_back(resource);
+    return static_cast<GraphResource>(resources.size() - 1);
+}
+
+GraphResource RenderGraph::importImage(const std::string& name, const Image& image, const GraphAttachmentInfo& info,
+                                       VkImageLayout layout) {
+    ResourceNode resource;
+    resource.name = name;
+    resource.type = ResourceType::ImportedImage;
+    resource.info = info;
+    resource.image = image;
+    resource.importedLayout = layout;
+    resources.push_back(resource);
+    return static_cast<GraphResource>(resources.size() - 1);
+}
+
+GraphResource RenderGraph::importBuffer(const std::string& name, const Buffer& buffer) {
+    ResourceNode resource;
+    resource.name = name;
+    resource.type = ResourceType::ImportedBuffer;
+    resource.buffer = buffer.buffer;
+    resources.push_back(resource);
+    return static_cast<GraphResource>(resources.size() - 1);
+}
+
+GraphPass RenderGraph::addPass(const std::string& name, const std::function<void(GraphPassBuilder&)>& setup,
+                               std::function<void(GraphContext&)> execute) {
+    PassNode node;
+    node.name = name;
+    node.execute = std::move(execute);
+    passes.push_back(std::move(node));
+
+    const auto pass = static_cast<GraphPass>(passes.size() - 1);
+    GraphPassBuilder builder(*this, pass);
+    setup(builder);
+
+    // We validate the declarations right away, the error is much clearer here than in compile
+    for (const auto& use : passes[pass].uses) {
+        if (use.resource >= resources.size()) {
+            throw std::runtime_error("Pass '" + name + "' uses a resource from another graph");
+        }
+        const bool isBuffer = resources[use.resource].type == ResourceType::ImportedBuffer;
+        const bool wantsBuffer = use.access == Access::BufferRead || use.access == Access::BufferWrite;
+        if (isBuffer != wantsBuffer) {
+            throw std::runtime_error("Pass '" + name + "' uses '" + resources[use.resource].name +
+                "' as the wrong kind of resource");
+        }
+        if (use.access == Access::DepthWrite && !resources[use.resource].info.depth) {
+            throw std::runtime_error("Pass '" + name + "' writes depth into color attachment '" +
+                resources[use.resource].name + "'");
+        }
+        if (use.access == Access::ColorWrite && resources[use.resource].info.depth) {
+            throw std::runtime_error("Pass '" + name + "' writes color into depth attachment '" +
+                resources[use.resource].name + "'");
+        }
+    }
+    return pass;
+}
+
+VkExtent2D RenderGraph::resolveExtent(const ResourceNode& resource) const {
+    if (resource.info.extent.width != 0 && resource.info.extent.height != 0) {
+        return resource.info.extent;
+    }
+    if (presentable != nullptr) {
+        return presentable->extent;
+    }
+    return device.instance.extent;
+}
+
+void RenderGraph::compile() {
+    destroy();
+    if (passes.empty()) {
+        return;
+    }
+
+    compiledGeneration = presentable != nullptr ? presentable->getGeneration() : 0;
+    cullPasses();
+    buildGroups();
+    createTransientImages();
+    for (auto& group : groups) {
+        if (!group.attachments.empty()) {
+            buildRenderPass(group);
+        }
+    }
+    buildBarriers();
+}
+
+void RenderGraph::destroy() {
+    if (device.logicalDevice == VK_NULL_HANDLE) {
+        return;
+    }
+
+    for (auto& group : groups) {
+        for (VkFramebuffer framebuffer : group.framebuffers) {
+            vkDestroyFramebuffer(device.logicalDevice, framebuffer, nullptr);
+        }
+        if (group.renderPass != VK_NULL_HANDLE) {
+            vkDestroyRenderPass(device.logicalDevice, group.renderPass, nullptr);
+        }
+    }
+    groups.clear();
+    finalBarrier = {};
+
+    for (auto& resource : resources) {
+        if (resource.type != ResourceType::Transient) {
+            continue;
+        }
+        if (resource.image.view != VK_NULL_HANDLE) {
+            vkDestroyImageView(device.logicalDevice, resource.image.view, nullptr);
+        }
+        if (resource.image.image != VK_NULL_HANDLE) {
+            vkDestroyImage(device.logicalDevice, resource.image.image, nullptr);
+        }
+        resource.image = {};
+    }
+
+    for (auto& allocation : transientMemory) {
+        device.getAllocator().free(allocation);
+    }
+    transientMemory.clear();
+    transientMemorySize = 0;
+    unaliasedMemorySize = 0;
+}
+
+bool RenderGraph::isWrite(Access access) {
+    return access == Access::ColorWrite || access == Access::DepthWrite || access == Access::BufferWrite;
+}
+
+bool RenderGraph::isAttachment(Access access) {
+    return access == Access::ColorWrite || access == Access::DepthWrite || access == Access::InputAttachment;
+}
+
+void RenderGraph::cullPasses() {
+    // We walk backwards and only keep passes whose results someone downstream still needs
+    std::vector<bool> needed(resources.size(), false);
+    for (size_t i = passes.size(); i-- > 0;) {
+        PassNode& pass = passes[i];
+
+        bool alive = pass.keep;
+        for (const auto& use : pass.uses) {
+            if (isWrite(use.access) &&
+                (resources[use.resource].type != ResourceType::Transient || needed[use.resource])) {
+                alive = true;
+            }
+        }
+        pass.culled = !alive;
+        if (!alive) {
+            continue;
+        }
+
+        // A full overwrite means earlier contents are not needed anymore, unless this pass reads them too
+        for (const auto& use : pass.uses) {
+            if (isWrite(use.access) && use.access != Access::BufferWrite && use.load != Operation::Load) {
+                needed[use.resource] = false;
+            }
+        }
+        for (const auto& use : pass.uses) {
+            if (!isWrite(use.access) || use.access == Access::BufferWrite || use.load == Operation::Load) {
+                needed[use.resource] = true;
+            }
+        }
+    }
+
+    // Transient data only exists once a pass has written it
+    std::vector<bool> written(resources.size(), false);
+    for (const auto& pass : passes) {
+        if (pass.culled) {
+            continue;
+        }
+        for (const auto& use : pass.uses) {
+            const ResourceNode& resource = resources[use.resource];
+            if (!isWrite(use.access) && resource.type == ResourceType::Transient && !written[use.resource]) {
+                throw std::runtime_error("Pass '" + pass.name + "' reads '" + resource.name +
+                    "' before any pass writes it");
+            }
+        }
+        for (const auto& use : pass.uses) {
+            if (isWrite(use.access)) {
+                written[use.resource] = true;
+            }
+        }
+    }
+}
+
+bool RenderGraph::canMerge(const PassGroup& group, const PassNode& pass) const {
+    if (!mergeSubpasses || group.attachments.empty()) {
+        return false;
+    }
+
+    bool drawsAttachments = false;
+    VkExtent2D extent = {0, 0};
+    for (const auto& use : pass.uses) {
+        if (isAttachment(use.access)) {
+            drawsAttachments = true;
+            extent = resolveExtent(resources[use.resource]);
+        }
+    }
+    if (!drawsAttachments || extent.width != group.extent.width || extent.height != group.extent.height) {
+        return false;
+    }
+
+    // Anything that isn't a per-pixel attachment read needs a barrier, which a render pass can't contain
+    for (GraphPass other : group.passes) {
+        for (const auto& previous : passes[other].uses) {
+            for (const auto& use : pass.uses) {
+                if (previous.resource != use.resource) {
+                    continue;
+                }
+                const bool previousBuffer = previous.access == Access::BufferRead ||
+                    previous.access == Access::BufferWrite;
+                if (previousBuffer && (isWrite(previous.access) || isWrite(use.access))) {
+                    return false;
+                }
+                if (use.access == Access::Sampled && isWrite(previous.access)) {
+                    return false;
+                }
+                if (previous.access == Access::Sampled && isWrite(use.access)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void RenderGraph::buildGroups() {
+    for (auto& resource : resources) {
+        resource.imageUsage = 0;
+        resource.firstGroup = UINT32_MAX;
+        resource.lastGroup = 0;
+    }
+
+    for (GraphPass index = 0; index < passes.size(); index++) {
+        PassNode& pass = passes[index];
+        if (pass.culled) {
+            continue;
+        }
+
+        if (groups.empty() || !canMerge(groups.back(), pass)) {
+            PassGroup group;
+            for (const auto& use : pass.uses) {
+                if (isAttachment(use.access)) {
+                    const VkExtent2D extent = resolveExtent(resources[use.resource]);
+                    if (group.extent.width != 0 &&
+                        (extent.width != group.extent.width || extent.height != group.extent.height)) {
+                        throw std::runtime_error("Every attachment of pass '" + pass.name +
+                            "' must have the same extent");
+                    }
+                    group.extent = extent;
+                }
+            }
+            groups.push_back(group);
+        }
+
+        PassGroup& group = groups.back();
+        pass.group = static_cast<uint32_t>(groups.size() - 1);
+        pass.subpass = static_cast<uint32_t>(group.passes.size());
+        group.passes.push_back(index);
+
+        for (const auto& use : pass.uses) {
+            ResourceNode& resource = resources[use.resource];
+            resource.firstGroup = std::min(resource.firstGroup, pass.group);
+            resource.lastGroup = std::max(resource.lastGroup, pass.group);
+
+            switch (use.access) {
+            case Access::ColorWrite:
+                resource.imageUsage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+                break;
+            case Access::DepthWrite:
+                resource.imageUsage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+                break;
+            case Access::Sampled:
+                resource.imageUsage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+                break;
+            case Access::InputAttachment:
+                resource.imageUsage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+                break;
+            default:
+                break;
+            }
+
+            if (isAttachment(use.access) &&
+                std::ranges::find(group.attachments, use.resource) == group.attachments.end()) {
+                group.attachments.push_back(use.resource);
+                group.clearValues.push_back(use.clear);
+            }
+        }
+    }
+}
+
+void RenderGraph::createTransientImages() {
+    struct Placement {
+        GraphResource resource = 0;
+        VkMemoryRequirements requirements = {};
+        VkDeviceSize offset = 0;
+    };
+
+    // Images that may share memory must agree on the memory types they accept
+    std::unordered_map<uint32_t, std::vector<Placement>> buckets;
+
+    for (GraphResource index = 0; index < resources.size(); index++) {
+        ResourceNode& resource = resources[index];
+        if (resource.type != ResourceType::Transient || resource.firstGroup == UINT32_MAX) {
+            continue; // Imported, or only touched by culled passes
+        }
+
+        const VkExtent2D extent = resolveExtent(resource);
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = resource.info.format;
+        imageInfo.extent = {extent.width, extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = resource.imageUsage;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VkResult result = vkCreateImage(device.logicalDevice, &imageInfo, nullptr, &resource.image.image);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create graph attachment '" + resource.name + "'. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+
+        Placement placement;
+        placement.resource = index;
+        vkGetImageMemoryRequirements(device.logicalDevice, resource.image.image, &placement.requirements);
+        buckets[placement.requirements.memoryTypeBits].push_back(placement);
+        unaliasedMemorySize += placement.requirements.size;
+    }
+
+    for (auto& [memoryTypeBits, placements] : buckets) {
+        // Largest first, each image gets the lowest offset that no live neighbour occupies
+        std::ranges::sort(placements, [](const Placement& a, const Placement& b)
+        {
+            return a.requirements.size > b.requirements.size;
+        });
+
+        VkDeviceSize bucketSize = 0;
+        VkDeviceSize bucketAlignment = 1;
+        for (size_t i = 0; i < placements.size(); i++) {
+            Placement& placement = placements[i];
+            const ResourceNode& resource = resources[placement.resource];
+            const VkDeviceSize alignment = std::max<VkDeviceSize>(placement.requirements.alignment, 1);
+
+            std::vector<VkDeviceSize> candidates = {0};
+            for (size_t j = 0; j < i; j++) {
+                candidates.push_back(placements[j].offset + placements[j].requirements.size);
+            }
+            std::ranges::sort(candidates);
+
+            for (VkDeviceSize candidate : candidates) {
+                const VkDeviceSize offset = (candidate + alignment - 1) / alignment * alignment;
+                bool fits = true;
+                for (size_t j = 0; j < i && fits; j++) {
+                    const Placement& other = placements[j];
+                    const ResourceNode& otherResource = resources[other.resource];
+                    const bool livesTogether = resource.firstGroup <= otherResource.lastGroup &&
+                        otherResource.firstGroup <= resource.lastGroup;
+                    const bool overlaps = offset < other.offset + other.requirements.size &&
+                        other.offset < offset + placement.requirements.size;
+                    fits = !(livesTogether && overlaps);
+                }
+                if (fits) {
+                    placement.offset = offset;
+                    break;
+                }
+            }
+
+            bucketSize = std::max(bucketSize, placement.offset + placement.requirements.size);
+            bucketAlignment = std::max(bucketAlignment, alignment);
+        }
+
+        VkMemoryRequirements requirements{};
+        requirements.size = bucketSize;
+        requirements.alignment = bucketAlignment;
+        requirements.memoryTypeBits = memoryTypeBits;
+        Allocation allocation = device.getAllocator().allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                               zen::ResourceKind::Image,
+                                                               zen::AllocationStrategy::General,
+                                                               zen::MemoryCategory::Attachment);
+        transientMemory.push_back(allocation);
+        transientMemorySize += bucketSize;
+
+        for (const auto& placement : placements) {
+            ResourceNode& resource = resources[placement.resource];
+            VkResult result = vkBindImageMemory(device.logicalDevice, resource.image.image, allocation.memory,
+                                                allocation.offset + placement.offset);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Failed to bind graph attachment '" + resource.name + "'. Error: " +
+                    zen::getVulkanErrorString(result));
+            }
+
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = resource.image.image;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = resource.info.format;
+            viewInfo.subresourceRange.aspectMask = getAspect(resource.info);
+            viewInfo.subresourceRange.levelCount = 1;
+            viewInfo.subresourceRange.layerCount = 1;
+
+            result = vkCreateImageView(device.logicalDevice, &viewInfo, nullptr, &resource.image.view);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create view of graph attachment '" + resource.name +
+                    "'. Error: " + zen::getVulkanErrorString(result));
+            }
+        }
+    }
+}
+
+VkImageLayout RenderGraph::getLayout(Access access, bool depth) {
+    switch (access) {
+    case Access::ColorWrite:
+        return VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    case Access::DepthWrite:
+        return VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    case Access::Sampled:
+    case Access::InputAttachment:
+        return depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    default:
+        return VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+}
+
+void RenderGraph::getAccess(const ResourceUse& use, VkAccessFlags& access, VkPipelineStageFlags& stages) {
+    switch (use.access) {
+    case Access::ColorWrite:
+        access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        break;
+    case Access::DepthWrite:
+        access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        break;
+    case Access::Sampled:
+        access = VK_ACCESS_SHADER_READ_BIT;
+        stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        break;
+    case Access::InputAttachment:
+        access = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+        stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        break;
+    case Access::BufferRead:
+    case Access::BufferWrite:
+        getBufferAccess(use.usage, access, stages);
+        if (use.access == Access::BufferWrite && (access & writeAccessMask) == 0) {
+            access |= VK_ACCESS_MEMORY_WRITE_BIT; // The usage alone doesn't say how it is written
+        }
+        break;
+    }
+}
+
+void RenderGraph::buildRenderPass(PassGroup& group) {
+    const auto groupIndex = static_cast<uint32_t>(&group - groups.data());
+
+    // Where every attachment shows up inside the group, in subpass order
+    std::vector<std::vector<std::pair<uint32_t, const ResourceUse*>>> attachmentUses(group.attachments.size());
+    for (uint32_t subpass = 0; subpass < group.passes.size(); subpass++) {
+        for (const auto& use : passes[group.passes[subpass]].uses) {
+            auto it = std::ranges::find(group.attachments, use.resource);
+            if (it != group.attachments.end() && isAttachment(use.access)) {
+                attachmentUses[it - group.attachments.begin()].emplace_back(subpass, &use);
+            }
+        }
+    }
+
+    bool drawsBackbuffer = false;
+    std::vector<VkAttachmentDescription> descriptions;
+    for (size_t a = 0; a < group.attachments.size(); a++) {
+        const ResourceNode& resource = resources[group.attachments[a]];
+        const ResourceUse& first = *attachmentUses[a].front().second;
+        const ResourceUse& last = *attachmentUses[a].back().second;
+        drawsBackbuffer |= resource.type == ResourceType::Backbuffer;
+
+        // Results nobody reads after this render pass never leave the tile
+        const bool readLater = resource.lastGroup > groupIndex || resource.type != ResourceType::Transient;
+
+        VkAttachmentDescription description{};
+        description.format = resource.info.format;
+        description.samples = VK_SAMPLE_COUNT_1_BIT;
+        description.loadOp = first.access == Access::InputAttachment
+                                 ? VK_ATTACHMENT_LOAD_OP_LOAD
+                                 : toVulkanLoadOp(first.load);
+        description.storeOp = readLater ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        if (hasStencil(resource.info.format)) {
+            description.stencilLoadOp = description.loadOp;
+            description.stencilStoreOp = description.storeOp;
+        }
+        // The barrier recorded before the group already moved the image into its first layout
+        description.initialLayout = getLayout(first.access, resource.info.depth);
+        description.finalLayout = getLayout(last.access, resource.info.depth);
+        descriptions.push_back(description);
+    }
+
+    // The references must outlive the create call, so every subpass gets its own storage
+    struct SubpassReferences {
+        std::vector<VkAttachmentReference> colors = {};
+        std::vector<VkAttachmentReference> inputs = {};
+        VkAttachmentReference depth = {};
+        bool hasDepth = false;
+        std::vector<uint32_t> preserved = {};
+    };
+    std::vector<SubpassReferences> references(group.passes.size());
+
+    for (uint32_t subpass = 0; subpass < group.passes.size(); subpass++) {
+        SubpassReferences& refs = references[subpass];
+        for (const auto& use : passes[group.passes[subpass]].uses) {
+            if (!isAttachment(use.access)) {
+                continue;
+            }
+            const auto index = static_cast<uint32_t>(
+                std::ranges::find(group.attachments, use.resource) - group.attachments.begin());
+            const VkAttachmentReference reference = {index, getLayout(use.access, resources[use.resource].info.depth)};
+            if (use.access == Access::ColorWrite) {
+                refs.colors.push_back(reference);
+            }
+            else if (use.access == Access::DepthWrite) {
+                refs.depth = reference;
+                refs.hasDepth = true;
+            }
+            else {
+                refs.inputs.push_back(reference);
+            }
+        }
+
+        // Attachments used before and after this subpass but not by it must be preserved
+        for (uint32_t a = 0; a < attachmentUses.size(); a++) {
+            const auto& uses = attachmentUses[a];
+            const bool before = uses.front().first < subpass;
+            const bool after = uses.back().first > subpass;
+            const bool here = std::ranges::any_of(uses, [&](const auto& use) { return use.first == subpass; });
+            if (before && after && !here) {
+                refs.preserved.push_back(a);
+            }
+        }
+    }
+
+    std::vector<VkSubpassDescription> subpasses;
+    for (auto& refs : references) {
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = static_cast<uint32_t>(refs.colors.size());
+        subpass.pColorAttachments = refs.colors.data();
+        subpass.inputAttachmentCount = static_cast<uint32_t>(refs.inputs.size());
+        subpass.pInputAttachments = refs.inputs.data();
+        subpass.pDepthStencilAttachment = refs.hasDepth ? &refs.depth : nullptr;
+        subpass.preserveAttachmentCount = static_cast<uint32_t>(refs.preserved.size());
+        subpass.pPreserveAttachments = refs.preserved.data();
+        subpasses.push_back(subpass);
+    }
+
+    // Subpasses that share an attachment are ordered per pixel, which is all tilers need
+    std::vector<VkSubpassDependency> dependencies;
+    for (uint32_t dst = 1; dst < group.passes.size(); dst++) {
+        for (uint32_t src = 0; src < dst; src++) {
+            VkSubpassDependency dependency{};
+            for (const auto& srcUse : passes[group.passes[src]].uses) {
+                for (const auto& dstUse : passes[group.passes[dst]].uses) {
+                    if (srcUse.resource != dstUse.resource || !isAttachment(srcUse.access) ||
+                        !isAttachment(dstUse.access)) {
+                        continue;
+                    }
+                    VkAccessFlags access = 0;
+                    VkPipelineStageFlags stages = 0;
+                    getAccess(srcUse, access, stages);
+                    dependency.srcStageMask |= stages;
+                    dependency.srcAccessMask |= access & writeAccessMask;
+                    getAccess(dstUse, access, stages);
+                    dependency.dstStageMask |= stages;
+                    dependency.dstAccessMask |= access;
+                }
+            }
+            if (dependency.srcStageMask != 0) {
+                dependency.srcSubpass = src;
+                dependency.dstSubpass = dst;
+                dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+                dependencies.push_back(dependency);
+            }
+        }
+    }
+
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(descriptions.size());
+    renderPassInfo.pAttachments = descriptions.data();
+    renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+    renderPassInfo.pSubpasses = subpasses.data();
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+
+    VkResult result = vkCreateRenderPass(device.logicalDevice, &renderPassInfo, nullptr, &group.renderPass);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create render pass for '" + passes[group.passes.front()].name +
+            "'. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    const size_t framebufferCount = drawsBackbuffer ? presentable->images.size() : 1;
+    for (size_t i = 0; i < framebufferCount; i++) {
+        std::vector<VkImageView> views;
+        for (GraphResource attachment : group.attachments) {
+            const ResourceNode& resource = resources[attachment];
+            views.push_back(resource.type == ResourceType::Backbuffer
+                                ? presentable->images[i].view
+                                : resource.image.view);
+        }
+
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = group.renderPass;
+        framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+        framebufferInfo.pAttachments = views.data();
+        framebufferInfo.width = group.extent.width;
+        framebufferInfo.height = group.extent.height;
+        framebufferInfo.layers = 1;
+
+        VkFramebuffer framebuffer = VK_NULL_HANDLE;
+        result = vkCreateFramebuffer(device.logicalDevice, &framebufferInfo, nullptr, &framebuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create graph framebuffer. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+        group.framebuffers.push_back(framebuffer);
+    }
+}
+
+void RenderGraph::buildBarriers() {
+    struct State {
+        bool touched = false;
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags stages = 0;
+        VkAccessFlags access = 0;
+        VkAccessFlags writes = 0;
+    };
+    std::vector<State> states(resources.size());
+
+    for (auto& group : groups) {
+        Barrier& barrier = group.barrier;
+        std::vector<bool> seen(resources.size(), false);
+        std::vector<State> after(resources.size());
+
+        for (GraphPass index : group.passes) {
+            for (const auto& use : passes[index].uses) {
+                const ResourceNode& resource = resources[use.resource];
+                VkAccessFlags access = 0;
+                VkPipelineStageFlags stages = 0;
+                getAccess(use, access, stages);
+
+                // Everything the group does to the resource is what the next barrier has to wait for
+                State& next = after[use.resource];
+                next.touched = true;
+                next.layout = getLayout(use.access, resource.info.depth);
+                next.stages |= stages;
+                next.access |= access;
+                next.writes |= isWrite(use.access) ? access & writeAccessMask : 0;
+
+                if (seen[use.resource]) {
+                    continue; // Later uses inside the group are ordered by subpass dependencies
+                }
+                seen[use.resource] = true;
+
+                const State& state = states[use.resource];
+                if (resource.type == ResourceType::ImportedBuffer) {
+                    // External writers synchronize on their own, we only order what the graph does
+                    if (state.touched && (state.writes != 0 || isWrite(use.access))) {
+                        barrier.buffers.push_back({use.resource, state.writes, access});
+                        barrier.srcStages |= state.stages;
+                        barrier.dstStages |= stages;
+                    }
+                    continue;
+                }
+
+                ImageTransition transition;
+                transition.resource = use.resource;
+                transition.newLayout = getLayout(use.access, resource.info.depth);
+                transition.dstAccess = access;
+                if (state.touched) {
+                    const bool readAfterRead = state.writes == 0 && !isWrite(use.access);
+                    if (readAfterRead && state.layout == transition.newLayout) {
+                        continue;
+                    }
+                    transition.oldLayout = state.layout;
+                    transition.srcAccess = state.writes;
+                    barrier.srcStages |= state.stages;
+                }
+                else if (resource.type == ResourceType::Transient) {
+                    // Old contents are garbage, but an aliased image or the last frame may still be using the memory
+                    transition.srcAccess = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+                    barrier.srcStages |= transientStages;
+                }
+                else if (resource.type == ResourceType::Backbuffer) {
+                    // Chained to the acquire semaphore, which submit waits on at this stage
+                    barrier.srcStages |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+                }
+                else {
+                    transition.oldLayout = resource.importedLayout;
+                    transition.srcAccess = VK_ACCESS_MEMORY_WRITE_BIT;
+                    barrier.srcStages |= VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+                }
+                barrier.dstStages |= stages;
+                barrier.images.push_back(transition);
+            }
+        }
+
+        for (size_t i = 0; i < resources.size(); i++) {
+            if (after[i].touched) {
+                states[i] = after[i];
+            }
+        }
+    }
+
+    // Outside the graph, the backbuffer is presented and imported images are back where we found them
+    for (GraphResource index = 0; index < resources.size(); index++) {
+        const ResourceNode& resource = resources[index];
+        const State& state = states[index];
+        if (resource.type == ResourceType::Backbuffer) {
+            finalBarrier.images.push_back({index, state.layout, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, state.writes, 0});
+            finalBarrier.srcStages |= state.touched ? state.stages : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            finalBarrier.dstStages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        }
+        else if (resource.type == ResourceType::ImportedImage && state.touched) {
+            finalBarrier.images.push_back({
+                index, state.layout, resource.importedLayout, state.writes,
+                VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT
+            });
+            finalBarrier.srcStages |= state.stages;
+            finalBarrier.dstStages |= VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        }
+    }
+}
+
+VkImage RenderGraph::resolveImage(GraphResource resource, uint32_t imageIndex) const {
+    if (resources[resource].type == ResourceType::Backbuffer) {
+        return presentable->images[imageIndex].image;
+    }
+    return resources[resource].image.image;
+}
+
+void RenderGraph::recordBarrier(VkCommandBuffer commandBuffer, const Barrier& barrier, uint32_t imageIndex) const {
+    if (barrier.isEmpty()) {
+        return;
+    }
+
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    for (const auto& transition : barrier.images) {
+        VkImageMemoryBarrier imageBarrier{};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.oldLayout = transition.oldLayout;
+        imageBarrier.newLayout = transition.newLayout;
+        imageBarrier.srcAccessMask = transition.srcAccess;
+        imageBarrier.dstAccessMask = transition.dstAccess;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = resolveImage(transition.resource, imageIndex);
+        imageBarrier.subresourceRange.aspectMask = getAspect(resources[transition.resource].info);
+        imageBarrier.subresourceRange.levelCount = 1;
+        imageBarrier.subresourceRange.layerCount = 1;
+        imageBarriers.push_back(imageBarrier);
+    }
+
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    for (const auto& transition : barrier.buffers) {
+        VkBufferMemoryBarrier bufferBarrier{};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcAccessMask = transition.srcAccess;
+        bufferBarrier.dstAccessMask = transition.dstAccess;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = resources[transition.resource].buffer;
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+        bufferBarriers.push_back(bufferBarrier);
+    }
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         barrier.srcStages != 0 ? barrier.srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         barrier.dstStages != 0 ? barrier.dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr,
+                         static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+                         static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, uint32_t imageIndex) const {
+    if (presentable != nullptr && imageIndex >= presentable->images.size()) {
+        throw std::runtime_error("The image index is out of the presentable's range");
+    }
+
+    GraphContext context;
+    context.commandBuffer = commandBuffer;
+
+    for (const auto& group : groups) {
+        recordBarrier(commandBuffer, group.barrier, imageIndex);
+        context.extent = group.extent;
+
+        if (group.renderPass == VK_NULL_HANDLE) {
+            // Passes without attachments, e.g. compute or copies, run outside of any render pass
+            const PassNode& pass = passes[group.passes.front()];
+            context.renderPass = VK_NULL_HANDLE;
+            context.subpass = 0;
+            if (pass.execute) {
+                pass.execute(context);
+            }
+            continue;
+        }
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = group.renderPass;
+        renderPassInfo.framebuffer = group.framebuffers.size() > 1
+                                         ? group.framebuffers[imageIndex]
+                                         : group.framebuffers.front();
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = group.extent;
+        renderPassInfo.clearValueCount = static_cast<uint32_t>(group.clearValues.size());
+        renderPassInfo.pClearValues = group.clearValues.data();
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        zen::setViewport(commandBuffer, group.extent); // Stays set across the group's subpasses
+        context.renderPass = group.renderPass;
+        for (uint32_t subpass = 0; subpass < group.passes.size(); subpass++) {
+            if (subpass > 0) {
+                vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+            }
+            context.subpass = subpass;
+            const PassNode& pass = passes[group.passes[subpass]];
+            if (pass.execute) {
+                pass.execute(context);
+            }
+        }
+        vkCmdEndRenderPass(commandBuffer);
+    }
+
+    recordBarrier(commandBuffer, finalBarrier, imageIndex);
+}
+
+RenderPass RenderGraph::getRenderPass(GraphPass pass) const {
+    if (pass >= passes.size() || passes[pass].culled || groups.empty()) {
+        throw std::runtime_error("The pass must survive compile before pipelines can target it");
+    }
+    RenderPass renderPass;
+    renderPass.renderPass = groups[passes[pass].group].renderPass;
+    return renderPass;
+}
+
+uint32_t RenderGraph::getSubpass(GraphPass pass) const {
+    if (pass >= passes.size()) {
+        throw std::runtime_error("Unknown graph pass");
+    }
+    return passes[pass].subpass;
+}
+
+uint32_t RenderGraph::getColorAttachmentCount(GraphPass pass) const {
+    if (pass >= passes.size()) {
+        throw std::runtime_error("Unknown graph pass");
+    }
+    return static_cast<uint32_t>(std::ranges::count_if(passes[pass].uses, [](const ResourceUse& use)
+    {
+        return use.access == Access::ColorWrite;
+    }));
+}
+
+bool RenderGraph::isCulled(GraphPass pass) const {
+    if (pass >= passes.size()) {
+        throw std::runtime_error("Unknown graph pass");
+    }
+    return passes[pass].culled;
+}
+
+Image RenderGraph::getImage(GraphResource resource) const {
+    if (resource >= resources.size()) {
+        throw std::runtime_error("Unknown graph resource");
+    }
+    if (resources[resource].type == ResourceType::Backbuffer) {
+        throw std::runtime_error("The backbuffer changes every frame, it has no single image");
+    }
+    return resources[resource].image;
+}
+
+#endif
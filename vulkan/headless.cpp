@@ -0,0 +1,448 @@
+/*
+* headless.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description: Rendering without a window, offscreen targets and readback to host memory.
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace zen;
+
+namespace {
+    // Readbacks are tightly packed, so we need the size of a texel for the formats targets use
+    VkDeviceSize getTexelSize(VkFormat format) {
+        switch (format) {
+        case VK_FORMAT_R8_UNORM:
+        case VK_FORMAT_R8_SRGB:
+            return 1;
+        case VK_FORMAT_R8G8_UNORM:
+        case VK_FORMAT_R16_SFLOAT:
+            return 2;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+        case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+        case VK_FORMAT_R16G16_SFLOAT:
+        case VK_FORMAT_R32_SFLOAT:
+            return 4;
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+        case VK_FORMAT_R32G32_SFLOAT:
+            return 8;
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+            return 16;
+        default:
+            throw std::runtime_error("Reading back this render target format is not supported");
+        }
+    }
+
+    bool hasInstanceExtension(const std::vector<VkExtensionProperties>& available, const char* name) {
+        return std::any_of(available.begin(), available.end(), [&](const VkExtensionProperties& extension) {
+            return std::strcmp(extension.extensionName, name) == 0;
+        });
+    }
+}
+
+Instance Instance::makeHeadless(uint32_t vulkanVersion, bool enableValidationLayers) {
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "Zenith";
+    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.pEngineName = "Zenith";
+    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.apiVersion = vulkanVersion;
+
+    uint32_t availableCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, nullptr);
+    std::vector<VkExtensionProperties> available(availableCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, available.data());
+
+    VkInstanceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
+
+    // No surface extensions, but the device still queries its features through properties2
+    std::vector<const char*> enabledExtensions;
+    if (hasInstanceExtension(available, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+        enabledExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+    if (hasInstanceExtension(available, VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME)) {
+        // MoltenVK devices are only listed when we ask for portability drivers
+        enabledExtensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
+        createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+    }
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
+
+    const char* validationLayer = "VK_LAYER_KHRONOS_validation";
+    if (enableValidationLayers) {
+        if (CoreValidationLayer{validationLayer}.exists()) {
+            createInfo.enabledLayerCount = 1;
+            createInfo.ppEnabledLayerNames = &validationLayer;
+        }
+        else {
+            std::cerr << "Validation layer " << validationLayer << " does not exist. Skipping." << std::endl;
+        }
+    }
+
+    VkInstance instance = VK_NULL_HANDLE;
+    VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create headless Vulkan instance. Error: " +
+            zen::getVulkanErrorString(result));
+    }
+    return Instance(instance);
+}
+
+void Instance::destroy() const {
+    if (instance != VK_NULL_HANDLE) {
+        vkDestroyInstance(instance, nullptr);
+    }
+}
+
+RenderTarget::RenderTarget(Device& device, VkExtent2D extent, VkFormat format,
+                           const FramebufferAttachments& attachments) : device(device), extent(extent), format(format) {
+    if (extent.width == 0 || extent.height == 0) {
+        throw std::runtime_error("Render targets need a non-zero extent");
+    }
+    if (!Format{format}.isSupportedColorAttachment(device)) {
+        throw std::runtime_error("The render target format can't be used as a color attachment on this device");
+    }
+
+    // Sampled too, so a later pass can read what was rendered without a copy
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {extent.width, extent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+        VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkResult result = vkCreateImage(device.logicalDevice, &imageInfo, nullptr, &image.image);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create render target image. Error: " + zen::getVulkanErrorString(result));
+    }
+    allocation = device.getAllocator().allocateForImage(image.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                                        MemoryCategory::Attachment);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+    result = vkCreateImageView(device.logicalDevice, &viewInfo, nullptr, &image.view);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create render target view. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    // Like a swapchain pass, except that the image ends up ready to be copied instead of presented.
+    // The pass' dependencies order it against readbacks of the previous frame and of this one.
+    RenderAttachment color;
+    color.format.format = format;
+    color.attachmentIndex = 0;
+    pass.addAttachment(color);
+    if (attachments.hasDepth()) {
+        RenderAttachment depth;
+        depth.layout = AttachmentLayout::DepthAttachment;
+        depth.format.format = attachments.depthFormat;
+        depth.attachmentIndex = 1;
+        pass.addAttachment(depth);
+    }
+    pass.samples = attachments.samples;
+    pass.createPass(device, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+    // The pass may have lowered the sample count
+    const bool multisampled = pass.samples != VK_SAMPLE_COUNT_1_BIT;
+    std::vector<VkImageView> views;
+    if (multisampled) {
+        multisampleImage.create(device, extent, format, pass.samples);
+        views.push_back(multisampleImage.view);
+    }
+    else {
+        views.push_back(image.view);
+    }
+    if (attachments.hasDepth()) {
+        depthImage.create(device, extent, attachments.depthFormat, pass.samples);
+        views.push_back(depthImage.view);
+    }
+    if (multisampled) {
+        views.push_back(image.view); // Resolved into
+    }
+
+    VkFramebufferCreateInfo framebufferInfo{};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = pass.renderPass;
+    framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+    framebufferInfo.pAttachments = views.data();
+    framebufferInfo.width = extent.width;
+    framebufferInfo.height = extent.height;
+    framebufferInfo.layers = 1;
+
+    result = vkCreateFramebuffer(device.logicalDevice, &framebufferInfo, nullptr, &framebuffer);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create render target framebuffer. Error: " +
+            zen::getVulkanErrorString(result));
+    }
+}
+
+RenderTarget::~RenderTarget() {
+    // Frames in flight or a pending readback may still use the image
+    device.waitIdle();
+    if (framebuffer != VK_NULL_HANDLE) {
+        vkDestroyFramebuffer(device.logicalDevice, framebuffer, nullptr);
+    }
+    if (pass.renderPass != VK_NULL_HANDLE) {
+        vkDestroyRenderPass(device.logicalDevice, pass.renderPass, nullptr);
+    }
+    depthImage.destroy(device);
+    multisampleImage.destroy(device);
+    if (image.view != VK_NULL_HANDLE) {
+        vkDestroyImageView(device.logicalDevice, image.view, nullptr);
+    }
+    if (image.image != VK_NULL_HANDLE) {
+        vkDestroyImage(device.logicalDevice, image.image, nullptr);
+    }
+    device.getAllocator().free(allocation);
+}
+
+Readback::Readback(ReadbackPool& pool, size_t slot, VkDeviceSize size, VkExtent2D extent, VkFormat format)
+    : pool(pool), slot(slot), size(size), extent(extent), format(format) {
+}
+
+Readback::~Readback() {
+    // The copy may still be running, the slot is only reused once it is done
+    const VkFence fence = pool.getSlot(slot).fence;
+    vkWaitForFences(pool.device.logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+    pool.release(slot);
+}
+
+bool Readback::isReady() const {
+    return vkGetFenceStatus(pool.device.logicalDevice, pool.getSlot(slot).fence) == VK_SUCCESS;
+}
+
+void Readback::wait() const {
+    const VkFence fence = pool.getSlot(slot).fence;
+    VkResult result = vkWaitForFences(pool.device.logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to wait for readback. Error: " + zen::getVulkanErrorString(result));
+    }
+}
+
+const void* Readback::getData() const {
+    wait();
+    return pool.getSlot(slot).allocation.mapped;
+}
+
+ReadbackPool::ReadbackPool(Device& device) : device(device) {
+    // Copies go through the graphics queue, which already owns the targets after rendering
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = device.getGraphicsQueue().familyIndex;
+
+    VkResult result = vkCreateCommandPool(device.logicalDevice, &poolInfo, nullptr, &commandPool);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create readback command pool. Error: " +
+            zen::getVulkanErrorString(result));
+    }
+}
+
+ReadbackPool::~ReadbackPool() {
+    for (auto& slot : slots) {
+        if (slot.busy) {
+            std::cerr << "Zenith: a readback outlived its device, its data is gone" << std::endl;
+        }
+        vkWaitForFences(device.logicalDevice, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        vkDestroyFence(device.logicalDevice, slot.fence, nullptr);
+        if (slot.buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device.logicalDevice, slot.buffer, nullptr);
+            device.getAllocator().free(slot.allocation);
+        }
+    }
+    slots.clear();
+    // Destroying the pool frees the command buffers allocated from it
+    vkDestroyCommandPool(device.logicalDevice, commandPool, nullptr);
+}
+
+std::shared_ptr<Readback> ReadbackPool::read(const RenderTarget& target) {
+    const VkExtent2D extent = target.getExtent();
+    const VkDeviceSize size = getTexelSize(target.getFormat()) * extent.width * extent.height;
+    const size_t index = acquire(size);
+    // The slot is only ever touched by us until the readback exists, so we don't hold the lock
+    Slot& slot = slots[index];
+
+    VkResult result = vkResetCommandBuffer(slot.commandBuffer, 0);
+    if (result == VK_SUCCESS) {
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        result = vkBeginCommandBuffer(slot.commandBuffer, &beginInfo);
+    }
+    if (result != VK_SUCCESS) {
+        release(index);
+        throw std::runtime_error("Failed to begin readback commands. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    // The render pass left the image in TRANSFER_SRC_OPTIMAL and made its writes visible to transfers
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0; // Tightly packed
+    region.bufferImageHeight = 0;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(slot.commandBuffer, target.getImage().image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           slot.buffer, 1, &region);
+
+    // The fence alone doesn't make device writes visible to the host
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = slot.buffer;
+    barrier.offset = 0;
+    barrier.size = size;
+    vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0,
+                         nullptr, 1, &barrier, 0, nullptr);
+
+    result = vkEndCommandBuffer(slot.commandBuffer);
+    if (result == VK_SUCCESS) {
+        result = vkResetFences(device.logicalDevice, 1, &slot.fence);
+    }
+    if (result == VK_SUCCESS) {
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &slot.commandBuffer;
+        VkQueue queue = device.getGraphicsQueue().queue;
+        std::lock_guard submitLock(device.getSubmitMutex(queue));
+        result = vkQueueSubmit(queue, 1, &submitInfo, slot.fence);
+    }
+    if (result != VK_SUCCESS) {
+        release(index);
+        throw std::runtime_error("Failed to submit readback. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    return std::shared_ptr<Readback>(new Readback(*this, index, size, extent, target.getFormat()));
+}
+
+size_t ReadbackPool::acquire(VkDeviceSize size) {
+    std::lock_guard lock(mutex);
+
+    // We take the smallest free slot that fits, so big and small readbacks don't keep growing each other
+    std::optional<size_t> best = std::nullopt;
+    std::optional<size_t> unused = std::nullopt;
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].busy) {
+            continue;
+        }
+        unused = unused.value_or(i);
+        if (slots[i].capacity >= size && (!best || slots[i].capacity < slots[*best].capacity)) {
+            best = i;
+        }
+    }
+
+    size_t index = 0;
+    if (best) {
+        index = *best;
+    }
+    else if (unused) {
+        index = *unused; // Grown below
+    }
+    else {
+        Slot slot;
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VkResult result = vkAllocateCommandBuffers(device.logicalDevice, &allocInfo, &slot.commandBuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate readback command buffer. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+
+        // Signaled, so waiting on a slot that never copied returns right away
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        result = vkCreateFence(device.logicalDevice, &fenceInfo, nullptr, &slot.fence);
+        if (result != VK_SUCCESS) {
+            vkFreeCommandBuffers(device.logicalDevice, commandPool, 1, &slot.commandBuffer);
+            throw std::runtime_error("Failed to create readback fence. Error: " + zen::getVulkanErrorString(result));
+        }
+        slots.push_back(slot);
+        index = slots.size() - 1;
+    }
+
+    Slot& slot = slots[index];
+    if (slot.capacity < size) {
+        if (slot.buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device.logicalDevice, slot.buffer, nullptr);
+            device.getAllocator().free(slot.allocation);
+            slot.buffer = VK_NULL_HANDLE;
+            slot.capacity = 0;
+        }
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VkResult result = vkCreateBuffer(device.logicalDevice, &bufferInfo, nullptr, &slot.buffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create readback buffer. Error: " + zen::getVulkanErrorString(result));
+        }
+
+        // The CPU reads every byte, cached memory makes that much faster where the device has it
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device.logicalDevice, slot.buffer, &requirements);
+        VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        const VkMemoryPropertyFlags cached = properties | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        for (uint32_t i = 0; i < device.physicalDeviceMemoryProperties.memoryTypeCount; i++) {
+            const VkMemoryPropertyFlags flags = device.physicalDeviceMemoryProperties.memoryTypes[i].propertyFlags;
+            if ((requirements.memoryTypeBits & (1u << i)) && (flags & cached) == cached) {
+                properties = cached;
+                break;
+            }
+        }
+        slot.allocation = device.getAllocator().allocateForBuffer(slot.buffer, properties, AllocationStrategy::General,
+                                                                  MemoryCategory::Staging);
+        slot.capacity = size;
+    }
+
+    slot.busy = true;
+    return index;
+}
+
+void ReadbackPool::release(size_t slot) {
+    std::lock_guard lock(mutex);
+    slots[slot].busy = false;
+}
+
+const ReadbackPool::Slot& ReadbackPool::getSlot(size_t slot) const {
+    std::lock_guard lock(mutex);
+    return slots[slot];
+}
+
+#endif
@@ -0,0 +1,404 @@
+/*
+* jobs.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description: Cross-queue job submission on timeline semaphores.
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+
+using namespace zen;
+
+bool GpuJobAwaiter::await_ready() const {
+    return scheduler.isComplete(job);
+}
+
+void GpuJobAwaiter::await_suspend(std::coroutine_handle<> handle) const {
+    scheduler.onCompletion(job, [handle]() {
+        handle.resume();
+    });
+}
+
+JobScheduler::JobScheduler(Device& device) : device(device) {
+    for (QueueRole role : {QueueRole::Graphics, QueueRole::Compute, QueueRole::Transfer}) {
+        Timeline& timeline = getTimeline(role);
+        const CoreQueue queue = device.getQueue(role);
+        timeline.queue = queue.queue;
+
+        VkSemaphoreTypeCreateInfoKHR typeInfo{};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+        typeInfo.initialValue = 0;
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &typeInfo;
+        VkResult result = vkCreateSemaphore(device.logicalDevice, &semaphoreInfo, nullptr, &timeline.semaphore);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create timeline semaphore. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+
+        // Recorded jobs are short lived and recycled one by one
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = queue.familyIndex;
+        result = vkCreateCommandPool(device.logicalDevice, &poolInfo, nullptr, &timeline.pool);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create job command pool. Error: " + zen::getVulkanErrorString(result));
+        }
+    }
+}
+
+JobScheduler::~JobScheduler() {
+    // Callbacks may queue more work, so we keep going until none are left
+    bool pending = true;
+    while (pending) {
+        std::vector<VkSemaphore> semaphores;
+        std::vector<uint64_t> values;
+        {
+            std::lock_guard lock(mutex);
+            flushLocked(VK_NULL_HANDLE, QueueRole::Graphics);
+            for (const auto& timeline : timelines) {
+                semaphores.push_back(timeline.semaphore);
+                values.push_back(timeline.submittedValue);
+            }
+        }
+        VkSemaphoreWaitInfoKHR waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = static_cast<uint32_t>(semaphores.size());
+        waitInfo.pSemaphores = semaphores.data();
+        waitInfo.pValues = values.data();
+        device.waitForSemaphores(device.logicalDevice, &waitInfo, UINT64_MAX);
+
+        poll();
+        std::lock_guard lock(mutex);
+        pending = !callbacks.empty() || std::ranges::any_of(timelines, [](const Timeline& timeline) {
+            return !timeline.queued.empty();
+        });
+    }
+
+    // Destroying a pool frees the command buffers recorded from it
+    for (auto& timeline : timelines) {
+        vkDestroyCommandPool(device.logicalDevice, timeline.pool, nullptr);
+        vkDestroySemaphore(device.logicalDevice, timeline.semaphore, nullptr);
+    }
+}
+
+JobScheduler::Timeline& JobScheduler::getTimeline(QueueRole queue) {
+    return timelines[static_cast<size_t>(queue)];
+}
+
+const JobScheduler::Timeline& JobScheduler::getTimeline(QueueRole queue) const {
+    return timelines[static_cast<size_t>(queue)];
+}
+
+uint64_t JobScheduler::getCompletedValue(const Timeline& timeline) const {
+    uint64_t value = 0;
+    const VkResult result = device.getSemaphoreCounterValue(device.logicalDevice, timeline.semaphore, &value);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to read timeline semaphore. Error: " + zen::getVulkanErrorString(result));
+    }
+    return value;
+}
+
+GpuJob JobScheduler::submit(const GpuJobDescription& job) {
+    std::lock_guard lock(mutex);
+    return queueLocked(job);
+}
+
+GpuJob JobScheduler::submitNow(const GpuJobDescription& job, VkFence fence) {
+    std::lock_guard lock(mutex);
+    const GpuJob handle = queueLocked(job);
+    flushLocked(fence, job.queue);
+    return handle;
+}
+
+GpuJob JobScheduler::record(QueueRole queue, const std::function<void(VkCommandBuffer)>& recorder,
+                            const std::vector<GpuJob>& dependencies, VkPipelineStageFlags waitStages) {
+    Timeline& timeline = getTimeline(queue);
+    std::lock_guard recording(timeline.recording);
+
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    {
+        std::lock_guard lock(mutex);
+        if (!timeline.freeCommandBuffers.empty()) {
+            commandBuffer = timeline.freeCommandBuffers.back();
+            timeline.freeCommandBuffers.pop_back();
+        }
+    }
+    if (commandBuffer == VK_NULL_HANDLE) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = timeline.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VkResult result = vkAllocateCommandBuffers(device.logicalDevice, &allocInfo, &commandBuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate job command buffer. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+    }
+
+    // The pool resets the buffer when it begins again
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    try {
+        VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to begin job command buffer. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+        recorder(commandBuffer);
+        result = vkEndCommandBuffer(commandBuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to end job command buffer. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+    }
+    catch (...) {
+        // Whatever was half recorded is thrown away, the buffer goes back to the free ones
+        vkResetCommandBuffer(commandBuffer, 0);
+        std::lock_guard lock(mutex);
+        timeline.freeCommandBuffers.push_back(commandBuffer);
+        throw;
+    }
+
+    GpuJobDescription job;
+    job.queue = queue;
+    job.commandBuffers = {commandBuffer};
+    job.dependencies = dependencies;
+    job.waitStages = waitStages;
+
+    std::lock_guard lock(mutex);
+    const GpuJob handle = queueLocked(job);
+    timeline.recorded.emplace_back(handle.value, commandBuffer);
+    return handle;
+}
+
+GpuJob JobScheduler::queueLocked(const GpuJobDescription& job) {
+    if (job.waitSemaphores.size() != job.waitSemaphoreStages.size()) {
+        throw std::invalid_argument("Every binary semaphore a job waits on needs its stages");
+    }
+    if (!job.dependencies.empty() && job.waitStages == 0) {
+        throw std::invalid_argument("Jobs with dependencies need the stages that wait for them");
+    }
+    // Values are handed out in submission order, which is what makes flushLocked always progress
+    for (const auto& dependency : job.dependencies) {
+        if (dependency.value >= getTimeline(dependency.queue).nextValue) {
+            throw std::invalid_argument("Jobs can only depend on jobs submitted before them");
+        }
+    }
+
+    Timeline& timeline = getTimeline(job.queue);
+    const uint64_t value = timeline.nextValue++;
+    timeline.queued.push_back({job, value});
+    return {job.queue, value};
+}
+
+void JobScheduler::flush() {
+    std::lock_guard lock(mutex);
+    flushLocked(VK_NULL_HANDLE, QueueRole::Graphics);
+}
+
+void JobScheduler::flushLocked(VkFence fence, QueueRole fenceQueue) {
+    // Everything the submit infos point at has to stay in place until vkQueueSubmit returns
+    struct SubmitStorage {
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<uint64_t> waitValues;
+        std::vector<VkPipelineStageFlags> waitStages;
+        std::vector<VkSemaphore> signalSemaphores;
+        std::vector<uint64_t> signalValues;
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+    };
+
+    // Earlier jobs on the same queue are submitted first anyway, jobs on other queues must be submitted already
+    const auto isReady = [&](const QueuedJob& job) {
+        return std::ranges::all_of(job.description.dependencies, [&](const GpuJob& dependency) {
+            return dependency.queue == job.description.queue ||
+                getTimeline(dependency.queue).submittedValue >= dependency.value;
+        });
+    };
+
+    // Queues take turns submitting the longest run of jobs that are ready, so no queue ever waits on
+    // a signal submitted after it. Roles sharing a VkQueue would deadlock otherwise. The oldest queued
+    // job is always ready, so every round submits something.
+    bool submitted = true;
+    while (submitted) {
+        submitted = false;
+        for (size_t role = 0; role < timelines.size(); role++) {
+            Timeline& timeline = timelines[role];
+            size_t count = 0;
+            while (count < timeline.queued.size() && isReady(timeline.queued[count])) {
+                count++;
+            }
+            if (count == 0) {
+                continue;
+            }
+
+            std::vector<SubmitStorage> storage(count);
+            std::vector<VkSubmitInfo> submits(count);
+            for (size_t i = 0; i < count; i++) {
+                const QueuedJob& job = timeline.queued[i];
+                SubmitStorage& info = storage[i];
+
+                // Timelines only count up, so the latest job per queue covers the others
+                std::array<uint64_t, 3> waits = {};
+                for (const auto& dependency : job.description.dependencies) {
+                    uint64_t& wait = waits[static_cast<size_t>(dependency.queue)];
+                    wait = std::max(wait, dependency.value);
+                }
+                for (size_t other = 0; other < waits.size(); other++) {
+                    if (waits[other] != 0) {
+                        info.waitSemaphores.push_back(timelines[other].semaphore);
+                        info.waitValues.push_back(waits[other]);
+                        info.waitStages.push_back(job.description.waitStages);
+                    }
+                }
+
+                // Binary semaphores ignore their values, but every semaphore needs one
+                for (size_t j = 0; j < job.description.waitSemaphores.size(); j++) {
+                    info.waitSemaphores.push_back(job.description.waitSemaphores[j]);
+                    info.waitValues.push_back(0);
+                    info.waitStages.push_back(job.description.waitSemaphoreStages[j]);
+                }
+                info.signalSemaphores.push_back(timeline.semaphore);
+                info.signalValues.push_back(job.value);
+                for (VkSemaphore semaphore : job.description.signalSemaphores) {
+                    info.signalSemaphores.push_back(semaphore);
+                    info.signalValues.push_back(0);
+                }
+
+                info.timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+                info.timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(info.waitValues.size());
+                info.timelineInfo.pWaitSemaphoreValues = info.waitValues.data();
+                info.timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(info.signalValues.size());
+                info.timelineInfo.pSignalSemaphoreValues = info.signalValues.data();
+
+                VkSubmitInfo& submit = submits[i];
+                submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+                submit.pNext = &info.timelineInfo;
+                submit.waitSemaphoreCount = static_cast<uint32_t>(info.waitSemaphores.size());
+                submit.pWaitSemaphores = info.waitSemaphores.data();
+                submit.pWaitDstStageMask = info.waitStages.data();
+                submit.commandBufferCount = static_cast<uint32_t>(job.description.commandBuffers.size());
+                submit.pCommandBuffers = job.description.commandBuffers.data();
+                submit.signalSemaphoreCount = static_cast<uint32_t>(info.signalSemaphores.size());
+                submit.pSignalSemaphores = info.signalSemaphores.data();
+            }
+
+            // The fence goes with the batch that holds the queue's last job
+            const bool last = count == timeline.queued.size() && static_cast<QueueRole>(role) == fenceQueue;
+            VkResult result;
+            {
+                std::lock_guard submitLock(device.getSubmitMutex(timeline.queue));
+                result = vkQueueSubmit(timeline.queue, static_cast<uint32_t>(count), submits.data(),
+                                       last ? fence : VK_NULL_HANDLE);
+            }
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Failed to submit jobs. Error: " + zen::getVulkanErrorString(result));
+            }
+
+            timeline.submittedValue = timeline.queued[count - 1].value;
+            const auto end = timeline.queued.begin() + static_cast<std::ptrdiff_t>(count);
+            timeline.queued.erase(timeline.queued.begin(), end);
+            submitted = true;
+        }
+    }
+}
+
+bool JobScheduler::isComplete(GpuJob job) const {
+    return !job.isValid() || getCompletedValue(getTimeline(job.queue)) >= job.value;
+}
+
+bool JobScheduler::wait(GpuJob job, uint64_t timeout) {
+    return waitAll({job}, timeout);
+}
+
+bool JobScheduler::waitAll(const std::vector<GpuJob>& jobs, uint64_t timeout) {
+    std::array<uint64_t, 3> values = {};
+    for (const auto& job : jobs) {
+        uint64_t& value = values[static_cast<size_t>(job.queue)];
+        value = std::max(value, job.value);
+    }
+
+    std::vector<VkSemaphore> semaphores;
+    std::vector<uint64_t> waitValues;
+    {
+        // A job that is still queued would never signal
+        std::lock_guard lock(mutex);
+        bool queued = false;
+        for (size_t role = 0; role < timelines.size(); role++) {
+            queued = queued || values[role] > timelines[role].submittedValue;
+            if (values[role] != 0) {
+                semaphores.push_back(timelines[role].semaphore);
+                waitValues.push_back(values[role]);
+            }
+        }
+        if (queued) {
+            flushLocked(VK_NULL_HANDLE, QueueRole::Graphics);
+        }
+    }
+    if (semaphores.empty()) {
+        return true;
+    }
+
+    VkSemaphoreWaitInfoKHR waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+    waitInfo.semaphoreCount = static_cast<uint32_t>(semaphores.size());
+    waitInfo.pSemaphores = semaphores.data();
+    waitInfo.pValues = waitValues.data();
+    const VkResult result = device.waitForSemaphores(device.logicalDevice, &waitInfo, timeout);
+    if (result == VK_TIMEOUT) {
+        return false;
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to wait for jobs. Error: " + zen::getVulkanErrorString(result));
+    }
+    return true;
+}
+
+void JobScheduler::onCompletion(GpuJob job, std::function<void()> callback) {
+    std::lock_guard lock(mutex);
+    callbacks.push_back({job, std::move(callback)});
+}
+
+void JobScheduler::poll() {
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard lock(mutex);
+        std::array<uint64_t, 3> completed = {};
+        for (size_t role = 0; role < timelines.size(); role++) {
+            Timeline& timeline = timelines[role];
+            completed[role] = getCompletedValue(timeline);
+            while (!timeline.recorded.empty() && timeline.recorded.front().first <= completed[role]) {
+                timeline.freeCommandBuffers.push_back(timeline.recorded.front().second);
+                timeline.recorded.pop_front();
+            }
+        }
+
+        for (auto it = callbacks.begin(); it != callbacks.end();) {
+            if (it->job.value <= completed[static_cast<size_t>(it->job.queue)]) {
+                ready.push_back(std::move(it->callback));
+                it = callbacks.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    // Outside the lock, so callbacks and resumed coroutines may submit and wait themselves
+    for (auto& callback : ready) {
+        callback();
+    }
+}
+
+#endif
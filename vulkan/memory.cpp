@@ -0,0 +1,533 @@
+/*
+* memory.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <bit>
+#include <iostream>
+#include <sstream>
+
+using namespace zen;
+
+namespace {
+    constexpr uint32_t minimumOrder = 8; // The smallest buddy is 256 bytes
+    constexpr VkDeviceSize unusedFrame = UINT64_MAX;
+
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        if (alignment <= 1) {
+            return value;
+        }
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    uint32_t orderFor(VkDeviceSize size, VkDeviceSize alignment) {
+        // Buddies are naturally aligned to their own size, so covering the alignment is enough
+        VkDeviceSize needed = std::max(size, alignment);
+        auto order = static_cast<uint32_t>(std::bit_width(needed - 1));
+        return std::max(order, minimumOrder);
+    }
+
+    uint32_t poolKeyFor(uint32_t memoryType, ResourceKind kind) {
+        // Buffers and images live in separate blocks so bufferImageGranularity never applies
+        return memoryType * 2 + (kind == ResourceKind::Image ? 1 : 0);
+    }
+}
+
+const char* zen::getMemoryCategoryName(MemoryCategory category) {
+    switch (category) {
+    case MemoryCategory::Buffer:
+        return "Buffer";
+    case MemoryCategory::Texture:
+        return "Texture";
+    case MemoryCategory::Attachment:
+        return "Attachment";
+    case MemoryCategory::Staging:
+        return "Staging";
+    case MemoryCategory::Uniform:
+        return "Uniform";
+    case MemoryCategory::Other:
+        return "Other";
+    default:
+        throw std::runtime_error("Unknown memory category");
+    }
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    destroy();
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped) {
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkResult result = vkAllocateMemory(device.logicalDevice, &allocInfo, nullptr, &memory);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate device memory. Error: " + zen::getVulkanErrorString(result));
+    }
+    deviceMemoryCount++;
+    reservedBytes[getHeapIndex(memoryType)] += size;
+
+    *mapped = nullptr;
+    const VkMemoryPropertyFlags flags = device.physicalDeviceMemoryProperties.memoryTypes[memoryType].propertyFlags;
+    if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        // We map host visible memory once and keep it mapped
+        result = vkMapMemory(device.logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, mapped);
+        if (result != VK_SUCCESS) {
+            freeDeviceMemory(memory, size, memoryType);
+            throw std::runtime_error("Failed to map device memory. Error: " + zen::getVulkanErrorString(result));
+        }
+    }
+    return memory;
+}
+
+void MemoryAllocator::freeDeviceMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType) {
+    // Freeing implicitly unmaps the memory
+    vkFreeMemory(device.logicalDevice, memory, nullptr);
+    deviceMemoryCount--;
+    reservedBytes[getHeapIndex(memoryType)] -= size;
+}
+
+uint32_t MemoryAllocator::getHeapIndex(uint32_t memoryType) const {
+    return device.physicalDeviceMemoryProperties.memoryTypes[memoryType].heapIndex;
+}
+
+void MemoryAllocator::track(const Allocation& allocation, bool live) {
+    MemoryUsage& heap = heapUsage[getHeapIndex(allocation.memoryType)];
+    MemoryUsage& category = categoryUsage[static_cast<uint32_t>(allocation.category)];
+    if (live) {
+        heap.bytes += allocation.size;
+        heap.allocations++;
+        category.bytes += allocation.size;
+        category.allocations++;
+    }
+    else {
+        heap.bytes -= allocation.size;
+        heap.allocations--;
+        category.bytes -= allocation.size;
+        category.allocations--;
+    }
+}
+
+void MemoryAllocator::trackExternal(VkDeviceSize size, uint32_t memoryType, MemoryCategory category, bool live) {
+    std::lock_guard lock(mutex);
+    Allocation allocation;
+    allocation.size = size;
+    allocation.memoryType = memoryType;
+    allocation.category = category;
+    allocation.dedicated = true;
+    track(allocation, live);
+    if (live) {
+        deviceMemoryCount++;
+        reservedBytes[getHeapIndex(memoryType)] += size;
+    }
+    else {
+        deviceMemoryCount--;
+        reservedBytes[getHeapIndex(memoryType)] -= size;
+    }
+}
+
+uint32_t MemoryAllocator::getBlockOrder() const {
+    if (!std::has_single_bit(blockSize)) {
+        throw std::runtime_error("MemoryAllocator::blockSize must be a power of two");
+    }
+    return static_cast<uint32_t>(std::countr_zero(blockSize));
+}
+
+MemoryAllocator::MemoryBlock& MemoryAllocator::createBlock(uint32_t poolKey, uint32_t memoryType) {
+    auto block = std::make_unique<MemoryBlock>();
+    block->size = blockSize;
+    block->memoryType = memoryType;
+    block->memory = allocateDeviceMemory(blockSize, memoryType, &block->mapped);
+
+    // The whole block starts as a single free buddy of the highest order
+    const uint32_t blockOrder = getBlockOrder();
+    block->freeLists.resize(blockOrder - minimumOrder + 1);
+    block->freeLists.back().insert(0);
+
+    auto& pool = pools[poolKey];
+    pool.push_back(std::move(block));
+    return *pool.back();
+}
+
+bool MemoryAllocator::allocateFromBlock(MemoryBlock& block, uint32_t order, VkDeviceSize& offset) const {
+    const uint32_t blockOrder = getBlockOrder();
+
+    // We look for the smallest free buddy that can hold the request
+    uint32_t found = order;
+    while (found <= blockOrder && block.freeLists[found - minimumOrder].empty()) {
+        found++;
+    }
+    if (found > blockOrder) {
+        return false;
+    }
+
+    auto& list = block.freeLists[found - minimumOrder];
+    offset = *list.begin();
+    list.erase(list.begin());
+
+    // And split it down, handing the upper halves back to the free lists
+    while (found > order) {
+        found--;
+        block.freeLists[found - minimumOrder].insert(offset + (VkDeviceSize{1} << found));
+    }
+
+    block.allocatedOrders[offset] = order;
+    return true;
+}
+
+void MemoryAllocator::freeFromBlock(MemoryBlock& block, VkDeviceSize offset) const {
+    auto it = block.allocatedOrders.find(offset);
+    if (it == block.allocatedOrders.end()) {
+        throw std::runtime_error("Freeing an allocation that does not belong to this memory block");
+    }
+    uint32_t order = it->second;
+    block.allocatedOrders.erase(it);
+
+    // We merge with our buddy for as long as it is free
+    const uint32_t blockOrder = getBlockOrder();
+    while (order < blockOrder) {
+        const VkDeviceSize buddy = offset ^ (VkDeviceSize{1} << order);
+        auto& list = block.freeLists[order - minimumOrder];
+        auto buddyIt = list.find(buddy);
+        if (buddyIt == list.end()) {
+            break;
+        }
+        list.erase(buddyIt);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    block.freeLists[order - minimumOrder].insert(offset);
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+                                     ResourceKind kind, AllocationStrategy strategy, MemoryCategory category) {
+    if (requirements.size == 0) {
+        throw std::invalid_argument("Cannot allocate zero bytes of device memory");
+    }
+    const uint32_t memoryType = device.vkFindMemoryType(requirements.memoryTypeBits, properties);
+
+    std::lock_guard lock(mutex);
+
+    if (strategy == AllocationStrategy::Linear) {
+        Allocation allocation = allocateLinear(requirements, memoryType, kind);
+        allocation.category = category;
+        return allocation;
+    }
+
+    Allocation allocation;
+    allocation.memoryType = memoryType;
+    allocation.size = requirements.size;
+    allocation.kind = kind;
+    allocation.strategy = AllocationStrategy::General;
+    allocation.category = category;
+
+    const uint32_t order = orderFor(requirements.size, requirements.alignment);
+    if (order >= getBlockOrder()) {
+        // Anything as big as a block gets its own allocation
+        void* mapped = nullptr;
+        allocation.memory = allocateDeviceMemory(requirements.size, memoryType, &mapped);
+        allocation.mapped = mapped;
+        allocation.dedicated = true;
+        track(allocation, true);
+        return allocation;
+    }
+
+    const uint32_t poolKey = poolKeyFor(memoryType, kind);
+    VkDeviceSize offset = 0;
+    MemoryBlock* target = nullptr;
+    for (auto& block : pools[poolKey]) {
+        if (allocateFromBlock(*block, order, offset)) {
+            target = block.get();
+            break;
+        }
+    }
+    if (target == nullptr) {
+        target = &createBlock(poolKey, memoryType);
+        if (!allocateFromBlock(*target, order, offset)) {
+            throw std::runtime_error("Failed to sub-allocate from a fresh memory block");
+        }
+    }
+
+    allocation.memory = target->memory;
+    allocation.offset = offset;
+    if (target->mapped != nullptr) {
+        allocation.mapped = static_cast<uint8_t*>(target->mapped) + offset;
+    }
+    track(allocation, true);
+    return allocation;
+}
+
+Allocation MemoryAllocator::allocateLinear(const VkMemoryRequirements& requirements, uint32_t memoryType,
+                                           ResourceKind kind) {
+    LinearRing& ring = rings[memoryType];
+    if (ring.memory == VK_NULL_HANDLE) {
+        ring.size = linearBlockSize;
+        ring.memory = allocateDeviceMemory(ring.size, memoryType, &ring.mapped);
+
+        // The frame creating the ring owns it from the start, or the next recycle would free its data
+        if (linearFrameCount != 0) {
+            ring.frameStarts.assign(linearFrameCount, unusedFrame);
+            ring.frameStarts[linearFrameIndex] = ring.head;
+        }
+    }
+
+    VkDeviceSize alignment = requirements.alignment;
+    if (kind == ResourceKind::Image) {
+        // Images may share the ring with buffers, so they must start on their own page
+        alignment = std::max(alignment, device.physicalDeviceProperties.limits.bufferImageGranularity);
+    }
+
+    if (requirements.size > ring.size) {
+        throw std::runtime_error("Linear allocation of " + std::to_string(requirements.size) +
+            " bytes does not fit in the linear ring");
+    }
+
+    // We work on a copy of the head so a failed allocation doesn't move it
+    VkDeviceSize head = ring.head;
+    const VkDeviceSize physical = head % ring.size;
+    VkDeviceSize aligned = alignUp(physical, alignment);
+    if (aligned + requirements.size > ring.size) {
+        // Not enough room before the end, we skip the remainder and wrap to the start
+        head += ring.size - physical;
+        aligned = 0;
+    }
+    else {
+        head += aligned - physical;
+    }
+
+    const VkDeviceSize end = head + requirements.size;
+    if (end - ring.tail > ring.size) {
+        throw std::runtime_error("Linear memory ring is exhausted, consider raising linearBlockSize");
+    }
+    ring.head = end;
+
+    Allocation allocation;
+    allocation.memory = ring.memory;
+    allocation.offset = aligned;
+    allocation.size = requirements.size;
+    allocation.memoryType = memoryType;
+    allocation.strategy = AllocationStrategy::Linear;
+    allocation.kind = kind;
+    if (ring.mapped != nullptr) {
+        allocation.mapped = static_cast<uint8_t*>(ring.mapped) + aligned;
+    }
+    return allocation;
+}
+
+Allocation MemoryAllocator::allocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties,
+                                              AllocationStrategy strategy, MemoryCategory category) {
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device.logicalDevice, buffer, &memRequirements);
+
+    Allocation allocation = allocate(memRequirements, properties, ResourceKind::Buffer, strategy, category);
+    VkResult result = vkBindBufferMemory(device.logicalDevice, buffer, allocation.memory, allocation.offset);
+    if (result != VK_SUCCESS) {
+        free(allocation);
+        throw std::runtime_error("Failed to bind buffer memory. Error: " + zen::getVulkanErrorString(result));
+    }
+    return allocation;
+}
+
+Allocation MemoryAllocator::allocateForImage(VkImage image, VkMemoryPropertyFlags properties,
+                                             MemoryCategory category) {
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device.logicalDevice, image, &memRequirements);
+
+    Allocation allocation = allocate(memRequirements, properties, ResourceKind::Image,
+                                     AllocationStrategy::General, category);
+    VkResult result = vkBindImageMemory(device.logicalDevice, image, allocation.memory, allocation.offset);
+    if (result != VK_SUCCESS) {
+        free(allocation);
+        throw std::runtime_error("Failed to bind image memory. Error: " + zen::getVulkanErrorString(result));
+    }
+    return allocation;
+}
+
+void MemoryAllocator::free(Allocation& allocation) {
+    if (!allocation.isValid()) {
+        return;
+    }
+
+    std::lock_guard lock(mutex);
+
+    if (allocation.dedicated) {
+        freeDeviceMemory(allocation.memory, allocation.size, allocation.memoryType);
+        track(allocation, false);
+    }
+    else if (allocation.strategy == AllocationStrategy::General) {
+        auto& pool = pools[poolKeyFor(allocation.memoryType, allocation.kind)];
+        auto it = std::ranges::find_if(pool, [&](const std::unique_ptr<MemoryBlock>& block)
+        {
+            return block->memory == allocation.memory;
+        });
+        if (it == pool.end()) {
+            throw std::runtime_error("Freeing an allocation that was not made by this allocator");
+        }
+        freeFromBlock(**it, allocation.offset);
+        track(allocation, false);
+
+        // We keep one empty block around so a resource that comes and goes doesn't reallocate it
+        // every time, any further empty block goes back to the driver
+        if ((*it)->allocatedOrders.empty()) {
+            const bool hasSpare = std::ranges::any_of(pool, [&](const std::unique_ptr<MemoryBlock>& block)
+            {
+                return block != *it && block->allocatedOrders.empty();
+            });
+            if (hasSpare) {
+                freeDeviceMemory((*it)->memory, (*it)->size, (*it)->memoryType);
+                pool.erase(it);
+            }
+        }
+    }
+    // Linear allocations are reclaimed in bulk by beginFrame
+
+    allocation = {};
+}
+
+void MemoryAllocator::beginFrame(uint32_t frameIndex, uint32_t frameCount) {
+    MemoryBudgetCallback callback;
+    float threshold;
+    {
+        std::lock_guard lock(mutex);
+        recycleLinear(frameIndex, frameCount);
+        callback = budgetCallback;
+        threshold = budgetThreshold;
+    }
+
+    // The callback runs without the lock, evicting frees memory through us
+    if (!callback) {
+        return;
+    }
+    const MemoryStatistics statistics = getStatistics();
+    for (uint32_t heap = 0; heap < statistics.heaps.size(); heap++) {
+        const MemoryHeapStatistics& stats = statistics.heaps[heap];
+        if (static_cast<double>(stats.usage) > threshold * static_cast<double>(stats.budget)) {
+            callback({heap, stats.usage, stats.budget});
+        }
+    }
+}
+
+void MemoryAllocator::recycleLinear(uint32_t frameIndex, uint32_t frameCount) {
+    linearFrameIndex = frameIndex;
+    linearFrameCount = frameCount;
+    for (auto& [type, ring] : rings) {
+        // Only rings created before the first frame aren't sized yet, what they hold is recycled here
+        if (ring.frameStarts.size() != frameCount) {
+            ring.frameStarts.resize(frameCount, unusedFrame);
+        }
+
+        // The slot we are recycling is done on the GPU, so the oldest live data now belongs
+        // to whichever other slot started first
+        ring.frameStarts[frameIndex] = unusedFrame;
+        VkDeviceSize oldest = ring.head;
+        for (auto start : ring.frameStarts) {
+            if (start != unusedFrame) {
+                oldest = std::min(oldest, start);
+            }
+        }
+        ring.tail = oldest;
+        ring.frameStarts[frameIndex] = ring.head;
+    }
+}
+
+void MemoryAllocator::resetLinear() {
+    std::lock_guard lock(mutex);
+
+    for (auto& [type, ring] : rings) {
+        ring.tail = ring.head;
+        std::ranges::fill(ring.frameStarts, unusedFrame);
+    }
+}
+
+MemoryStatistics MemoryAllocator::getStatistics() const {
+    const VkPhysicalDeviceMemoryProperties& properties = device.physicalDeviceMemoryProperties;
+    MemoryStatistics statistics;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    if (device.supportsMemoryBudget) {
+        VkPhysicalDeviceMemoryProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties2.pNext = &budget;
+        device.getMemoryProperties2(device.physicalDevice, &properties2);
+        statistics.hasBudget = true;
+    }
+
+    std::lock_guard lock(mutex);
+    statistics.heaps.resize(properties.memoryHeapCount);
+    for (uint32_t heap = 0; heap < properties.memoryHeapCount; heap++) {
+        MemoryHeapStatistics& stats = statistics.heaps[heap];
+        stats.size = properties.memoryHeaps[heap].size;
+        stats.flags = properties.memoryHeaps[heap].flags;
+        stats.reservedBytes = reservedBytes[heap];
+        stats.used = heapUsage[heap];
+        if (statistics.hasBudget) {
+            stats.budget = budget.heapBudget[heap];
+            stats.usage = budget.heapUsage[heap];
+        }
+        else {
+            stats.budget = stats.size;
+            stats.usage = stats.reservedBytes;
+        }
+    }
+    statistics.categories = categoryUsage;
+    statistics.deviceMemoryCount = deviceMemoryCount;
+    return statistics;
+}
+
+void MemoryAllocator::setBudgetCallback(MemoryBudgetCallback callback, float threshold) {
+    std::lock_guard lock(mutex);
+    budgetCallback = std::move(callback);
+    budgetThreshold = threshold;
+}
+
+std::string MemoryAllocator::getLeakReport() const {
+    std::lock_guard lock(mutex);
+    std::ostringstream report;
+    for (uint32_t category = 0; category < memoryCategoryCount; category++) {
+        const MemoryUsage& usage = categoryUsage[category];
+        if (usage.allocations == 0) {
+            continue;
+        }
+        report << (report.tellp() > 0 ? ", " : "") << getMemoryCategoryName(static_cast<MemoryCategory>(category))
+            << ": " << usage.allocations << " (" << usage.bytes << " bytes)";
+    }
+    return report.str();
+}
+
+void MemoryAllocator::destroy() {
+    // Everything the device owns is gone by now, what is left was never destroyed by its owner
+    if (const std::string leaks = getLeakReport(); !leaks.empty()) {
+        std::cerr << "Zenith: allocations still alive when the device was destroyed. " << leaks << std::endl;
+    }
+
+    std::lock_guard lock(mutex);
+
+    for (auto& [key, pool] : pools) {
+        for (auto& block : pool) {
+            freeDeviceMemory(block->memory, block->size, block->memoryType);
+        }
+    }
+    pools.clear();
+
+    for (auto& [type, ring] : rings) {
+        freeDeviceMemory(ring.memory, ring.size, type);
+    }
+    rings.clear();
+    heapUsage = {};
+    categoryUsage = {};
+}
+
+#endif
@@ -0,0 +1,399 @@
+/*
+* package.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description: Baking and memory mapped loading of binary asset packages.
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace zen;
+
+namespace {
+    uint64_t alignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Larger than any device's image limit, which keeps the level sizes far from overflowing
+    constexpr uint32_t maxTextureExtent = 1u << 16;
+
+    // Every level has to lie inside the blob, Texture::load trusts the sizes and offsets it gets
+    bool fitsTexture(const PackageEntry& entry) {
+        if (entry.width == 0 || entry.height == 0 || entry.width > maxTextureExtent ||
+            entry.height > maxTextureExtent) {
+            return false;
+        }
+        const uint32_t levelCount = std::max(entry.levelCount, 1u);
+        for (uint32_t level = 0; level < levelCount; level++) {
+            const VkDeviceSize offset = entry.levelCount == 0 ? 0 : entry.levelOffsets[level];
+            const VkDeviceSize size = Format{entry.format}.getLevelSize(std::max(entry.width >> level, 1u),
+                                                                        std::max(entry.height >> level, 1u));
+            if (size == 0 || offset > entry.size || size > entry.size - offset) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+namespace {
+    // A transfer source backed by imported pages of the mapping, which it keeps alive. The allocator
+    // never sees the memory, so we report it to its statistics ourselves.
+    struct ImportedSource {
+        Device& device;
+        std::shared_ptr<const void> mapping;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint32_t memoryType = 0;
+
+        ImportedSource(Device& device, std::shared_ptr<const void> mapping)
+            : device(device), mapping(std::move(mapping)) {
+        }
+
+        ImportedSource(const ImportedSource&) = delete;
+        ImportedSource& operator=(const ImportedSource&) = delete;
+
+        ~ImportedSource() {
+            if (buffer != VK_NULL_HANDLE) {
+                vkDestroyBuffer(device.logicalDevice, buffer, nullptr);
+            }
+            if (memory != VK_NULL_HANDLE) {
+                vkFreeMemory(device.logicalDevice, memory, nullptr);
+                device.getAllocator().trackExternal(size, memoryType, MemoryCategory::Staging, false);
+            }
+        }
+    };
+}
+
+struct AssetPackage::MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data != nullptr) {
+            munmap(const_cast<uint8_t*>(data), size);
+        }
+    }
+
+    // Asks the kernel to read the whole range ahead instead of faulting it in page by page
+    void prefetch(uint64_t offset, uint64_t length) const {
+        const auto pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        const uint64_t start = offset / pageSize * pageSize;
+        madvise(const_cast<uint8_t*>(data) + start, offset + length - start, MADV_WILLNEED);
+    }
+};
+
+void PackageWriter::addBlob(const std::string& name, const void* data, size_t size, PackageBlobType type,
+                            uint32_t stride) {
+    if (std::ranges::any_of(blobs, [&](const Blob& blob) { return blob.name == name; })) {
+        throw std::runtime_error("The package already has a blob named " + name);
+    }
+    Blob& blob = blobs.emplace_back();
+    blob.name = name;
+    blob.entry.type = type;
+    blob.entry.stride = stride;
+    blob.entry.size = size;
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    blob.data.assign(bytes, bytes + size);
+}
+
+void PackageWriter::addTexture(const std::string& name, const void* pixels, size_t size, uint32_t width,
+                               uint32_t height, VkFormat format, const std::vector<VkDeviceSize>& levelOffsets) {
+    if (levelOffsets.size() > packageMaxLevels) {
+        throw std::runtime_error("Packaged textures hold at most " + std::to_string(packageMaxLevels) + " levels");
+    }
+    PackageEntry entry;
+    entry.type = PackageBlobType::Texture;
+    entry.size = size;
+    entry.width = width;
+    entry.height = height;
+    entry.format = format;
+    entry.levelCount = static_cast<uint32_t>(levelOffsets.size());
+    std::ranges::copy(levelOffsets, entry.levelOffsets);
+    if (!fitsTexture(entry)) {
+        throw std::runtime_error("The levels of " + name + " don't fit in its pixels, or its format is unknown");
+    }
+
+    addBlob(name, pixels, size, PackageBlobType::Texture);
+    blobs.back().entry = entry;
+}
+
+void PackageWriter::write(const std::string& path) const {
+    PackageHeader header;
+    header.entryCount = static_cast<uint32_t>(blobs.size());
+
+    std::vector<PackageEntry> entries;
+    std::string names;
+    for (const auto& blob : blobs) {
+        PackageEntry entry = blob.entry;
+        entry.nameOffset = static_cast<uint32_t>(names.size());
+        entry.nameLength = static_cast<uint32_t>(blob.name.size());
+        names += blob.name;
+        entries.push_back(entry);
+    }
+    header.nameBytes = static_cast<uint32_t>(names.size());
+
+    // Blobs start on their own pages, so they can be imported or copied without touching their neighbours
+    uint64_t offset = alignUp(sizeof(PackageHeader) + entries.size() * sizeof(PackageEntry) + names.size(),
+                              packageAlignment);
+    for (auto& entry : entries) {
+        entry.offset = offset;
+        offset += alignUp(entry.size, packageAlignment);
+    }
+
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    if (!stream) {
+        throw std::runtime_error("Failed to open " + path + " for writing the package");
+    }
+    const auto pad = [&](uint64_t to) {
+        static constexpr char zeros[packageAlignment] = {};
+        while (static_cast<uint64_t>(stream.tellp()) < to) {
+            const uint64_t count = std::min<uint64_t>(to - static_cast<uint64_t>(stream.tellp()), sizeof(zeros));
+            stream.write(zeros, static_cast<std::streamsize>(count));
+        }
+    };
+
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.write(reinterpret_cast<const char*>(entries.data()),
+                 static_cast<std::streamsize>(entries.size() * sizeof(PackageEntry)));
+    stream.write(names.data(), static_cast<std::streamsize>(names.size()));
+    for (size_t i = 0; i < blobs.size(); i++) {
+        pad(entries[i].offset);
+        stream.write(reinterpret_cast<const char*>(blobs[i].data.data()),
+                     static_cast<std::streamsize>(blobs[i].data.size()));
+    }
+    pad(offset);
+
+    if (!stream) {
+        throw std::runtime_error("Failed to write the package to " + path);
+    }
+}
+
+AssetPackage::AssetPackage(const std::string& path) {
+    const int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw std::runtime_error("Failed to open the asset package " + path);
+    }
+    struct stat status{};
+    if (fstat(descriptor, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(PackageHeader)) {
+        ::close(descriptor);
+        throw std::runtime_error(path + " is too small to be an asset package");
+    }
+
+    auto mapped = std::make_shared<MappedFile>();
+    mapped->size = static_cast<size_t>(status.st_size);
+    void* data = mmap(nullptr, mapped->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    ::close(descriptor); // The mapping keeps the file open
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Failed to map the asset package " + path);
+    }
+    mapped->data = static_cast<const uint8_t*>(data);
+
+    PackageHeader header;
+    std::memcpy(&header, mapped->data, sizeof(header));
+    if (std::memcmp(header.magic, PackageHeader{}.magic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(path + " is not an asset package");
+    }
+    if (header.version != packageVersion) {
+        throw std::runtime_error(path + " has package version " + std::to_string(header.version) +
+            ", this build reads version " + std::to_string(packageVersion));
+    }
+
+    // The table of contents is read in place, we only check that nothing in it points outside the file
+    const uint64_t tableEnd = sizeof(PackageHeader) + uint64_t{header.entryCount} * sizeof(PackageEntry);
+    if (tableEnd + header.nameBytes > mapped->size) {
+        throw std::runtime_error("The table of contents of " + path + " runs past the end of the file");
+    }
+    entries = reinterpret_cast<const PackageEntry*>(mapped->data + sizeof(PackageHeader));
+    names = reinterpret_cast<const char*>(mapped->data + tableEnd);
+
+    index.reserve(header.entryCount);
+    for (uint32_t i = 0; i < header.entryCount; i++) {
+        const PackageEntry& entry = entries[i];
+        // Nothing is added before it is checked, a huge size would wrap around and pass
+        const bool inFile = entry.offset % packageAlignment == 0 && entry.offset <= mapped->size &&
+            entry.size <= mapped->size - entry.offset;
+        const bool named = entry.nameOffset <= header.nameBytes &&
+            entry.nameLength <= header.nameBytes - entry.nameOffset;
+        const bool levels = entry.levelCount <= packageMaxLevels &&
+            (entry.type != PackageBlobType::Texture || fitsTexture(entry));
+        if (!inFile || !named || !levels) {
+            throw std::runtime_error("Entry " + std::to_string(i) + " of " + path + " is malformed");
+        }
+        if (!index.emplace(getName(entry), i).second) {
+            throw std::runtime_error(path + " has two blobs named " + std::string(getName(entry)));
+        }
+    }
+    file = std::move(mapped);
+}
+
+const PackageEntry* AssetPackage::find(std::string_view name) const {
+    const auto it = index.find(name);
+    return it != index.end() ? &entries[it->second] : nullptr;
+}
+
+const PackageEntry& AssetPackage::get(std::string_view name) const {
+    const PackageEntry* entry = find(name);
+    if (entry == nullptr) {
+        throw std::runtime_error("The package has no blob named " + std::string(name));
+    }
+    return *entry;
+}
+
+std::string_view AssetPackage::getName(const PackageEntry& entry) const {
+    return {names + entry.nameOffset, entry.nameLength};
+}
+
+const void* AssetPackage::getData(const PackageEntry& entry) const {
+    return file->data + entry.offset;
+}
+
+Buffer AssetPackage::loadBuffer(Device& device, std::string_view name, BufferUsage usage) const {
+    const PackageEntry& entry = get(name);
+    if (entry.type == PackageBlobType::Texture) {
+        throw std::runtime_error(std::string(name) + " is a texture, load it with loadTexture");
+    }
+    if (entry.size == 0) {
+        throw std::runtime_error(std::string(name) + " is empty, there is nothing to make a buffer from");
+    }
+    file->prefetch(entry.offset, entry.size);
+
+    Buffer buffer;
+    buffer.usage = usage;
+    buffer.create(entry.size, device);
+    if (buffer.allocation.mapped != nullptr) {
+        // Device local memory the host can write, as on unified architectures, needs no GPU copy
+        std::memcpy(buffer.allocation.mapped, getData(entry), entry.size);
+    }
+    else if (!importBuffer(device, buffer, entry)) {
+        device.uploadBuffer(buffer, getData(entry), entry.size);
+    }
+    return buffer;
+}
+
+bool AssetPackage::importBuffer(Device& device, const Buffer& target, const PackageEntry& entry) const {
+    const VkDeviceSize alignment = device.minImportedHostPointerAlignment;
+    if (!device.supportsHostMemoryImport || alignment == 0 || packageAlignment % alignment != 0) {
+        return false;
+    }
+
+    // Blobs are padded up to the package alignment, a file cut short of the padding can't be imported.
+    // Some drivers refuse file backed pages, we then fall back to the staging ring.
+    constexpr auto handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    const VkDeviceSize size = alignUp(entry.size, packageAlignment);
+    if (size > file->size - entry.offset) {
+        return false;
+    }
+    void* pointer = const_cast<uint8_t*>(file->data + entry.offset);
+
+    VkMemoryHostPointerPropertiesEXT pointerProperties{};
+    pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    if (device.getMemoryHostPointerProperties(device.logicalDevice, handleType, pointer, &pointerProperties) !=
+        VK_SUCCESS) {
+        return false;
+    }
+
+    // Whoever drops the last reference frees the import, the upload batch once the copy ran or any
+    // early return and exception before that
+    auto source = std::make_shared<ImportedSource>(device, file);
+
+    VkExternalMemoryBufferCreateInfo externalInfo{};
+    externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    externalInfo.handleTypes = handleType;
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext = &externalInfo;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device.logicalDevice, &bufferInfo, nullptr, &source->buffer) != VK_SUCCESS) {
+        source->buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device.logicalDevice, source->buffer, &requirements);
+    const uint32_t memoryTypes = requirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+    if (memoryTypes == 0) {
+        return false;
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo{};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType = handleType;
+    importInfo.pHostPointer = pointer;
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = &importInfo;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = static_cast<uint32_t>(std::countr_zero(memoryTypes));
+    if (vkAllocateMemory(device.logicalDevice, &allocInfo, nullptr, &source->memory) != VK_SUCCESS) {
+        source->memory = VK_NULL_HANDLE;
+        return false;
+    }
+    source->size = size;
+    source->memoryType = allocInfo.memoryTypeIndex;
+    device.getAllocator().trackExternal(size, source->memoryType, MemoryCategory::Staging, true);
+    if (vkBindBufferMemory(device.logicalDevice, source->buffer, source->memory, 0) != VK_SUCCESS) {
+        return false;
+    }
+
+    UploadBatcher& uploads = device.getUploadBatcher();
+    uploads.record([&](VkCommandBuffer commandBuffer) {
+        VkBufferCopy region{};
+        region.size = entry.size;
+        vkCmdCopyBuffer(commandBuffer, source->buffer, target.buffer, 1, &region);
+    });
+    try {
+        VkAccessFlags access;
+        VkPipelineStageFlags stages;
+        zen::getBufferAccess(target.usage, access, stages);
+        uploads.releaseToGraphics(target.buffer, 0, entry.size, access, stages);
+        uploads.releaseOnCompletion([source]() mutable {
+            source.reset();
+        });
+    }
+    catch (...) {
+        // The copy is recorded already, the source may only go once the batch has run
+        uploads.flush().wait();
+        throw;
+    }
+    return true;
+}
+
+Texture AssetPackage::loadTexture(Device& device, std::string_view name, bool generateMips) const {
+    const PackageEntry& entry = get(name);
+    if (entry.type != PackageBlobType::Texture) {
+        throw std::runtime_error(std::string(name) + " is not a texture");
+    }
+    file->prefetch(entry.offset, entry.size);
+
+    // The pixels alias the mapping and keep it alive, the texture only ever reads them
+    std::shared_ptr<void> pixels(file, const_cast<void*>(getData(entry)));
+    const std::vector<VkDeviceSize> levelOffsets(entry.levelOffsets, entry.levelOffsets + entry.levelCount);
+
+    Texture texture;
+    texture.load(std::move(pixels), entry.size, device, entry.width, entry.height, entry.format, levelOffsets,
+                 generateMips);
+    return texture;
+}
+
+#endif
@@ -0,0 +1,219 @@
+/*
+* packing.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description: Conversion of float vertex data into packed and half precision formats.
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace zen;
+
+namespace {
+    uint32_t getFloatComponents(InputFormat format) {
+        switch (format) {
+        case InputFormat::Float:
+            return 1;
+        case InputFormat::Vector2:
+            return 2;
+        case InputFormat::Vector3:
+            return 3;
+        case InputFormat::Vector4:
+        case InputFormat::Color:
+            return 4;
+        default:
+            throw std::runtime_error("Only float attributes can be compressed");
+        }
+    }
+
+    // Signed values map [-1, 1] onto the symmetric range of the bits, unsigned ones [0, 1] onto all of it
+    int32_t toSnorm(float value, uint32_t bits) {
+        const float scale = static_cast<float>((1u << (bits - 1)) - 1);
+        return static_cast<int32_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * scale));
+    }
+
+    uint32_t toUnorm(float value, uint32_t bits) {
+        const float scale = static_cast<float>((1u << bits) - 1);
+        return static_cast<uint32_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * scale));
+    }
+
+    template <typename T>
+    void append(uint8_t*& out, T value) {
+        std::memcpy(out, &value, sizeof(T));
+        out += sizeof(T);
+    }
+
+    void pack(InputFormat format, const float (&v)[4], uint8_t* out) {
+        switch (format) {
+        case InputFormat::Half2:
+        case InputFormat::Half4:
+            for (uint32_t i = 0; i < (format == InputFormat::Half2 ? 2u : 4u); i++) {
+                append(out, toHalf(v[i]));
+            }
+            break;
+        case InputFormat::Byte4Norm:
+            for (float component : v) {
+                append(out, static_cast<int8_t>(toSnorm(component, 8)));
+            }
+            break;
+        case InputFormat::UByte4Norm:
+            for (float component : v) {
+                append(out, static_cast<uint8_t>(toUnorm(component, 8)));
+            }
+            break;
+        case InputFormat::Short2Norm:
+        case InputFormat::Short4Norm:
+            for (uint32_t i = 0; i < (format == InputFormat::Short2Norm ? 2u : 4u); i++) {
+                append(out, static_cast<int16_t>(toSnorm(v[i], 16)));
+            }
+            break;
+        case InputFormat::UShort2Norm:
+        case InputFormat::UShort4Norm:
+            for (uint32_t i = 0; i < (format == InputFormat::UShort2Norm ? 2u : 4u); i++) {
+                append(out, static_cast<uint16_t>(toUnorm(v[i], 16)));
+            }
+            break;
+        case InputFormat::Packed1010102Norm: {
+            // Red sits in the low bits, two's complement fields masked to their width
+            const uint32_t packed = (static_cast<uint32_t>(toSnorm(v[0], 10)) & 0x3ff) |
+                ((static_cast<uint32_t>(toSnorm(v[1], 10)) & 0x3ff) << 10) |
+                ((static_cast<uint32_t>(toSnorm(v[2], 10)) & 0x3ff) << 20) |
+                ((static_cast<uint32_t>(toSnorm(v[3], 2)) & 0x3) << 30);
+            append(out, packed);
+            break;
+        }
+        case InputFormat::UPacked1010102Norm: {
+            const uint32_t packed = toUnorm(v[0], 10) | (toUnorm(v[1], 10) << 10) | (toUnorm(v[2], 10) << 20) |
+                (toUnorm(v[3], 2) << 30);
+            append(out, packed);
+            break;
+        }
+        default:
+            throw std::runtime_error("Vertices can only be compressed into half, normalized or packed formats");
+        }
+    }
+}
+
+uint16_t zen::toHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    const uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff) {
+        // Infinity stays infinity, NaN stays a quiet NaN
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+    }
+
+    const int32_t halfExponent = static_cast<int32_t>(exponent) - 127 + 15;
+    if (halfExponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+
+    uint32_t half;
+    uint32_t rest;
+    uint32_t halfway;
+    if (halfExponent <= 0) {
+        // Too small for a normal half, we shift the mantissa with its implicit bit into a subnormal
+        if (halfExponent < -10) {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        const uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+        half = mantissa >> shift;
+        rest = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    }
+    else {
+        half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+        rest = mantissa & 0x1fff;
+        halfway = 0x1000;
+    }
+
+    // Round to nearest even, a carry out of the mantissa correctly bumps the exponent
+    if (rest > halfway || (rest == halfway && (half & 1) != 0)) {
+        half++;
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+CompressedVertices zen::compressVertices(const void* vertices, size_t vertexCount, const InputDescriptor& layout,
+                                         const std::vector<VertexCompression>& compressions, uint32_t binding) {
+    struct Attribute {
+        std::shared_ptr<InputDescriptorItemInterface> item;
+        uint32_t sourceOffset = 0;
+        uint32_t targetOffset = 0;
+        std::optional<InputFormat> target = std::nullopt;
+    };
+
+    CompressedVertices compressed;
+    compressed.descriptor = layout;
+    compressed.descriptor.items.clear();
+
+    // Other bindings come from other buffers, they keep their items
+    std::vector<Attribute> attributes;
+    uint32_t sourceStride = 0;
+    for (const auto& item : layout.items) {
+        if (item->getBinding() != binding) {
+            compressed.descriptor.items.push_back(item);
+            continue;
+        }
+        Attribute attribute;
+        attribute.item = item;
+        attribute.sourceOffset = sourceStride;
+        attribute.targetOffset = compressed.stride;
+        for (const auto& compression : compressions) {
+            if (compression.location == item->getLocation()) {
+                (void)getFloatComponents(item->getFormat()); // Throws for anything but floats before we convert
+                attribute.target = compression.format;
+            }
+        }
+
+        if (attribute.target.has_value()) {
+            compressed.descriptor.items.push_back(
+                std::make_shared<PackedInputDescriptorItem>(item->getLocation(), *attribute.target, binding));
+            compressed.stride += static_cast<uint32_t>(getInputFormatSize(*attribute.target));
+        }
+        else {
+            compressed.descriptor.items.push_back(item);
+            compressed.stride += static_cast<uint32_t>(item->getSize());
+        }
+        sourceStride += static_cast<uint32_t>(item->getSize());
+        attributes.push_back(std::move(attribute));
+    }
+    if (attributes.empty()) {
+        throw std::runtime_error("The layout has no attributes in binding " + std::to_string(binding));
+    }
+
+    const auto* source = static_cast<const uint8_t*>(vertices);
+    compressed.data.resize(vertexCount * compressed.stride);
+    for (size_t vertex = 0; vertex < vertexCount; vertex++) {
+        const uint8_t* sourceVertex = source + vertex * sourceStride;
+        uint8_t* targetVertex = compressed.data.data() + vertex * compressed.stride;
+        for (const auto& attribute : attributes) {
+            if (!attribute.target.has_value()) {
+                std::memcpy(targetVertex + attribute.targetOffset, sourceVertex + attribute.sourceOffset,
+                            attribute.item->getSize());
+                continue;
+            }
+
+            float components[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+            const uint32_t count = getFloatComponents(attribute.item->getFormat());
+            std::memcpy(components, sourceVertex + attribute.sourceOffset, count * sizeof(float));
+            pack(*attribute.target, components, targetVertex + attribute.targetOffset);
+        }
+    }
+    compressed.descriptor.buildInputLayout();
+    return compressed;
+}
+
+#endif
@@ -14,6 +14,7 @@
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <unordered_map>
 
 using namespace zen;
 
@@ -53,6 +54,8 @@ VkAttachmentStoreOp zen::toVulkanStoreOp(const zen::Operation operation) {
         throw std::runtime_error("Clear operation is not supported for Vulkan store op");
     case zen::Operation::DontCare:
         return VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    case zen::Operation::Load:
+        throw std::runtime_error("Load operation is not supported for Vulkan store op");
     default:
         throw std::runtime_error("Unknown operation for Vulkan store op");
     }
@@ -66,42 +69,112 @@ VkAttachmentLoadOp zen::toVulkanLoadOp(zen::Operation operation) {
         return VK_ATTACHMENT_LOAD_OP_CLEAR;
     case zen::Operation::DontCare:
         return VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    case zen::Operation::Load:
+        return VK_ATTACHMENT_LOAD_OP_LOAD;
     default:
         throw std::runtime_error("Unknown operation for Vulkan load op");
     }
 }
 
 void RenderPass::create(Device& device, const Presentable& presentable) {
+    createPass(device, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    device.makeFramebuffers(renderPass, presentable, getFramebufferAttachments());
+}
+
+void RenderPass::createPass(const Device& device, VkImageLayout outputLayout) {
     if (attachments.empty()) {
         throw std::runtime_error("No attachments specified to create the Render Pass");
     }
-    // First, we need to create a subpass. We're going to use a single subpass for now
-    VkSubpassDescription subpass{};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &attachments[0].reference; // We assume the first attachment is a color attachment
-    if (attachments.size() > 1 && attachments[1].layout == AttachmentLayout::DepthAttachment) {
-        subpass.pDepthStencilAttachment = &attachments[1].reference;
+    const bool hasDepth = attachments.size() > 1 && attachments[1].layout == AttachmentLayout::DepthAttachment;
+
+    // We fall back to the highest count the device has rather than failing
+    const VkSampleCountFlagBits maxSamples = device.getMaxSampleCount();
+    while (samples > maxSamples) {
+        samples = static_cast<VkSampleCountFlagBits>(samples >> 1);
+    }
+    const bool multisampled = samples != VK_SAMPLE_COUNT_1_BIT;
+
+    // The color attachment comes first, then depth and then the resolve target when multisampling
+    std::vector<VkAttachmentDescription> vulkanAttachments{};
+    RenderAttachment& color = attachments[0];
+    color.makeRenderAttachment();
+    color.reference.attachment = 0;
+    VkAttachmentDescription colorDescription = color.description;
+    colorDescription.samples = samples;
+    colorDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    if (multisampled) {
+        // The samples only live until they are resolved, so they never have to reach memory
+        colorDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     }
     else {
-        subpass.pDepthStencilAttachment = nullptr; // No depth attachment
+        colorDescription.finalLayout = outputLayout;
+    }
+    vulkanAttachments.push_back(colorDescription);
+
+    if (hasDepth) {
+        // Nothing reads depth after the pass, dropping it saves the write back on tilers
+        RenderAttachment& depth = attachments[1];
+        depth.makeRenderAttachment();
+        depth.reference.attachment = 1;
+        VkAttachmentDescription depthDescription = depth.description;
+        depthDescription.samples = samples;
+        depthDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        vulkanAttachments.push_back(depthDescription);
     }
 
-    // We create the subpass dependencies
-    VkSubpassDependency subpassDependency{};
-    subpassDependency.srcSubpass = VK_SUBPASS_EXTERNAL; // This is the first subpass
-    subpassDependency.dstSubpass = 0; // This is the subpass we created
-
-    subpassDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    subpassDependency.srcAccessMask = 0;
-
-    subpassDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    subpassDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+    VkAttachmentReference resolveReference{};
+    if (multisampled) {
+        VkAttachmentDescription resolveDescription{};
+        resolveDescription.format = color.format.format;
+        resolveDescription.samples = VK_SAMPLE_COUNT_1_BIT;
+        resolveDescription.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // Every pixel is overwritten by the resolve
+        resolveDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        resolveDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        resolveDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        resolveDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        resolveDescription.finalLayout = outputLayout;
+        resolveReference.attachment = static_cast<uint32_t>(vulkanAttachments.size());
+        resolveReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        vulkanAttachments.push_back(resolveDescription);
+    }
 
-    std::vector<VkAttachmentDescription> vulkanAttachments{};
-    for (auto& attachment : attachments) {
-        attachment.makeRenderAttachment();
-        vulkanAttachments.push_back(attachment.description);
+    // We use a single subpass for now
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color.reference;
+    subpass.pDepthStencilAttachment = hasDepth ? &attachments[1].reference : nullptr;
+    subpass.pResolveAttachments = multisampled ? &resolveReference : nullptr;
+
+    // Frames in flight share the depth and multisample images, so the previous frame's writes to
+    // them must be done before we clear them. The transfer stage covers readbacks of the output.
+    std::vector<VkSubpassDependency> dependencies(1);
+    VkSubpassDependency& subpassDependency = dependencies[0];
+    subpassDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    subpassDependency.dstSubpass = 0;
+    subpassDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    subpassDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpassDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    subpassDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+
+    if (outputLayout != VK_IMAGE_LAYOUT_PRESENT_SRC_KHR) {
+        // Presentation waits on a semaphore, anything else reads the output through this dependency
+        VkSubpassDependency outputDependency{};
+        outputDependency.srcSubpass = 0;
+        outputDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+        outputDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        outputDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        outputDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        outputDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        dependencies.push_back(outputDependency);
     }
 
     VkRenderPassCreateInfo renderPassInfo{};
@@ -110,310 +183,204 @@ void RenderPass::create(Device& device, const Presentable& presentable) {
     renderPassInfo.pAttachments = vulkanAttachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &subpassDependency;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
 
     if (const VkResult result = vkCreateRenderPass(device.logicalDevice, &renderPassInfo, nullptr, &renderPass); result
         !=
         VK_SUCCESS) {
         throw std::runtime_error("Failed to create render pass. Error: " + zen::getVulkanErrorString(result));
     }
+}
 
-    device.framebuffers.resize(presentable.images.size());
-    for (size_t i = 0; i < presentable.images.size(); i++) {
-        std::vector<VkImageView> attachmentViews;
-        attachmentViews.push_back(presentable.images[i].view);
-        if (attachments.size() > 1 && attachments[1].layout == AttachmentLayout::DepthAttachment) {
-        }
-
-        VkFramebufferCreateInfo framebufferInfo{};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = renderPass;
-        framebufferInfo.attachmentCount = static_cast<uint32_t>(attachmentViews.size());
-        framebufferInfo.pAttachments = attachmentViews.data();
-        framebufferInfo.width = presentable.extent.width;
-        framebufferInfo.height = presentable.extent.height;
-        framebufferInfo.layers = 1;
-
-        if (vkCreateFramebuffer(device.logicalDevice, &framebufferInfo, nullptr, &device.framebuffers[i].framebuffer) !=
-            VK_SUCCESS) {
-            throw std::runtime_error("Failed to create framebuffer!");
-        }
+FramebufferAttachments RenderPass::getFramebufferAttachments() const {
+    FramebufferAttachments framebufferAttachments;
+    if (attachments.size() > 1 && attachments[1].layout == AttachmentLayout::DepthAttachment) {
+        framebufferAttachments.depthFormat = attachments[1].format.format;
     }
+    framebufferAttachments.samples = samples;
+    return framebufferAttachments;
 }
 
 void InputDescriptor::buildInputLayout() {
-    int size = 0;
-    uint32_t offset = 0;
+    // Each binding packs its own items in order, the stride is the sum of their sizes
+    std::vector<uint32_t> bindingIndices;
+    std::unordered_map<uint32_t, uint32_t> strides;
     for (const auto& item : items) {
-        size += static_cast<int>(item->getSize());
+        const uint32_t index = item->getBinding();
+        if (!strides.contains(index)) {
+            bindingIndices.push_back(index);
+        }
+        strides[index] += static_cast<uint32_t>(item->getSize());
     }
-    binding.binding = 0;
-    binding.stride = size;
-    binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // We use vertex input rate for now
-
-    attributes.resize(items.size());
-
-    for (size_t i = 0; i < items.size(); ++i) {
-        const auto& item = items[i];
-        attributes[i].location = item->getLocation();
-        attributes[i].binding = binding.binding;
-        attributes[i].format = zen::toVulkanFormat(item->getFormat());
-        attributes[i].offset = offset;
+
+    bindings.clear();
+    for (uint32_t index : bindingIndices) {
+        VkVertexInputBindingDescription description{};
+        description.binding = index;
+        description.stride = strides[index];
+        const auto rate = rates.find(index);
+        description.inputRate = rate != rates.end() && rate->second == InputRate::Instance
+                                    ? VK_VERTEX_INPUT_RATE_INSTANCE
+                                    : VK_VERTEX_INPUT_RATE_VERTEX;
+        bindings.push_back(description);
+    }
+    binding = bindings.empty() ? VkVertexInputBindingDescription{} : bindings.front();
+
+    attributes.clear();
+    attributes.reserve(items.size());
+
+    std::unordered_map<uint32_t, uint32_t> offsets;
+    for (const auto& item : items) {
+        uint32_t& offset = offsets[item->getBinding()];
+
+        // A matrix takes one location per column, its columns follow each other in the vertex
+        const uint32_t locations = zen::getInputFormatLocations(item->getFormat());
+        const uint32_t columnSize = static_cast<uint32_t>(item->getSize()) / locations;
+        for (uint32_t column = 0; column < locations; column++) {
+            VkVertexInputAttributeDescription attribute{};
+            attribute.location = static_cast<uint32_t>(item->getLocation()) + column;
+            attribute.binding = item->getBinding();
+            attribute.format = zen::toVulkanFormat(item->getFormat());
+            attribute.offset = offset + column * columnSize;
+            attributes.push_back(attribute);
+        }
         offset += static_cast<uint32_t>(item->getSize());
     }
 }
 
 void RenderPipeline::makePipeline() {
-    VkGraphicsPipelineCreateInfo info{};
-    info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-
-    // First, we need to set the shader stages
-    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
-    shaderStages.reserve(shaderProgram.shaderModules.size());
-    for (const auto& shader : shaderProgram.shaderModules) {
-        shaderStages.emplace_back(shader.get().shaderStageInfo);
+    // The pipeline's own resources are set 0, unless that index was handed to a resource set
+    if (!resources.isEmpty()) {
+        if (setLayouts.contains(0)) {
+            throw std::runtime_error("Set 0 holds the pipeline's attachments, declare resource sets from 1 on");
+        }
+        if (descriptorSet == VK_NULL_HANDLE) {
+            resources.build();
+            descriptorSet = resources.descriptorSet;
+        }
+        setLayouts[0] = resources.getLayout();
+    }
+
+    // Every index below the highest declared set needs a layout, gaps get an empty one
+    std::vector<VkDescriptorSetLayout> layouts;
+    if (!setLayouts.empty()) {
+        const uint32_t setCount = setLayouts.rbegin()->first + 1;
+        for (uint32_t set = 0; set < setCount; set++) {
+            auto it = setLayouts.find(set);
+            layouts.push_back(it != setLayouts.end() ? it->second : device.getDescriptorLayoutCache().getLayout({}));
+        }
+    }
+
+    // Only 128 bytes are guaranteed, most desktop drivers give 256
+    if (!pushConstantRanges.empty()) {
+        const uint32_t pushConstantSize = pushConstantRanges.back().offset + pushConstantRanges.back().size;
+        const uint32_t maxSize = device.physicalDeviceProperties.limits.maxPushConstantsSize;
+        if (pushConstantSize > maxSize) {
+            throw std::runtime_error("Push constants take " + std::to_string(pushConstantSize) +
+                " bytes, the device allows " + std::to_string(maxSize));
+        }
     }
-    info.stageCount = static_cast<uint32_t>(shaderStages.size());
-    info.pStages = shaderStages.data();
-
-    // Now, we need to set the vertex input state
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &inputDescriptor.binding;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(inputDescriptor.attributes.size());
-    vertexInputInfo.pVertexAttributeDescriptions = inputDescriptor.attributes.data();
-
-    info.pVertexInputState = &vertexInputInfo;
-
-    // We set the input assembly state
-    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; // We use triangle list for now
-    inputAssembly.primitiveRestartEnable = VK_FALSE; // We don't use primitive restart for now
-
-    info.pInputAssemblyState = &inputAssembly;
-
-    // We set the viewport and scissor state
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = static_cast<float>(device.instance.extent.height); // Start from bottom
-    viewport.width = static_cast<float>(device.instance.extent.width);
-    viewport.height = -static_cast<float>(device.instance.extent.height); // Negative height flips Y
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = {device.instance.extent.width, device.instance.extent.height};
-
-    VkPipelineViewportStateCreateInfo viewportState{};
-    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
-    viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
-    info.pViewportState = &viewportState;
-
-    // We set the rasterization state
-    VkPipelineRasterizationStateCreateInfo rasterizer{};
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL; // <- wireframe for debug?
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-
-    info.pRasterizationState = &rasterizer;
-
-    // We set the multisample state
-    VkPipelineMultisampleStateCreateInfo multisampling{};
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT; // We use 1 sample for now
-
-    info.pMultisampleState = &multisampling;
-
-    // We set the depth stencil state
-    VkPipelineDepthStencilStateCreateInfo depthStencil{};
-    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencil.depthTestEnable = VK_TRUE;
-    depthStencil.depthWriteEnable = VK_TRUE;
-    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-    depthStencil.depthBoundsTestEnable = VK_FALSE;
-    depthStencil.stencilTestEnable = VK_FALSE;
-
-    info.pDepthStencilState = &depthStencil;
-
-    // We set the color blend state
-    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-
-    VkPipelineColorBlendStateCreateInfo colorBlending{};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-
-    info.pColorBlendState = &colorBlending;
 
     // We set the layout
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    if (descriptorSetLayout != VK_NULL_HANDLE) {
-        pipelineLayoutInfo.setLayoutCount = 1;
-        pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-    }
-    else {
-        pipelineLayoutInfo.setLayoutCount = 0;
-        pipelineLayoutInfo.pSetLayouts = nullptr; // No descriptor set layout
-    }
-    pipelineLayoutInfo.pushConstantRangeCount = 0; // no push constants
-    pipelineLayoutInfo.pPushConstantRanges = nullptr;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(layouts.size());
+    pipelineLayoutInfo.pSetLayouts = layouts.empty() ? nullptr : layouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+    pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.empty() ? nullptr : pushConstantRanges.data();
 
     if (vkCreatePipelineLayout(device.logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create empty pipeline layout!");
     }
 
-    info.layout = pipelineLayout;
-    info.renderPass = renderPass.renderPass;
-    info.subpass = 0; // We use the first subpass
+    // The fixed-function state lives in the description, so variants and this pipeline are built alike
+    pipeline = PipelineStateCache::build(device, describe(state));
+}
 
-    VkResult result = vkCreateGraphicsPipelines(device.logicalDevice, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create graphics pipeline. Error: " + zen::getVulkanErrorString(result));
+void RenderPipeline::destroy() {
+    if (pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device.logicalDevice, pipeline, nullptr);
+        pipeline = VK_NULL_HANDLE;
     }
+    if (pipelineLayout != VK_NULL_HANDLE) {
+        vkDestroyPipelineLayout(device.logicalDevice, pipelineLayout, nullptr);
+        pipelineLayout = VK_NULL_HANDLE;
+    }
+    // The layouts stay with the device's cache, only the set goes back
+    resources.release();
+    descriptorSet = VK_NULL_HANDLE;
 }
 
 void RenderPipeline::attachUniformBlock(UniformBlock& uniformBlock) {
-    uniformBlocks.push_back(std::make_shared<UniformBlock>(uniformBlock));
-    recalculateDescriptors();
+    // The set is only built once in makePipeline, no matter how many resources get attached
+    resources.attachUniformBlock(uniformBlock);
 }
 
-void RenderPipeline::recalculateDescriptors() {
-    if (descriptorSet != VK_NULL_HANDLE || descriptorPool != VK_NULL_HANDLE) {
-        // If we already have a descriptor set and pool, we need to destroy them first
-        vkDestroyDescriptorSetLayout(device.logicalDevice, descriptorSetLayout, nullptr);
-        vkDestroyDescriptorPool(device.logicalDevice, descriptorPool, nullptr);
-    }
-    std::vector<VkDescriptorSetLayoutBinding> bindings;
-    bindings.reserve(uniformBlocks.size());
-    for (uint32_t i = 0; i < uniformBlocks.size(); i++) {
-        bindings.push_back({
-            .binding = i,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-            // We use both vertex and fragment stages
-            .pImmutableSamplers = nullptr // No samplers for uniform buffers
-        });
-    }
+void RenderPipeline::attachTexture(Texture& texture) {
+    resources.attachTexture(texture);
+}
 
-    uint32_t textureBindingStart = static_cast<uint32_t>(uniformBlocks.size());
-    for (uint32_t i = 0; i < textures.size(); i++) {
-        bindings.push_back({
-            .binding = textureBindingStart + i,
-            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT, // Textures typically used in fragment shader
-            .pImmutableSamplers = nullptr
-        });
-    }
+void RenderPipeline::attachUniformBlock(UniformBlockHandle uniformBlock) {
+    resources.attachUniformBlock(uniformBlock);
+}
+
+void RenderPipeline::attachTexture(TextureHandle texture) {
+    resources.attachTexture(texture);
+}
 
-    VkDescriptorSetLayoutCreateInfo layoutInfo{};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-    layoutInfo.pBindings = bindings.data();
-    VkResult result = vkCreateDescriptorSetLayout(device.logicalDevice, &layoutInfo, nullptr, &descriptorSetLayout);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create descriptor set layout. Error: " + zen::getVulkanErrorString(result));
+void RenderPipeline::useResourceSet(uint32_t set, ResourceSet& resourceSet) {
+    if (pipeline != VK_NULL_HANDLE) {
+        throw std::runtime_error("Resource sets must be declared before making the pipeline");
     }
+    setLayouts[set] = resourceSet.getLayout();
+}
 
-    std::vector<VkDescriptorPoolSize> poolSizes;
-    if (!uniformBlocks.empty()) {
-        poolSizes.push_back({
-            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = static_cast<uint32_t>(uniformBlocks.size())
-        });
+uint32_t RenderPipeline::addPushConstantRange(uint32_t size, VkShaderStageFlags stages) {
+    if (pipeline != VK_NULL_HANDLE) {
+        throw std::runtime_error("Push constants must be declared before making the pipeline");
     }
-    if (!textures.empty()) {
-        poolSizes.push_back({
-            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = static_cast<uint32_t>(textures.size())
-        });
+    if (size == 0) {
+        throw std::runtime_error("Push constant ranges can't be empty");
     }
 
-    if (!poolSizes.empty()) {
-        VkDescriptorPoolCreateInfo poolInfo{};
-        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-        poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = 1; // We create one descriptor set that contains everything
-        poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT; // Allow freeing individual sets
-
-        result = vkCreateDescriptorPool(device.logicalDevice, &poolInfo, nullptr, &descriptorPool);
-        if (result != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create descriptor pool. Error: " + zen::getVulkanErrorString(result));
-        }
-
-        // Allocate descriptor set
-        VkDescriptorSetAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = descriptorPool;
-        allocInfo.descriptorSetCount = 1;
-        allocInfo.pSetLayouts = &descriptorSetLayout;
-
-        result = vkAllocateDescriptorSets(device.logicalDevice, &allocInfo, &descriptorSet);
-        if (result != VK_SUCCESS) {
-            throw std::runtime_error("Failed to allocate descriptor set. Error: " + zen::getVulkanErrorString(result));
-        }
+    // Offsets and sizes have to be multiples of four
+    const uint32_t offset = pushConstantRanges.empty() ? 0 :
+        pushConstantRanges.back().offset + pushConstantRanges.back().size;
+    pushConstantRanges.push_back({stages, offset, (size + 3) & ~3u});
+    return offset;
+}
 
-        // Update descriptor sets
-        std::vector<VkWriteDescriptorSet> descriptorWrites;
-        // Write uniform buffer descriptors
-        for (uint32_t i = 0; i < uniformBlocks.size(); ++i) {
-            descriptorWrites.push_back({
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = descriptorSet,
-                .dstBinding = i,
-                .dstArrayElement = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .pBufferInfo = &uniformBlocks[i]->descriptorBufferInfo
-            });
+VkShaderStageFlags RenderPipeline::getPushConstantStages(uint32_t offset, uint32_t size) const {
+    if (offset % 4 != 0 || size % 4 != 0) {
+        throw std::runtime_error("Push constant offsets and sizes must be multiples of four");
+    }
+    VkShaderStageFlags stages = 0;
+    for (const auto& range : pushConstantRanges) {
+        if (offset >= range.offset + range.size || offset + size <= range.offset) {
+            continue;
         }
-        // Write texture descriptors
-        for (uint32_t i = 0; i < textures.size(); ++i) {
-            // Ensure texture has valid descriptor info
-            if (textures[i]->imageDescriptorInfo.imageView == VK_NULL_HANDLE || textures[i]->imageDescriptorInfo.sampler
-                == VK_NULL_HANDLE) {
-                throw std::runtime_error("Texture descriptor info not properly initialized");
-            }
-
-            descriptorWrites.push_back({
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = descriptorSet,
-                .dstBinding = textureBindingStart + i,
-                .dstArrayElement = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                .pImageInfo = &textures[i]->imageDescriptorInfo
-            });
+        // Each stage we push for must see the whole update, so it can't straddle ranges
+        if (offset < range.offset || offset + size > range.offset + range.size) {
+            throw std::runtime_error("Push constant updates must stay within one declared range");
         }
-
-        vkUpdateDescriptorSets(device.logicalDevice, static_cast<uint32_t>(descriptorWrites.size()),
-                               descriptorWrites.data(), 0, nullptr);
+        stages |= range.stageFlags;
+    }
+    if (stages == 0) {
+        throw std::runtime_error("No push constant range covers offset " + std::to_string(offset));
     }
+    return stages;
 }
 
-void RenderPipeline::attachTexture(Texture& texture) {
-    textures.push_back(std::make_shared<Texture>(texture));
-    recalculateDescriptors();
+void RenderPipeline::useBindlessTextures(uint32_t set) {
+    if (pipeline != VK_NULL_HANDLE) {
+        throw std::runtime_error("The bindless table must be declared before making the pipeline");
+    }
+    setLayouts[set] = device.getBindlessTable().getLayout();
 }
 
+void RenderPipeline::resolveUniformOffsets(std::vector<uint32_t>& offsets) const {
+    resources.resolveUniformOffsets(offsets);
+}
 
 #endif
@@ -11,28 +11,77 @@
 
 #include <zenith/zenith.h>
 #include <vulkan/vulkan.hpp>
+#include <algorithm>
 
 using namespace zen;
 
-Presentable::Presentable(zen::Device device, zen::Instance instance) : device(std::move(device)), instance(instance) {
+Presentable::Presentable(zen::Device& device, zen::Instance instance, PresentConfiguration configuration) :
+    device(device), instance(instance), configuration(configuration) {
+    if (instance.isHeadless()) {
+        throw std::runtime_error("Headless instances have no surface to present to, render into a RenderTarget");
+    }
     create();
 }
 
 Presentable::~Presentable() {
+    // The semaphores may still be pending on the queues
+    device.waitIdle();
+    synchronization.destroy(device.logicalDevice);
+
+    destroyViews();
     if (swapchain != VK_NULL_HANDLE) {
         vkDestroySwapchainKHR(device.logicalDevice, swapchain, nullptr);
     }
+}
+
+bool Presentable::recreate(VkExtent2D windowExtent) {
+    // Without a size from the caller the window knows best, the old extent is stale after a resize
+    if ((windowExtent.width == 0 || windowExtent.height == 0) && instance.queryExtent) {
+        windowExtent = instance.queryExtent();
+        if (windowExtent.width == 0 || windowExtent.height == 0) {
+            return false; // Minimized, nothing to present to until the window comes back
+        }
+    }
+    if (windowExtent.width != 0 && windowExtent.height != 0) {
+        instance.extent = windowExtent;
+    }
+
+    VkSurfaceCapabilitiesKHR capabilities;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device.physicalDevice, instance.surface, &capabilities);
+    const VkExtent2D surfaceExtent = chooseSwapExtent(capabilities, instance.extent);
+    if (surfaceExtent.width == 0 || surfaceExtent.height == 0) {
+        return false; // Nothing to present to until the window comes back
+    }
+
+    // Frames in flight still render to the old images and wait on their semaphores
+    device.waitIdle();
+    destroyViews();
+    synchronization.destroy(device.logicalDevice);
+
+    // Handing over the old swapchain lets the driver reuse its resources and keep presenting meanwhile
+    VkSwapchainKHR oldSwapchain = swapchain;
+    swapchain = VK_NULL_HANDLE;
+    create(oldSwapchain);
+    vkDestroySwapchainKHR(device.logicalDevice, oldSwapchain, nullptr);
+    generation++;
+
+    if (device.getFramebufferRenderPass() != VK_NULL_HANDLE) {
+        device.makeFramebuffers(device.getFramebufferRenderPass(), *this);
+    }
+    return true;
+}
+
+void Presentable::destroyViews() {
+    // Swapchain images are owned by the swapchain, so we only destroy our views
     for (const auto& image : images) {
         if (image.view != VK_NULL_HANDLE) {
             vkDestroyImageView(device.logicalDevice, image.view, nullptr);
         }
-        if (image.image != VK_NULL_HANDLE) {
-            vkDestroyImage(device.logicalDevice, image.image, nullptr);
-        }
     }
+    images.clear();
 }
 
-void Presentable::create() {
+void Presentable::create(VkSwapchainKHR oldSwapchain) {
     // First, we need to get the surface capabilities
     VkSurfaceCapabilitiesKHR capabilities;
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device.physicalDevice, instance.surface, &capabilities);
@@ -53,11 +102,13 @@ void Presentable::create() {
 
     // Finally, we choose the surface format, present mode, and extent
     auto surfaceFormat = chooseSurfaceFormat(availableFormats);
-    auto presentMode = choosePresentMode(availablePresentModes);
+    presentMode = choosePresentMode(availablePresentModes, configuration.mode);
     extent = chooseSwapExtent(capabilities, instance.extent);
 
-    // We create the swapchain and get the images
-    uint32_t imageCount = capabilities.minImageCount + 1;
+    // We create the swapchain and get the images. More images add latency but stall less.
+    uint32_t imageCount = configuration.minImageCount != 0 ? configuration.minImageCount
+                                                           : capabilities.minImageCount + 1;
+    imageCount = std::max(imageCount, capabilities.minImageCount);
     if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount) {
         imageCount = capabilities.maxImageCount;
     }
@@ -76,7 +127,7 @@ void Presentable::create() {
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
+    createInfo.oldSwapchain = oldSwapchain;
 
     VkResult result = vkCreateSwapchainKHR(device.logicalDevice, &createInfo, nullptr, &swapchain);
     if (result != VK_SUCCESS) {
@@ -84,6 +135,7 @@ void Presentable::create() {
     }
 
     format = surfaceFormat.format;
+    presentId = 0;
 
     // Now we get the swapchain images
     uint32_t count = 0;
@@ -112,6 +164,8 @@ void Presentable::create() {
         }
         images.push_back({image, view});
     }
+
+    synchronization.create(device.logicalDevice, device.framesInFlight, static_cast<uint32_t>(images.size()));
 }
 
 VkSurfaceFormatKHR Presentable::chooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
@@ -137,16 +191,77 @@ VkSurfaceFormatKHR Presentable::chooseSurfaceFormat(const std::vector<VkSurfaceF
 }
 
 
-VkPresentModeKHR Presentable::choosePresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
-    for (const auto& mode : availablePresentModes) {
-        if (mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            return mode; // This is the preferred mode for low latency
+VkPresentModeKHR Presentable::choosePresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes,
+                                                PresentMode requested) {
+    const auto available = [&](VkPresentModeKHR mode) {
+        return std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) !=
+            availablePresentModes.end();
+    };
+
+    // We step down towards FIFO, each fallback keeps as much of the request as it can
+    switch (requested) {
+    case PresentMode::Immediate:
+        if (available(VK_PRESENT_MODE_IMMEDIATE_KHR)) {
+            return VK_PRESENT_MODE_IMMEDIATE_KHR;
         }
+        [[fallthrough]];
+    case PresentMode::Mailbox:
+        if (available(VK_PRESENT_MODE_MAILBOX_KHR)) {
+            return VK_PRESENT_MODE_MAILBOX_KHR;
+        }
+        break;
+    case PresentMode::FifoRelaxed:
+        if (available(VK_PRESENT_MODE_FIFO_RELAXED_KHR)) {
+            return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+        }
+        break;
+    case PresentMode::Fifo:
+        break;
     }
-    // If we don't find the preferred mode, we return FIFO which is guaranteed to be available
+    // FIFO is guaranteed to be available
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+VkResult Presentable::present(VkQueue queue, VkSemaphore waitSemaphore, uint32_t imageIndex) {
+    const bool pacing = configuration.paceFrames && device.supportsPresentWait;
+
+    VkPresentInfoKHR presentInfo = {};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &waitSemaphore;
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &swapchain;
+    presentInfo.pImageIndices = &imageIndex;
+    presentInfo.pResults = nullptr;
+
+    const uint64_t id = ++presentId;
+    VkPresentIdKHR presentIdInfo = {};
+    presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+    presentIdInfo.swapchainCount = 1;
+    presentIdInfo.pPresentIds = &id;
+    if (pacing) {
+        presentInfo.pNext = &presentIdInfo;
+    }
+
+    VkResult result;
+    {
+        std::lock_guard submitLock(device.getSubmitMutex(queue));
+        result = vkQueuePresentKHR(queue, &presentInfo);
+    }
+    if (!pacing || result != VK_SUCCESS || id <= configuration.maxQueuedPresents) {
+        return result;
+    }
+
+    // Instead of racing ahead and having frames dropped or queued, we wait for an older one to show
+    const VkResult waitResult = device.waitForPresent(device.logicalDevice, swapchain,
+                                                      id - configuration.maxQueuedPresents,
+                                                      configuration.presentWaitTimeout);
+    if (waitResult == VK_ERROR_OUT_OF_DATE_KHR || waitResult == VK_ERROR_SURFACE_LOST_KHR) {
+        return waitResult;
+    }
+    return result; // A timeout only means the window isn't visible right now
+}
+
 VkExtent2D Presentable::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, VkExtent2D windowExtent) {
     if (capabilities.currentExtent.width != UINT32_MAX) {
         return capabilities.currentExtent; // The surface has a fixed extent
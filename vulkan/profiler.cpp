@@ -0,0 +1,445 @@
+/*
+* profiler.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+using namespace zen;
+
+namespace {
+    const auto programStart = std::chrono::steady_clock::now();
+
+    struct OpenCpuScope {
+        const Profiler* owner = nullptr;
+        std::string name;
+        double start = 0.0;
+        bool active = false;
+    };
+
+    // Every thread nests its own scopes, so nothing here needs the profiler's lock
+    thread_local std::vector<OpenCpuScope> openCpuScopes;
+
+    // The order of the flags is the order the results come back in
+    constexpr VkQueryPipelineStatisticFlags statisticFlags =
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+    constexpr uint32_t statisticCount = 6;
+
+    std::string escapeJson(const std::string& value) {
+        std::string escaped;
+        escaped.reserve(value.size());
+        for (const char c : value) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                escaped += ' '; // Names never need control characters
+            }
+            else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    double sumScopes(const std::vector<ProfileScope>& scopes, const std::string& name) {
+        double total = 0.0;
+        for (const auto& scope : scopes) {
+            if (scope.name == name) {
+                total += scope.duration;
+            }
+        }
+        return total;
+    }
+}
+
+double FrameProfile::getCpuTime(const std::string& name) const {
+    return sumScopes(cpuScopes, name);
+}
+
+double FrameProfile::getGpuTime(const std::string& name) const {
+    return sumScopes(gpuScopes, name);
+}
+
+Profiler::Profiler(Device& device, uint32_t maxGpuScopes) : device(device), maxGpuScopes(maxGpuScopes) {
+    timestampPeriod = device.physicalDeviceProperties.limits.timestampPeriod;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device.physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device.physicalDevice, &familyCount, families.data());
+
+    // Only the low bits of a timestamp are meaningful, the rest is garbage we mask away
+    const uint32_t familyIndex = device.getGraphicsQueue().familyIndex;
+    const uint32_t validBits = familyIndex < familyCount ? families[familyIndex].timestampValidBits : 0;
+    if (validBits >= 64) {
+        timestampMask = ~0ull;
+    }
+    else if (validBits > 0) {
+        timestampMask = (1ull << validBits) - 1;
+    }
+}
+
+Profiler::~Profiler() {
+    if (timestampPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device.logicalDevice, timestampPool, nullptr);
+    }
+    if (statisticsPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device.logicalDevice, statisticsPool, nullptr);
+    }
+}
+
+double Profiler::now() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - programStart).count();
+}
+
+void Profiler::beginCpuScope(const std::string& name) {
+    openCpuScopes.push_back({this, name, now(), enabled.load()});
+}
+
+void Profiler::endCpuScope() {
+    if (openCpuScopes.empty() || openCpuScopes.back().owner != this) {
+        return; // Unbalanced, we'd rather lose the scope than misattribute it
+    }
+    const OpenCpuScope scope = std::move(openCpuScopes.back());
+    openCpuScopes.pop_back();
+    if (!scope.active) {
+        return;
+    }
+    const auto depth = static_cast<uint32_t>(std::count_if(openCpuScopes.begin(), openCpuScopes.end(),
+                                                           [this](const OpenCpuScope& open) {
+                                                               return open.owner == this;
+                                                           }));
+    addCpuScope(scope.name, scope.start, now(), depth);
+}
+
+void Profiler::addCpuScope(const std::string& name, double start, double end, uint32_t depth) {
+    std::lock_guard lock(mutex);
+    if (slots.empty() || !slots[currentSlot].active) {
+        return;
+    }
+    const auto thread = threads.try_emplace(std::this_thread::get_id(), static_cast<uint32_t>(threads.size()));
+    slots[currentSlot].cpuScopes.push_back({name, start, end - start, depth, thread.first->second});
+}
+
+void Profiler::createPools(uint32_t frameCount) {
+    slots.resize(frameCount);
+
+    if (timestampMask != 0) {
+        VkQueryPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = frameCount * maxGpuScopes * 2; // A begin and an end per scope
+        VkResult result = vkCreateQueryPool(device.logicalDevice, &poolInfo, nullptr, &timestampPool);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create timestamp query pool. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+    }
+
+    // Secondaries run inside the frame's query, which they can only do when it's inherited
+    if (device.physicalDeviceFeatures.pipelineStatisticsQuery && device.physicalDeviceFeatures.inheritedQueries) {
+        VkQueryPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        poolInfo.queryCount = frameCount;
+        poolInfo.pipelineStatistics = statisticFlags;
+        VkResult result = vkCreateQueryPool(device.logicalDevice, &poolInfo, nullptr, &statisticsPool);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create pipeline statistics query pool. Error: " +
+                zen::getVulkanErrorString(result));
+        }
+    }
+}
+
+void Profiler::beginFrame(uint32_t frameIndex, uint32_t frameCount, uint64_t serial) {
+    std::lock_guard lock(mutex);
+    if (slots.empty()) {
+        createPools(frameCount);
+    }
+    if (frameIndex >= slots.size()) {
+        throw std::runtime_error("The frame count changed after the profiler created its queries");
+    }
+
+    Slot& slot = slots[frameIndex];
+    resolve(slot, frameIndex);
+    slot = {};
+    slot.active = enabled.load();
+    slot.serial = serial;
+    currentSlot = frameIndex;
+}
+
+void Profiler::beginCommands(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+    std::lock_guard lock(mutex);
+    if (frameIndex >= slots.size() || !slots[frameIndex].active) {
+        return;
+    }
+    Slot& slot = slots[frameIndex];
+
+    // Queries have to be reset outside of a render pass, so the whole range goes here
+    if (timestampPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, timestampPool, frameIndex * maxGpuScopes * 2, maxGpuScopes * 2);
+        slot.recorded = true;
+    }
+    if (collectStatistics && statisticsPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, statisticsPool, frameIndex, 1);
+        vkCmdBeginQuery(commandBuffer, statisticsPool, frameIndex, 0);
+        slot.statistics = true;
+    }
+    beginGpuScopeLocked(commandBuffer, frameIndex, "Frame");
+}
+
+void Profiler::endCommands(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+    std::lock_guard lock(mutex);
+    if (frameIndex >= slots.size() || !slots[frameIndex].active) {
+        return;
+    }
+    Slot& slot = slots[frameIndex];
+
+    // Scopes left open end with the frame
+    while (!slot.openRecords.empty()) {
+        endGpuScopeLocked(commandBuffer, frameIndex);
+    }
+    if (slot.statistics) {
+        vkCmdEndQuery(commandBuffer, statisticsPool, frameIndex);
+    }
+}
+
+void Profiler::markSubmit(uint32_t frameIndex) {
+    std::lock_guard lock(mutex);
+    if (frameIndex < slots.size()) {
+        slots[frameIndex].submitTime = now();
+    }
+}
+
+VkQueryPipelineStatisticFlags Profiler::getInheritedStatistics(uint32_t frameIndex) const {
+    std::lock_guard lock(mutex);
+    return frameIndex < slots.size() && slots[frameIndex].statistics ? statisticFlags : 0;
+}
+
+void Profiler::beginGpuScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, const std::string& name) {
+    std::lock_guard lock(mutex);
+    beginGpuScopeLocked(commandBuffer, frameIndex, name);
+}
+
+void Profiler::endGpuScope(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+    std::lock_guard lock(mutex);
+    endGpuScopeLocked(commandBuffer, frameIndex);
+}
+
+void Profiler::beginGpuScopeLocked(VkCommandBuffer commandBuffer, uint32_t frameIndex, const std::string& name) {
+    if (frameIndex >= slots.size() || !slots[frameIndex].recorded) {
+        return;
+    }
+    Slot& slot = slots[frameIndex];
+    if (slot.records.size() >= maxGpuScopes) {
+        // The matching end still pops, so the scopes after it stay balanced
+        slot.droppedScopes++;
+        slot.openRecords.push_back(UINT32_MAX);
+        return;
+    }
+
+    const auto record = static_cast<uint32_t>(slot.records.size());
+    slot.records.push_back({name, static_cast<uint32_t>(slot.openRecords.size()), false});
+    slot.openRecords.push_back(record);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool,
+                        (frameIndex * maxGpuScopes + record) * 2);
+}
+
+void Profiler::endGpuScopeLocked(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+    if (frameIndex >= slots.size() || slots[frameIndex].openRecords.empty()) {
+        return;
+    }
+    Slot& slot = slots[frameIndex];
+    const uint32_t record = slot.openRecords.back();
+    slot.openRecords.pop_back();
+    if (record == UINT32_MAX) {
+        return;
+    }
+
+    // The end waits for everything before it to finish, so the span covers the scope's work
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool,
+                        (frameIndex * maxGpuScopes + record) * 2 + 1);
+    slot.records[record].closed = true;
+}
+
+void Profiler::resolve(Slot& slot, uint32_t frameIndex) {
+    if (!slot.active) {
+        return;
+    }
+
+    FrameProfile profile;
+    profile.serial = slot.serial;
+    profile.cpuScopes = std::move(slot.cpuScopes);
+    profile.droppedScopes = slot.droppedScopes;
+
+    // The slot's fence was waited on before we got here, so nothing is left to wait for. A frame
+    // that was never submitted has no available queries and simply reports no GPU scopes.
+    if (slot.recorded && !slot.records.empty()) {
+        const auto queryCount = static_cast<uint32_t>(slot.records.size() * 2);
+        std::vector<uint64_t> results(queryCount * 2); // Value and availability for each query
+        (void)vkGetQueryPoolResults(device.logicalDevice, timestampPool, frameIndex * maxGpuScopes * 2, queryCount,
+                                    results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t),
+                                    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+        // The GPU lane starts at the submit, it can't have begun any earlier
+        const uint64_t origin = results[0] & timestampMask;
+        const double millisecondsPerTick = timestampPeriod / 1e6;
+        for (size_t i = 0; i < slot.records.size(); i++) {
+            const uint64_t* begin = &results[i * 4];
+            const uint64_t* end = &results[i * 4 + 2];
+            if (!slot.records[i].closed || results[1] == 0 || begin[1] == 0 || end[1] == 0) {
+                continue;
+            }
+            const uint64_t beginTicks = begin[0] & timestampMask;
+            const uint64_t endTicks = end[0] & timestampMask;
+
+            ProfileScope scope;
+            scope.name = slot.records[i].name;
+            scope.start = slot.submitTime + static_cast<double>((beginTicks - origin) & timestampMask) *
+                millisecondsPerTick;
+            scope.duration = static_cast<double>((endTicks - beginTicks) & timestampMask) * millisecondsPerTick;
+            scope.depth = slot.records[i].depth;
+            profile.gpuScopes.push_back(std::move(scope));
+        }
+    }
+
+    if (slot.statistics) {
+        uint64_t results[statisticCount + 1] = {};
+        const VkResult result = vkGetQueryPoolResults(device.logicalDevice, statisticsPool, frameIndex, 1,
+                                                      sizeof(results), results, sizeof(results),
+                                                      VK_QUERY_RESULT_64_BIT |
+                                                      VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (result == VK_SUCCESS && results[statisticCount] != 0) {
+            PipelineStatistics statistics;
+            statistics.inputAssemblyVertices = results[0];
+            statistics.inputAssemblyPrimitives = results[1];
+            statistics.vertexShaderInvocations = results[2];
+            statistics.clippingPrimitives = results[3];
+            statistics.fragmentShaderInvocations = results[4];
+            statistics.computeShaderInvocations = results[5];
+            profile.statistics = statistics;
+        }
+    }
+
+    history.push_back(std::move(profile));
+    while (history.size() > std::max<size_t>(historySize, 1)) {
+        history.pop_front();
+    }
+}
+
+std::optional<FrameProfile> Profiler::getLatest() const {
+    std::lock_guard lock(mutex);
+    if (history.empty()) {
+        return std::nullopt;
+    }
+    return history.back();
+}
+
+std::vector<FrameProfile> Profiler::getHistory() const {
+    std::lock_guard lock(mutex);
+    return {history.begin(), history.end()};
+}
+
+std::string Profiler::makeReport() const {
+    const std::optional<FrameProfile> latest = getLatest();
+    if (!latest.has_value()) {
+        return "No profiled frames yet, set Profiler::enabled and render a few frames\n";
+    }
+
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(3);
+    report << "Frame " << latest->serial << "\n";
+
+    const auto writeScopes = [&report](std::vector<ProfileScope> scopes) {
+        // CPU scopes are stored as they close, we list them the way they opened
+        std::stable_sort(scopes.begin(), scopes.end(), [](const ProfileScope& a, const ProfileScope& b) {
+            return a.thread != b.thread ? a.thread < b.thread : a.start < b.start;
+        });
+        for (const auto& scope : scopes) {
+            const int width = std::max(8, 28 - static_cast<int>(scope.depth) * 2); // Durations line up
+            report << std::string(4 + scope.depth * 2, ' ') << std::left << std::setw(width) << scope.name
+                << std::right << std::setw(10) << scope.duration << " ms";
+            if (scope.thread != 0) {
+                report << " (thread " << scope.thread << ")";
+            }
+            report << "\n";
+        }
+    };
+
+    report << "  CPU\n";
+    writeScopes(latest->cpuScopes);
+    report << "  GPU\n";
+    if (latest->gpuScopes.empty()) {
+        report << "    " << (supportsGpuTiming() ? "nothing was recorded" : "timestamps are not supported") << "\n";
+    }
+    writeScopes(latest->gpuScopes);
+    if (latest->droppedScopes > 0) {
+        report << "    " << latest->droppedScopes << " scopes dropped over the GPU scope limit\n";
+    }
+
+    if (latest->statistics.has_value()) {
+        const PipelineStatistics& statistics = latest->statistics.value();
+        report << "  Pipeline statistics\n";
+        report << "    Input assembly vertices     " << statistics.inputAssemblyVertices << "\n";
+        report << "    Input assembly primitives   " << statistics.inputAssemblyPrimitives << "\n";
+        report << "    Vertex shader invocations   " << statistics.vertexShaderInvocations << "\n";
+        report << "    Clipping primitives         " << statistics.clippingPrimitives << "\n";
+        report << "    Fragment shader invocations " << statistics.fragmentShaderInvocations << "\n";
+        report << "    Compute shader invocations  " << statistics.computeShaderInvocations << "\n";
+    }
+    return report.str();
+}
+
+bool Profiler::exportChromeTrace(const std::string& path) const {
+    const std::vector<FrameProfile> frames = getHistory();
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+
+    // The CPU threads and the GPU queue are separate processes, so the viewer draws them apart
+    file << "{\"traceEvents\":[\n";
+    file << R"({"name":"process_name","ph":"M","pid":0,"args":{"name":"CPU"}},)" << "\n";
+    file << R"({"name":"process_name","ph":"M","pid":1,"args":{"name":"GPU"}})";
+
+    const auto writeScope = [&file](const ProfileScope& scope, uint64_t serial, int process) {
+        // The format counts in microseconds
+        file << ",\n{\"name\":\"" << escapeJson(scope.name) << "\",\"ph\":\"X\",\"pid\":" << process
+            << ",\"tid\":" << scope.thread << ",\"ts\":" << std::fixed << std::setprecision(3)
+            << scope.start * 1000.0 << ",\"dur\":" << scope.duration * 1000.0
+            << ",\"args\":{\"frame\":" << serial << "}}";
+    };
+    for (const auto& frame : frames) {
+        for (const auto& scope : frame.cpuScopes) {
+            writeScope(scope, frame.serial, 0);
+        }
+        for (const auto& scope : frame.gpuScopes) {
+            writeScope(scope, frame.serial, 1);
+        }
+    }
+
+    file << "\n]}\n";
+    return static_cast<bool>(file);
+}
+
+#endif
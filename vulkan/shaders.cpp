@@ -10,8 +10,6 @@
 #ifdef ZENITH_VULKAN
 
 #include <glslang/Public/ShaderLang.h>
-#include <glslang/SPIRV/GlslangToSpv.h>
-#include <glslang/Include/ResourceLimits.h>
 #include <zenith/zenith_vulkan.h>
 #include <iostream>
 
@@ -23,141 +21,19 @@ EShLanguage zen::toGlslShaderType(const ShaderType type) {
         return EShLangVertex;
     case ShaderType::Fragment:
         return EShLangFragment;
+    case ShaderType::Compute:
+        return EShLangCompute;
     default:
         throw std::runtime_error("Unsupported shader type");
     }
 }
 
 ShaderModule ShaderModule::loadFromSource(const std::string& source, const Device& device, ShaderType type) {
-    glslang::InitializeProcess();
-
-    const char* shaderStrings[1];
-    shaderStrings[0] = source.c_str();
-
-    glslang::TShader shader(toGlslShaderType(type));
-    shader.setStrings(shaderStrings, 1);
-
-    shader.setEnvInput(glslang::EShSourceGlsl, toGlslShaderType(type), glslang::EShClientVulkan, 450);
-    shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_2);
-    shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_5);
-
-    TBuiltInResource resources = {};
-    resources.maxLights = 32;
-    resources.maxClipPlanes = 6;
-    resources.maxTextureUnits = 32;
-    resources.maxTextureCoords = 32;
-    resources.maxVertexAttribs = 64;
-    resources.maxVertexUniformComponents = 4096;
-    resources.maxVaryingFloats = 64;
-    resources.maxVertexTextureImageUnits = 32;
-    resources.maxCombinedTextureImageUnits = 80;
-    resources.maxTextureImageUnits = 32;
-    resources.maxFragmentUniformComponents = 4096;
-    resources.maxDrawBuffers = 32;
-    resources.maxVertexUniformVectors = 128;
-    resources.maxVaryingVectors = 8;
-    resources.maxFragmentUniformVectors = 16;
-    resources.maxVertexOutputVectors = 16;
-    resources.maxFragmentInputVectors = 15;
-    resources.minProgramTexelOffset = -8;
-    resources.maxProgramTexelOffset = 7;
-    resources.maxClipDistances = 8;
-    resources.maxComputeWorkGroupCountX = 65535;
-    resources.maxComputeWorkGroupCountY = 65535;
-    resources.maxComputeWorkGroupCountZ = 65535;
-    resources.maxComputeWorkGroupSizeX = 1024;
-    resources.maxComputeWorkGroupSizeY = 1024;
-    resources.maxComputeWorkGroupSizeZ = 64;
-    resources.maxComputeUniformComponents = 1024;
-    resources.maxComputeTextureImageUnits = 16;
-    resources.maxComputeImageUniforms = 8;
-    resources.maxComputeAtomicCounters = 8;
-    resources.maxComputeAtomicCounterBuffers = 1;
-    resources.maxVaryingComponents = 60;
-    resources.maxVertexOutputComponents = 64;
-    resources.maxGeometryInputComponents = 64;
-    resources.maxGeometryOutputComponents = 128;
-    resources.maxFragmentInputComponents = 128;
-    resources.maxImageUnits = 8;
-    resources.maxCombinedImageUnitsAndFragmentOutputs = 8;
-    resources.maxCombinedShaderOutputResources = 8;
-    resources.maxImageSamples = 0;
-    resources.maxVertexImageUniforms = 0;
-    resources.maxTessControlImageUniforms = 0;
-    resources.maxTessEvaluationImageUniforms = 0;
-    resources.maxGeometryImageUniforms = 0;
-    resources.maxFragmentImageUniforms = 8;
-    resources.maxCombinedImageUniforms = 8;
-    resources.maxGeometryTextureImageUnits = 16;
-    resources.maxGeometryOutputVertices = 256;
-    resources.maxGeometryTotalOutputComponents = 1024;
-    resources.maxGeometryUniformComponents = 1024;
-    resources.maxGeometryVaryingComponents = 64;
-    resources.maxTessControlInputComponents = 128;
-    resources.maxTessControlOutputComponents = 128;
-    resources.maxTessControlTextureImageUnits = 16;
-    resources.maxTessControlUniformComponents = 1024;
-    resources.maxTessControlTotalOutputComponents = 4096;
-    resources.maxTessEvaluationInputComponents = 128;
-    resources.maxTessEvaluationOutputComponents = 128;
-    resources.maxTessEvaluationTextureImageUnits = 16;
-    resources.maxTessEvaluationUniformComponents = 1024;
-    resources.maxTessPatchComponents = 120;
-    resources.maxPatchVertices = 32;
-    resources.maxTessGenLevel = 64;
-    resources.maxViewports = 16;
-    resources.maxVertexAtomicCounters = 0;
-    resources.maxTessControlAtomicCounters = 0;
-    resources.maxTessEvaluationAtomicCounters = 0;
-    resources.maxGeometryAtomicCounters = 0;
-    resources.maxFragmentAtomicCounters = 8;
-    resources.maxCombinedAtomicCounters = 8;
-    resources.maxAtomicCounterBindings = 1;
-    resources.maxVertexAtomicCounterBuffers = 0;
-    resources.maxTessControlAtomicCounterBuffers = 0;
-    resources.maxTessEvaluationAtomicCounterBuffers = 0;
-    resources.maxGeometryAtomicCounterBuffers = 0;
-    resources.maxFragmentAtomicCounterBuffers = 1;
-    resources.maxCombinedAtomicCounterBuffers = 1;
-    resources.maxAtomicCounterBufferSize = 16384;
-    resources.maxTransformFeedbackBuffers = 4;
-    resources.maxTransformFeedbackInterleavedComponents = 64;
-    resources.maxCullDistances = 8;
-    resources.maxCombinedClipAndCullDistances = 8;
-    resources.maxSamples = 4;
-    resources.limits.nonInductiveForLoops = true;
-    resources.limits.whileLoops = true;
-    resources.limits.doWhileLoops = true;
-    resources.limits.generalUniformIndexing = true;
-    resources.limits.generalAttributeMatrixVectorIndexing = true;
-    resources.limits.generalVaryingIndexing = true;
-    resources.limits.generalSamplerIndexing = true;
-    resources.limits.generalVariableIndexing = true;
-    resources.limits.generalConstantMatrixVectorIndexing = true;
-
-    auto messages = static_cast<EShMessages>(EShMsgSpvRules | EShMsgVulkanRules);
-
-    if (!shader.parse(&resources, 450, false, messages)) {
-        glslang::FinalizeProcess();
-        std::string errorMessage = std::string(shader.getInfoLog()) + "\n" + shader.getInfoDebugLog();
-        throw std::runtime_error("Failed to parse shader: " + errorMessage);
-    }
-
-    glslang::TProgram program;
-    program.addShader(&shader);
-
-    if (!program.link(messages)) {
-        glslang::FinalizeProcess();
-        std::string errorMessage = std::string(program.getInfoLog()) + "\n" + program.getInfoDebugLog();
-        throw std::runtime_error("Failed to link shader program: " + errorMessage);
-    }
-
-    std::vector<uint32_t> spirv;
-
-    glslang::GlslangToSpv(*program.getIntermediate(toGlslShaderType(type)), spirv);
-    glslang::FinalizeProcess();
-
-    return ShaderModule::loadFromCompiled(spirv, device, type);
+    // The device's compiler skips glslang entirely when it has seen this source before
+    ShaderSource shaderSource;
+    shaderSource.source = source;
+    shaderSource.type = type;
+    return ShaderModule::loadFromCompiled(device.getShaderCompiler().compile(shaderSource), device, type);
 }
 
 ShaderModule ShaderModule::loadFromCompiled(const std::vector<uint32_t>& code, const Device& device, ShaderType type) {
@@ -172,6 +48,13 @@ ShaderModule ShaderModule::loadFromCompiled(const std::vector<uint32_t>& code, c
     if (result != VK_SUCCESS) {
         throw std::runtime_error("Failed to create shader module. Error: " + zen::getVulkanErrorString(result));
     }
+
+    // FNV-1a over the words, the same code always maps to the same cached pipelines
+    module.codeHash = 14695981039346656037ull;
+    for (uint32_t word : code) {
+        module.codeHash ^= word;
+        module.codeHash *= 1099511628211ull;
+    }
     return module;
 }
 
@@ -205,6 +88,8 @@ VkShaderStageFlagBits zen::toVulkanShaderStage(ShaderType type) {
         return VK_SHADER_STAGE_VERTEX_BIT;
     case ShaderType::Fragment:
         return VK_SHADER_STAGE_FRAGMENT_BIT;
+    case ShaderType::Compute:
+        return VK_SHADER_STAGE_COMPUTE_BIT;
     default:
         return VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM; // Invalid type
     }
@@ -216,14 +101,15 @@ void ShaderModule::compile(std::string entryPoint, ShaderSpecializationInformati
     shaderStageInfo.module = shaderModule;
     this->entryPoint = std::move(entryPoint);
     shaderStageInfo.pName = this->entryPoint.c_str();
-    if (!info.specializationInfo.pData || info.specializationInfo.dataSize == 0) {
+    // We store the information first, the stage must point at our copy and not at the argument
+    specializationInfo = std::move(info);
+    specializationInfo.createSpecializationInfo();
+    if (specializationInfo.specializationInfo.dataSize == 0) {
         shaderStageInfo.pSpecializationInfo = nullptr; // No specialization info
     }
     else {
-        info.createSpecializationInfo();
-        shaderStageInfo.pSpecializationInfo = &info.specializationInfo;
+        shaderStageInfo.pSpecializationInfo = &specializationInfo.specializationInfo;
     }
-    specializationInfo = std::move(info); // Store the specialization info
 }
 
 
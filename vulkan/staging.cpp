@@ -0,0 +1,122 @@
+/*
+* staging.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+using namespace zen;
+
+StagingRing::StagingRing(Device& device, VkDeviceSize capacity) : device(device), capacity(capacity) {
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = capacity;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkResult result = vkCreateBuffer(device.logicalDevice, &bufferInfo, nullptr, &buffer);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create staging buffer. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    allocation = device.getAllocator().allocateForBuffer(buffer,
+                                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                         AllocationStrategy::General, MemoryCategory::Staging);
+}
+
+StagingRing::~StagingRing() {
+    {
+        std::lock_guard lock(mutex);
+        reclaimLocked(true);
+    }
+
+    if (buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device.logicalDevice, buffer, nullptr);
+    }
+    device.getAllocator().free(allocation);
+}
+
+StagingRegion StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+    if (size > capacity) {
+        throw std::runtime_error("Staging request of " + std::to_string(size) +
+            " bytes is larger than the staging ring");
+    }
+
+    std::lock_guard lock(mutex);
+    reclaimLocked(false);
+
+    while (true) {
+        VkDeviceSize start = head;
+        const VkDeviceSize physical = start % capacity;
+        VkDeviceSize aligned = alignment > 1 ? (physical + alignment - 1) / alignment * alignment : physical;
+        if (aligned + size > capacity) {
+            // Not enough room before the end, we skip the remainder and wrap to the start
+            start += capacity - physical;
+            aligned = 0;
+        }
+        else {
+            start += aligned - physical;
+        }
+
+        if (start + size - tail <= capacity) {
+            head = start + size;
+
+            StagingRegion region;
+            region.buffer = buffer;
+            region.offset = aligned;
+            region.size = size;
+            region.mapped = static_cast<uint8_t*>(allocation.mapped) + aligned;
+            return region;
+        }
+
+        if (inFlight.empty()) {
+            throw std::runtime_error("Staging ring is full of regions that were never retired");
+        }
+
+        // The ring is full, we have to wait for the oldest upload to finish
+        auto [end, fence] = inFlight.front();
+        if (fence != VK_NULL_HANDLE) {
+            vkWaitForFences(device.logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+        }
+        tail = end;
+        inFlight.pop_front();
+    }
+}
+
+void StagingRing::retire(VkFence fence) {
+    std::lock_guard lock(mutex);
+    // The fence must stay alive and unreset until reclaim has seen it signaled
+    inFlight.emplace_back(head, fence);
+    reclaimLocked(false);
+}
+
+void StagingRing::reclaim() {
+    std::lock_guard lock(mutex);
+    reclaimLocked(false);
+}
+
+void StagingRing::reclaimLocked(bool wait) {
+    // We recycle in submission order, so we stop at the first region that is still pending
+    while (!inFlight.empty()) {
+        auto [end, fence] = inFlight.front();
+        if (fence != VK_NULL_HANDLE) {
+            if (wait) {
+                vkWaitForFences(device.logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+            }
+            else if (vkGetFenceStatus(device.logicalDevice, fence) != VK_SUCCESS) {
+                break;
+            }
+        }
+        tail = end;
+        inFlight.pop_front();
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*
+* synchronization.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description: 
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+
+using namespace zen;
+
+void SynchronizationPool::create(VkDevice device, uint32_t frameCount, uint32_t imageCount) {
+    destroy(device); // We make sure we don't leak the previous objects
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    imageAvailableSemaphores.resize(frameCount, VK_NULL_HANDLE);
+    for (auto& semaphore : imageAvailableSemaphores) {
+        VkResult result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create semaphore. Error: " + zen::getVulkanErrorString(result));
+        }
+    }
+
+    renderFinishedSemaphores.resize(imageCount, VK_NULL_HANDLE);
+    for (auto& semaphore : renderFinishedSemaphores) {
+        VkResult result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create semaphore. Error: " + zen::getVulkanErrorString(result));
+        }
+    }
+
+    // No frame owns any image yet
+    imagesInFlight.assign(imageCount, VK_NULL_HANDLE);
+}
+
+void SynchronizationPool::destroy(VkDevice device) {
+    for (auto semaphore : imageAvailableSemaphores) {
+        if (semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+    }
+    for (auto semaphore : renderFinishedSemaphores) {
+        if (semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+    }
+    imageAvailableSemaphores.clear();
+    renderFinishedSemaphores.clear();
+    imagesInFlight.clear();
+}
+
+VkSemaphore SynchronizationPool::getImageAvailableSemaphore(uint32_t frameIndex) const {
+    if (frameIndex >= imageAvailableSemaphores.size()) {
+        throw std::runtime_error("Frame index " + std::to_string(frameIndex) + " has no acquire semaphore");
+    }
+    return imageAvailableSemaphores[frameIndex];
+}
+
+VkSemaphore SynchronizationPool::getRenderFinishedSemaphore(uint32_t imageIndex) const {
+    if (imageIndex >= renderFinishedSemaphores.size()) {
+        throw std::runtime_error("Image index " + std::to_string(imageIndex) + " has no render semaphore");
+    }
+    return renderFinishedSemaphores[imageIndex];
+}
+
+void SynchronizationPool::claimImage(VkDevice device, uint32_t imageIndex, VkFence frameFence) {
+    if (imageIndex >= imagesInFlight.size()) {
+        throw std::runtime_error("Image index " + std::to_string(imageIndex) + " is out of range");
+    }
+
+    VkFence previous = imagesInFlight[imageIndex];
+    if (previous != VK_NULL_HANDLE && previous != frameFence) {
+        vkWaitForFences(device, 1, &previous, VK_TRUE, UINT64_MAX);
+    }
+    imagesInFlight[imageIndex] = frameFence;
+}
+
+#endif
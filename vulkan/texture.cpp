@@ -10,48 +10,46 @@
 #ifdef ZENITH_VULKAN
 
 #include <zenith/zenith.h>
+#include <algorithm>
 
 using namespace zen;
 
-void Texture::load(std::shared_ptr<void> imageData, VkDeviceSize imageSize, Device& device, uint32_t height,
-                   uint32_t width) {
-    this->height = height;
+void Texture::load(std::shared_ptr<void> imageData, VkDeviceSize imageSize, Device& device, uint32_t width,
+                   uint32_t height, VkFormat format, const std::vector<VkDeviceSize>& levelOffsets,
+                   bool generateMips) {
     this->width = width;
-    VkBufferCreateInfo bufferInfo = {};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = imageSize;
-    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    VkResult result = vkCreateBuffer(device.logicalDevice, &bufferInfo, nullptr, &imageBuffer);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create image buffer. Error: " + zen::getVulkanErrorString(result));
-    }
-
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(device.logicalDevice, imageBuffer, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device.vkFindMemoryType(memRequirements.memoryTypeBits,
-                                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    this->height = height;
+    this->format = format;
 
-    VkResult allocResult = vkAllocateMemory(device.logicalDevice, &allocInfo, nullptr, &stagingMemory);
-    if (allocResult != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate image memory. Error: " + zen::getVulkanErrorString(allocResult));
+    if (!Format{format}.isSupportedTexture(device)) {
+        throw std::runtime_error("The device can't sample texture format " +
+            std::to_string(static_cast<int>(format)));
     }
 
-    vkBindBufferMemory(device.logicalDevice, imageBuffer, stagingMemory, 0);
+    // Files that bring their mips are uploaded as they are, otherwise we build the chain ourselves
+    this->levelOffsets = levelOffsets.empty() ? std::vector<VkDeviceSize>{0} : levelOffsets;
+    generatesMipmaps = levelOffsets.size() <= 1 && generateMips && Format{format}.isSupportedMipmapBlit(device);
+    mipLevels = static_cast<uint32_t>(this->levelOffsets.size());
+    if (generatesMipmaps) {
+        uint32_t largest = std::max(width, height);
+        mipLevels = 1;
+        while (largest > 1) {
+            largest >>= 1;
+            mipLevels++;
+        }
+    }
 
-    void* data;
-    vkMapMemory(device.logicalDevice, stagingMemory, 0, imageSize, 0, &data);
-    std::memcpy(data, imageData.get(), static_cast<size_t>(imageSize));
-    vkUnmapMemory(device.logicalDevice, stagingMemory);
+    // The pixels are kept until activateTexture stages them, then they are dropped
+    this->imageData = std::move(imageData);
+    this->imageSize = imageSize;
 
-    createImage(width, height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, device);
+    // Generating mips reads every level but the last back as a blit source
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (generatesMipmaps) {
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    createImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                device);
 }
 
 void Texture::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
@@ -62,7 +60,7 @@ void Texture::createImage(uint32_t width, uint32_t height, VkFormat format, VkIm
     imageInfo.extent.width = width;
     imageInfo.extent.height = height;
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
+    imageInfo.mipLevels = mipLevels;
     imageInfo.arrayLayers = 1;
     imageInfo.format = format;
     imageInfo.tiling = tiling;
@@ -76,17 +74,8 @@ void Texture::createImage(uint32_t width, uint32_t height, VkFormat format, VkIm
         throw std::runtime_error("Failed to create image. Error: " + zen::getVulkanErrorString(result));
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(device.logicalDevice, image.image, &memRequirements);
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device.vkFindMemoryType(memRequirements.memoryTypeBits, properties);
-    result = vkAllocateMemory(device.logicalDevice, &allocInfo, nullptr, &imageMemory);
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate image memory. Error: " + zen::getVulkanErrorString(result));
-    }
-    vkBindImageMemory(device.logicalDevice, image.image, imageMemory, 0);
+    imageAllocation = device.getAllocator().allocateForImage(image.image, properties);
+    imageMemory = imageAllocation.memory;
 
     VkImageViewCreateInfo viewInfo = {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -95,7 +84,7 @@ void Texture::createImage(uint32_t width, uint32_t height, VkFormat format, VkIm
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
@@ -106,7 +95,7 @@ void Texture::createImage(uint32_t width, uint32_t height, VkFormat format, VkIm
 }
 
 void Texture::transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
-                                    std::shared_ptr<SimpleCommandBuffer> commandBuffer) const {
+                                    VkCommandBuffer commandBuffer) const {
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.oldLayout = oldLayout;
@@ -116,7 +105,7 @@ void Texture::transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkIm
     barrier.image = image;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.levelCount = mipLevels;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
 
@@ -140,35 +129,103 @@ void Texture::transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkIm
         throw std::invalid_argument("Unsupported layout transition!");
     }
 
-    vkCmdPipelineBarrier(commandBuffer->commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1,
-                         &barrier);
+    vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
 
 void Texture::activateTexture(Device& device) {
-    auto commandBuffer = device.requestSimpleCommandBuffer();
-    commandBuffer->start();
-
-    transitionImageLayout(image.image,
-                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
-    // Copy buffer to image
-    VkBufferImageCopy region = {};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {width, height, 1};
-
-    vkCmdCopyBufferToImage(commandBuffer->commandBuffer, imageBuffer, image.image,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    transitionImageLayout(image.image,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                          commandBuffer);
+    if (!imageData) {
+        throw std::runtime_error("The texture has no pixels to upload, load it before activating it");
+    }
+    UploadBatcher& uploads = device.getUploadBatcher();
+
+    const auto recordCopy = [&](VkCommandBuffer commandBuffer, VkBuffer source, VkDeviceSize sourceOffset) {
+        transitionImageLayout(image.image,
+                              VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
+        // Copy every level that came with the data, compressed ones included
+        std::vector<VkBufferImageCopy> regions;
+        for (uint32_t level = 0; level < levelOffsets.size(); level++) {
+            VkBufferImageCopy region = {};
+            region.bufferOffset = sourceOffset + levelOffsets[level];
+            region.bufferRowLength = 0;
+            region.bufferImageHeight = 0;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = level;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {0, 0, 0};
+            region.imageExtent = {std::max(width >> level, 1u), std::max(height >> level, 1u), 1};
+            regions.push_back(region);
+        }
+
+        vkCmdCopyBufferToImage(commandBuffer, source, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               static_cast<uint32_t>(regions.size()), regions.data());
+    };
+
+    // The copy joins the current upload batch and stages through the shared ring when it fits
+    const bool staged = uploads.stage(imageData.get(), imageSize,
+                                      [&](VkCommandBuffer commandBuffer, const StagingRegion& region) {
+                                          recordCopy(commandBuffer, region.buffer, region.offset);
+                                      });
+    if (!staged) {
+        // Too large for the ring, so it gets a staging buffer of its own for one batch
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = imageSize;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VkResult result = vkCreateBuffer(device.logicalDevice, &bufferInfo, nullptr, &imageBuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create image buffer. Error: " + zen::getVulkanErrorString(result));
+        }
+
+        stagingAllocation = device.getAllocator().allocateForBuffer(imageBuffer,
+                                                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                                    AllocationStrategy::General,
+                                                                    MemoryCategory::Staging);
+        stagingMemory = stagingAllocation.memory;
+        std::memcpy(stagingAllocation.mapped, imageData.get(), static_cast<size_t>(imageSize));
+
+        uploads.record([&](VkCommandBuffer commandBuffer) {
+            recordCopy(commandBuffer, imageBuffer, 0);
+        });
+    }
+    imageData.reset();
+
+    // The copy may have run on the transfer queue, so the graphics family takes the image over
+    VkImageSubresourceRange range = {};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel = 0;
+    range.levelCount = mipLevels;
+    range.baseArrayLayer = 0;
+    range.layerCount = 1;
+    if (generatesMipmaps) {
+        // Blits need a graphics queue, so the chain is built after the hand over
+        uploads.releaseToGraphics(image.image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                  VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                                  VK_PIPELINE_STAGE_TRANSFER_BIT);
+        uploads.record([this](VkCommandBuffer commandBuffer) {
+            generateMipmaps(commandBuffer);
+        }, QueueRole::Graphics);
+    }
+    else {
+        uploads.releaseToGraphics(image.image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+                                  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
+
+    // The staging buffer is only needed until the batch has run
+    if (imageBuffer != VK_NULL_HANDLE) {
+        uploads.releaseOnCompletion([&device, stagingBuffer = imageBuffer, allocation = stagingAllocation]() mutable {
+            vkDestroyBuffer(device.logicalDevice, stagingBuffer, nullptr);
+            device.getAllocator().free(allocation);
+        });
+        imageBuffer = VK_NULL_HANDLE;
+        stagingMemory = VK_NULL_HANDLE;
+        stagingAllocation = {};
+    }
 
     createSampler(device);
 
@@ -176,12 +233,97 @@ void Texture::activateTexture(Device& device) {
     imageDescriptorInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     imageDescriptorInfo.sampler = vkSampler;
     imageDescriptorInfo.imageView = image.view;
+}
+
 
-    commandBuffer->endCommitAndDelete();
+void Texture::generateMipmaps(VkCommandBuffer commandBuffer) const {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    auto levelWidth = static_cast<int32_t>(width);
+    auto levelHeight = static_cast<int32_t>(height);
+    for (uint32_t level = 1; level < mipLevels; level++) {
+        // Each level is read once it is complete, then left for the shaders
+        barrier.subresourceRange.baseMipLevel = level - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+
+        const int32_t nextWidth = std::max(levelWidth / 2, 1);
+        const int32_t nextHeight = std::max(levelHeight / 2, 1);
+
+        VkImageBlit blit{};
+        blit.srcOffsets[0] = {0, 0, 0};
+        blit.srcOffsets[1] = {levelWidth, levelHeight, 1};
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = level - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        blit.dstOffsets[0] = {0, 0, 0};
+        blit.dstOffsets[1] = {nextWidth, nextHeight, 1};
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = level;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = 1;
+        vkCmdBlitImage(commandBuffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
+
+    // The last level was only ever written
+    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
 }
 
+void Texture::destroy(const Device& device) {
+    if (sampler.sampler != VK_NULL_HANDLE) {
+        vkDestroySampler(device.logicalDevice, sampler.sampler, nullptr);
+        sampler.sampler = VK_NULL_HANDLE;
+        vkSampler = VK_NULL_HANDLE;
+    }
+    if (image.view != VK_NULL_HANDLE) {
+        vkDestroyImageView(device.logicalDevice, image.view, nullptr);
+        image.view = VK_NULL_HANDLE;
+    }
+    if (image.image != VK_NULL_HANDLE) {
+        vkDestroyImage(device.logicalDevice, image.image, nullptr);
+        image.image = VK_NULL_HANDLE;
+    }
+    if (imageAllocation.memory != VK_NULL_HANDLE) {
+        device.getAllocator().free(imageAllocation);
+        imageAllocation = {};
+        imageMemory = VK_NULL_HANDLE;
+    }
+    imageData.reset();
+    imageDescriptorInfo = {};
+}
 
 void Texture::createSampler(Device& device) {
+    sampler.maxLod = static_cast<float>(mipLevels);
     sampler.createSampler(device);
     vkSampler = sampler.sampler;
 }
@@ -297,7 +439,7 @@ void TextureSampler::createSampler(const Device& device) {
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    samplerInfo.maxLod = maxLod;
 
     VkResult result = vkCreateSampler(device.logicalDevice, &samplerInfo, nullptr, &sampler);
     if (result != VK_SUCCESS) {
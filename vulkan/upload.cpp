@@ -0,0 +1,468 @@
+/*
+* upload.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description:
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <cstring>
+
+using namespace zen;
+
+bool UploadHandle::isComplete() const {
+    if (batcher == nullptr) {
+        return true;
+    }
+    return batcher->isComplete(serial);
+}
+
+void UploadHandle::wait() const {
+    if (batcher != nullptr) {
+        batcher->wait(serial);
+    }
+}
+
+UploadBatcher::UploadBatcher(Device& device) : device(device) {
+    graphicsFamily = device.getQueue(QueueRole::Graphics).familyIndex;
+    transferFamily = device.getQueue(QueueRole::Transfer).familyIndex;
+
+    // The batcher records on its own pools so it never competes with the frames
+    const auto makePool = [&](uint32_t family, VkCommandPool& pool) {
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = family;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        VkResult result = vkCreateCommandPool(device.logicalDevice, &poolInfo, nullptr, &pool);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error(
+                "Failed to create upload command pool. Error: " + zen::getVulkanErrorString(result));
+        }
+    };
+
+    makePool(graphicsFamily, graphicsPool);
+    if (usesDedicatedTransfer()) {
+        makePool(transferFamily, transferPool);
+    }
+}
+
+UploadBatcher::~UploadBatcher() {
+    {
+        std::lock_guard lock(mutex);
+        if (recording.has_value()) {
+            flushLocked();
+        }
+        for (Batch& batch : submitted) {
+            vkWaitForFences(device.logicalDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        }
+        collectLocked();
+    }
+
+    for (Batch& batch : freeBatches) {
+        vkDestroyFence(device.logicalDevice, batch.fence, nullptr);
+        if (batch.transferFinished != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device.logicalDevice, batch.transferFinished, nullptr);
+        }
+    }
+    freeBatches.clear();
+
+    if (transferPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device.logicalDevice, transferPool, nullptr);
+    }
+    if (graphicsPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device.logicalDevice, graphicsPool, nullptr);
+    }
+}
+
+UploadBatcher::Batch& UploadBatcher::beginLocked() {
+    if (recording.has_value()) {
+        return *recording;
+    }
+
+    collectLocked();
+
+    Batch batch;
+    if (!freeBatches.empty()) {
+        batch = std::move(freeBatches.back());
+        freeBatches.pop_back();
+    }
+    else {
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkResult result = vkCreateFence(device.logicalDevice, &fenceInfo, nullptr, &batch.fence);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upload fence. Error: " + zen::getVulkanErrorString(result));
+        }
+    }
+
+    batch.serial = nextSerial++;
+    recording = std::move(batch);
+    return *recording;
+}
+
+VkCommandBuffer UploadBatcher::laneLocked(QueueRole lane) {
+    Batch& batch = beginLocked();
+
+    // Without a dedicated transfer family both lanes share the graphics command buffer
+    const bool transfer = lane == QueueRole::Transfer && usesDedicatedTransfer();
+    VkCommandBuffer& commandBuffer = transfer ? batch.transferCommands : batch.graphicsCommands;
+    bool& recordingLane = transfer ? batch.transferRecording : batch.graphicsRecording;
+
+    if (recordingLane) {
+        return commandBuffer;
+    }
+
+    if (commandBuffer == VK_NULL_HANDLE) {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = transfer ? transferPool : graphicsPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkResult result = vkAllocateCommandBuffers(device.logicalDevice, &allocInfo, &commandBuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error(
+                "Failed to allocate upload command buffer. Error: " + zen::getVulkanErrorString(result));
+        }
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin upload command buffer. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    recordingLane = true;
+    return commandBuffer;
+}
+
+void UploadBatcher::uploadBuffer(const Buffer& buffer, const void* data, VkDeviceSize size, VkDeviceSize offset,
+                                 QueueRole lane) {
+    if (buffer.buffer == VK_NULL_HANDLE) {
+        throw std::runtime_error("Cannot upload into a buffer that has not been created");
+    }
+    if (lane == QueueRole::Compute) {
+        throw std::invalid_argument("Uploads run on the transfer or the graphics lane");
+    }
+
+    VkAccessFlags readAccess;
+    VkPipelineStageFlags readStages;
+    zen::getBufferAccess(buffer.usage, readAccess, readStages);
+
+    std::lock_guard lock(mutex);
+
+    // A batch never stages more than half the ring, so the next one can be filled while it is in flight
+    StagingRing& ring = device.getStagingRing();
+    const VkDeviceSize batchLimit = ring.getCapacity() / 2;
+    const auto* source = static_cast<const uint8_t*>(data);
+
+    VkDeviceSize written = 0;
+    while (written < size) {
+        const VkDeviceSize chunk = std::min(batchLimit, size - written);
+        if (stagedBytes + chunk > batchLimit) {
+            flushLocked();
+        }
+
+        StagingRegion region = ring.allocate(chunk);
+        std::memcpy(region.mapped, source + written, chunk);
+
+        VkCommandBuffer commandBuffer = laneLocked(lane);
+
+        if (lane == QueueRole::Graphics) {
+            // Earlier frames may still be reading the range we are about to overwrite
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.buffer = buffer.buffer;
+            barrier.offset = offset + written;
+            barrier.size = chunk;
+            vkCmdPipelineBarrier(commandBuffer, readStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                 0, nullptr, 1, &barrier, 0, nullptr);
+        }
+
+        VkBufferCopy copy{};
+        copy.srcOffset = region.offset;
+        copy.dstOffset = offset + written;
+        copy.size = chunk;
+        vkCmdCopyBuffer(commandBuffer, region.buffer, buffer.buffer, 1, &copy);
+
+        // And we make the new contents visible to whoever reads this kind of buffer
+        releaseBufferLocked(buffer.buffer, offset + written, chunk, readAccess, readStages, lane);
+
+        stagedBytes += chunk;
+        written += chunk;
+    }
+}
+
+void UploadBatcher::record(const std::function<void(VkCommandBuffer)>& recorder, QueueRole lane) {
+    if (lane == QueueRole::Compute) {
+        throw std::invalid_argument("Uploads run on the transfer or the graphics lane");
+    }
+    std::lock_guard lock(mutex);
+    recorder(laneLocked(lane));
+}
+
+bool UploadBatcher::stage(const void* data, VkDeviceSize size,
+                          const std::function<void(VkCommandBuffer, const StagingRegion&)>& recorder, QueueRole lane) {
+    if (lane == QueueRole::Compute) {
+        throw std::invalid_argument("Uploads run on the transfer or the graphics lane");
+    }
+    std::lock_guard lock(mutex);
+
+    // Same rule as uploadBuffer, but the work can't be split so oversized data is refused
+    StagingRing& ring = device.getStagingRing();
+    const VkDeviceSize batchLimit = ring.getCapacity() / 2;
+    if (size > batchLimit) {
+        return false;
+    }
+    if (stagedBytes + size > batchLimit) {
+        flushLocked();
+    }
+
+    StagingRegion region = ring.allocate(size);
+    std::memcpy(region.mapped, data, size);
+    recorder(laneLocked(lane), region);
+    stagedBytes += size;
+    return true;
+}
+
+void UploadBatcher::releaseToGraphics(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                                      VkAccessFlags access, VkPipelineStageFlags stages) {
+    std::lock_guard lock(mutex);
+    releaseBufferLocked(buffer, offset, size, access, stages, QueueRole::Transfer);
+}
+
+void UploadBatcher::releaseBufferLocked(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                                        VkAccessFlags access, VkPipelineStageFlags stages, QueueRole lane) {
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    if (lane == QueueRole::Graphics || !usesDedicatedTransfer()) {
+        vkCmdPipelineBarrier(laneLocked(QueueRole::Graphics), VK_PIPELINE_STAGE_TRANSFER_BIT, stages, 0,
+                             0, nullptr, 1, &barrier, 0, nullptr);
+        return;
+    }
+
+    // The transfer family releases the range and the graphics family acquires it, the
+    // semaphore between both submits orders them
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(laneLocked(QueueRole::Transfer), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = access;
+    vkCmdPipelineBarrier(laneLocked(QueueRole::Graphics), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, stages, 0,
+                         0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void UploadBatcher::releaseToGraphics(VkImage image, const VkImageSubresourceRange& range, VkImageLayout oldLayout,
+                                      VkImageLayout newLayout, VkAccessFlags access, VkPipelineStageFlags stages) {
+    std::lock_guard lock(mutex);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+
+    if (!usesDedicatedTransfer()) {
+        vkCmdPipelineBarrier(laneLocked(QueueRole::Graphics), VK_PIPELINE_STAGE_TRANSFER_BIT, stages, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+        return;
+    }
+
+    // Release and acquire must describe the same layout transition, it happens only once
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(laneLocked(QueueRole::Transfer), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = access;
+    vkCmdPipelineBarrier(laneLocked(QueueRole::Graphics), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, stages, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void UploadBatcher::releaseOnCompletion(std::function<void()> release) {
+    std::lock_guard lock(mutex);
+    beginLocked().releases.push_back(std::move(release));
+}
+
+bool UploadBatcher::hasPendingWork() {
+    std::lock_guard lock(mutex);
+    return recording.has_value();
+}
+
+UploadHandle UploadBatcher::flush() {
+    std::lock_guard lock(mutex);
+    return {this, flushLocked()};
+}
+
+uint64_t UploadBatcher::flushLocked() {
+    if (!recording.has_value()) {
+        // Nothing new, the handle tracks the last batch we submitted
+        return nextSerial - 1;
+    }
+
+    Batch batch = std::move(*recording);
+    recording = std::nullopt;
+    stagedBytes = 0;
+
+    const auto end = [](VkCommandBuffer commandBuffer) {
+        VkResult result = vkEndCommandBuffer(commandBuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error(
+                "Failed to end upload command buffer. Error: " + zen::getVulkanErrorString(result));
+        }
+    };
+
+    if (batch.transferRecording) {
+        end(batch.transferCommands);
+
+        if (batch.transferFinished == VK_NULL_HANDLE) {
+            VkSemaphoreCreateInfo semaphoreInfo = {};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            VkResult result = vkCreateSemaphore(device.logicalDevice, &semaphoreInfo, nullptr,
+                                                &batch.transferFinished);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error(
+                    "Failed to create upload semaphore. Error: " + zen::getVulkanErrorString(result));
+            }
+        }
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.transferCommands;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &batch.transferFinished;
+
+        VkQueue transferQueue = device.getQueue(QueueRole::Transfer).queue;
+        std::lock_guard submitLock(device.getSubmitMutex(transferQueue));
+        VkResult result = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to submit upload batch. Error: " + zen::getVulkanErrorString(result));
+        }
+    }
+
+    if (batch.graphicsRecording) {
+        end(batch.graphicsCommands);
+    }
+
+    // The graphics side always carries the fence, so it also covers the transfer submit it waits on
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    if (batch.graphicsRecording) {
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.graphicsCommands;
+    }
+    if (batch.transferRecording) {
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &batch.transferFinished;
+        submitInfo.pWaitDstStageMask = &waitStage;
+    }
+
+    VkQueue graphicsQueue = device.getQueue(QueueRole::Graphics).queue;
+    VkResult result;
+    {
+        std::lock_guard submitLock(device.getSubmitMutex(graphicsQueue));
+        result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch.fence);
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit upload batch. Error: " + zen::getVulkanErrorString(result));
+    }
+
+    // Everything staged so far belongs to this batch
+    device.getStagingRing().retire(batch.fence);
+
+    const uint64_t serial = batch.serial;
+    submitted.push_back(std::move(batch));
+    return serial;
+}
+
+void UploadBatcher::collect() {
+    std::lock_guard lock(mutex);
+    collectLocked();
+}
+
+void UploadBatcher::collectLocked() {
+    // Batches are recycled in submission order, so the staging ring has always seen
+    // a fence signaled before we reset it
+    while (!submitted.empty()) {
+        Batch& batch = submitted.front();
+        if (vkGetFenceStatus(device.logicalDevice, batch.fence) != VK_SUCCESS) {
+            break;
+        }
+
+        completedSerial = batch.serial;
+        device.getStagingRing().reclaim();
+
+        for (auto& release : batch.releases) {
+            release();
+        }
+        batch.releases.clear();
+
+        if (batch.transferRecording) {
+            vkResetCommandBuffer(batch.transferCommands, 0);
+            batch.transferRecording = false;
+        }
+        if (batch.graphicsRecording) {
+            vkResetCommandBuffer(batch.graphicsCommands, 0);
+            batch.graphicsRecording = false;
+        }
+        vkResetFences(device.logicalDevice, 1, &batch.fence);
+
+        freeBatches.push_back(std::move(batch));
+        submitted.pop_front();
+    }
+}
+
+bool UploadBatcher::isComplete(uint64_t serial) {
+    std::lock_guard lock(mutex);
+    collectLocked();
+    return serial <= completedSerial;
+}
+
+void UploadBatcher::wait(uint64_t serial) {
+    std::lock_guard lock(mutex);
+    if (recording.has_value() && recording->serial <= serial) {
+        flushLocked();
+    }
+
+    while (completedSerial < serial && !submitted.empty()) {
+        VkFence fence = submitted.front().fence;
+        vkWaitForFences(device.logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+        collectLocked();
+    }
+}
+
+#endif
@@ -0,0 +1,504 @@
+/*
+* variants.cpp
+* As part of the Zenith project
+* Created by Max Van den Eynde in 2025
+* --------------------------------------
+* Description: Pipeline descriptions, their cache and asynchronous creation.
+* Copyright (c) 2025 Max Van den Eynde
+*/
+
+#ifdef ZENITH_VULKAN
+
+#include <zenith/zenith_vulkan.h>
+#include <vulkan/vulkan.hpp>
+#include <algorithm>
+#include <cstring>
+
+using namespace zen;
+
+namespace {
+    // FNV-1a, fed field by field so that padding never ends up in the hash
+    template <typename T>
+    void hashValue(uint64_t& hash, const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only plain values are hashed byte for byte");
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+        for (size_t i = 0; i < sizeof(T); i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    void hashBytes(uint64_t& hash, const void* data, size_t size) {
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    VkPipelineColorBlendAttachmentState makeBlendState(const PipelineState& state) {
+        VkPipelineColorBlendAttachmentState blend{};
+        blend.colorWriteMask = state.colorWriteMask;
+        blend.blendEnable = state.blend == BlendMode::Opaque ? VK_FALSE : VK_TRUE;
+        blend.colorBlendOp = VK_BLEND_OP_ADD;
+        blend.alphaBlendOp = VK_BLEND_OP_ADD;
+        switch (state.blend) {
+        case BlendMode::Opaque:
+            break;
+        case BlendMode::Alpha:
+            blend.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+            blend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            break;
+        case BlendMode::Premultiplied:
+            blend.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            blend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            break;
+        case BlendMode::Additive:
+            blend.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+            blend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            break;
+        }
+        return blend;
+    }
+}
+
+uint64_t PipelineDescription::hash() const {
+    uint64_t hash = 14695981039346656037ull;
+
+    hashValue(hash, state.topology);
+    hashValue(hash, state.primitiveRestart);
+    hashValue(hash, state.polygonMode);
+    hashValue(hash, state.cullMode);
+    hashValue(hash, state.frontFace);
+    hashValue(hash, state.lineWidth);
+    hashValue(hash, state.depthBias);
+    hashValue(hash, state.depthBiasConstant);
+    hashValue(hash, state.depthBiasSlope);
+    hashValue(hash, state.depthTest);
+    hashValue(hash, state.depthWrite);
+    hashValue(hash, state.depthCompare);
+    hashValue(hash, state.blend);
+    hashValue(hash, state.colorWriteMask);
+    hashValue(hash, state.alphaToCoverage);
+
+    for (const auto& stage : stages) {
+        hashValue(hash, stage.stage);
+        if (stage.codeHash != 0) {
+            hashValue(hash, stage.codeHash);
+        }
+        else {
+            hashValue(hash, stage.module);
+        }
+        hashBytes(hash, stage.entryPoint.data(), stage.entryPoint.size());
+        for (const auto& entry : stage.specializationEntries) {
+            hashValue(hash, entry.constantID);
+            hashValue(hash, entry.offset);
+            hashValue(hash, entry.size);
+        }
+        hashBytes(hash, stage.specializationData.data(), stage.specializationData.size());
+    }
+    for (const auto& binding : bindings) {
+        hashValue(hash, binding.binding);
+        hashValue(hash, binding.stride);
+        hashValue(hash, binding.inputRate);
+    }
+    for (const auto& attribute : attributes) {
+        hashValue(hash, attribute.location);
+        hashValue(hash, attribute.binding);
+        hashValue(hash, attribute.format);
+        hashValue(hash, attribute.offset);
+    }
+
+    hashValue(hash, samples);
+    hashValue(hash, colorAttachmentCount);
+    if (renderPassHash != 0) {
+        hashValue(hash, renderPassHash);
+    }
+    else {
+        hashValue(hash, renderPass);
+    }
+    hashValue(hash, subpass);
+    if (layoutHash != 0) {
+        hashValue(hash, layoutHash);
+    }
+    else {
+        hashValue(hash, layout);
+    }
+    return hash;
+}
+
+bool PipelineDescription::operator==(const PipelineDescription& other) const {
+    // Only when neither side has a hash do the handles decide
+    const auto same = [](const auto& a, uint64_t aHash, const auto& b, uint64_t bHash) {
+        return aHash != 0 || bHash != 0 ? aHash == bHash : a == b;
+    };
+    const auto sameStage = [&](const PipelineShaderStage& a, const PipelineShaderStage& b) {
+        return a.stage == b.stage && same(a.module, a.codeHash, b.module, b.codeHash) && a.entryPoint == b.entryPoint &&
+            a.specializationData == b.specializationData &&
+            std::equal(a.specializationEntries.begin(), a.specializationEntries.end(),
+                       b.specializationEntries.begin(), b.specializationEntries.end(),
+                       [](const VkSpecializationMapEntry& x, const VkSpecializationMapEntry& y) {
+                           return x.constantID == y.constantID && x.offset == y.offset && x.size == y.size;
+                       });
+    };
+    const auto sameBinding = [](const VkVertexInputBindingDescription& a, const VkVertexInputBindingDescription& b) {
+        return a.binding == b.binding && a.stride == b.stride && a.inputRate == b.inputRate;
+    };
+    const auto sameAttribute = [](const VkVertexInputAttributeDescription& a,
+                                  const VkVertexInputAttributeDescription& b) {
+        return a.location == b.location && a.binding == b.binding && a.format == b.format && a.offset == b.offset;
+    };
+
+    return state == other.state && samples == other.samples && colorAttachmentCount == other.colorAttachmentCount &&
+        same(renderPass, renderPassHash, other.renderPass, other.renderPassHash) && subpass == other.subpass &&
+        same(layout, layoutHash, other.layout, other.layoutHash) &&
+        std::equal(stages.begin(), stages.end(), other.stages.begin(), other.stages.end(), sameStage) &&
+        std::equal(bindings.begin(), bindings.end(), other.bindings.begin(), other.bindings.end(), sameBinding) &&
+        std::equal(attributes.begin(), attributes.end(), other.attributes.begin(), other.attributes.end(),
+                   sameAttribute);
+}
+
+PipelineStateCache::PipelineStateCache(Device& device, uint32_t threadCount) : device(device) {
+    if (threadCount == 0) {
+        threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    }
+    workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++) {
+        workers.emplace_back([this] { work(); });
+    }
+}
+
+PipelineStateCache::~PipelineStateCache() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+        for (Entry* entry : queue) {
+            entry->state = BuildState::Failed;
+            entry->error = "The pipeline state cache was destroyed before the build started";
+        }
+        queue.clear();
+    }
+    workAvailable.notify_all();
+    buildFinished.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // Only the device's destructor gets here, nothing executes anymore
+    for (auto& [hash, bucket] : entries) {
+        for (auto& entry : bucket) {
+            if (entry->pipeline != VK_NULL_HANDLE) {
+                vkDestroyPipeline(device.logicalDevice, entry->pipeline, nullptr);
+            }
+        }
+    }
+    entries.clear();
+}
+
+VkPipeline PipelineStateCache::get(const PipelineDescription& description) {
+    std::unique_lock lock(mutex);
+    const std::shared_ptr<Entry> entry = findLocked(description, false);
+    if (entry->state == BuildState::Queued) {
+        // Waiting behind the rest of the queue would only make the stall longer
+        std::erase(queue, entry.get());
+        buildEntry(*entry, lock);
+    }
+    buildFinished.wait(lock, [&] {
+        return entry->state == BuildState::Ready || entry->state == BuildState::Failed;
+    });
+    if (entry->state == BuildState::Failed) {
+        throw std::runtime_error(entry->error);
+    }
+    return entry->pipeline;
+}
+
+VkPipeline PipelineStateCache::request(const PipelineDescription& description) {
+    std::lock_guard lock(mutex);
+    const std::shared_ptr<Entry> entry = findLocked(description, true);
+    return entry->state == BuildState::Ready ? entry->pipeline : VK_NULL_HANDLE;
+}
+
+void PipelineStateCache::prewarm(const std::vector<PipelineDescription>& descriptions) {
+    std::lock_guard lock(mutex);
+    for (const auto& description : descriptions) {
+        (void)findLocked(description, true);
+    }
+}
+
+void PipelineStateCache::wait() {
+    std::unique_lock lock(mutex);
+    buildFinished.wait(lock, [&] {
+        if (!queue.empty()) {
+            return false;
+        }
+        for (const auto& [hash, bucket] : entries) {
+            for (const auto& entry : bucket) {
+                if (entry->state == BuildState::Building) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    });
+}
+
+void PipelineStateCache::clearFailed() {
+    std::lock_guard lock(mutex);
+    for (auto it = entries.begin(); it != entries.end();) {
+        std::erase_if(it->second, [](const std::shared_ptr<Entry>& entry) {
+            return entry->state == BuildState::Failed;
+        });
+        it = it->second.empty() ? entries.erase(it) : std::next(it);
+    }
+}
+
+size_t PipelineStateCache::getPipelineCount() const {
+    std::lock_guard lock(mutex);
+    return pipelineCount;
+}
+
+std::shared_ptr<PipelineStateCache::Entry> PipelineStateCache::findLocked(const PipelineDescription& description,
+                                                                         bool enqueue) {
+    auto& bucket = entries[description.hash()];
+    for (const auto& entry : bucket) {
+        if (entry->description == description) {
+            return entry;
+        }
+    }
+
+    auto& entry = bucket.emplace_back(std::make_shared<Entry>());
+    entry->description = description;
+    if (enqueue) {
+        queue.push_back(entry.get());
+        workAvailable.notify_one();
+    }
+    return entry;
+}
+
+void PipelineStateCache::buildEntry(Entry& entry, std::unique_lock<std::mutex>& lock) {
+    entry.state = BuildState::Building;
+    lock.unlock();
+
+    // The description is only written before it is queued, so we can read it without the lock
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    std::string error;
+    try {
+        pipeline = build(device, entry.description);
+    }
+    catch (const std::exception& exception) {
+        error = exception.what();
+    }
+
+    lock.lock();
+    entry.pipeline = pipeline;
+    entry.error = std::move(error);
+    entry.state = pipeline != VK_NULL_HANDLE ? BuildState::Ready : BuildState::Failed;
+    if (pipeline != VK_NULL_HANDLE) {
+        pipelineCount++;
+    }
+    buildFinished.notify_all();
+}
+
+void PipelineStateCache::work() {
+    std::unique_lock lock(mutex);
+    while (true) {
+        workAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) {
+            return;
+        }
+        Entry* entry = queue.front();
+        queue.pop_front();
+        buildEntry(*entry, lock);
+    }
+}
+
+VkPipeline PipelineStateCache::build(const Device& device, const PipelineDescription& description) {
+    const PipelineState& state = description.state;
+
+    VkGraphicsPipelineCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+
+    // The stages point into the description, which outlives the call
+    std::vector<VkSpecializationInfo> specializations(description.stages.size());
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+    shaderStages.reserve(description.stages.size());
+    for (size_t i = 0; i < description.stages.size(); i++) {
+        const PipelineShaderStage& stage = description.stages[i];
+        VkPipelineShaderStageCreateInfo stageInfo{};
+        stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stageInfo.stage = stage.stage;
+        stageInfo.module = stage.module;
+        stageInfo.pName = stage.entryPoint.c_str();
+        if (!stage.specializationData.empty()) {
+            specializations[i].mapEntryCount = static_cast<uint32_t>(stage.specializationEntries.size());
+            specializations[i].pMapEntries = stage.specializationEntries.data();
+            specializations[i].dataSize = stage.specializationData.size();
+            specializations[i].pData = stage.specializationData.data();
+            stageInfo.pSpecializationInfo = &specializations[i];
+        }
+        shaderStages.push_back(stageInfo);
+    }
+    info.stageCount = static_cast<uint32_t>(shaderStages.size());
+    info.pStages = shaderStages.data();
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(description.bindings.size());
+    vertexInputInfo.pVertexBindingDescriptions = description.bindings.data();
+    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(description.attributes.size());
+    vertexInputInfo.pVertexAttributeDescriptions = description.attributes.data();
+    info.pVertexInputState = &vertexInputInfo;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = state.topology;
+    inputAssembly.primitiveRestartEnable = state.primitiveRestart ? VK_TRUE : VK_FALSE;
+    info.pInputAssemblyState = &inputAssembly;
+
+    // Viewport and scissor are set when rendering begins, so a resize doesn't need a new pipeline
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+    info.pViewportState = &viewportState;
+
+    const VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+    info.pDynamicState = &dynamicState;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = state.polygonMode;
+    rasterizer.lineWidth = state.lineWidth;
+    rasterizer.cullMode = state.cullMode;
+    rasterizer.frontFace = state.frontFace;
+    rasterizer.depthBiasEnable = state.depthBias ? VK_TRUE : VK_FALSE;
+    rasterizer.depthBiasConstantFactor = state.depthBiasConstant;
+    rasterizer.depthBiasSlopeFactor = state.depthBiasSlope;
+    info.pRasterizationState = &rasterizer;
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = description.samples; // Must match the pass' attachments
+    multisampling.alphaToCoverageEnable = state.alphaToCoverage ? VK_TRUE : VK_FALSE;
+    info.pMultisampleState = &multisampling;
+
+    // Without a depth attachment in the pass the depth state is simply ignored
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = state.depthTest ? VK_TRUE : VK_FALSE;
+    depthStencil.depthWriteEnable = state.depthWrite ? VK_TRUE : VK_FALSE;
+    depthStencil.depthCompareOp = state.depthCompare;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+    info.pDepthStencilState = &depthStencil;
+
+    // Every color attachment of the subpass needs its own state, e.g. the targets of a G-buffer
+    std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments(description.colorAttachmentCount,
+                                                                           makeBlendState(state));
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.attachmentCount = description.colorAttachmentCount;
+    colorBlending.pAttachments = colorBlendAttachments.data();
+    info.pColorBlendState = &colorBlending;
+
+    info.layout = description.layout;
+    info.renderPass = description.renderPass;
+    info.subpass = description.subpass;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result = vkCreateGraphicsPipelines(device.logicalDevice, device.getPipelineCache(), 1, &info, nullptr,
+                                                &pipeline);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create graphics pipeline. Error: " + zen::getVulkanErrorString(result));
+    }
+    return pipeline;
+}
+
+PipelineDescription RenderPipeline::describe(const PipelineState& variantState) const {
+    PipelineDescription description;
+    description.state = variantState;
+    description.stages.reserve(shaderProgram.shaderModules.size());
+    for (const auto& shader : shaderProgram.shaderModules) {
+        const VkPipelineShaderStageCreateInfo& stageInfo = shader.get().shaderStageInfo;
+        PipelineShaderStage stage;
+        stage.stage = stageInfo.stage;
+        stage.module = stageInfo.module;
+        stage.codeHash = shader.get().codeHash;
+        stage.entryPoint = stageInfo.pName != nullptr ? stageInfo.pName : "main";
+        if (const VkSpecializationInfo* specialization = stageInfo.pSpecializationInfo) {
+            stage.specializationEntries.assign(specialization->pMapEntries,
+                                               specialization->pMapEntries + specialization->mapEntryCount);
+            const auto* data = static_cast<const uint8_t*>(specialization->pData);
+            stage.specializationData.assign(data, data + specialization->dataSize);
+        }
+        description.stages.push_back(std::move(stage));
+    }
+    description.bindings = inputDescriptor.bindings;
+    description.attributes = inputDescriptor.attributes;
+    description.samples = renderPass.samples;
+    description.colorAttachmentCount = colorAttachmentCount;
+    description.renderPass = renderPass.renderPass;
+    description.subpass = subpass;
+    description.layout = pipelineLayout;
+
+    // Passes are compatible when their attachments match in format and kind at the same samples
+    description.renderPassHash = 14695981039346656037ull;
+    hashValue(description.renderPassHash, renderPass.samples);
+    for (const auto& attachment : renderPass.attachments) {
+        hashValue(description.renderPassHash, attachment.format.format);
+        hashValue(description.renderPassHash, attachment.layout);
+    }
+
+    // Set layouts come from the device's caches and live as long as it does, so their handles are stable
+    description.layoutHash = 14695981039346656037ull;
+    for (const auto& [set, setLayout] : setLayouts) {
+        hashValue(description.layoutHash, set);
+        hashValue(description.layoutHash, setLayout);
+    }
+    for (const auto& range : pushConstantRanges) {
+        hashValue(description.layoutHash, range.stageFlags);
+        hashValue(description.layoutHash, range.offset);
+        hashValue(description.layoutHash, range.size);
+    }
+    return description;
+}
+
+RenderPipeline RenderPipeline::makeVariant(const PipelineState& variantState) const {
+    if (pipelineLayout == VK_NULL_HANDLE) {
+        throw std::runtime_error("Variants share the pipeline's layout, call makePipeline first");
+    }
+    RenderPipeline variant = *this;
+    variant.state = variantState;
+    variant.pipeline = device.getPipelineStateCache().get(describe(variantState));
+    return variant;
+}
+
+std::optional<RenderPipeline> RenderPipeline::requestVariant(const PipelineState& variantState) const {
+    if (pipelineLayout == VK_NULL_HANDLE) {
+        throw std::runtime_error("Variants share the pipeline's layout, call makePipeline first");
+    }
+    const VkPipeline variantPipeline = device.getPipelineStateCache().request(describe(variantState));
+    if (variantPipeline == VK_NULL_HANDLE) {
+        return std::nullopt;
+    }
+    RenderPipeline variant = *this;
+    variant.state = variantState;
+    variant.pipeline = variantPipeline;
+    return variant;
+}
+
+#endif